@@ -9,25 +9,37 @@
 #import <AppKit/AppKit.h>
 #import <Foundation/Foundation.h>
 #import "SSAppDelegate.h"
+#import "ProfileLoadPipeline.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class ICCProfile;
 @class MainWindow;
 @class SettingsManager;
+@class ProfileLibraryScanner;
 
-@interface AppController : NSObject <SSAppDelegate> {
+@interface AppController : NSObject <SSAppDelegate, ProfileLoadPipelineDelegate> {
     MainWindow *mainWindow;
     ICCProfile *activeProfile;
     SettingsManager *settingsManager;
+    ProfileLibraryScanner *profileLibrary;
+    ProfileLoadPipeline *loadPipeline;
 }
 
 @property (retain, nonatomic) MainWindow *mainWindow;
 @property (retain, nonatomic, nullable) ICCProfile *activeProfile;
 @property (retain, nonatomic) SettingsManager *settingsManager;
 
+// Index of scanned profile folders, kept in the cache directory
+@property (readonly, nonatomic) ProfileLibraryScanner *profileLibrary;
+
 - (BOOL)loadProfileFromPath:(NSString *)path error:(NSError **)error;
+
+// Parse in the background and show the profile when ready; opening another
+// profile first cancels this one. Failures are reported with an alert.
+- (void)openProfileAtPath:(NSString *)path;
 - (BOOL)saveProfileToPath:(NSString *)path error:(NSError **)error;
+- (BOOL)scanProfileLibraryAtPath:(NSString *)path error:(NSError **)error;
 
 @end
 
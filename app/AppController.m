@@ -11,6 +11,8 @@
 #import "ICCProfile.h"
 #import "ICCParser.h"
 #import "ICCWriter.h"
+#import "GamutCache.h"
+#import "ProfileLibraryScanner.h"
 
 @implementation AppController
 
@@ -23,11 +25,15 @@
     if (self) {
         settingsManager = [SettingsManager sharedManager];
         activeProfile = nil;
+        loadPipeline = [[ProfileLoadPipeline alloc] init];
+        [loadPipeline setDelegate:self];
     }
     return self;
 }
 
 - (void)applicationDidFinishLaunching {
+    // Profile gamuts computed in earlier sessions load from here instead of LittleCMS
+    [[GamutCache sharedCache] setDiskDirectory:[settingsManager cacheDirectory]];
     mainWindow = [[MainWindow alloc] initWithAppController:self];
     [mainWindow makeKeyAndOrderFront:nil];
 }
@@ -38,7 +44,11 @@
 }
 
 - (BOOL)loadProfileFromPath:(NSString *)path error:(NSError **)error {
+    // A background load finishing later would replace this profile
+    [loadPipeline cancel];
     ICCParser *parser = [[ICCParser alloc] init];
+    // Panels decode only the tags they show
+    [parser setLazyTagDecoding:YES];
     ICCProfile *profile = [parser parseProfileFromPath:path error:error];
     
     if (profile) {
@@ -52,6 +62,26 @@
     }
 }
 
+- (void)openProfileAtPath:(NSString *)path {
+    [loadPipeline loadProfileFromPath:path];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didLoadProfile:(ICCProfile *)profile path:(NSString *)path {
+    self.activeProfile = profile;
+    [mainWindow profileLoadProgress:1.0 stage:nil];
+    [mainWindow profileDidLoad:profile];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didFailWithError:(NSError *)error path:(NSString *)path {
+    [mainWindow profileLoadProgress:1.0 stage:nil];
+    NSAlert *alert = [NSAlert alertWithError:error];
+    [alert runModal];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline progress:(double)fraction stage:(NSString *)stage {
+    [mainWindow profileLoadProgress:fraction stage:stage];
+}
+
 - (BOOL)saveProfileToPath:(NSString *)path error:(NSError **)error {
     if (!activeProfile) {
         if (error) {
@@ -69,9 +99,27 @@
     return success;
 }
 
+- (ProfileLibraryScanner *)profileLibrary {
+    if (!profileLibrary) {
+        NSString *directory = [settingsManager cacheDirectory];
+        NSString *indexPath = directory ? [directory stringByAppendingPathComponent:@"ProfileIndex.plist"] : nil;
+        profileLibrary = [[ProfileLibraryScanner alloc] initWithIndexPath:indexPath];
+    }
+    return profileLibrary;
+}
+
+- (BOOL)scanProfileLibraryAtPath:(NSString *)path error:(NSError **)error {
+    return [[self profileLibrary] scanDirectory:path error:error];
+}
+
 - (void)dealloc {
+    // Operations still running keep the pipeline alive; stop it calling back
+    [loadPipeline setDelegate:nil];
+    [loadPipeline cancel];
+    [loadPipeline release];
     [mainWindow release];
     [activeProfile release];
+    [profileLibrary release];
     /* settingsManager is shared singleton, do not release */
     [super dealloc];
 }
@@ -0,0 +1,87 @@
+//
+//  ProfileBatchProcessor.h
+//  SmallICCer
+//
+//  Applies one set of edits to many profiles without the GUI: description
+//  and copyright text, TRC replacement, version conversion, or a full
+//  re-encode. Files are processed in parallel on a worker pool; each result
+//  is handed to the delegate as soon as its file is done, so reports stream
+//  instead of waiting for the whole run.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Edit keys (all optional)
+extern NSString * const kProfileBatchDescriptionKey;  // NSString, 'desc' text
+extern NSString * const kProfileBatchCopyrightKey;    // NSString, 'cprt' text
+extern NSString * const kProfileBatchGammaKey;        // NSNumber, TRCs become this pure gamma
+extern NSString * const kProfileBatchTRCProfileKey;   // NSString path, TRCs copied from that profile
+extern NSString * const kProfileBatchVersionKey;      // NSNumber, major version to write (2 or 4)
+extern NSString * const kProfileBatchRegenerateKey;   // NSNumber BOOL, re-encode every tag that has an encoder (lut8/lut16 tags are copied)
+
+// Result keys
+extern NSString * const kProfileBatchPathKey;         // NSString, input file
+extern NSString * const kProfileBatchOutputPathKey;   // NSString, file written (or that would be)
+extern NSString * const kProfileBatchStatusKey;       // One of the status values below
+extern NSString * const kProfileBatchBytesKey;        // NSNumber, output size (absent on failure)
+extern NSString * const kProfileBatchMessageKey;      // NSString, failure reason (empty otherwise)
+
+// Status values
+extern NSString * const kProfileBatchStatusWritten;   // Output written
+extern NSString * const kProfileBatchStatusUnchanged; // Output identical to the existing file; not rewritten
+extern NSString * const kProfileBatchStatusDryRun;    // Edits applied, nothing written
+extern NSString * const kProfileBatchStatusFailed;
+
+@class ProfileBatchProcessor;
+
+@protocol ProfileBatchProcessorDelegate <NSObject>
+// Called on a worker thread, one call at a time, in completion order
+- (void)batchProcessor:(ProfileBatchProcessor *)processor didProcessFile:(NSDictionary *)result;
+@end
+
+@interface ProfileBatchProcessor : NSObject {
+    NSDictionary *edits;
+    NSDictionary *replacementTRCs;                // Signature → decoded ICCTagTRC from the TRC profile
+    NSString *outputDirectory;
+    NSUInteger workerCount;
+    BOOL dryRun;
+    id<ProfileBatchProcessorDelegate> delegate;   // Not retained
+    NSLock *deliveryLock;
+    NSUInteger writtenCount;
+    NSUInteger dryRunCount;
+    NSUInteger unchangedCount;
+    NSUInteger failedCount;
+}
+
+// Fails when the edits are invalid (unknown version, unreadable TRC profile,
+// or a version change or re-encode without LittleCMS to decode tags)
+- (nullable id)initWithEdits:(NSDictionary *)editDictionary error:(NSError **)error;
+
+// Write results under this directory, mirroring each file's path relative to
+// the argument it was found under; nil (default) rewrites files in place
+@property (nonatomic, copy, nullable) NSString *outputDirectory;
+
+// Concurrent workers (0 = one per active core, the default)
+@property (nonatomic) NSUInteger workerCount;
+
+// Apply and serialize the edits but write nothing
+@property (nonatomic) BOOL dryRun;
+
+@property (nonatomic, assign, nullable) id<ProfileBatchProcessorDelegate> delegate;
+
+// Totals for the last run; dry runs count files that would be written in
+// dryRunCount, not writtenCount
+@property (nonatomic, readonly) NSUInteger writtenCount;
+@property (nonatomic, readonly) NSUInteger dryRunCount;
+@property (nonatomic, readonly) NSUInteger unchangedCount;
+@property (nonatomic, readonly) NSUInteger failedCount;
+
+// Process files and every .icc/.icm file below directories; returns when
+// all are done. NO if any file failed (each failure is in its result).
+- (BOOL)processPaths:(NSArray *)paths;
+
+@end
+
+NS_ASSUME_NONNULL_END
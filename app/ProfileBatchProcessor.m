@@ -0,0 +1,411 @@
+//
+//  ProfileBatchProcessor.m
+//  SmallICCer
+//
+//  Profile Batch Processor implementation.
+//  Each operation handles a few files start to finish: map, lazy parse,
+//  edit, serialize, write. Only the tags an edit touches are decoded, so
+//  everything else is copied from the mapping by ICCWriter. Workers share
+//  nothing mutable except the delivery lock, which also orders the counters.
+//
+
+#import "ProfileBatchProcessor.h"
+#import "ICCParser.h"
+#import "ICCWriter.h"
+#import "ICCProfile.h"
+#import "ICCProfileIO.h"
+#import "ICCTag.h"
+#import "ICCTagTRC.h"
+#import "ICCTagLUT.h"
+#import "ICCTagMetadata.h"
+#import <string.h>
+
+NSString * const kProfileBatchDescriptionKey = @"Description";
+NSString * const kProfileBatchCopyrightKey = @"Copyright";
+NSString * const kProfileBatchGammaKey = @"Gamma";
+NSString * const kProfileBatchTRCProfileKey = @"TRCProfile";
+NSString * const kProfileBatchVersionKey = @"Version";
+NSString * const kProfileBatchRegenerateKey = @"Regenerate";
+
+NSString * const kProfileBatchPathKey = @"Path";
+NSString * const kProfileBatchOutputPathKey = @"OutputPath";
+NSString * const kProfileBatchStatusKey = @"Status";
+NSString * const kProfileBatchBytesKey = @"Bytes";
+NSString * const kProfileBatchMessageKey = @"Message";
+
+NSString * const kProfileBatchStatusWritten = @"written";
+NSString * const kProfileBatchStatusUnchanged = @"unchanged";
+NSString * const kProfileBatchStatusDryRun = @"dry-run";
+NSString * const kProfileBatchStatusFailed = @"failed";
+
+static const NSUInteger kFilesPerOperation = 4;
+
+static NSArray *trcSignatures(void) {
+    static NSArray *signatures = nil;
+    if (!signatures) {
+        signatures = [[NSArray alloc] initWithObjects:@"rTRC", @"gTRC", @"bTRC", @"kTRC", nil];
+    }
+    return signatures;
+}
+
+static NSError *batchError(NSInteger code, NSString *description) {
+    return [NSError errorWithDomain:@"SmallICCer"
+                               code:code
+                           userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                     description, NSLocalizedDescriptionKey, nil]];
+}
+
+@interface ProfileBatchProcessor (Worker)
+- (NSDictionary *)resultForFile:(NSDictionary *)file writer:(ICCWriter *)writer;
+- (void)deliverResult:(NSDictionary *)result;
+@end
+
+@interface ProfileBatchOperation : NSOperation {
+    ProfileBatchProcessor *processor;
+    NSArray *files; // Dictionaries with path and output path
+}
+
+- (id)initWithProcessor:(ProfileBatchProcessor *)p files:(NSArray *)f;
+
+@end
+
+@implementation ProfileBatchOperation
+
+- (id)initWithProcessor:(ProfileBatchProcessor *)p files:(NSArray *)f {
+    self = [super init];
+    if (self) {
+        processor = [p retain];
+        files = [f retain];
+    }
+    return self;
+}
+
+- (void)main {
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    NSUInteger i;
+    for (i = 0; i < [files count]; i++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [processor deliverResult:[processor resultForFile:[files objectAtIndex:i] writer:writer]];
+        [pool release];
+    }
+    [writer release];
+}
+
+- (void)dealloc {
+    [processor release];
+    [files release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileBatchProcessor
+
+@synthesize outputDirectory;
+@synthesize workerCount;
+@synthesize dryRun;
+@synthesize delegate;
+@synthesize writtenCount;
+@synthesize dryRunCount;
+@synthesize unchangedCount;
+@synthesize failedCount;
+
+- (id)initWithEdits:(NSDictionary *)editDictionary error:(NSError **)error {
+    self = [super init];
+    if (!self) return nil;
+    edits = [editDictionary copy];
+    deliveryLock = [[NSLock alloc] init];
+
+    NSString *failure = nil;
+    NSNumber *version = [edits objectForKey:kProfileBatchVersionKey];
+    NSNumber *gamma = [edits objectForKey:kProfileBatchGammaKey];
+    if (version && [version unsignedIntegerValue] != 2 && [version unsignedIntegerValue] != 4) {
+        failure = @"Version must be 2 or 4";
+    } else if (gamma && !([gamma doubleValue] > 0.0)) {
+        failure = @"Gamma must be positive";
+    }
+#ifndef HAVE_LCMS
+    // Both re-encode tags from decoded values
+    if (!failure && (version || [[edits objectForKey:kProfileBatchRegenerateKey] boolValue])) {
+        failure = @"Version changes and regeneration need LittleCMS";
+    }
+#endif
+
+    NSString *trcPath = [edits objectForKey:kProfileBatchTRCProfileKey];
+    if (!failure && trcPath) {
+        ICCParser *parser = [[ICCParser alloc] init];
+        [parser setLazyTagDecoding:YES];
+        ICCProfile *reference = [parser parseProfileFromPath:trcPath error:NULL];
+        [parser release];
+        NSMutableDictionary *curves = [NSMutableDictionary dictionary];
+        NSUInteger i;
+        for (i = 0; i < [trcSignatures() count]; i++) {
+            NSString *signature = [trcSignatures() objectAtIndex:i];
+            ICCTag *tag = [reference tagWithSignature:signature];
+            if ([tag isKindOfClass:[ICCTagTRC class]]) {
+                // Decoded now, so workers only ever read it
+                [tag decodeIfNeeded];
+                [curves setObject:tag forKey:signature];
+            }
+        }
+        if ([curves count] == 0) {
+            failure = @"TRC profile has no TRC tags";
+        } else {
+            replacementTRCs = [curves copy];
+        }
+    }
+
+    if (failure) {
+        if (error) {
+            *error = batchError(1, failure);
+        }
+        [self release];
+        return nil;
+    }
+    return self;
+}
+
+- (id)init {
+    return [self initWithEdits:[NSDictionary dictionary] error:NULL];
+}
+
+// One entry per profile to process; arguments that do not exist are
+// reported straight away
+- (NSArray *)filesForPaths:(NSArray *)paths {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSMutableArray *files = [NSMutableArray array];
+    NSUInteger i;
+    for (i = 0; i < [paths count]; i++) {
+        NSString *argument = [[paths objectAtIndex:i] stringByStandardizingPath];
+        BOOL isDirectory = NO;
+        if (![fm fileExistsAtPath:argument isDirectory:&isDirectory]) {
+            [self deliverResult:[NSDictionary dictionaryWithObjectsAndKeys:
+                                 argument, kProfileBatchPathKey,
+                                 argument, kProfileBatchOutputPathKey,
+                                 kProfileBatchStatusFailed, kProfileBatchStatusKey,
+                                 @"No such file or directory", kProfileBatchMessageKey,
+                                 nil]];
+            continue;
+        }
+        if (!isDirectory) {
+            NSString *output = outputDirectory
+                ? [outputDirectory stringByAppendingPathComponent:[argument lastPathComponent]]
+                : argument;
+            [files addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                              argument, kProfileBatchPathKey, output, kProfileBatchOutputPathKey, nil]];
+            continue;
+        }
+        NSDirectoryEnumerator *walker = [fm enumeratorAtPath:argument];
+        NSString *relative;
+        while ((relative = [walker nextObject]) != nil) {
+            NSString *extension = [[relative pathExtension] lowercaseString];
+            if (![extension isEqualToString:@"icc"] && ![extension isEqualToString:@"icm"]) continue;
+            if (![[[walker fileAttributes] fileType] isEqualToString:NSFileTypeRegular]) continue;
+            NSString *path = [argument stringByAppendingPathComponent:relative];
+            NSString *output = outputDirectory ? [outputDirectory stringByAppendingPathComponent:relative] : path;
+            [files addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                              path, kProfileBatchPathKey, output, kProfileBatchOutputPathKey, nil]];
+        }
+    }
+    return files;
+}
+
+- (BOOL)processPaths:(NSArray *)paths {
+    writtenCount = 0;
+    dryRunCount = 0;
+    unchangedCount = 0;
+    failedCount = 0;
+
+    NSArray *files = [self filesForPaths:paths];
+    NSMutableArray *operations = [NSMutableArray array];
+    NSUInteger first;
+    for (first = 0; first < [files count]; first += kFilesPerOperation) {
+        NSRange range = NSMakeRange(first, MIN(kFilesPerOperation, [files count] - first));
+        ProfileBatchOperation *op = [[ProfileBatchOperation alloc] initWithProcessor:self
+                                                                               files:[files subarrayWithRange:range]];
+        [operations addObject:op];
+        [op release];
+    }
+
+    NSUInteger workers = workerCount ? workerCount : [[NSProcessInfo processInfo] activeProcessorCount];
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    [queue setMaxConcurrentOperationCount:(NSInteger)MAX(workers, 1)];
+    [queue addOperations:operations waitUntilFinished:YES];
+    [queue release];
+    return failedCount == 0;
+}
+
+- (void)dealloc {
+    [edits release];
+    [replacementTRCs release];
+    [outputDirectory release];
+    [deliveryLock release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileBatchProcessor (Worker)
+
+- (void)setText:(NSString *)text forSignature:(NSString *)signature inProfile:(ICCProfile *)profile {
+    ICCTag *tag = [profile tagWithSignature:signature];
+    if (![tag isKindOfClass:[ICCTagMetadata class]]) {
+        tag = [[[ICCTagMetadata alloc] initWithData:NULL signature:signature] autorelease];
+        [profile setTag:tag withSignature:signature];
+    }
+    [(ICCTagMetadata *)tag setTextValue:text];
+}
+
+- (void)copyCurve:(ICCTagTRC *)source toTag:(ICCTagTRC *)target {
+    if ([source curveType] == 0) {
+        [target setParametricType:[source parametricType] parameters:[source parameters]];
+    } else {
+        [target setTableValues:[source tableValues] count:[source tableCount]];
+    }
+}
+
+// lutAtoBType/lutBtoAType (which edited LUTs are written as) is version 4 only
+- (BOOL)isVersion4LUT:(ICCTag *)tag {
+    if (![tag isKindOfClass:[ICCTagLUT class]]) return NO;
+    NSData *source = [tag sourcePayload];
+    if ([source length] < 4) return YES;
+    return memcmp([source bytes], "mAB ", 4) == 0 || memcmp([source bytes], "mBA ", 4) == 0;
+}
+
+// nil on success, otherwise why the edits do not apply
+- (NSString *)applyEditsToProfile:(ICCProfile *)profile {
+    NSArray *signatures = [profile allTagSignatures];
+    NSNumber *version = [edits objectForKey:kProfileBatchVersionKey];
+    NSUInteger major = version ? [version unsignedIntegerValue] : [profile version];
+    NSUInteger i;
+
+    NSString *description = [edits objectForKey:kProfileBatchDescriptionKey];
+    if (description) {
+        [self setText:description forSignature:@"desc" inProfile:profile];
+    }
+    NSString *copyright = [edits objectForKey:kProfileBatchCopyrightKey];
+    if (copyright) {
+        [self setText:copyright forSignature:@"cprt" inProfile:profile];
+    }
+
+    NSNumber *gamma = [edits objectForKey:kProfileBatchGammaKey];
+    if (gamma || replacementTRCs) {
+        double g = [gamma doubleValue];
+        NSUInteger replaced = 0;
+        for (i = 0; i < [trcSignatures() count]; i++) {
+            NSString *signature = [trcSignatures() objectAtIndex:i];
+            ICCTag *tag = [profile tagWithSignature:signature];
+            if (![tag isKindOfClass:[ICCTagTRC class]]) continue;
+            if (gamma) {
+                [(ICCTagTRC *)tag setParametricType:0 parameters:&g];
+            } else {
+                ICCTagTRC *source = [replacementTRCs objectForKey:signature];
+                if (!source) {
+                    // Gray curve for RGB channels and the other way round
+                    source = [[replacementTRCs allValues] objectAtIndex:0];
+                }
+                [self copyCurve:source toTag:(ICCTagTRC *)tag];
+            }
+            replaced++;
+        }
+        if (replaced == 0) return @"Profile has no TRC tags";
+    }
+
+    if ([[edits objectForKey:kProfileBatchRegenerateKey] boolValue]) {
+        for (i = 0; i < [signatures count]; i++) {
+            ICCTag *tag = [profile tagWithSignature:[signatures objectAtIndex:i]];
+            // lut8/lut16 tags keep their source bytes whatever the target
+            // version: re-encoding them as lutAtoBType would carry their
+            // legacy 16-bit Lab PCS values over unconverted. Raw tags have
+            // no encoder, so both are copied
+            if ([tag isKindOfClass:[ICCTagLUT class]] && ![self isVersion4LUT:tag]) continue;
+            if ([tag isMemberOfClass:[ICCTag class]]) continue;
+            [tag decodeIfNeeded];
+            [tag markModified];
+        }
+    }
+
+    if (version) {
+        if (major < 4) {
+            for (i = 0; i < [signatures count]; i++) {
+                if ([self isVersion4LUT:[profile tagWithSignature:[signatures objectAtIndex:i]]]) {
+                    return @"lutAtoBType and lutBtoAType tags need a version 4 profile";
+                }
+            }
+        }
+        [profile setVersion:major];
+    }
+    return nil;
+}
+
+- (NSDictionary *)resultForFile:(NSDictionary *)file writer:(ICCWriter *)writer {
+    NSString *path = [file objectForKey:kProfileBatchPathKey];
+    NSString *outputPath = [file objectForKey:kProfileBatchOutputPathKey];
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithDictionary:file];
+    NSError *error = nil;
+    NSString *failure = nil;
+
+    NSData *source = ICCMappedDataWithContentsOfFile(path);
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *profile = source ? [parser parseProfileFromData:source error:&error] : nil;
+    [parser release];
+    if (!source) {
+        failure = @"Failed to read file";
+    } else if (!profile) {
+        failure = [error localizedDescription];
+    } else {
+        failure = [self applyEditsToProfile:profile];
+    }
+
+    NSData *output = nil;
+    if (!failure) {
+        output = [writer dataForProfile:profile error:&error];
+        if (!output) failure = [error localizedDescription];
+    }
+
+    NSString *status = kProfileBatchStatusFailed;
+    if (!failure) {
+        [result setObject:[NSNumber numberWithUnsignedInteger:[output length]] forKey:kProfileBatchBytesKey];
+        NSData *existing = [outputPath isEqualToString:path] ? source : ICCMappedDataWithContentsOfFile(outputPath);
+        if (dryRun) {
+            status = kProfileBatchStatusDryRun;
+        } else if ([existing isEqualToData:output]) {
+            status = kProfileBatchStatusUnchanged;
+        } else {
+            NSString *directory = [outputPath stringByDeletingLastPathComponent];
+            [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                                      withIntermediateDirectories:YES
+                                                       attributes:nil
+                                                            error:NULL];
+            // Atomic: an in-place rewrite replaces the file under the mapping
+            if ([output writeToFile:outputPath atomically:YES]) {
+                status = kProfileBatchStatusWritten;
+            } else {
+                failure = @"Failed to write file";
+            }
+        }
+    }
+
+    [result setObject:status forKey:kProfileBatchStatusKey];
+    [result setObject:(failure ? failure : @"") forKey:kProfileBatchMessageKey];
+    return result;
+}
+
+- (void)deliverResult:(NSDictionary *)result {
+    [deliveryLock lock];
+    NSString *status = [result objectForKey:kProfileBatchStatusKey];
+    if ([status isEqualToString:kProfileBatchStatusFailed]) {
+        failedCount++;
+    } else if ([status isEqualToString:kProfileBatchStatusUnchanged]) {
+        unchangedCount++;
+    } else if ([status isEqualToString:kProfileBatchStatusDryRun]) {
+        dryRunCount++;
+    } else {
+        writtenCount++;
+    }
+    [delegate batchProcessor:self didProcessFile:result];
+    [deliveryLock unlock];
+}
+
+@end
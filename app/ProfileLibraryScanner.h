@@ -0,0 +1,107 @@
+//
+//  ProfileLibraryScanner.h
+//  SmallICCer
+//
+//  Walks a directory tree of ICC profiles and keeps a searchable index of
+//  their headers, descriptions and gamut volumes. Files are parsed lazily
+//  (header + tag directory, plus the description tag) on a worker pool; the
+//  index is saved after every batch, and rescans skip files whose
+//  modification date and size are unchanged, including files that failed
+//  to parse last time. Scans can run on a background queue and report to
+//  a delegate on the main thread.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Index entry keys (each entry is a property-list dictionary)
+extern NSString * const kProfileIndexPathKey;           // NSString, absolute path
+extern NSString * const kProfileIndexModificationKey;   // NSNumber, milliseconds since 1970
+extern NSString * const kProfileIndexFileSizeKey;       // NSNumber, bytes
+extern NSString * const kProfileIndexDeviceClassKey;    // NSString signature, e.g. "prtr"
+extern NSString * const kProfileIndexColorSpaceKey;     // NSString signature, e.g. "CMYK"
+extern NSString * const kProfileIndexPCSKey;            // NSString signature, "XYZ " or "Lab "
+extern NSString * const kProfileIndexVersionKey;        // NSNumber, major version
+extern NSString * const kProfileIndexDescriptionKey;    // NSString (empty when absent)
+extern NSString * const kProfileIndexGamutVolumeKey;    // NSNumber, Lab units^3 (input/display/output profiles only)
+
+@class ProfileLibraryScanner;
+
+@protocol ProfileLibraryScannerDelegate <NSObject>
+
+@optional
+// Background scans only, on the main thread. fraction in [0, 1]; entries
+// parsed so far are already searchable.
+- (void)profileLibraryScanner:(ProfileLibraryScanner *)scanner progress:(double)fraction stage:(NSString *)stage;
+- (void)profileLibraryScanner:(ProfileLibraryScanner *)scanner didFinishScanWithError:(nullable NSError *)error;
+
+@end
+
+@interface ProfileLibraryScanner : NSObject {
+    NSString *indexPath;
+    NSMutableDictionary *entries;  // Path → entry
+    NSMutableDictionary *failures; // Path → modification and size of files that failed to parse
+    id<ProfileLibraryScannerDelegate> delegate; // Not retained
+    NSOperationQueue *scanQueue;
+    BOOL scanning;                 // Main thread only
+    NSUInteger workerCount;
+    NSUInteger batchSize;
+    NSUInteger gamutResolution;
+    BOOL computesGamutVolume;
+    NSUInteger lastParsedCount;
+    NSUInteger lastSkippedCount;
+}
+
+// Loads the index at path when it exists; nil path keeps the index in memory
+- (id)initWithIndexPath:(nullable NSString *)path;
+
+@property (nonatomic, readonly, nullable) NSString *indexPath;
+
+// Concurrent parse workers (0 = one per active core, the default)
+@property (nonatomic) NSUInteger workerCount;
+
+// Files parsed between index saves (default 256)
+@property (nonatomic) NSUInteger batchSize;
+
+// Gamut volume from a resolution^n device lattice and its convex hull
+// (default YES, resolution 9). Needs LittleCMS.
+@property (nonatomic) BOOL computesGamutVolume;
+@property (nonatomic) NSUInteger gamutResolution;
+
+// Files parsed / skipped as unchanged by the last scan
+@property (nonatomic, readonly) NSUInteger lastParsedCount;
+@property (nonatomic, readonly) NSUInteger lastSkippedCount;
+
+@property (nonatomic, assign, nullable) id<ProfileLibraryScannerDelegate> delegate;
+
+// Index every .icc/.icm file below directory. Entries for files under it that
+// no longer exist or fail to parse are dropped; failures are remembered with
+// their modification date and size so rescans do not parse them again until
+// they change. NO only when the directory cannot be read or the index cannot
+// be saved. Blocks until done; the index may be read from other threads.
+- (BOOL)scanDirectory:(NSString *)directory error:(NSError **)error;
+
+// Same scan on a private queue, reported to the delegate. NO (and nothing
+// started) while another background scan is running. Main thread only.
+- (BOOL)scanDirectoryInBackground:(NSString *)directory;
+- (BOOL)isScanning;
+
+- (NSUInteger)count;
+- (nullable NSDictionary *)entryForPath:(NSString *)path;
+
+// All entries, sorted by description then path
+- (NSArray *)allEntries;
+
+// Case-insensitive match against description, file name and the class,
+// color space and PCS signatures; empty text matches everything
+- (NSArray *)entriesMatchingText:(NSString *)text;
+
+// Filter on signatures (nil = any)
+- (NSArray *)entriesWithDeviceClass:(nullable NSString *)deviceClass colorSpace:(nullable NSString *)colorSpace;
+
+- (BOOL)saveIndex:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
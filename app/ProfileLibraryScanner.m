@@ -0,0 +1,517 @@
+//
+//  ProfileLibraryScanner.m
+//  SmallICCer
+//
+//  Profile Library Scanner implementation.
+//  Each batch of changed files is split into operations of a few files; an
+//  operation maps, lazily parses and measures its files and keeps the
+//  entries to itself, so workers never share mutable state. The scanning
+//  thread merges the results and saves the index between batches; the
+//  entry and failure tables are only touched under the scanner's lock, so
+//  the main thread can search while a background scan runs.
+//
+
+#import "ProfileLibraryScanner.h"
+#import "ICCParser.h"
+#import "ICCProfile.h"
+#import "ICCProfileIO.h"
+#import "ICCTagMetadata.h"
+#import "GamutCalculator.h"
+#import "GamutComparator.h"
+#import "Gamut3DModel.h"
+#import <math.h>
+
+NSString * const kProfileIndexPathKey = @"Path";
+NSString * const kProfileIndexModificationKey = @"Modified";
+NSString * const kProfileIndexFileSizeKey = @"FileSize";
+NSString * const kProfileIndexDeviceClassKey = @"DeviceClass";
+NSString * const kProfileIndexColorSpaceKey = @"ColorSpace";
+NSString * const kProfileIndexPCSKey = @"PCS";
+NSString * const kProfileIndexVersionKey = @"Version";
+NSString * const kProfileIndexDescriptionKey = @"Description";
+NSString * const kProfileIndexGamutVolumeKey = @"GamutVolume";
+
+static NSString * const kIndexFormatKey = @"Format";
+static NSString * const kIndexEntriesKey = @"Entries";
+static NSString * const kIndexFailuresKey = @"Failures";
+static const NSInteger kIndexFormat = 1;
+
+static const NSUInteger kDefaultBatchSize = 256;
+static const NSUInteger kDefaultGamutResolution = 9;
+static const NSUInteger kFilesPerOperation = 8;
+
+// ICC device classes and data color spaces the gamut lattice can be built for
+static BOOL hasDeviceGamut(NSString *deviceClass, NSString *colorSpace) {
+    BOOL device = [deviceClass isEqualToString:@"scnr"] || [deviceClass isEqualToString:@"mntr"] ||
+                  [deviceClass isEqualToString:@"prtr"];
+    BOOL lattice = [colorSpace isEqualToString:@"RGB "] || [colorSpace isEqualToString:@"CMYK"] ||
+                   [colorSpace isEqualToString:@"GRAY"];
+    return device && lattice;
+}
+
+@interface ProfileScanOperation : NSOperation {
+    NSArray *files;        // Dictionaries with path, modification and size
+    NSUInteger gamutResolution;
+    BOOL computesGamutVolume;
+    NSMutableArray *results;
+    NSMutableArray *failedFiles; // Entries of files that did not parse
+}
+
+- (id)initWithFiles:(NSArray *)f gamutResolution:(NSUInteger)res computesGamutVolume:(BOOL)volume;
+- (NSArray *)results;
+- (NSArray *)failedFiles;
+
+@end
+
+@interface ProfileLibraryScanner (Background)
+- (void)reportProgress:(double)fraction stage:(NSString *)stage;
+- (void)deliverProgress:(NSDictionary *)progress;
+- (void)finishBackgroundScan:(NSError *)error;
+@end
+
+// Runs one scanDirectory:error: off the main thread
+@interface ProfileDirectoryScanOperation : NSOperation {
+    ProfileLibraryScanner *scanner;
+    NSString *directory;
+}
+
+- (id)initWithScanner:(ProfileLibraryScanner *)s directory:(NSString *)dir;
+
+@end
+
+@implementation ProfileDirectoryScanOperation
+
+- (id)initWithScanner:(ProfileLibraryScanner *)s directory:(NSString *)dir {
+    self = [super init];
+    if (self) {
+        scanner = [s retain];
+        directory = [dir copy];
+    }
+    return self;
+}
+
+- (void)main {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSError *error = nil;
+    BOOL ok = [scanner scanDirectory:directory error:&error];
+    if (ok) error = nil;
+    // Retains the error past this pool
+    [scanner performSelectorOnMainThread:@selector(finishBackgroundScan:) withObject:error waitUntilDone:NO];
+    [pool release];
+}
+
+- (void)dealloc {
+    [scanner release];
+    [directory release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileScanOperation
+
+- (id)initWithFiles:(NSArray *)f gamutResolution:(NSUInteger)res computesGamutVolume:(BOOL)volume {
+    self = [super init];
+    if (self) {
+        files = [f retain];
+        gamutResolution = res;
+        computesGamutVolume = volume;
+        results = [[NSMutableArray alloc] initWithCapacity:[f count]];
+        failedFiles = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (NSArray *)results {
+    return results;
+}
+
+- (NSArray *)failedFiles {
+    return failedFiles;
+}
+
+- (NSMutableDictionary *)entryForFile:(NSDictionary *)file parser:(ICCParser *)parser {
+    NSString *path = [file objectForKey:kProfileIndexPathKey];
+    NSData *data = ICCMappedDataWithContentsOfFile(path);
+    ICCProfile *profile = data ? [parser parseProfileFromData:data error:NULL] : nil;
+    if (!profile) return nil;
+
+    NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithDictionary:file];
+    NSString *deviceClass = [ICCParser stringForSignature:(uint32_t)[profile deviceClass]];
+    NSString *colorSpace = [ICCParser stringForSignature:(uint32_t)[profile dataColorSpace]];
+    [entry setObject:deviceClass forKey:kProfileIndexDeviceClassKey];
+    [entry setObject:colorSpace forKey:kProfileIndexColorSpaceKey];
+    [entry setObject:[ICCParser stringForSignature:(uint32_t)[profile pcsColorSpace]] forKey:kProfileIndexPCSKey];
+    [entry setObject:[NSNumber numberWithUnsignedInteger:[profile version]] forKey:kProfileIndexVersionKey];
+
+    // Decodes only the description tag
+    ICCTag *desc = [profile tagWithSignature:@"desc"];
+    NSString *text = [desc isKindOfClass:[ICCTagMetadata class]] ? [(ICCTagMetadata *)desc textValue] : nil;
+    [entry setObject:(text ? text : @"") forKey:kProfileIndexDescriptionKey];
+
+#ifdef HAVE_LCMS
+    if (computesGamutVolume && hasDeviceGamut(deviceClass, colorSpace)) {
+        // Workers already run in parallel, so each gamut is evaluated serially
+        GamutCalculator *calc = [[GamutCalculator alloc] init];
+        [calc setResolution:gamutResolution];
+        [calc setWorkerCount:1];
+        NSData *points = [calc computePackedGamutForProfile:profile];
+        NSData *triangles = [calc computeConvexHullTrianglesForPackedLab:points];
+        [calc release];
+        Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:points triangles:triangles name:path];
+        GamutComparator *comparator = [[GamutComparator alloc] init];
+        [entry setObject:[NSNumber numberWithDouble:[comparator computeVolume:model]] forKey:kProfileIndexGamutVolumeKey];
+        [comparator release];
+        [model release];
+    }
+#endif
+    return entry;
+}
+
+- (void)main {
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    NSUInteger i;
+    for (i = 0; i < [files count]; i++) {
+        if ([self isCancelled]) break;
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSDictionary *file = [files objectAtIndex:i];
+        NSMutableDictionary *entry = [self entryForFile:file parser:parser];
+        if (entry) {
+            [results addObject:entry];
+        } else {
+            [failedFiles addObject:file];
+        }
+        [pool release];
+    }
+    [parser release];
+}
+
+- (void)dealloc {
+    [files release];
+    [results release];
+    [failedFiles release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileLibraryScanner
+
+@synthesize indexPath;
+@synthesize workerCount;
+@synthesize batchSize;
+@synthesize gamutResolution;
+@synthesize computesGamutVolume;
+@synthesize lastParsedCount;
+@synthesize lastSkippedCount;
+@synthesize delegate;
+
+- (id)initWithIndexPath:(NSString *)path {
+    self = [super init];
+    if (self) {
+        indexPath = [path copy];
+        entries = [[NSMutableDictionary alloc] init];
+        failures = [[NSMutableDictionary alloc] init];
+        delegate = nil;
+        scanQueue = [[NSOperationQueue alloc] init];
+        [scanQueue setMaxConcurrentOperationCount:1];
+        scanning = NO;
+        workerCount = 0;
+        batchSize = kDefaultBatchSize;
+        gamutResolution = kDefaultGamutResolution;
+        computesGamutVolume = YES;
+
+        NSDictionary *saved = path ? [NSDictionary dictionaryWithContentsOfFile:path] : nil;
+        if ([[saved objectForKey:kIndexFormatKey] integerValue] == kIndexFormat) {
+            NSDictionary *savedEntries = [saved objectForKey:kIndexEntriesKey];
+            if ([savedEntries isKindOfClass:[NSDictionary class]]) {
+                [entries addEntriesFromDictionary:savedEntries];
+            }
+            NSDictionary *savedFailures = [saved objectForKey:kIndexFailuresKey];
+            if ([savedFailures isKindOfClass:[NSDictionary class]]) {
+                [failures addEntriesFromDictionary:savedFailures];
+            }
+        }
+    }
+    return self;
+}
+
+- (id)init {
+    return [self initWithIndexPath:nil];
+}
+
+- (BOOL)saveIndex:(NSError **)error {
+    if (!indexPath) return YES;
+    BOOL written;
+    @synchronized(self) {
+        NSDictionary *index = [NSDictionary dictionaryWithObjectsAndKeys:
+                               [NSNumber numberWithInteger:kIndexFormat], kIndexFormatKey,
+                               entries, kIndexEntriesKey,
+                               failures, kIndexFailuresKey,
+                               nil];
+        written = [index writeToFile:indexPath atomically:YES];
+    }
+    if (!written) {
+        if (error) {
+            *error = [NSError errorWithDomain:@"SmallICCer"
+                                         code:2
+                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                               @"Failed to save profile index", NSLocalizedDescriptionKey, nil]];
+        }
+        return NO;
+    }
+    return YES;
+}
+
+// Parse one batch of files on the worker pool and merge the entries
+- (void)parseFiles:(NSArray *)files {
+    NSUInteger workers = workerCount ? workerCount : [[NSProcessInfo processInfo] activeProcessorCount];
+    NSMutableArray *operations = [NSMutableArray array];
+    NSUInteger first;
+    for (first = 0; first < [files count]; first += kFilesPerOperation) {
+        NSRange range = NSMakeRange(first, MIN(kFilesPerOperation, [files count] - first));
+        ProfileScanOperation *op = [[ProfileScanOperation alloc] initWithFiles:[files subarrayWithRange:range]
+                                                               gamutResolution:gamutResolution
+                                                           computesGamutVolume:computesGamutVolume];
+        [operations addObject:op];
+        [op release];
+    }
+
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    [queue setMaxConcurrentOperationCount:(NSInteger)MAX(workers, 1)];
+    [queue addOperations:operations waitUntilFinished:YES];
+    [queue release];
+
+    NSUInteger i, j;
+    @synchronized(self) {
+        for (i = 0; i < [operations count]; i++) {
+            NSArray *results = [[operations objectAtIndex:i] results];
+            for (j = 0; j < [results count]; j++) {
+                NSDictionary *entry = [results objectAtIndex:j];
+                [entries setObject:entry forKey:[entry objectForKey:kProfileIndexPathKey]];
+            }
+            NSArray *failed = [[operations objectAtIndex:i] failedFiles];
+            for (j = 0; j < [failed count]; j++) {
+                NSDictionary *file = [failed objectAtIndex:j];
+                [failures setObject:file forKey:[file objectForKey:kProfileIndexPathKey]];
+            }
+        }
+    }
+    lastParsedCount += [files count];
+}
+
+- (BOOL)scanDirectory:(NSString *)directory error:(NSError **)error {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *root = [directory stringByStandardizingPath];
+    NSDirectoryEnumerator *walker = [fm enumeratorAtPath:root];
+    if (!walker) {
+        if (error) {
+            *error = [NSError errorWithDomain:@"SmallICCer"
+                                         code:1
+                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                               @"Failed to read directory", NSLocalizedDescriptionKey, nil]];
+        }
+        return NO;
+    }
+    lastParsedCount = 0;
+    lastSkippedCount = 0;
+    [self reportProgress:0.0 stage:@"Scanning folder"];
+
+    // Collect changed files; everything seen stays in the index
+    NSMutableSet *seen = [NSMutableSet set];
+    NSMutableArray *changed = [NSMutableArray array];
+    NSString *relative;
+    while ((relative = [walker nextObject]) != nil) {
+        NSString *extension = [[relative pathExtension] lowercaseString];
+        if (![extension isEqualToString:@"icc"] && ![extension isEqualToString:@"icm"]) continue;
+        NSDictionary *attributes = [walker fileAttributes];
+        if (![[attributes fileType] isEqualToString:NSFileTypeRegular]) continue;
+
+        NSString *path = [root stringByAppendingPathComponent:relative];
+        // Whole milliseconds survive the property-list round trip exactly
+        NSTimeInterval seconds = [[attributes fileModificationDate] timeIntervalSince1970];
+        NSNumber *modified = [NSNumber numberWithLongLong:(long long)floor(seconds * 1000.0)];
+        NSNumber *size = [NSNumber numberWithUnsignedLongLong:[attributes fileSize]];
+        [seen addObject:path];
+
+        BOOL unchanged = NO;
+        @synchronized(self) {
+            // A parsed entry or a recorded failure for the same bytes
+            NSDictionary *existing = [entries objectForKey:path];
+            if (!existing) existing = [failures objectForKey:path];
+            unchanged = existing && [[existing objectForKey:kProfileIndexModificationKey] isEqualToNumber:modified] &&
+                        [[existing objectForKey:kProfileIndexFileSizeKey] isEqualToNumber:size];
+            if (!unchanged) {
+                [entries removeObjectForKey:path];
+                [failures removeObjectForKey:path];
+            }
+        }
+        if (unchanged) {
+            lastSkippedCount++;
+            continue;
+        }
+        [changed addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                            path, kProfileIndexPathKey,
+                            modified, kProfileIndexModificationKey,
+                            size, kProfileIndexFileSizeKey,
+                            nil]];
+    }
+
+    // Forget files under this root that are gone
+    NSString *prefix = [root hasSuffix:@"/"] ? root : [root stringByAppendingString:@"/"];
+    NSUInteger i, t;
+    @synchronized(self) {
+        NSMutableDictionary *tables[2] = { entries, failures };
+        for (t = 0; t < 2; t++) {
+            NSArray *known = [tables[t] allKeys];
+            for (i = 0; i < [known count]; i++) {
+                NSString *path = [known objectAtIndex:i];
+                if ([path hasPrefix:prefix] && ![seen containsObject:path]) {
+                    [tables[t] removeObjectForKey:path];
+                }
+            }
+        }
+    }
+
+    // Batches bound the work lost if the scan is interrupted
+    NSUInteger batch = MAX(batchSize, 1);
+    NSUInteger first;
+    for (first = 0; first < [changed count]; first += batch) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSUInteger n = MIN(batch, [changed count] - first);
+        [self parseFiles:[changed subarrayWithRange:NSMakeRange(first, n)]];
+        BOOL saved = [self saveIndex:error];
+        if (!saved && error && *error) [*error retain];
+        [self reportProgress:(double)(first + n) / (double)[changed count]
+                       stage:[NSString stringWithFormat:@"Scanned %lu of %lu profiles",
+                              (unsigned long)(first + n), (unsigned long)[changed count]]];
+        [pool release];
+        if (!saved) {
+            if (error && *error) [*error autorelease];
+            return NO;
+        }
+    }
+    return [changed count] > 0 ? YES : [self saveIndex:error];
+}
+
+- (BOOL)scanDirectoryInBackground:(NSString *)directory {
+    if (scanning) return NO;
+    scanning = YES;
+    ProfileDirectoryScanOperation *op = [[ProfileDirectoryScanOperation alloc] initWithScanner:self
+                                                                                     directory:directory];
+    [scanQueue addOperation:op];
+    [op release];
+    return YES;
+}
+
+- (BOOL)isScanning {
+    return scanning;
+}
+
+- (NSUInteger)count {
+    @synchronized(self) {
+        return [entries count];
+    }
+}
+
+- (NSDictionary *)entryForPath:(NSString *)path {
+    @synchronized(self) {
+        return [[[entries objectForKey:[path stringByStandardizingPath]] retain] autorelease];
+    }
+}
+
+static NSInteger compareEntries(id a, id b, void *context) {
+    NSComparisonResult order = [[a objectForKey:kProfileIndexDescriptionKey]
+                                localizedCaseInsensitiveCompare:[b objectForKey:kProfileIndexDescriptionKey]];
+    if (order != NSOrderedSame) return order;
+    return [[a objectForKey:kProfileIndexPathKey] compare:[b objectForKey:kProfileIndexPathKey]];
+}
+
+- (NSArray *)allEntries {
+    NSArray *values;
+    @synchronized(self) {
+        values = [entries allValues];
+    }
+    return [values sortedArrayUsingFunction:compareEntries context:NULL];
+}
+
+- (NSArray *)entriesMatchingText:(NSString *)text {
+    if ([text length] == 0) return [self allEntries];
+    NSMutableArray *matches = [NSMutableArray array];
+    NSArray *values;
+    @synchronized(self) {
+        values = [entries allValues];
+    }
+    NSEnumerator *e = [values objectEnumerator];
+    NSDictionary *entry;
+    NSArray *fields = [NSArray arrayWithObjects:kProfileIndexDescriptionKey, kProfileIndexDeviceClassKey,
+                       kProfileIndexColorSpaceKey, kProfileIndexPCSKey, nil];
+    while ((entry = [e nextObject]) != nil) {
+        BOOL match = [[[entry objectForKey:kProfileIndexPathKey] lastPathComponent]
+                      rangeOfString:text options:NSCaseInsensitiveSearch].location != NSNotFound;
+        NSUInteger f;
+        for (f = 0; !match && f < [fields count]; f++) {
+            NSString *value = [entry objectForKey:[fields objectAtIndex:f]];
+            match = value && [value rangeOfString:text options:NSCaseInsensitiveSearch].location != NSNotFound;
+        }
+        if (match) [matches addObject:entry];
+    }
+    return [matches sortedArrayUsingFunction:compareEntries context:NULL];
+}
+
+- (NSArray *)entriesWithDeviceClass:(NSString *)deviceClass colorSpace:(NSString *)colorSpace {
+    NSMutableArray *matches = [NSMutableArray array];
+    NSArray *values;
+    @synchronized(self) {
+        values = [entries allValues];
+    }
+    NSEnumerator *e = [values objectEnumerator];
+    NSDictionary *entry;
+    while ((entry = [e nextObject]) != nil) {
+        if (deviceClass && ![[entry objectForKey:kProfileIndexDeviceClassKey] isEqualToString:deviceClass]) continue;
+        if (colorSpace && ![[entry objectForKey:kProfileIndexColorSpaceKey] isEqualToString:colorSpace]) continue;
+        [matches addObject:entry];
+    }
+    return [matches sortedArrayUsingFunction:compareEntries context:NULL];
+}
+
+- (void)dealloc {
+    [scanQueue release];
+    [indexPath release];
+    [entries release];
+    [failures release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileLibraryScanner (Background)
+
+// Progress goes to the delegate on the main thread; the scan does not wait for it
+- (void)reportProgress:(double)fraction stage:(NSString *)stage {
+    if (!delegate) return;
+    [self performSelectorOnMainThread:@selector(deliverProgress:)
+                           withObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                                       [NSNumber numberWithDouble:fraction], @"fraction",
+                                       stage, @"stage",
+                                       nil]
+                        waitUntilDone:NO];
+}
+
+- (void)deliverProgress:(NSDictionary *)progress {
+    if ([delegate respondsToSelector:@selector(profileLibraryScanner:progress:stage:)]) {
+        [delegate profileLibraryScanner:self
+                               progress:[[progress objectForKey:@"fraction"] doubleValue]
+                                  stage:[progress objectForKey:@"stage"]];
+    }
+}
+
+- (void)finishBackgroundScan:(NSError *)error {
+    scanning = NO;
+    if ([delegate respondsToSelector:@selector(profileLibraryScanner:didFinishScanWithError:)]) {
+        [delegate profileLibraryScanner:self didFinishScanWithError:error];
+    }
+}
+
+@end
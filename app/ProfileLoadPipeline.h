@@ -0,0 +1,58 @@
+//
+//  ProfileLoadPipeline.h
+//  SmallICCer
+//
+//  Background profile loading and gamut computation. Requests run on a
+//  private operation queue and their results are delivered to the delegate
+//  on the main thread. Each new request cancels the previous one, and
+//  results from a superseded request are dropped rather than delivered.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ICCProfile;
+@class Gamut3DModel;
+@class ProfileLoadPipeline;
+
+@protocol ProfileLoadPipelineDelegate <NSObject>
+
+@optional
+// Profile parsed, with its curve and text tags already decoded
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didLoadProfile:(ICCProfile *)profile path:(NSString *)path;
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didFailWithError:(NSError *)error path:(NSString *)path;
+
+// Shared GamutCache model; wrap its buffers to recolor or rename it
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didComputeGamut:(Gamut3DModel *)gamut forProfile:(ICCProfile *)profile;
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didFailToComputeGamutForProfile:(ICCProfile *)profile error:(NSError *)error;
+
+// fraction in [0, 1]; stage is a short user-visible description
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline progress:(double)fraction stage:(NSString *)stage;
+
+@end
+
+@interface ProfileLoadPipeline : NSObject {
+    id<ProfileLoadPipelineDelegate> delegate; // Not retained
+    NSOperationQueue *queue;
+    NSOperation *currentOperation;
+    NSUInteger generation;                    // Bumped per request; main thread only
+}
+
+@property (nonatomic, assign, nullable) id<ProfileLoadPipelineDelegate> delegate;
+
+// Parse the file (lazy tag decoding) and deliver the profile; no gamut
+- (void)loadProfileFromPath:(NSString *)path;
+
+// Profile gamut at resolution through the shared GamutCache
+- (void)computeGamutForProfile:(ICCProfile *)profile resolution:(NSUInteger)resolution;
+
+// Cancel the current request; nothing more is delivered for it
+- (void)cancel;
+
+// YES from a request until its final delivery or cancellation
+- (BOOL)isBusy;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,271 @@
+//
+//  ProfileLoadPipeline.m
+//  SmallICCer
+//
+//  Profile Load Pipeline implementation.
+//  Operations check for cancellation between stages; a stage already running
+//  (a LittleCMS parse or a gamut lattice) finishes, but its result is only
+//  kept in GamutCache, never delivered. Every delivery carries the generation
+//  of its request and is dropped on the main thread if a newer request exists.
+//
+
+#import "ProfileLoadPipeline.h"
+#import "ICCParser.h"
+#import "ICCProfile.h"
+#import "ICCTag.h"
+#import "ICCTagTRC.h"
+#import "ICCTagMetadata.h"
+#import "GamutCache.h"
+#import "Gamut3DModel.h"
+
+@interface ProfileLoadPipeline (Delivery)
+- (void)deliverProfile:(NSDictionary *)result;
+- (void)deliverError:(NSDictionary *)result;
+- (void)deliverGamut:(NSDictionary *)result;
+- (void)deliverGamutError:(NSDictionary *)result;
+- (void)deliverProgress:(NSDictionary *)result;
+@end
+
+@interface ProfileLoadOperation : NSOperation {
+    ProfileLoadPipeline *pipeline;
+    NSUInteger generation;
+    NSString *path;           // Set for loads
+    ICCProfile *profile;      // Set for gamut requests
+    NSUInteger resolution;
+}
+
+- (id)initWithPipeline:(ProfileLoadPipeline *)p
+            generation:(NSUInteger)g
+                  path:(NSString *)filePath
+               profile:(ICCProfile *)gamutProfile
+            resolution:(NSUInteger)res;
+
+@end
+
+@implementation ProfileLoadOperation
+
+- (id)initWithPipeline:(ProfileLoadPipeline *)p
+            generation:(NSUInteger)g
+                  path:(NSString *)filePath
+               profile:(ICCProfile *)gamutProfile
+            resolution:(NSUInteger)res {
+    self = [super init];
+    if (self) {
+        pipeline = [p retain];
+        generation = g;
+        path = [filePath copy];
+        profile = [gamutProfile retain];
+        resolution = res;
+    }
+    return self;
+}
+
+- (void)deliver:(SEL)selector values:(NSDictionary *)values {
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithDictionary:values];
+    [result setObject:[NSNumber numberWithUnsignedInteger:generation] forKey:@"generation"];
+    [pipeline performSelectorOnMainThread:selector withObject:result waitUntilDone:NO];
+}
+
+- (void)reportProgress:(double)fraction stage:(NSString *)stage {
+    [self deliver:@selector(deliverProgress:)
+           values:[NSDictionary dictionaryWithObjectsAndKeys:
+                   [NSNumber numberWithDouble:fraction], @"fraction",
+                   stage, @"stage",
+                   nil]];
+}
+
+- (void)loadProfile {
+    [self reportProgress:0.0 stage:@"Parsing profile"];
+    NSError *error = nil;
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *loaded = [parser parseProfileFromPath:path error:&error];
+    [parser release];
+    if ([self isCancelled]) return;
+    if (!loaded) {
+        if (!error) {
+            error = [NSError errorWithDomain:@"SmallICCer"
+                                        code:1
+                                    userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                              @"Failed to parse profile", NSLocalizedDescriptionKey, nil]];
+        }
+        [self deliver:@selector(deliverError:)
+               values:[NSDictionary dictionaryWithObjectsAndKeys:error, @"error", path, @"path", nil]];
+        return;
+    }
+
+    // Decode what the inspector and curve panels show, so drawing never
+    // calls into LittleCMS; LUTs stay lazy until the tag editor asks
+    [self reportProgress:0.5 stage:@"Decoding tags"];
+    NSArray *signatures = [loaded allTagSignatures];
+    NSUInteger i;
+    for (i = 0; i < [signatures count]; i++) {
+        if ([self isCancelled]) return;
+        ICCTag *tag = [loaded tagWithSignature:[signatures objectAtIndex:i]];
+        if ([tag isKindOfClass:[ICCTagTRC class]] || [tag isKindOfClass:[ICCTagMetadata class]]) {
+            [tag decodeIfNeeded];
+        }
+    }
+    if ([self isCancelled]) return;
+    [self deliver:@selector(deliverProfile:)
+           values:[NSDictionary dictionaryWithObjectsAndKeys:loaded, @"profile", path, @"path", nil]];
+}
+
+- (void)computeGamut {
+    [self reportProgress:0.0 stage:@"Computing gamut"];
+    Gamut3DModel *gamut = [[GamutCache sharedCache] gamutForProfile:profile resolution:resolution];
+    if ([self isCancelled]) return;
+    if (!gamut) {
+        // Still a final delivery, so the delegate stops showing progress
+        NSError *error = [NSError errorWithDomain:@"SmallICCer"
+                                             code:2
+                                         userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                                   @"Failed to compute the profile gamut", NSLocalizedDescriptionKey, nil]];
+        [self deliver:@selector(deliverGamutError:)
+               values:[NSDictionary dictionaryWithObjectsAndKeys:error, @"error", profile, @"profile", nil]];
+        return;
+    }
+    [self deliver:@selector(deliverGamut:)
+           values:[NSDictionary dictionaryWithObjectsAndKeys:gamut, @"gamut", profile, @"profile", nil]];
+}
+
+- (void)main {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    if (![self isCancelled]) {
+        if (path) {
+            [self loadProfile];
+        } else {
+            [self computeGamut];
+        }
+    }
+    [pool release];
+}
+
+- (void)dealloc {
+    [pipeline release];
+    [path release];
+    [profile release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileLoadPipeline
+
+@synthesize delegate;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        delegate = nil;
+        queue = [[NSOperationQueue alloc] init];
+        // A cancelled request may still be finishing its stage; let the
+        // replacement start beside it rather than wait
+        [queue setMaxConcurrentOperationCount:2];
+        currentOperation = nil;
+        generation = 0;
+    }
+    return self;
+}
+
+- (void)startOperationWithPath:(NSString *)path profile:(ICCProfile *)profile resolution:(NSUInteger)resolution {
+    [self cancel];
+    ProfileLoadOperation *op = [[ProfileLoadOperation alloc] initWithPipeline:self
+                                                                   generation:generation
+                                                                         path:path
+                                                                      profile:profile
+                                                                   resolution:resolution];
+    currentOperation = op;
+    [queue addOperation:op];
+}
+
+- (void)loadProfileFromPath:(NSString *)path {
+    [self startOperationWithPath:path profile:nil resolution:0];
+}
+
+- (void)computeGamutForProfile:(ICCProfile *)profile resolution:(NSUInteger)resolution {
+    [self startOperationWithPath:nil profile:profile resolution:resolution];
+}
+
+- (void)cancel {
+    generation++;
+    [currentOperation cancel];
+    [currentOperation release];
+    currentOperation = nil;
+}
+
+- (BOOL)isBusy {
+    return currentOperation != nil;
+}
+
+- (void)dealloc {
+    [currentOperation cancel];
+    [currentOperation release];
+    [queue release];
+    [super dealloc];
+}
+
+@end
+
+@implementation ProfileLoadPipeline (Delivery)
+
+- (BOOL)isCurrent:(NSDictionary *)result {
+    return [[result objectForKey:@"generation"] unsignedIntegerValue] == generation;
+}
+
+// The request is over once its final result is delivered
+- (void)finishRequest {
+    [currentOperation release];
+    currentOperation = nil;
+}
+
+- (void)deliverProfile:(NSDictionary *)result {
+    if (![self isCurrent:result]) return;
+    [self finishRequest];
+    if ([delegate respondsToSelector:@selector(profileLoadPipeline:didLoadProfile:path:)]) {
+        [delegate profileLoadPipeline:self
+                       didLoadProfile:[result objectForKey:@"profile"]
+                                 path:[result objectForKey:@"path"]];
+    }
+}
+
+- (void)deliverError:(NSDictionary *)result {
+    if (![self isCurrent:result]) return;
+    [self finishRequest];
+    if ([delegate respondsToSelector:@selector(profileLoadPipeline:didFailWithError:path:)]) {
+        [delegate profileLoadPipeline:self
+                     didFailWithError:[result objectForKey:@"error"]
+                                 path:[result objectForKey:@"path"]];
+    }
+}
+
+- (void)deliverGamut:(NSDictionary *)result {
+    if (![self isCurrent:result]) return;
+    [self finishRequest];
+    if ([delegate respondsToSelector:@selector(profileLoadPipeline:didComputeGamut:forProfile:)]) {
+        [delegate profileLoadPipeline:self
+                      didComputeGamut:[result objectForKey:@"gamut"]
+                           forProfile:[result objectForKey:@"profile"]];
+    }
+}
+
+- (void)deliverGamutError:(NSDictionary *)result {
+    if (![self isCurrent:result]) return;
+    [self finishRequest];
+    if ([delegate respondsToSelector:@selector(profileLoadPipeline:didFailToComputeGamutForProfile:error:)]) {
+        [delegate profileLoadPipeline:self
+      didFailToComputeGamutForProfile:[result objectForKey:@"profile"]
+                                error:[result objectForKey:@"error"]];
+    }
+}
+
+- (void)deliverProgress:(NSDictionary *)result {
+    if (![self isCurrent:result]) return;
+    if ([delegate respondsToSelector:@selector(profileLoadPipeline:progress:stage:)]) {
+        [delegate profileLoadPipeline:self
+                             progress:[[result objectForKey:@"fraction"] doubleValue]
+                                stage:[result objectForKey:@"stage"]];
+    }
+}
+
+@end
@@ -37,6 +37,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)saveSettings;
 - (void)loadSettings;
 
+// Per-user cache directory for derived data such as computed gamuts
+// (<user caches>/SmallICCer), created on first use; nil if it cannot be created
+- (nullable NSString *)cacheDirectory;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -81,6 +81,23 @@ static SettingsManager *sharedInstance = nil;
     [defaults synchronize];
 }
 
+- (NSString *)cacheDirectory {
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    if ([paths count] == 0) return nil;
+    NSString *path = [[paths objectAtIndex:0] stringByAppendingPathComponent:@"SmallICCer"];
+    BOOL isDirectory = NO;
+    if ([[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:&isDirectory]) {
+        return isDirectory ? path : nil;
+    }
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:path
+                                   withIntermediateDirectories:YES
+                                                    attributes:nil
+                                                         error:NULL]) {
+        return nil;
+    }
+    return path;
+}
+
 - (void)dealloc {
     [comparisonColorSpaces release];
     [super dealloc];
@@ -27,11 +27,27 @@ NS_ASSUME_NONNULL_BEGIN
 // Lab to XYZ conversion
 + (void)labToXyz:(const double *)lab xyz:(double *)xyz whitePoint:(const double *)whitePoint;
 
+// Build the row-major RGB→XYZ matrix from primaries (3 arrays of xy) and xy white point.
+// Returns NO if primaries/white point are missing or degenerate.
++ (BOOL)rgbToXyzMatrixFromPrimaries:(NSArray *)primaries
+                         whitePoint:(NSArray *)whitePoint
+                          matrixOut:(double *)rgb2xyz;
+
+// Invert a row-major 3x3 matrix. Returns NO if singular.
++ (BOOL)invertMatrix3x3:(const double *)matrix into:(double *)inverse;
+
+// Bradford chromatic adaptation (row-major XYZ → XYZ) taking sourceWhite to
+// destinationWhite, both XYZ with Y=1. Used to move D65 spaces into the D50 PCS.
++ (void)bradfordAdaptationFromWhite:(const double *)sourceWhite
+                            toWhite:(const double *)destinationWhite
+                          matrixOut:(double *)adaptation;
+
 // RGB to XYZ conversion (linear RGB; matrix from primaries and white point xy; nil = sRGB D65)
 + (void)rgbToXyz:(const double *)rgb xyz:(double *)xyz 
        primaries:(NSArray *)primaries whitePoint:(NSArray *)whitePoint;
 
-// XYZ to RGB conversion (output clamped to [0,1])
+// XYZ to RGB conversion. Out-of-gamut results are clamped to [0,1] per
+// channel, exactly as -[ColorTransform convertXYZ:toRGB:count:] does
 + (void)xyzToRgb:(const double *)xyz rgb:(double *)rgb
        primaries:(NSArray *)primaries whitePoint:(NSArray *)whitePoint;
 
@@ -20,6 +20,10 @@ static const double kD50_X = 0.96422;
 static const double kD50_Y = 1.0;
 static const double kD50_Z = 0.82521;
 
+static inline double clampUnitInterval(double v) {
+    return v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+}
+
 @implementation ColorConverter
 
 #pragma mark - xy chromaticity and white point helpers
@@ -112,6 +116,48 @@ static BOOL matrix3x3Inverse(const double M[9], double invM[9]) {
     return YES;
 }
 
++ (BOOL)invertMatrix3x3:(const double *)matrix into:(double *)inverse {
+    return matrix3x3Inverse(matrix, inverse);
+}
+
+// Bradford cone response matrix and its inverse (Lindbloom, Chromatic Adaptation)
+static const double kBradford[9] = {
+     0.8951,  0.2664, -0.1614,
+    -0.7502,  1.7135,  0.0367,
+     0.0389, -0.0685,  1.0296
+};
+static const double kBradfordInverse[9] = {
+     0.9869929, -0.1470543,  0.1599627,
+     0.4323053,  0.5183603,  0.0492912,
+    -0.0085287,  0.0400428,  0.9684867
+};
+
++ (void)bradfordAdaptationFromWhite:(const double *)sourceWhite
+                            toWhite:(const double *)destinationWhite
+                          matrixOut:(double *)adaptation {
+    double src[3], dst[3], scaled[9];
+    NSUInteger row, col;
+    for (row = 0; row < 3; row++) {
+        src[row] = kBradford[row * 3] * sourceWhite[0] + kBradford[row * 3 + 1] * sourceWhite[1] +
+                   kBradford[row * 3 + 2] * sourceWhite[2];
+        dst[row] = kBradford[row * 3] * destinationWhite[0] + kBradford[row * 3 + 1] * destinationWhite[1] +
+                   kBradford[row * 3 + 2] * destinationWhite[2];
+    }
+    // diag(dst / src) * Bradford, then back out of cone space
+    for (row = 0; row < 3; row++) {
+        for (col = 0; col < 3; col++) {
+            scaled[row * 3 + col] = kBradford[row * 3 + col] * dst[row] / src[row];
+        }
+    }
+    for (row = 0; row < 3; row++) {
+        for (col = 0; col < 3; col++) {
+            adaptation[row * 3 + col] = kBradfordInverse[row * 3] * scaled[col] +
+                                        kBradfordInverse[row * 3 + 1] * scaled[3 + col] +
+                                        kBradfordInverse[row * 3 + 2] * scaled[6 + col];
+        }
+    }
+}
+
 // Build RGB→XYZ matrix from primaries (array of 3 arrays of 2 numbers each) and
 // white point (array of 2 numbers). Output: rgb2xyz[9] row-major.
 // Formula: Lindbloom, RGB/XYZ Matrices. Returns NO if primaries/white invalid.
@@ -195,13 +241,11 @@ static BOOL matrix3x3Inverse(const double M[9], double invM[9]) {
     rgb[1] = invM[3]*xyz[0] + invM[4]*xyz[1] + invM[5]*xyz[2];
     rgb[2] = invM[6]*xyz[0] + invM[7]*xyz[1] + invM[8]*xyz[2];
     
-    {
-        int i;
-        for (i = 0; i < 3; i++) {
-            if (rgb[i] < 0.0) rgb[i] = 0.0;
-            if (rgb[i] > 1.0) rgb[i] = 1.0;
-        }
-    }
+    // Same clamp as -[ColorTransform convertXYZ:toRGB:count:], so the scalar
+    // and batch paths agree on out-of-gamut input
+    rgb[0] = clampUnitInterval(rgb[0]);
+    rgb[1] = clampUnitInterval(rgb[1]);
+    rgb[2] = clampUnitInterval(rgb[2]);
 }
 
 @end
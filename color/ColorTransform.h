@@ -0,0 +1,54 @@
+//
+//  ColorTransform.h
+//  SmallICCer
+//
+//  Precomputed RGB ↔ XYZ ↔ Lab transform for one color space.
+//  Built once per ColorSpace; bulk entry points run over packed
+//  interleaved float buffers (3 floats per sample) with SSE2 kernels.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ColorSpace;
+
+@interface ColorTransform : NSObject {
+    double rgbToXyz[9];      // Row-major linear RGB → XYZ
+    double xyzToRgb[9];      // Inverse of rgbToXyz
+    double whitePointXyz[3]; // Reference white (Y=1) used for Lab (D50 when PCS-adapted)
+    float rgbToXyzF[9];      // Single-precision copies for the batch kernels
+    float xyzToRgbF[9];
+    float rgbToLabF[9];      // rgbToXyz rows pre-divided by the white point
+    float xyzToLabScale[3];  // 1 / white point
+}
+
++ (ColorTransform *)transformWithColorSpace:(ColorSpace *)colorSpace;
+
+// nil primaries/white point (or degenerate ones) fall back to sRGB D65,
+// matching ColorConverter's scalar behaviour.
+- (id)initWithColorSpace:(ColorSpace *)colorSpace;
+- (id)initWithPrimaries:(nullable NSArray *)primaries whitePoint:(nullable NSArray *)whitePoint;
+
+// Same space with XYZ and Lab relative to the ICC D50 PCS: the RGB → XYZ
+// matrix is Bradford-adapted from the space's white point to D50, so Lab
+// lines up with profile gamuts evaluated by LittleCMS.
++ (ColorTransform *)pcsTransformWithColorSpace:(ColorSpace *)colorSpace;
+- (id)initWithPrimaries:(nullable NSArray *)primaries
+             whitePoint:(nullable NSArray *)whitePoint
+           adaptedToPCS:(BOOL)adaptToPCS;
+
+- (const double *)rgbToXyzMatrix;
+- (const double *)xyzToRgbMatrix;
+- (const double *)whitePointXyz;
+
+// Bulk conversions over interleaved float triples. Input and output may alias (in place).
+- (void)convertRGB:(const float *)rgb toXYZ:(float *)xyz count:(NSUInteger)count;
+// XYZ -> RGB clamps each channel to [0,1], like +[ColorConverter xyzToRgb:...]
+- (void)convertXYZ:(const float *)xyz toRGB:(float *)rgb count:(NSUInteger)count;
+- (void)convertXYZ:(const float *)xyz toLab:(float *)lab count:(NSUInteger)count;
+- (void)convertRGB:(const float *)rgb toLab:(float *)lab count:(NSUInteger)count;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,255 @@
+//
+//  ColorTransform.m
+//  SmallICCer
+//
+//  Color Transform implementation.
+//  The batch path multiplies 4 samples at a time by a cached 3x3 matrix and,
+//  for Lab output, evaluates the CIE f() function with a vectorised cube root
+//  (bit-level initial guess + 3 Newton steps, accurate to float precision).
+//
+
+#import "ColorTransform.h"
+#import "ColorConverter.h"
+#import "ColorSpace.h"
+#import <math.h>
+#import <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNELS 1
+#else
+#define HAVE_SSE2_KERNELS 0
+#endif
+
+// CIE 1976 constants, same values as ColorConverter's scalar path
+static const float kLabEpsilon = 0.008856f;
+static const float kLabLinearSlope = 7.787f;
+static const float kLabLinearOffset = 16.0f / 116.0f;
+
+typedef enum {
+    TransformKernelLinear,  // out = M * in
+    TransformKernelClamped, // out = clamp(M * in, 0, 1)
+    TransformKernelLab      // out = Lab(f(M * in)); M already normalised by the white point
+} TransformKernelMode;
+
+static inline float labF(float t) {
+    return (t > kLabEpsilon) ? cbrtf(t) : (kLabLinearSlope * t + kLabLinearOffset);
+}
+
+static inline float clampUnit(float v) {
+    return (v < 0.0f) ? 0.0f : ((v > 1.0f) ? 1.0f : v);
+}
+
+static void transformScalar(const float M[9], const float *in, float *out,
+                            NSUInteger count, TransformKernelMode mode) {
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        float x = in[0], y = in[1], z = in[2];
+        float o0 = M[0] * x + M[1] * y + M[2] * z;
+        float o1 = M[3] * x + M[4] * y + M[5] * z;
+        float o2 = M[6] * x + M[7] * y + M[8] * z;
+        if (mode == TransformKernelLab) {
+            float fx = labF(o0), fy = labF(o1), fz = labF(o2);
+            o0 = 116.0f * fy - 16.0f;
+            o1 = 500.0f * (fx - fy);
+            o2 = 200.0f * (fy - fz);
+        } else if (mode == TransformKernelClamped) {
+            o0 = clampUnit(o0);
+            o1 = clampUnit(o1);
+            o2 = clampUnit(o2);
+        }
+        out[0] = o0;
+        out[1] = o1;
+        out[2] = o2;
+        in += 3;
+        out += 3;
+    }
+}
+
+#if HAVE_SSE2_KERNELS
+static inline __m128 cbrtPs(__m128 x) {
+    // Initial guess: divide the exponent (and mantissa) bits by 3
+    __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    __m128i bits = _mm_castps_si128(x);
+    __m128i guess = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(bits), third)),
+                                  _mm_set1_epi32(0x2a514067));
+    __m128 y = _mm_castsi128_ps(guess);
+    int i;
+    for (i = 0; i < 3; i++) {
+        __m128 y2 = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(third, _mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(x, y2)));
+    }
+    return y;
+}
+
+static inline __m128 labFPs(__m128 t) {
+    __m128 eps = _mm_set1_ps(kLabEpsilon);
+    __m128 mask = _mm_cmpgt_ps(t, eps);
+    // Clamp before the cube root so masked-off lanes never see zero/negative input
+    __m128 cube = cbrtPs(_mm_max_ps(t, eps));
+    __m128 lin = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(kLabLinearSlope)), _mm_set1_ps(kLabLinearOffset));
+    return _mm_or_ps(_mm_and_ps(mask, cube), _mm_andnot_ps(mask, lin));
+}
+
+static void transformSSE2(const float M[9], const float *in, float *out,
+                          NSUInteger count, TransformKernelMode mode) {
+    __m128 m0 = _mm_set1_ps(M[0]), m1 = _mm_set1_ps(M[1]), m2 = _mm_set1_ps(M[2]);
+    __m128 m3 = _mm_set1_ps(M[3]), m4 = _mm_set1_ps(M[4]), m5 = _mm_set1_ps(M[5]);
+    __m128 m6 = _mm_set1_ps(M[6]), m7 = _mm_set1_ps(M[7]), m8 = _mm_set1_ps(M[8]);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    NSUInteger blocks = count / 4;
+    NSUInteger i;
+
+    for (i = 0; i < blocks; i++) {
+        // Deinterleave 4 samples (12 floats); all loads happen before any store,
+        // so in-place conversion is safe.
+        __m128 x = _mm_setr_ps(in[0], in[3], in[6], in[9]);
+        __m128 y = _mm_setr_ps(in[1], in[4], in[7], in[10]);
+        __m128 z = _mm_setr_ps(in[2], in[5], in[8], in[11]);
+
+        __m128 o0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), _mm_mul_ps(m2, z));
+        __m128 o1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, x), _mm_mul_ps(m4, y)), _mm_mul_ps(m5, z));
+        __m128 o2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m6, x), _mm_mul_ps(m7, y)), _mm_mul_ps(m8, z));
+
+        if (mode == TransformKernelLab) {
+            __m128 fx = labFPs(o0);
+            __m128 fy = labFPs(o1);
+            __m128 fz = labFPs(o2);
+            o0 = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(116.0f), fy), _mm_set1_ps(16.0f));
+            o1 = _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy));
+            o2 = _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz));
+        } else if (mode == TransformKernelClamped) {
+            o0 = _mm_min_ps(_mm_max_ps(o0, zero), one);
+            o1 = _mm_min_ps(_mm_max_ps(o1, zero), one);
+            o2 = _mm_min_ps(_mm_max_ps(o2, zero), one);
+        }
+
+        float a[4], b[4], c[4];
+        _mm_storeu_ps(a, o0);
+        _mm_storeu_ps(b, o1);
+        _mm_storeu_ps(c, o2);
+        out[0] = a[0]; out[1] = b[0]; out[2] = c[0];
+        out[3] = a[1]; out[4] = b[1]; out[5] = c[1];
+        out[6] = a[2]; out[7] = b[2]; out[8] = c[2];
+        out[9] = a[3]; out[10] = b[3]; out[11] = c[3];
+        in += 12;
+        out += 12;
+    }
+
+    transformScalar(M, in, out, count - blocks * 4, mode);
+}
+#endif
+
+static void runTransform(const float M[9], const float *in, float *out,
+                         NSUInteger count, TransformKernelMode mode) {
+    if (count == 0) return;
+#if HAVE_SSE2_KERNELS
+    transformSSE2(M, in, out, count, mode);
+#else
+    transformScalar(M, in, out, count, mode);
+#endif
+}
+
+@implementation ColorTransform
+
++ (ColorTransform *)transformWithColorSpace:(ColorSpace *)colorSpace {
+    return [[[self alloc] initWithColorSpace:colorSpace] autorelease];
+}
+
+- (id)initWithColorSpace:(ColorSpace *)colorSpace {
+    return [self initWithPrimaries:[colorSpace primaries] whitePoint:[colorSpace whitePoint]];
+}
+
++ (ColorTransform *)pcsTransformWithColorSpace:(ColorSpace *)colorSpace {
+    return [[[self alloc] initWithPrimaries:[colorSpace primaries]
+                                 whitePoint:[colorSpace whitePoint]
+                               adaptedToPCS:YES] autorelease];
+}
+
+- (id)initWithPrimaries:(NSArray *)primaries whitePoint:(NSArray *)whitePoint {
+    return [self initWithPrimaries:primaries whitePoint:whitePoint adaptedToPCS:NO];
+}
+
+- (id)initWithPrimaries:(NSArray *)primaries whitePoint:(NSArray *)whitePoint adaptedToPCS:(BOOL)adaptToPCS {
+    self = [super init];
+    if (self) {
+        if (![ColorConverter rgbToXyzMatrixFromPrimaries:primaries whitePoint:whitePoint matrixOut:rgbToXyz]) {
+            // Fallback: sRGB D65 (linear RGB, IEC 61966-2-1)
+            rgbToXyz[0] = 0.4124564; rgbToXyz[1] = 0.3575761; rgbToXyz[2] = 0.1804375;
+            rgbToXyz[3] = 0.2126729; rgbToXyz[4] = 0.7151522; rgbToXyz[5] = 0.0721750;
+            rgbToXyz[6] = 0.0193339; rgbToXyz[7] = 0.1191920; rgbToXyz[8] = 0.9503041;
+        }
+        [ColorConverter whitePointXyzFromColorSpace:whitePoint outXyz:whitePointXyz];
+        if (adaptToPCS) {
+            // Adapt from the matrix's own white (RGB 1,1,1), which is also right for the fallback
+            double sourceWhite[3], d50[3], adaptation[9], adapted[9];
+            NSUInteger r, c;
+            for (r = 0; r < 3; r++) {
+                sourceWhite[r] = rgbToXyz[r * 3] + rgbToXyz[r * 3 + 1] + rgbToXyz[r * 3 + 2];
+            }
+            [ColorConverter d50WhitePointXyz:d50];
+            [ColorConverter bradfordAdaptationFromWhite:sourceWhite toWhite:d50 matrixOut:adaptation];
+            for (r = 0; r < 3; r++) {
+                for (c = 0; c < 3; c++) {
+                    adapted[r * 3 + c] = adaptation[r * 3] * rgbToXyz[c] +
+                                         adaptation[r * 3 + 1] * rgbToXyz[3 + c] +
+                                         adaptation[r * 3 + 2] * rgbToXyz[6 + c];
+                }
+            }
+            memcpy(rgbToXyz, adapted, sizeof(adapted));
+            memcpy(whitePointXyz, d50, sizeof(d50));
+        }
+        if (![ColorConverter invertMatrix3x3:rgbToXyz into:xyzToRgb]) {
+            NSUInteger k;
+            for (k = 0; k < 9; k++) xyzToRgb[k] = 0.0;
+        }
+
+        NSUInteger row, col;
+        for (row = 0; row < 3; row++) {
+            xyzToLabScale[row] = (float)(1.0 / whitePointXyz[row]);
+            for (col = 0; col < 3; col++) {
+                NSUInteger k = row * 3 + col;
+                rgbToXyzF[k] = (float)rgbToXyz[k];
+                xyzToRgbF[k] = (float)xyzToRgb[k];
+                rgbToLabF[k] = (float)(rgbToXyz[k] / whitePointXyz[row]);
+            }
+        }
+    }
+    return self;
+}
+
+- (const double *)rgbToXyzMatrix {
+    return rgbToXyz;
+}
+
+- (const double *)xyzToRgbMatrix {
+    return xyzToRgb;
+}
+
+- (const double *)whitePointXyz {
+    return whitePointXyz;
+}
+
+- (void)convertRGB:(const float *)rgb toXYZ:(float *)xyz count:(NSUInteger)count {
+    runTransform(rgbToXyzF, rgb, xyz, count, TransformKernelLinear);
+}
+
+- (void)convertXYZ:(const float *)xyz toRGB:(float *)rgb count:(NSUInteger)count {
+    runTransform(xyzToRgbF, xyz, rgb, count, TransformKernelClamped);
+}
+
+- (void)convertXYZ:(const float *)xyz toLab:(float *)lab count:(NSUInteger)count {
+    float scale[9] = {
+        xyzToLabScale[0], 0.0f, 0.0f,
+        0.0f, xyzToLabScale[1], 0.0f,
+        0.0f, 0.0f, xyzToLabScale[2]
+    };
+    runTransform(scale, xyz, lab, count, TransformKernelLab);
+}
+
+- (void)convertRGB:(const float *)rgb toLab:(float *)lab count:(NSUInteger)count {
+    runTransform(rgbToLabF, rgb, lab, count, TransformKernelLab);
+}
+
+@end
@@ -0,0 +1,75 @@
+//
+//  DeviceLinkBaker.h
+//  SmallICCer
+//
+//  Bakes a whole source → destination conversion into a dense 3D/4D lookup
+//  table (17³, 33³, 65³...). The grid is sampled in parallel through the
+//  image transform pipeline. It is exported as an ICC DeviceLink profile
+//  and, for RGB to RGB, as a .cube file. Applying the baked table is one
+//  interpolation per pixel instead of a matrix/TRC/CLUT chain.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ICCProfile;
+@class ImageTransformEngine;
+
+@interface DeviceLinkBaker : NSObject {
+    ImageTransformEngine *engine;  // Float source pixels → float destination pixels
+    ICCProfile *sourceProfile;
+    ICCProfile *destinationProfile;
+    NSUInteger intent;
+    NSUInteger gridPoints;
+    NSUInteger inputChannels;
+    NSUInteger outputChannels;
+    NSData *table;
+    NSTimeInterval lastBakeTime;
+}
+
+// RGB or CMYK profiles with profile bytes. gridPoints per input axis is
+// 2-255 (0 = 33).
+- (nullable id)initWithSourceProfile:(ICCProfile *)source
+                  destinationProfile:(ICCProfile *)destination
+                              intent:(NSUInteger)renderingIntent
+                          gridPoints:(NSUInteger)points
+                               error:(NSError **)error;
+
+@property (nonatomic, readonly) NSUInteger gridPoints;
+@property (nonatomic, readonly) NSUInteger inputChannels;
+@property (nonatomic, readonly) NSUInteger outputChannels;
+
+// Concurrent sampling workers (0 = one per active core, the default)
+@property (nonatomic) NSUInteger workerCount;
+
+// Sample the grid. The exports bake on first use; calling this again
+// resamples (and retimes) it.
+- (BOOL)bakeWithError:(NSError **)error;
+
+// Baked grid, nil before baking: gridPoints^inputChannels nodes of
+// outputChannels floats in 0.0-1.0, last input varying fastest (the ICC
+// CLUT order)
+@property (nonatomic, readonly, nullable) NSData *table;
+
+// Wall-clock time of the last bake
+@property (nonatomic, readonly) NSTimeInterval lastBakeTime;
+
+// DeviceLink ('link' class, v4) whose A2B0 is the baked grid, with desc,
+// cprt and a profile sequence naming both profiles
+- (nullable ICCProfile *)deviceLinkProfileWithDescription:(NSString *)description
+                                                copyright:(nullable NSString *)copyright
+                                                    error:(NSError **)error;
+- (BOOL)writeDeviceLinkToPath:(NSString *)path
+                  description:(NSString *)description
+                    copyright:(nullable NSString *)copyright
+                        error:(NSError **)error;
+
+// Adobe/Resolve .cube text (LUT_3D_SIZE, red varying fastest). RGB to RGB
+// only.
+- (nullable NSData *)cubeDataWithTitle:(nullable NSString *)title error:(NSError **)error;
+- (BOOL)writeCubeToPath:(NSString *)path title:(nullable NSString *)title error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,291 @@
+//
+//  DeviceLinkBaker.m
+//  SmallICCer
+//
+//  Device Link Baker implementation.
+//  The grid nodes are laid out as a float image, gridPoints nodes per row,
+//  in ICC CLUT order. One ImageTransformEngine call converts it, so the
+//  engine's tile workers do the sampling in parallel through one shared
+//  LittleCMS transform. Results are normalized to 0.0-1.0 (CMYK inks come
+//  back as 0-100) and stored once; both exports read the same table.
+//
+
+#import "DeviceLinkBaker.h"
+#import "ImageTransformEngine.h"
+#import "ICCProfile.h"
+#import "ICCProfileIO.h"
+#import "ICCWriter.h"
+#import "ICCTag.h"
+#import "ICCTagLUT.h"
+#import "ICCTagMetadata.h"
+#import <stdlib.h>
+
+static const NSUInteger kDefaultGridPoints = 33;
+
+// 65^4 CMYK grids would need gigabytes of floats
+static const NSUInteger kMaxGridNodes = 1 << 24;
+
+static const uint32_t kColorSpaceRGB = 0x52474220;  // 'RGB '
+static const uint32_t kColorSpaceCMYK = 0x434D594B; // 'CMYK'
+
+static NSError *bakerError(NSInteger code, NSString *description) {
+    return [NSError errorWithDomain:@"SmallICCer"
+                               code:code
+                           userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                     description, NSLocalizedDescriptionKey, nil]];
+}
+
+static NSUInteger channelsOfColorSpace(NSUInteger colorSpace) {
+    if (colorSpace == kColorSpaceRGB) return 3;
+    if (colorSpace == kColorSpaceCMYK) return 4;
+    return 0;
+}
+
+static NSString *textOfTag(ICCProfile *profile, NSString *signature) {
+    ICCTag *tag = [profile tagWithSignature:signature];
+    return [tag isKindOfClass:[ICCTagMetadata class]] ? [(ICCTagMetadata *)tag textValue] : @"";
+}
+
+static uint32_t signatureValue(NSString *signature) {
+    uint32_t value = 0;
+    NSUInteger k;
+    for (k = 0; k < 4; k++) {
+        unichar c = (k < [signature length]) ? [signature characterAtIndex:k] : ' ';
+        value = (value << 8) | (c & 0xFF);
+    }
+    return [signature length] ? value : 0;
+}
+
+// profileSequenceDescType entry: header fields, then manufacturer and
+// model descriptions as embedded mluc
+static void appendSequenceEntry(NSMutableData *payload, ICCProfile *profile) {
+    ICCAppendUInt32(payload, signatureValue([profile deviceManufacturer]));
+    ICCAppendUInt32(payload, signatureValue([profile deviceModel]));
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt32(payload, (uint32_t)[profile deviceAttributes]);
+    ICCAppendUInt32(payload, 0); // Technology unknown
+    ICCTagMetadata *text = [[ICCTagMetadata alloc] initWithData:NULL signature:@"dmnd"];
+    [text setTextValue:textOfTag(profile, @"dmnd")];
+    [payload appendData:[text serializeForVersion:4]];
+    [text setTextValue:textOfTag(profile, @"desc")];
+    [payload appendData:[text serializeForVersion:4]];
+    [text release];
+}
+
+@implementation DeviceLinkBaker
+
+@synthesize gridPoints;
+@synthesize inputChannels;
+@synthesize outputChannels;
+@synthesize table;
+@synthesize lastBakeTime;
+
+- (id)initWithSourceProfile:(ICCProfile *)source
+         destinationProfile:(ICCProfile *)destination
+                     intent:(NSUInteger)renderingIntent
+                 gridPoints:(NSUInteger)points
+                      error:(NSError **)error {
+    self = [super init];
+    if (!self) return nil;
+    gridPoints = points ? points : kDefaultGridPoints;
+    intent = renderingIntent;
+    inputChannels = channelsOfColorSpace([source dataColorSpace]);
+    outputChannels = channelsOfColorSpace([destination dataColorSpace]);
+
+    NSString *failure = nil;
+    NSUInteger nodes = 1, i;
+    for (i = 0; i < inputChannels; i++) nodes *= gridPoints;
+    if (inputChannels == 0 || outputChannels == 0) {
+        failure = @"Device links can only be baked between RGB and CMYK profiles";
+    } else if (gridPoints < 2 || gridPoints > 255) {
+        failure = @"Grid points must be between 2 and 255";
+    } else if (nodes > kMaxGridNodes) {
+        failure = [NSString stringWithFormat:@"A %lu-point grid is too large for %lu inputs",
+                   (unsigned long)gridPoints, (unsigned long)inputChannels];
+    }
+    if (failure) {
+        if (error) {
+            *error = bakerError(2, failure);
+        }
+        [self release];
+        return nil;
+    }
+
+    engine = [[ImageTransformEngine alloc]
+        initWithSourceProfile:source
+           destinationProfile:destination
+                 proofProfile:nil
+                  inputFormat:(inputChannels == 4) ? ImagePixelFormatCMYKFloat : ImagePixelFormatRGBFloat
+                 outputFormat:(outputChannels == 4) ? ImagePixelFormatCMYKFloat : ImagePixelFormatRGBFloat
+                       intent:intent
+                        error:error];
+    if (!engine) {
+        [self release];
+        return nil;
+    }
+    sourceProfile = [source retain];
+    destinationProfile = [destination retain];
+    return self;
+}
+
+- (NSUInteger)workerCount {
+    return [engine workerCount];
+}
+
+- (void)setWorkerCount:(NSUInteger)count {
+    [engine setWorkerCount:count];
+}
+
+- (BOOL)bakeWithError:(NSError **)error {
+    NSDate *start = [NSDate date];
+    NSUInteger nodes = 1, i, k;
+    for (i = 0; i < inputChannels; i++) nodes *= gridPoints;
+    float *coordinates = (float *)malloc(nodes * inputChannels * sizeof(float));
+    float *values = (float *)malloc(nodes * outputChannels * sizeof(float));
+    if (!coordinates || !values) {
+        free(coordinates);
+        free(values);
+        if (error) {
+            *error = bakerError(5, @"Failed to allocate memory");
+        }
+        return NO;
+    }
+
+    // Node coordinates, last input fastest, in the engine's float encoding
+    float inputScale = (inputChannels == 4) ? 100.0f : 1.0f;
+    for (i = 0; i < nodes; i++) {
+        NSUInteger rest = i;
+        for (k = inputChannels; k > 0; k--) {
+            coordinates[i * inputChannels + k - 1] = inputScale * (float)(rest % gridPoints) / (float)(gridPoints - 1);
+            rest /= gridPoints;
+        }
+    }
+
+    BOOL success = [engine transformPixels:coordinates
+                             inputRowBytes:gridPoints * inputChannels * sizeof(float)
+                                  toPixels:values
+                            outputRowBytes:gridPoints * outputChannels * sizeof(float)
+                                     width:gridPoints
+                                    height:nodes / gridPoints
+                                     error:error];
+    free(coordinates);
+    if (!success) {
+        free(values);
+        return NO;
+    }
+
+    float outputScale = (outputChannels == 4) ? 0.01f : 1.0f;
+    for (i = 0; i < nodes * outputChannels; i++) {
+        float v = values[i] * outputScale;
+        values[i] = (v > 1.0f) ? 1.0f : ((v >= 0.0f) ? v : 0.0f);
+    }
+    [table release];
+    table = [[NSData alloc] initWithBytesNoCopy:values length:nodes * outputChannels * sizeof(float) freeWhenDone:YES];
+    lastBakeTime = -[start timeIntervalSinceNow];
+    return YES;
+}
+
+- (ICCProfile *)deviceLinkProfileWithDescription:(NSString *)description
+                                       copyright:(NSString *)copyright
+                                           error:(NSError **)error {
+    if (!table && ![self bakeWithError:error]) return nil;
+
+    ICCTagLUT *lut = [[ICCTagLUT alloc] initWithData:NULL signature:@"A2B0"];
+    NSUInteger grid[4] = {gridPoints, gridPoints, gridPoints, gridPoints};
+    [lut appendCLUTWithGrid:grid inputs:inputChannels outputs:outputChannels values:(const float *)[table bytes]];
+
+    ICCTagMetadata *desc = [[ICCTagMetadata alloc] initWithData:NULL signature:@"desc"];
+    [desc setTextValue:description];
+    ICCTagMetadata *cprt = [[ICCTagMetadata alloc] initWithData:NULL signature:@"cprt"];
+    [cprt setTextValue:copyright ? copyright : @""];
+
+    NSMutableData *sequence = [NSMutableData data];
+    ICCAppendUInt32(sequence, 0x70736571); // 'pseq'
+    ICCAppendUInt32(sequence, 0);
+    ICCAppendUInt32(sequence, 2);
+    appendSequenceEntry(sequence, sourceProfile);
+    appendSequenceEntry(sequence, destinationProfile);
+    ICCTag *pseq = [[ICCTag alloc] initWithData:NULL signature:@"pseq"];
+    [pseq setRawData:sequence];
+
+    // A link's PCS field holds the destination color space
+    ICCProfile *profile = [[[ICCProfile alloc] init] autorelease];
+    [profile setVersion:4];
+    [profile setDeviceClass:0x6C696E6B]; // 'link'
+    [profile setDataColorSpace:[sourceProfile dataColorSpace]];
+    [profile setPcsColorSpace:[destinationProfile dataColorSpace]];
+    [profile setRenderingIntent:intent];
+    [profile setCreationDate:[NSDate date]];
+    [profile setTag:lut withSignature:@"A2B0"];
+    [profile setTag:desc withSignature:@"desc"];
+    [profile setTag:cprt withSignature:@"cprt"];
+    [profile setTag:pseq withSignature:@"pseq"];
+    [lut release];
+    [desc release];
+    [cprt release];
+    [pseq release];
+    return profile;
+}
+
+- (BOOL)writeDeviceLinkToPath:(NSString *)path
+                  description:(NSString *)description
+                    copyright:(NSString *)copyright
+                        error:(NSError **)error {
+    ICCProfile *profile = [self deviceLinkProfileWithDescription:description copyright:copyright error:error];
+    if (!profile) return NO;
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    BOOL success = [writer writeProfile:profile toPath:path error:error];
+    [writer release];
+    return success;
+}
+
+- (NSData *)cubeDataWithTitle:(NSString *)title error:(NSError **)error {
+    if (inputChannels != 3 || outputChannels != 3) {
+        if (error) {
+            *error = bakerError(3, @".cube files hold RGB to RGB tables only");
+        }
+        return nil;
+    }
+    if (!table && ![self bakeWithError:error]) return nil;
+
+    NSMutableString *text = [NSMutableString string];
+    if ([title length]) {
+        NSString *quoted = [title stringByReplacingOccurrencesOfString:@"\"" withString:@"'"];
+        [text appendFormat:@"TITLE \"%@\"\n", quoted];
+    }
+    [text appendFormat:@"LUT_3D_SIZE %lu\n", (unsigned long)gridPoints];
+    [text appendString:@"DOMAIN_MIN 0.0 0.0 0.0\nDOMAIN_MAX 1.0 1.0 1.0\n"];
+
+    // .cube runs red fastest, the table blue fastest
+    const float *v = (const float *)[table bytes];
+    NSUInteger r, g, b;
+    for (b = 0; b < gridPoints; b++) {
+        for (g = 0; g < gridPoints; g++) {
+            for (r = 0; r < gridPoints; r++) {
+                const float *node = v + ((r * gridPoints + g) * gridPoints + b) * 3;
+                [text appendFormat:@"%.6f %.6f %.6f\n", node[0], node[1], node[2]];
+            }
+        }
+    }
+    return [text dataUsingEncoding:NSASCIIStringEncoding allowLossyConversion:YES];
+}
+
+- (BOOL)writeCubeToPath:(NSString *)path title:(NSString *)title error:(NSError **)error {
+    NSData *data = [self cubeDataWithTitle:title error:error];
+    if (!data) return NO;
+    BOOL success = [data writeToFile:path atomically:YES];
+    if (!success && error) {
+        *error = bakerError(4, @"Failed to write file");
+    }
+    return success;
+}
+
+- (void)dealloc {
+    [engine release];
+    [sourceProfile release];
+    [destinationProfile release];
+    [table release];
+    [super dealloc];
+}
+
+@end
@@ -12,18 +12,56 @@ NS_ASSUME_NONNULL_BEGIN
 @class ICCProfile;
 @class ColorSpace;
 
-@interface GamutCalculator : NSObject
+extern const NSUInteger kGamutCalculatorMaxCMYKResolution;
+
+@interface GamutCalculator : NSObject {
+    NSUInteger resolution;
+    NSUInteger workerCount;
+}
+
+// Lattice samples per device channel (default 17). CMYK lattices are capped
+// at kGamutCalculatorMaxCMYKResolution per channel to keep res^4 manageable.
+@property (nonatomic) NSUInteger resolution;
+
+// Number of concurrent slab workers (0 = one per active core, the default).
+// Lattices are split into slabs along the first device channel, and every
+// worker writes its slabs straight into the shared output buffer. All workers
+// run one LittleCMS transform built with cmsFLAGS_NOCACHE: without its
+// last-color cache cmsDoTransform writes no transform state, so concurrent
+// calls are safe. Small lattices always run serially.
+@property (nonatomic) NSUInteger workerCount;
+
+// Map SettingsManager.renderingQuality (0=low, 1=medium, 2=high) to 17/33/65
++ (NSUInteger)resolutionForRenderingQuality:(NSInteger)quality;
 
 // Compute gamut boundary points in Lab space
 - (NSArray *)computeGamutForProfile:(ICCProfile *)profile;
 - (NSArray *)computeGamutForColorSpace:(ColorSpace *)colorSpace;
 
+// Packed variants: interleaved float L*, a*, b* triples (3 floats per point).
+// Preferred for large lattices; feed directly into Gamut3DModel -initWithLabData:.
+// With LittleCMS, profile gamuts push the whole device lattice (RGB, CMYK or Gray)
+// through one cmsDoTransform call to D50 Lab; without it (or without profile
+// bytes) the sRGB gamut is returned. Color space gamuts are Bradford-adapted
+// from their own white point to D50, so both kinds share the same Lab.
+- (NSData *)computePackedGamutForProfile:(ICCProfile *)profile;
+- (NSData *)computePackedGamutForColorSpace:(ColorSpace *)colorSpace;
+
 // Generate sample points in RGB space and convert to Lab
-- (NSArray *)sampleRGBSpaceWithResolution:(NSUInteger)resolution;
+- (NSArray *)sampleRGBSpaceWithResolution:(NSUInteger)samplesPerChannel;
 
-// Compute convex hull of gamut points (returns face indices)
+// Compute convex hull of gamut points (returns face indices into points)
 - (NSArray *)computeConvexHullFaces:(NSArray *)points;
 
+// Boundary meshes over packed Lab (see GamutHull): uint32_t index triples into
+// the packed points, counter-clockwise from outside. The convex hull suits
+// matrix/TRC display profiles; the segment-maxima descriptor (around L*=50 on
+// the neutral axis) follows concave printer gamuts.
+- (NSData *)computeConvexHullTrianglesForPackedLab:(NSData *)packedLab;
+- (NSData *)computeBoundaryTrianglesForPackedLab:(NSData *)packedLab
+                                     hueSegments:(NSUInteger)hueSegments
+                               elevationSegments:(NSUInteger)elevationSegments;
+
 @end
 
 NS_ASSUME_NONNULL_END
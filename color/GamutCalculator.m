@@ -7,69 +7,348 @@
 
 #import "GamutCalculator.h"
 #import "ICCProfile.h"
+#import "ICCProfileIO.h"
 #import "ColorSpace.h"
 #import "ColorConverter.h"
+#import "ColorTransform.h"
+#import "GamutHull.h"
 #import "StandardColorSpaces.h"
 
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
+
+const NSUInteger kGamutCalculatorMaxCMYKResolution = 17;
+
+// Below this many lattice points the thread hand-off costs more than it saves
+static const NSUInteger kGamutParallelMinPoints = 8192;
+
+// Slabs per worker; more than one evens out load when slab costs differ
+static const NSUInteger kGamutSlabsPerWorker = 4;
+
+// Fill lattice points [start, start + count) of an N-channel device lattice
+// (first channel slowest) scaled to [0, maxValue].
+static void fillDeviceLattice(float *out, NSUInteger channels, NSUInteger res, float maxValue,
+                              NSUInteger start, NSUInteger count) {
+    NSUInteger i, c;
+    float scale = maxValue / (float)(res - 1);
+    for (i = 0; i < count; i++) {
+        NSUInteger rem = start + i;
+        for (c = channels; c > 0; c--) {
+            out[i * channels + (c - 1)] = (float)(rem % res) * scale;
+            rem /= res;
+        }
+    }
+}
+
+// Evaluates one contiguous slab of the lattice into a shared packed Lab buffer.
+// Either lcmsTransform (one NOCACHE LittleCMS transform built for the whole
+// lattice) or transform (matrix path) is set; both are safe to share.
+@interface GamutSlabOperation : NSOperation {
+    void *lcmsTransform;
+    ColorTransform *transform;
+    NSUInteger channels;
+    NSUInteger res;
+    float maxValue;
+    NSUInteger start;
+    NSUInteger count;
+    float *output;
+    BOOL failed;
+}
+
+- (id)initWithLCMSTransform:(void *)xform channels:(NSUInteger)ch resolution:(NSUInteger)r maxValue:(float)maxV;
+- (id)initWithTransform:(ColorTransform *)t resolution:(NSUInteger)r;
+- (void)setStart:(NSUInteger)s count:(NSUInteger)c output:(float *)out;
+- (BOOL)failed;
+
+@end
+
+@implementation GamutSlabOperation
+
+- (id)initWithLCMSTransform:(void *)xform channels:(NSUInteger)ch resolution:(NSUInteger)r maxValue:(float)maxV {
+    self = [super init];
+    if (self) {
+        lcmsTransform = xform;
+        channels = ch;
+        res = r;
+        maxValue = maxV;
+    }
+    return self;
+}
+
+- (id)initWithTransform:(ColorTransform *)t resolution:(NSUInteger)r {
+    self = [super init];
+    if (self) {
+        transform = [t retain];
+        channels = 3;
+        res = r;
+        maxValue = 1.0f;
+    }
+    return self;
+}
+
+- (void)setStart:(NSUInteger)s count:(NSUInteger)c output:(float *)out {
+    start = s;
+    count = c;
+    output = out;
+}
+
+- (BOOL)failed {
+    return failed;
+}
+
+- (void)main {
+    float *slabOut = output + start * 3;
+    
+    if (transform) {
+        // RGB lattice written straight into the output, converted in place
+        fillDeviceLattice(slabOut, 3, res, 1.0f, start, count);
+        [transform convertRGB:slabOut toLab:slabOut count:count];
+        return;
+    }
+    
+#ifdef HAVE_LCMS
+    float *deviceValues = lcmsTransform ? (float *)malloc(count * channels * sizeof(float)) : NULL;
+    if (deviceValues) {
+        fillDeviceLattice(deviceValues, channels, res, maxValue, start, count);
+        cmsDoTransform((cmsHTRANSFORM)lcmsTransform, deviceValues, slabOut, (cmsUInt32Number)count);
+        free(deviceValues);
+    } else {
+        failed = YES;
+    }
+#else
+    failed = YES;
+#endif
+}
+
+- (void)dealloc {
+    [transform release];
+    [super dealloc];
+}
+
+@end
+
 @implementation GamutCalculator
 
-- (NSArray *)computeGamutForProfile:(ICCProfile *)profile {
-    // Sample RGB space and convert to Lab. Simplified: uses sRGB→XYZ (no profile LUT).
-    // A full implementation would use the profile's actual transform (LUTs, matrices).
-    ColorSpace *sRGB = [StandardColorSpaces sRGB];
-    return [self computeGamutForColorSpace:sRGB];
+@synthesize resolution;
+@synthesize workerCount;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        resolution = 17;
+        workerCount = 0;
+    }
+    return self;
 }
 
-- (NSArray *)computeGamutForColorSpace:(ColorSpace *)colorSpace {
-    NSMutableArray *labPoints = [NSMutableArray array];
-    NSUInteger resolution = 17;
+// Effective worker count for a lattice of total points
+- (NSUInteger)workersForPointCount:(NSUInteger)total {
+    NSUInteger workers = workerCount;
+    if (workers == 0) {
+        workers = [[NSProcessInfo processInfo] activeProcessorCount];
+    }
+    if (workers < 1 || total < kGamutParallelMinPoints) {
+        workers = 1;
+    }
+    return workers;
+}
+
+// Evaluate a res^channels lattice into out (3 floats per point). The lattice
+// is split into slabs of whole first-channel planes, one operation per slab,
+// run on a queue bounded to the worker count. All slabs share the one
+// transform, so splitting finer only costs an operation, not a new context
+// and pipeline. Returns NO if any slab failed.
+- (BOOL)evaluateLatticeInto:(float *)out
+              lcmsTransform:(void *)lcmsTransform
+                  transform:(ColorTransform *)transform
+                   channels:(NSUInteger)channels
+                 resolution:(NSUInteger)res
+                   maxValue:(float)maxValue {
+    NSUInteger total = 1, c;
+    for (c = 0; c < channels; c++) total *= res;
+    NSUInteger planeSize = total / res;
     
-    // XYZ white point for Lab (from color space xy white point)
-    double whitePointXyz[3];
-    [ColorConverter whitePointXyzFromColorSpace:[colorSpace whitePoint] outXyz:whitePointXyz];
+    NSUInteger workers = [self workersForPointCount:total];
+    NSUInteger slabCount = (workers == 1) ? 1 : MIN(res, workers * kGamutSlabsPerWorker);
     
-    NSUInteger r, g, b;
-    for (r = 0; r < resolution; r++) {
-        for (g = 0; g < resolution; g++) {
-            for (b = 0; b < resolution; b++) {
-                double rgb[3] = {
-                    (double)r / (resolution - 1),
-                    (double)g / (resolution - 1),
-                    (double)b / (resolution - 1)
-                };
-                
-                double xyz[3];
-                [ColorConverter rgbToXyz:rgb xyz:xyz 
-                              primaries:[colorSpace primaries] 
-                             whitePoint:[colorSpace whitePoint]];
-                
-                double lab[3];
-                [ColorConverter xyzToLab:xyz lab:lab whitePoint:whitePointXyz];
-                
-                NSArray *point = [NSArray arrayWithObjects:
-                                 [NSNumber numberWithDouble:lab[0]],
-                                 [NSNumber numberWithDouble:lab[1]],
-                                 [NSNumber numberWithDouble:lab[2]],
-                                 nil];
-                [labPoints addObject:point];
-            }
+    NSMutableArray *operations = [NSMutableArray arrayWithCapacity:slabCount];
+    NSUInteger slab, firstPlane = 0;
+    for (slab = 0; slab < slabCount; slab++) {
+        // Spread the remainder planes over the leading slabs
+        NSUInteger planes = res / slabCount + ((slab < res % slabCount) ? 1 : 0);
+        GamutSlabOperation *op;
+        if (transform) {
+            op = [[GamutSlabOperation alloc] initWithTransform:transform resolution:res];
+        } else {
+            op = [[GamutSlabOperation alloc] initWithLCMSTransform:lcmsTransform channels:channels
+                                                        resolution:res maxValue:maxValue];
         }
+        [op setStart:firstPlane * planeSize count:planes * planeSize output:out];
+        [operations addObject:op];
+        [op release];
+        firstPlane += planes;
+    }
+    
+    if (slabCount == 1) {
+        [[operations objectAtIndex:0] start];
+    } else {
+        NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:(NSInteger)workers];
+        [queue addOperations:operations waitUntilFinished:YES];
+        [queue release];
     }
     
+    NSUInteger i;
+    for (i = 0; i < [operations count]; i++) {
+        if ([[operations objectAtIndex:i] failed]) return NO;
+    }
+    return YES;
+}
+
++ (NSUInteger)resolutionForRenderingQuality:(NSInteger)quality {
+    if (quality <= 0) return 17;
+    if (quality == 1) return 33;
+    return 65;
+}
+
+// Box packed L*, a*, b* floats as NSArray of 3-NSNumber points (compatibility view).
+static NSArray *pointArrayFromPackedLab(NSData *packed) {
+    NSUInteger count = [packed length] / (3 * sizeof(float));
+    const float *lab = (const float *)[packed bytes];
+    NSMutableArray *labPoints = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        NSArray *point = [NSArray arrayWithObjects:
+                         [NSNumber numberWithDouble:lab[i * 3 + 0]],
+                         [NSNumber numberWithDouble:lab[i * 3 + 1]],
+                         [NSNumber numberWithDouble:lab[i * 3 + 2]],
+                         nil];
+        [labPoints addObject:point];
+    }
     return labPoints;
 }
 
-- (NSArray *)sampleRGBSpaceWithResolution:(NSUInteger)resolution {
+- (NSArray *)computeGamutForProfile:(ICCProfile *)profile {
+    return pointArrayFromPackedLab([self computePackedGamutForProfile:profile]);
+}
+
+- (NSArray *)computeGamutForColorSpace:(ColorSpace *)colorSpace {
+    return pointArrayFromPackedLab([self computePackedGamutForColorSpace:colorSpace]);
+}
+
+#ifdef HAVE_LCMS
+// Device → Lab (D50) through LittleCMS. One NOCACHE transform is built in a
+// private context and shared by every slab worker, as ImageTransformEngine does.
+- (NSData *)computeProfileGamutWithLCMS:(NSData *)profileData {
+    cmsContext context = cmsCreateContext(NULL, NULL);
+    if (!context) return nil;
+    cmsHPROFILE hProfile = ICCOpenProfileFromData(context, profileData);
+    if (!hProfile) {
+        cmsDeleteContext(context);
+        return nil;
+    }
+    
+    cmsUInt32Number inputFormat;
+    NSUInteger channels;
+    NSUInteger res = resolution;
+    float maxValue = 1.0f;
+    cmsColorSpaceSignature space = cmsGetColorSpace(hProfile);
+    switch (space) {
+        case cmsSigRgbData:
+            inputFormat = TYPE_RGB_FLT;
+            channels = 3;
+            break;
+        case cmsSigCmykData:
+            inputFormat = TYPE_CMYK_FLT;
+            channels = 4;
+            maxValue = 100.0f; // LittleCMS float CMYK is 0..100 (ink %)
+            if (res > kGamutCalculatorMaxCMYKResolution) res = kGamutCalculatorMaxCMYKResolution;
+            break;
+        case cmsSigGrayData:
+            inputFormat = TYPE_GRAY_FLT;
+            channels = 1;
+            break;
+        default:
+            cmsCloseProfile(hProfile);
+            cmsDeleteContext(context);
+            return nil;
+    }
+    
+    cmsHPROFILE hLab = cmsCreateLab4ProfileTHR(context, NULL);
+    cmsHTRANSFORM xform = NULL;
+    if (hLab) {
+        xform = cmsCreateTransformTHR(context, hProfile, inputFormat, hLab, TYPE_Lab_FLT,
+                                      INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+        cmsCloseProfile(hLab);
+    }
+    cmsCloseProfile(hProfile);
+    if (!xform) {
+        cmsDeleteContext(context);
+        return nil;
+    }
+    
+    NSUInteger total = 1, c;
+    for (c = 0; c < channels; c++) total *= res;
+    NSMutableData *packed = [NSMutableData dataWithLength:total * 3 * sizeof(float)];
+    BOOL ok = packed && [self evaluateLatticeInto:(float *)[packed mutableBytes]
+                                    lcmsTransform:xform
+                                        transform:nil
+                                         channels:channels
+                                       resolution:res
+                                         maxValue:maxValue];
+    cmsDeleteTransform(xform);
+    cmsDeleteContext(context);
+    return ok ? packed : nil;
+}
+#endif
+
+- (NSData *)computePackedGamutForProfile:(ICCProfile *)profile {
+#ifdef HAVE_LCMS
+    NSData *profileData = [profile profileData];
+    if (profileData && resolution >= 2) {
+        NSData *packed = [self computeProfileGamutWithLCMS:profileData];
+        if (packed) return packed;
+    }
+#endif
+    // No profile bytes or unsupported device space: fall back to the sRGB gamut
+    ColorSpace *sRGB = [StandardColorSpaces sRGB];
+    return [self computePackedGamutForColorSpace:sRGB];
+}
+
+- (NSData *)computePackedGamutForColorSpace:(ColorSpace *)colorSpace {
+    if (resolution < 2) return [NSData data];
+    NSUInteger total = resolution * resolution * resolution;
+    NSMutableData *packed = [NSMutableData dataWithLength:total * 3 * sizeof(float)];
+    
+    // Each slab fills its part of the RGB lattice and converts it to Lab in place.
+    // Lab is taken against the D50 PCS (Bradford-adapted) so standard spaces
+    // overlay and compare with profile gamuts from LittleCMS.
+    ColorTransform *transform = [[ColorTransform alloc] initWithPrimaries:[colorSpace primaries]
+                                                              whitePoint:[colorSpace whitePoint]
+                                                            adaptedToPCS:YES];
+    [self evaluateLatticeInto:(float *)[packed mutableBytes]
+                lcmsTransform:NULL
+                    transform:transform
+                     channels:3
+                   resolution:resolution
+                     maxValue:1.0f];
+    [transform release];
+    
+    return packed;
+}
+
+- (NSArray *)sampleRGBSpaceWithResolution:(NSUInteger)samplesPerChannel {
     NSMutableArray *points = [NSMutableArray array];
     
     NSUInteger r, g, b;
-    for (r = 0; r < resolution; r++) {
-        for (g = 0; g < resolution; g++) {
-            for (b = 0; b < resolution; b++) {
+    for (r = 0; r < samplesPerChannel; r++) {
+        for (g = 0; g < samplesPerChannel; g++) {
+            for (b = 0; b < samplesPerChannel; b++) {
                 NSArray *point = [NSArray arrayWithObjects:
-                                 [NSNumber numberWithDouble:(double)r / (resolution - 1)],
-                                 [NSNumber numberWithDouble:(double)g / (resolution - 1)],
-                                 [NSNumber numberWithDouble:(double)b / (resolution - 1)],
+                                 [NSNumber numberWithDouble:(double)r / (samplesPerChannel - 1)],
+                                 [NSNumber numberWithDouble:(double)g / (samplesPerChannel - 1)],
+                                 [NSNumber numberWithDouble:(double)b / (samplesPerChannel - 1)],
                                  nil];
                 [points addObject:point];
             }
@@ -80,16 +359,34 @@
 }
 
 - (NSArray *)computeConvexHullFaces:(NSArray *)points {
-    // Simplified convex hull computation
-    // A full implementation would use Qhull or CGAL for proper 3D convex hull
-    // For now, return empty array - faces would be computed by proper library
-    
-    // This is a placeholder - in a full implementation, we would:
-    // 1. Extract point coordinates from NSArray
-    // 2. Call Qhull or CGAL to compute convex hull
-    // 3. Return face indices as NSArray of NSArrays
-    
-    return [NSArray array];
+    NSUInteger count = [points count];
+    NSMutableData *packed = [NSMutableData dataWithLength:count * 3 * sizeof(float)];
+    float *out = (float *)[packed mutableBytes];
+    NSUInteger i, k;
+    for (i = 0; i < count; i++) {
+        NSArray *point = [points objectAtIndex:i];
+        for (k = 0; k < 3; k++) {
+            out[i * 3 + k] = (k < [point count]) ? [[point objectAtIndex:k] floatValue] : 0.0f;
+        }
+    }
+    NSData *triangles = [self computeConvexHullTrianglesForPackedLab:packed];
+    return triangles ? [GamutHull faceArrayFromTriangles:triangles] : [NSArray array];
+}
+
+- (NSData *)computeConvexHullTrianglesForPackedLab:(NSData *)packedLab {
+    return [GamutHull convexHullTrianglesForPoints:(const float *)[packedLab bytes]
+                                             count:[packedLab length] / (3 * sizeof(float))];
+}
+
+- (NSData *)computeBoundaryTrianglesForPackedLab:(NSData *)packedLab
+                                     hueSegments:(NSUInteger)hueSegments
+                               elevationSegments:(NSUInteger)elevationSegments {
+    static const float neutralCenter[3] = {50.0f, 0.0f, 0.0f};
+    return [GamutHull segmentMaximaTrianglesForPoints:(const float *)[packedLab bytes]
+                                                count:[packedLab length] / (3 * sizeof(float))
+                                               center:neutralCenter
+                                          hueSegments:hueSegments
+                                    elevationSegments:elevationSegments];
 }
 
 @end
@@ -0,0 +1,42 @@
+//
+//  GamutHull.h
+//  SmallICCer
+//
+//  Triangle meshes over packed Lab point buffers (3 floats per point):
+//  the exact convex hull, and a segment-maxima gamut boundary descriptor
+//  (GBD) that follows the concave regions of printer gamuts.
+//  Triangles are packed uint32_t index triples into the point buffer,
+//  counter-clockwise seen from outside.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Cast the L* line through (a*, b*) against one triangle of a mesh over points.
+// Returns YES with the crossing L* and its winding (+1 where an outward mesh is
+// entered from below, -1 where it is left) when the line hits the triangle.
+// A line through an edge shared by two triangles hits exactly one of them.
+BOOL GamutHullColumnCrossing(const float *points, const uint32_t *triangle,
+                             double a, double b, float *crossingL, int *winding);
+
+@interface GamutHull : NSObject
+
+// Quickhull over the points. Empty for fewer than 4 points or a flat set,
+// nil if memory runs out. Points strictly inside are never referenced.
++ (nullable NSData *)convexHullTrianglesForPoints:(const float *)points count:(NSUInteger)count;
+
+// Farthest point from center in each hue x elevation segment, meshed as a
+// closed latitude/longitude surface capped by the lightest and darkest points.
++ (nullable NSData *)segmentMaximaTrianglesForPoints:(const float *)points
+                                               count:(NSUInteger)count
+                                              center:(const float *)center
+                                         hueSegments:(NSUInteger)hueSegments
+                                   elevationSegments:(NSUInteger)elevationSegments;
+
+// NSArray of 3-NSNumber index arrays (Gamut3DModel faces format)
++ (NSArray *)faceArrayFromTriangles:(NSData *)triangles;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,597 @@
+//
+//  GamutHull.m
+//  SmallICCer
+//
+//  Gamut boundary meshes.
+//  Convex hull: quickhull with per-face outside sets (expected O(n log n)).
+//  Points within a relative tolerance of a face count as on it, so flat
+//  lattice sides do not produce slivers; visibility during the horizon walk
+//  uses the exact sign so the hull stays convex.
+//  Segment maxima: one farthest point per (hue, elevation) segment around a
+//  center, after Morovic & Luo, stitched into a latitude/longitude mesh.
+//
+
+#import "GamutHull.h"
+#import <math.h>
+#import <float.h>
+#import <limits.h>
+#import <stdlib.h>
+#import <string.h>
+
+typedef struct {
+    int v[3];         // Vertex indices, counter-clockwise seen from outside
+    int nb[3];        // nb[e] is the face across edge (v[e], v[e + 1])
+    double n[3];      // Unit outward normal
+    double d;         // Plane offset (n . p = d on the face)
+    int *outside;     // Points above this face not yet on the hull
+    int outsideCount;
+    int outsideCapacity;
+    int alive;
+    int visited;
+} HullFace;
+
+typedef struct {
+    int face;
+    int edge;
+} HullEdge;
+
+typedef struct {
+    const float *pts;
+    HullFace *faces;
+    int faceCount;
+    int faceCapacity;
+    double eps;
+    int stamp;
+    HullEdge *horizon;
+    int horizonCount;
+    int horizonCapacity;
+    int *visible;
+    int visibleCount;
+    int visibleCapacity;
+    int failed;
+} HullState;
+
+static int growArray(void **array, int *capacity, int needed, size_t elementSize) {
+    if (needed <= *capacity) return 1;
+    int newCapacity = *capacity ? *capacity * 2 : 16;
+    while (newCapacity < needed) newCapacity *= 2;
+    void *p = realloc(*array, (size_t)newCapacity * elementSize);
+    if (!p) return 0;
+    *array = p;
+    *capacity = newCapacity;
+    return 1;
+}
+
+static double planeDistance(const HullState *s, const HullFace *f, int p) {
+    const float *q = s->pts + (size_t)p * 3;
+    return f->n[0] * q[0] + f->n[1] * q[1] + f->n[2] * q[2] - f->d;
+}
+
+static int addFace(HullState *s, int a, int b, int c) {
+    if (!growArray((void **)&s->faces, &s->faceCapacity, s->faceCount + 1, sizeof(HullFace))) return -1;
+    HullFace *f = &s->faces[s->faceCount];
+    memset(f, 0, sizeof(HullFace));
+    f->v[0] = a;
+    f->v[1] = b;
+    f->v[2] = c;
+    f->nb[0] = f->nb[1] = f->nb[2] = -1;
+    f->alive = 1;
+    
+    const float *pa = s->pts + (size_t)a * 3;
+    const float *pb = s->pts + (size_t)b * 3;
+    const float *pc = s->pts + (size_t)c * 3;
+    double u[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+    double w[3] = {pc[0] - pa[0], pc[1] - pa[1], pc[2] - pa[2]};
+    f->n[0] = u[1] * w[2] - u[2] * w[1];
+    f->n[1] = u[2] * w[0] - u[0] * w[2];
+    f->n[2] = u[0] * w[1] - u[1] * w[0];
+    double len = sqrt(f->n[0] * f->n[0] + f->n[1] * f->n[1] + f->n[2] * f->n[2]);
+    if (len > 0.0) {
+        f->n[0] /= len;
+        f->n[1] /= len;
+        f->n[2] /= len;
+    }
+    f->d = f->n[0] * pa[0] + f->n[1] * pa[1] + f->n[2] * pa[2];
+    return s->faceCount++;
+}
+
+static int addOutsidePoint(HullFace *f, int p) {
+    if (!growArray((void **)&f->outside, &f->outsideCapacity, f->outsideCount + 1, sizeof(int))) return 0;
+    f->outside[f->outsideCount++] = p;
+    return 1;
+}
+
+// Depth-first walk over the faces visible from eye. Horizon edges come out in
+// loop order because each neighbour is entered through its shared edge and
+// scanned starting from the edge after it.
+static void collectHorizon(HullState *s, int eye, int fi, int enteredEdge) {
+    s->faces[fi].visited = s->stamp;
+    if (!growArray((void **)&s->visible, &s->visibleCapacity, s->visibleCount + 1, sizeof(int))) {
+        s->failed = 1;
+        return;
+    }
+    s->visible[s->visibleCount++] = fi;
+    
+    int k, edgesToScan = (enteredEdge < 0) ? 3 : 2;
+    for (k = 0; k < edgesToScan; k++) {
+        int e = (enteredEdge < 0) ? k : (enteredEdge + 1 + k) % 3;
+        int ni = s->faces[fi].nb[e];
+        if (s->faces[ni].visited == s->stamp) continue;
+        if (planeDistance(s, &s->faces[ni], eye) > 0.0) {
+            int j;
+            for (j = 0; j < 3; j++) {
+                if (s->faces[ni].nb[j] == fi) break;
+            }
+            collectHorizon(s, eye, ni, j);
+            if (s->failed) return;
+        } else {
+            if (!growArray((void **)&s->horizon, &s->horizonCapacity, s->horizonCount + 1, sizeof(HullEdge))) {
+                s->failed = 1;
+                return;
+            }
+            s->horizon[s->horizonCount].face = fi;
+            s->horizon[s->horizonCount].edge = e;
+            s->horizonCount++;
+        }
+    }
+}
+
+// Replace the faces visible from eye with a cone from the horizon to eye
+static int addPointToHull(HullState *s, int fi, int eye) {
+    s->stamp++;
+    s->visibleCount = 0;
+    s->horizonCount = 0;
+    collectHorizon(s, eye, fi, -1);
+    if (s->failed || s->horizonCount < 3) return 0;
+    
+    int first = s->faceCount;
+    int k, i, j;
+    for (k = 0; k < s->horizonCount; k++) {
+        int hf = s->horizon[k].face;
+        int e = s->horizon[k].edge;
+        int a = s->faces[hf].v[e];
+        int b = s->faces[hf].v[(e + 1) % 3];
+        int other = s->faces[hf].nb[e];
+        int nf = addFace(s, a, b, eye);
+        if (nf < 0) return 0;
+        s->faces[nf].nb[0] = other;
+        for (j = 0; j < 3; j++) {
+            if (s->faces[other].nb[j] == hf) {
+                s->faces[other].nb[j] = nf;
+                break;
+            }
+        }
+    }
+    for (k = 0; k < s->horizonCount; k++) {
+        int cur = first + k;
+        int next = first + (k + 1) % s->horizonCount;
+        s->faces[cur].nb[1] = next;
+        s->faces[next].nb[2] = cur;
+    }
+    
+    // Hand the orphaned outside points to the new cone; the rest are interior now
+    for (i = 0; i < s->visibleCount; i++) {
+        HullFace *old = &s->faces[s->visible[i]];
+        for (j = 0; j < old->outsideCount; j++) {
+            int p = old->outside[j];
+            if (p == eye) continue;
+            for (k = first; k < s->faceCount; k++) {
+                if (planeDistance(s, &s->faces[k], p) > s->eps) {
+                    if (!addOutsidePoint(&s->faces[k], p)) return 0;
+                    break;
+                }
+            }
+        }
+        old = &s->faces[s->visible[i]];
+        free(old->outside);
+        old->outside = NULL;
+        old->outsideCount = 0;
+        old->outsideCapacity = 0;
+        old->alive = 0;
+    }
+    return 1;
+}
+
+// Pick four affinely independent extreme points. Returns 0 if the set is flat.
+static int findInitialSimplex(const float *pts, int count, double eps, int out[4]) {
+    int i, axis, bestAxis = 0;
+    int minIdx[3] = {0, 0, 0}, maxIdx[3] = {0, 0, 0};
+    for (i = 1; i < count; i++) {
+        for (axis = 0; axis < 3; axis++) {
+            if (pts[i * 3 + axis] < pts[minIdx[axis] * 3 + axis]) minIdx[axis] = i;
+            if (pts[i * 3 + axis] > pts[maxIdx[axis] * 3 + axis]) maxIdx[axis] = i;
+        }
+    }
+    double bestSpan = -1.0;
+    for (axis = 0; axis < 3; axis++) {
+        double span = pts[maxIdx[axis] * 3 + axis] - pts[minIdx[axis] * 3 + axis];
+        if (span > bestSpan) {
+            bestSpan = span;
+            bestAxis = axis;
+        }
+    }
+    if (bestSpan <= eps) return 0;
+    out[0] = minIdx[bestAxis];
+    out[1] = maxIdx[bestAxis];
+    
+    // Farthest from the line out[0]-out[1]
+    const float *p0 = pts + (size_t)out[0] * 3;
+    const float *p1 = pts + (size_t)out[1] * 3;
+    double dir[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double dirLen2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+    double best = -1.0;
+    out[2] = -1;
+    for (i = 0; i < count; i++) {
+        const float *q = pts + (size_t)i * 3;
+        double v[3] = {q[0] - p0[0], q[1] - p0[1], q[2] - p0[2]};
+        double c[3] = {v[1] * dir[2] - v[2] * dir[1], v[2] * dir[0] - v[0] * dir[2], v[0] * dir[1] - v[1] * dir[0]};
+        double dist2 = (c[0] * c[0] + c[1] * c[1] + c[2] * c[2]) / dirLen2;
+        if (dist2 > best) {
+            best = dist2;
+            out[2] = i;
+        }
+    }
+    if (best <= eps * eps) return 0;
+    
+    // Farthest from the plane through the first three
+    const float *p2 = pts + (size_t)out[2] * 3;
+    double u[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double w[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    double n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+    double nLen = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    best = -1.0;
+    out[3] = -1;
+    for (i = 0; i < count; i++) {
+        const float *q = pts + (size_t)i * 3;
+        double dist = fabs(n[0] * (q[0] - p0[0]) + n[1] * (q[1] - p0[1]) + n[2] * (q[2] - p0[2])) / nLen;
+        if (dist > best) {
+            best = dist;
+            out[3] = i;
+        }
+    }
+    return best > eps;
+}
+
+// Quickhull over packed xyz floats. Returns the triangle count and a malloc'd
+// array of 3 indices per triangle (outward, counter-clockwise), 0 for flat or
+// tiny inputs, or -1 on allocation failure.
+static int buildConvexHull(const float *pts, int count, int **outTriangles) {
+    *outTriangles = NULL;
+    if (count < 4) return 0;
+    
+    HullState s;
+    memset(&s, 0, sizeof(s));
+    s.pts = pts;
+    
+    int i, k;
+    double maxAbs[3] = {0.0, 0.0, 0.0};
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < 3; k++) {
+            double v = fabs(pts[i * 3 + k]);
+            if (v > maxAbs[k]) maxAbs[k] = v;
+        }
+    }
+    // Float inputs: treat points within a few ulps of a plane as on it
+    s.eps = 1e-6 * (maxAbs[0] + maxAbs[1] + maxAbs[2]) + DBL_MIN;
+    
+    int simplex[4];
+    if (!findInitialSimplex(pts, count, s.eps, simplex)) return 0;
+    
+    double centroid[3] = {0.0, 0.0, 0.0};
+    for (i = 0; i < 4; i++) {
+        for (k = 0; k < 3; k++) centroid[k] += pts[simplex[i] * 3 + k] * 0.25;
+    }
+    
+    static const int tetraFaces[4][3] = {{0, 1, 2}, {0, 3, 1}, {0, 2, 3}, {1, 3, 2}};
+    for (i = 0; i < 4; i++) {
+        int fi = addFace(&s, simplex[tetraFaces[i][0]], simplex[tetraFaces[i][1]], simplex[tetraFaces[i][2]]);
+        if (fi < 0) goto fail;
+        HullFace *f = &s.faces[fi];
+        double side = f->n[0] * centroid[0] + f->n[1] * centroid[1] + f->n[2] * centroid[2] - f->d;
+        if (side > 0.0) {
+            int a = f->v[0], b = f->v[1], c = f->v[2];
+            s.faceCount--;
+            addFace(&s, a, c, b);
+        }
+    }
+    // Link the tetrahedron's faces across shared edges
+    int fa, fb, ea, eb;
+    for (fa = 0; fa < 4; fa++) {
+        for (ea = 0; ea < 3; ea++) {
+            int a = s.faces[fa].v[ea], b = s.faces[fa].v[(ea + 1) % 3];
+            for (fb = 0; fb < 4; fb++) {
+                if (fb == fa) continue;
+                for (eb = 0; eb < 3; eb++) {
+                    if (s.faces[fb].v[eb] == b && s.faces[fb].v[(eb + 1) % 3] == a) {
+                        s.faces[fa].nb[ea] = fb;
+                    }
+                }
+            }
+        }
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (i == simplex[0] || i == simplex[1] || i == simplex[2] || i == simplex[3]) continue;
+        for (k = 0; k < 4; k++) {
+            if (planeDistance(&s, &s.faces[k], i) > s.eps) {
+                if (!addOutsidePoint(&s.faces[k], i)) goto fail;
+                break;
+            }
+        }
+    }
+    
+    // New faces are appended, so one forward pass reaches every face with work left
+    int fi;
+    for (fi = 0; fi < s.faceCount; fi++) {
+        HullFace *f = &s.faces[fi];
+        if (!f->alive || f->outsideCount == 0) continue;
+        int eye = f->outside[0];
+        double far = planeDistance(&s, f, eye);
+        for (k = 1; k < f->outsideCount; k++) {
+            double dist = planeDistance(&s, f, f->outside[k]);
+            if (dist > far) {
+                far = dist;
+                eye = f->outside[k];
+            }
+        }
+        if (!addPointToHull(&s, fi, eye)) goto fail;
+    }
+    
+    int triangleCount = 0;
+    for (fi = 0; fi < s.faceCount; fi++) {
+        if (s.faces[fi].alive) triangleCount++;
+    }
+    int *triangles = (int *)malloc((size_t)triangleCount * 3 * sizeof(int));
+    if (!triangles) goto fail;
+    k = 0;
+    for (fi = 0; fi < s.faceCount; fi++) {
+        if (!s.faces[fi].alive) continue;
+        triangles[k++] = s.faces[fi].v[0];
+        triangles[k++] = s.faces[fi].v[1];
+        triangles[k++] = s.faces[fi].v[2];
+    }
+    
+    for (fi = 0; fi < s.faceCount; fi++) free(s.faces[fi].outside);
+    free(s.faces);
+    free(s.horizon);
+    free(s.visible);
+    *outTriangles = triangles;
+    return triangleCount;
+    
+fail:
+    for (fi = 0; fi < s.faceCount; fi++) free(s.faces[fi].outside);
+    free(s.faces);
+    free(s.horizon);
+    free(s.visible);
+    return -1;
+}
+
+static int appendTriangle(int **triangles, int *count, int *capacity, const float *pts,
+                          const float center[3], int a, int b, int c) {
+    if (a == b || b == c || a == c) return 1;
+    const float *pa = pts + (size_t)a * 3, *pb = pts + (size_t)b * 3, *pc = pts + (size_t)c * 3;
+    double u[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+    double w[3] = {pc[0] - pa[0], pc[1] - pa[1], pc[2] - pa[2]};
+    double n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+    double m[3] = {(pa[0] + pb[0] + pc[0]) / 3.0 - center[0],
+                   (pa[1] + pb[1] + pc[1]) / 3.0 - center[1],
+                   (pa[2] + pb[2] + pc[2]) / 3.0 - center[2]};
+    // The descriptor is star-shaped around center: face away from it
+    if (n[0] * m[0] + n[1] * m[1] + n[2] * m[2] < 0.0) {
+        int t = b;
+        b = c;
+        c = t;
+    }
+    if (!growArray((void **)triangles, capacity, (*count + 1) * 3, sizeof(int))) return 0;
+    (*triangles)[*count * 3 + 0] = a;
+    (*triangles)[*count * 3 + 1] = b;
+    (*triangles)[*count * 3 + 2] = c;
+    (*count)++;
+    return 1;
+}
+
+// Segment-maxima gamut boundary descriptor: the farthest point from center in
+// each (hue, elevation) segment, stitched into a closed latitude/longitude mesh
+// capped by the lightest and darkest points. Follows concavities the convex
+// hull bridges over. Same return convention as buildConvexHull.
+static int buildSegmentMaximaMesh(const float *pts, int count, const float center[3],
+                                  int hueSegments, int elevationSegments, int **outTriangles) {
+    *outTriangles = NULL;
+    if (count < 4 || hueSegments < 3 || elevationSegments < 1) return 0;
+    
+    int segmentCount = hueSegments * elevationSegments;
+    int *found = (int *)malloc((size_t)segmentCount * sizeof(int));
+    int *grid = (int *)malloc((size_t)segmentCount * sizeof(int));
+    double *radii = (double *)malloc((size_t)segmentCount * sizeof(double));
+    int *triangles = NULL;
+    int triangleCount = 0, capacity = 0;
+    int result = -1;
+    if (!found || !grid || !radii) goto fail;
+    
+    int i, h, e, step;
+    for (i = 0; i < segmentCount; i++) {
+        found[i] = -1;
+        radii[i] = -1.0;
+    }
+    
+    int top = 0, bottom = 0;
+    for (i = 0; i < count; i++) {
+        const float *p = pts + (size_t)i * 3;
+        if (p[0] > pts[top * 3]) top = i;
+        if (p[0] < pts[bottom * 3]) bottom = i;
+        double dl = p[0] - center[0], da = p[1] - center[1], db = p[2] - center[2];
+        double radius = sqrt(dl * dl + da * da + db * db);
+        if (radius <= 0.0) continue;
+        
+        h = (int)((atan2(db, da) + M_PI) / (2.0 * M_PI) * hueSegments);
+        e = (int)((asin(dl / radius) + M_PI_2) / M_PI * elevationSegments);
+        if (h < 0) h = 0;
+        if (h >= hueSegments) h = hueSegments - 1;
+        if (e < 0) e = 0;
+        if (e >= elevationSegments) e = elevationSegments - 1;
+        int s = e * hueSegments + h;
+        if (radius > radii[s]) {
+            radii[s] = radius;
+            found[s] = i;
+        }
+    }
+    
+    // Empty segments borrow the nearest filled segment in their row, empty
+    // rows the nearest filled row
+    int anyRow = -1;
+    for (e = 0; e < elevationSegments; e++) {
+        const int *row = found + e * hueSegments;
+        for (h = 0; h < hueSegments; h++) {
+            int pick = row[h];
+            for (step = 1; pick < 0 && step <= hueSegments / 2; step++) {
+                pick = row[(h + hueSegments - step) % hueSegments];
+                if (pick < 0) pick = row[(h + step) % hueSegments];
+            }
+            grid[e * hueSegments + h] = pick;
+        }
+        if (grid[e * hueSegments] >= 0) anyRow = e;
+    }
+    if (anyRow < 0) {
+        result = 0;
+        goto fail;
+    }
+    for (e = 0; e < elevationSegments; e++) {
+        if (grid[e * hueSegments] >= 0) continue;
+        int source = -1;
+        for (step = 1; source < 0 && step < elevationSegments; step++) {
+            if (e - step >= 0 && grid[(e - step) * hueSegments] >= 0) source = e - step;
+            else if (e + step < elevationSegments && grid[(e + step) * hueSegments] >= 0) source = e + step;
+        }
+        memcpy(grid + e * hueSegments, grid + source * hueSegments, (size_t)hueSegments * sizeof(int));
+    }
+    
+    for (h = 0; h < hueSegments; h++) {
+        int next = (h + 1) % hueSegments;
+        if (!appendTriangle(&triangles, &triangleCount, &capacity, pts, center,
+                            bottom, grid[next], grid[h])) goto fail;
+        for (e = 0; e + 1 < elevationSegments; e++) {
+            int a = grid[e * hueSegments + h];
+            int b = grid[e * hueSegments + next];
+            int c = grid[(e + 1) * hueSegments + next];
+            int d = grid[(e + 1) * hueSegments + h];
+            if (!appendTriangle(&triangles, &triangleCount, &capacity, pts, center, a, b, c)) goto fail;
+            if (!appendTriangle(&triangles, &triangleCount, &capacity, pts, center, a, c, d)) goto fail;
+        }
+        int last = (elevationSegments - 1) * hueSegments;
+        if (!appendTriangle(&triangles, &triangleCount, &capacity, pts, center,
+                            top, grid[last + h], grid[last + next])) goto fail;
+    }
+    
+    free(found);
+    free(grid);
+    free(radii);
+    *outTriangles = triangles;
+    return triangleCount;
+    
+fail:
+    free(found);
+    free(grid);
+    free(radii);
+    free(triangles);
+    return result;
+}
+
+// Edge function in the (a*, b*) projection, evaluated with the endpoints in
+// index order so triangles sharing an edge get exactly opposite values
+static double projectedEdge(const float *pts, uint32_t i, uint32_t j, double a, double b) {
+    if (i > j) return -projectedEdge(pts, j, i, a, b);
+    const float *p = pts + (size_t)i * 3;
+    const float *q = pts + (size_t)j * 3;
+    return ((double)q[1] - p[1]) * (b - p[2]) - ((double)q[2] - p[2]) * (a - p[1]);
+}
+
+// Top-left fill rule: a point exactly on a shared edge belongs to one triangle
+static int ownsEdge(const float *pts, uint32_t i, uint32_t j, double w) {
+    if (w != 0.0) return w > 0.0;
+    double da = (double)pts[(size_t)j * 3 + 1] - pts[(size_t)i * 3 + 1];
+    double db = (double)pts[(size_t)j * 3 + 2] - pts[(size_t)i * 3 + 2];
+    return (db < 0.0) || (db == 0.0 && da < 0.0);
+}
+
+BOOL GamutHullColumnCrossing(const float *points, const uint32_t *triangle,
+                             double a, double b, float *crossingL, int *winding) {
+    uint32_t v0 = triangle[0], v1 = triangle[1], v2 = triangle[2];
+    const float *p0 = points + (size_t)v0 * 3;
+    const float *p1 = points + (size_t)v1 * 3;
+    const float *p2 = points + (size_t)v2 * 3;
+    double area = ((double)p1[1] - p0[1]) * ((double)p2[2] - p0[2]) -
+                  ((double)p1[2] - p0[2]) * ((double)p2[1] - p0[1]);
+    if (area == 0.0) return NO; // Vertical face: parallel to the line
+    
+    // The outward normal's L* component has the sign of the projected area;
+    // edge tests run on the counter-clockwise projection
+    int w = (area > 0.0) ? -1 : 1;
+    if (area < 0.0) {
+        uint32_t tmp = v1;
+        v1 = v2;
+        v2 = tmp;
+        p1 = points + (size_t)v1 * 3;
+        p2 = points + (size_t)v2 * 3;
+    }
+    double w0 = projectedEdge(points, v1, v2, a, b);
+    if (!ownsEdge(points, v1, v2, w0)) return NO;
+    double w1 = projectedEdge(points, v2, v0, a, b);
+    if (!ownsEdge(points, v2, v0, w1)) return NO;
+    double w2 = projectedEdge(points, v0, v1, a, b);
+    if (!ownsEdge(points, v0, v1, w2)) return NO;
+    
+    *crossingL = (float)((w0 * p0[0] + w1 * p1[0] + w2 * p2[0]) / (w0 + w1 + w2));
+    *winding = w;
+    return YES;
+}
+
+// Copy int triangles into packed uint32 NSData (empty for count 0, nil on failure)
+static NSData *triangleDataFromIndices(int *triangles, int triangleCount) {
+    if (triangleCount < 0) return nil;
+    NSMutableData *data = [NSMutableData dataWithLength:(NSUInteger)triangleCount * 3 * sizeof(uint32_t)];
+    uint32_t *out = (uint32_t *)[data mutableBytes];
+    int i;
+    for (i = 0; i < triangleCount * 3; i++) {
+        out[i] = (uint32_t)triangles[i];
+    }
+    free(triangles);
+    return data;
+}
+
+@implementation GamutHull
+
++ (NSData *)convexHullTrianglesForPoints:(const float *)points count:(NSUInteger)count {
+    if (!points || count < 4 || count > INT_MAX) return [NSData data];
+    int *triangles = NULL;
+    int triangleCount = buildConvexHull(points, (int)count, &triangles);
+    return triangleDataFromIndices(triangles, triangleCount);
+}
+
++ (NSData *)segmentMaximaTrianglesForPoints:(const float *)points
+                                      count:(NSUInteger)count
+                                     center:(const float *)center
+                                hueSegments:(NSUInteger)hueSegments
+                          elevationSegments:(NSUInteger)elevationSegments {
+    if (!points || count < 4 || count > INT_MAX) return [NSData data];
+    int *triangles = NULL;
+    int triangleCount = buildSegmentMaximaMesh(points, (int)count, center,
+                                               (int)hueSegments, (int)elevationSegments, &triangles);
+    return triangleDataFromIndices(triangles, triangleCount);
+}
+
++ (NSArray *)faceArrayFromTriangles:(NSData *)triangles {
+    NSUInteger count = [triangles length] / (3 * sizeof(uint32_t));
+    const uint32_t *idx = (const uint32_t *)[triangles bytes];
+    NSMutableArray *faces = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        [faces addObject:[NSArray arrayWithObjects:
+                         [NSNumber numberWithUnsignedInt:idx[i * 3 + 0]],
+                         [NSNumber numberWithUnsignedInt:idx[i * 3 + 1]],
+                         [NSNumber numberWithUnsignedInt:idx[i * 3 + 2]],
+                         nil]];
+    }
+    return faces;
+}
+
+@end
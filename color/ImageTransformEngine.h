@@ -0,0 +1,85 @@
+//
+//  ImageTransformEngine.h
+//  SmallICCer
+//
+//  Converts pixel buffers between two ICC profiles (optionally soft-proofed
+//  through a third). Images are cut into tiles that a worker pool converts
+//  concurrently through one shared LittleCMS transform.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ICCProfile;
+
+// Interleaved pixel layouts. 16-bit samples are native-endian; float RGB is
+// 0.0-1.0 and float CMYK 0.0-100.0 (the LittleCMS ink convention). Lab is
+// output only: D50 L* 0-100 and a*, b* as floats.
+typedef enum {
+    ImagePixelFormatRGB8,
+    ImagePixelFormatRGB16,
+    ImagePixelFormatRGBFloat,
+    ImagePixelFormatCMYK8,
+    ImagePixelFormatCMYK16,
+    ImagePixelFormatCMYKFloat,
+    ImagePixelFormatLabFloat
+} ImagePixelFormat;
+
+// Bytes per pixel of a format
+NSUInteger ImagePixelFormatBytesPerPixel(ImagePixelFormat format);
+
+@interface ImageTransformEngine : NSObject {
+    ImagePixelFormat inputFormat;
+    ImagePixelFormat outputFormat;
+    void *context;                 // cmsContext owning the transform
+    void *transform;               // cmsHTRANSFORM, created with cmsFLAGS_NOCACHE so workers can share it
+    NSUInteger tileWidth;
+    NSUInteger tileHeight;
+    NSUInteger workerCount;
+    NSTimeInterval lastElapsedTime;
+    double lastMegapixelsPerSecond;
+}
+
+// Source and destination profiles must have profile bytes and color spaces
+// matching the pixel formats; for Lab output the destination is nil. With a
+// proof profile, the output simulates that device on the destination
+// (out-of-gamut colors are not marked).
+- (nullable id)initWithSourceProfile:(ICCProfile *)source
+                  destinationProfile:(nullable ICCProfile *)destination
+                        proofProfile:(nullable ICCProfile *)proof
+                         inputFormat:(ImagePixelFormat)inFormat
+                        outputFormat:(ImagePixelFormat)outFormat
+                              intent:(NSUInteger)intent
+                               error:(NSError **)error;
+
+// Tile size in pixels. 0 width (the default) means full rows; the default
+// height is 64 rows. Images under 64K pixels are converted in one piece.
+@property (nonatomic) NSUInteger tileWidth;
+@property (nonatomic) NSUInteger tileHeight;
+
+// Concurrent tile workers (0 = one per active core, the default)
+@property (nonatomic) NSUInteger workerCount;
+
+@property (nonatomic, readonly) ImagePixelFormat inputFormat;
+@property (nonatomic, readonly) ImagePixelFormat outputFormat;
+
+// Wall-clock time and throughput of the last conversion
+@property (nonatomic, readonly) NSTimeInterval lastElapsedTime;
+@property (nonatomic, readonly) double lastMegapixelsPerSecond;
+
+// Convert width x height pixels. Rows may be padded (rowBytes >= width times
+// bytes per pixel). Output may be the input buffer when both formats have the
+// same pixel size and the row strides are equal. Not reentrant: one
+// conversion per engine at a time.
+- (BOOL)transformPixels:(const void *)input
+          inputRowBytes:(NSUInteger)inputRowBytes
+               toPixels:(void *)output
+         outputRowBytes:(NSUInteger)outputRowBytes
+                  width:(NSUInteger)width
+                 height:(NSUInteger)height
+                  error:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,283 @@
+//
+//  ImageTransformEngine.m
+//  SmallICCer
+//
+//  Image Transform Engine implementation.
+//  The LittleCMS transform is built once per engine with cmsFLAGS_NOCACHE.
+//  Without the one-pixel cache it keeps no per-call state, so every tile
+//  worker can call it at the same time. Each tile is a single
+//  cmsDoTransformLineStride call over its rectangle of the caller's buffers.
+//  Tiles never overlap, so in-place conversion only needs equal pixel sizes
+//  and strides.
+//
+
+#import "ImageTransformEngine.h"
+#import "ICCProfile.h"
+#import "ICCProfileIO.h"
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
+
+// Below this many pixels the thread hand-off costs more than it saves
+static const NSUInteger kImageParallelMinPixels = 65536;
+
+static const NSUInteger kDefaultTileHeight = 64;
+
+NSUInteger ImagePixelFormatBytesPerPixel(ImagePixelFormat format) {
+    switch (format) {
+        case ImagePixelFormatRGB8: return 3;
+        case ImagePixelFormatRGB16: return 6;
+        case ImagePixelFormatRGBFloat: return 12;
+        case ImagePixelFormatCMYK8: return 4;
+        case ImagePixelFormatCMYK16: return 8;
+        case ImagePixelFormatCMYKFloat: return 16;
+        case ImagePixelFormatLabFloat: return 12;
+    }
+    return 0;
+}
+
+static BOOL isCMYKFormat(ImagePixelFormat format) {
+    return format == ImagePixelFormatCMYK8 || format == ImagePixelFormatCMYK16 || format == ImagePixelFormatCMYKFloat;
+}
+
+static NSError *engineError(NSInteger code, NSString *description) {
+    return [NSError errorWithDomain:@"SmallICCer"
+                               code:code
+                           userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                     description, NSLocalizedDescriptionKey, nil]];
+}
+
+#ifdef HAVE_LCMS
+static cmsUInt32Number lcmsFormat(ImagePixelFormat format) {
+    switch (format) {
+        case ImagePixelFormatRGB8: return TYPE_RGB_8;
+        case ImagePixelFormatRGB16: return TYPE_RGB_16;
+        case ImagePixelFormatRGBFloat: return TYPE_RGB_FLT;
+        case ImagePixelFormatCMYK8: return TYPE_CMYK_8;
+        case ImagePixelFormatCMYK16: return TYPE_CMYK_16;
+        case ImagePixelFormatCMYKFloat: return TYPE_CMYK_FLT;
+        case ImagePixelFormatLabFloat: return TYPE_Lab_FLT;
+    }
+    return 0;
+}
+
+// Opens profile bytes in the engine context; nil description on success
+static NSString *openProfile(cmsContext context, ICCProfile *profile, NSString *role, cmsHPROFILE *hProfile) {
+    NSData *data = [profile profileData];
+    *hProfile = data ? ICCOpenProfileFromData(context, data) : NULL;
+    if (!*hProfile) {
+        return [NSString stringWithFormat:@"The %@ profile has no readable profile bytes", role];
+    }
+    return nil;
+}
+#endif
+
+// Converts one rectangle of the image through the shared transform
+@interface ImageTileOperation : NSOperation {
+    void *transform;
+    const uint8_t *input;
+    uint8_t *output;
+    NSUInteger inputRowBytes;
+    NSUInteger outputRowBytes;
+    NSUInteger width;
+    NSUInteger height;
+}
+
+- (id)initWithTransform:(void *)t
+                  input:(const uint8_t *)in inputRowBytes:(NSUInteger)inRowBytes
+                 output:(uint8_t *)out outputRowBytes:(NSUInteger)outRowBytes
+                  width:(NSUInteger)w height:(NSUInteger)h;
+
+@end
+
+@implementation ImageTileOperation
+
+- (id)initWithTransform:(void *)t
+                  input:(const uint8_t *)in inputRowBytes:(NSUInteger)inRowBytes
+                 output:(uint8_t *)out outputRowBytes:(NSUInteger)outRowBytes
+                  width:(NSUInteger)w height:(NSUInteger)h {
+    self = [super init];
+    if (self) {
+        transform = t;
+        input = in;
+        inputRowBytes = inRowBytes;
+        output = out;
+        outputRowBytes = outRowBytes;
+        width = w;
+        height = h;
+    }
+    return self;
+}
+
+- (void)main {
+#ifdef HAVE_LCMS
+    // Chunky pixels: the plane strides are unused
+    cmsDoTransformLineStride((cmsHTRANSFORM)transform, input, output,
+                             (cmsUInt32Number)width, (cmsUInt32Number)height,
+                             (cmsUInt32Number)inputRowBytes, (cmsUInt32Number)outputRowBytes, 0, 0);
+#endif
+}
+
+@end
+
+@implementation ImageTransformEngine
+
+@synthesize tileWidth;
+@synthesize tileHeight;
+@synthesize workerCount;
+@synthesize inputFormat;
+@synthesize outputFormat;
+@synthesize lastElapsedTime;
+@synthesize lastMegapixelsPerSecond;
+
+- (id)initWithSourceProfile:(ICCProfile *)source
+         destinationProfile:(ICCProfile *)destination
+               proofProfile:(ICCProfile *)proof
+                inputFormat:(ImagePixelFormat)inFormat
+               outputFormat:(ImagePixelFormat)outFormat
+                     intent:(NSUInteger)intent
+                      error:(NSError **)error {
+    self = [super init];
+    if (!self) return nil;
+    inputFormat = inFormat;
+    outputFormat = outFormat;
+    tileHeight = kDefaultTileHeight;
+
+    NSString *failure = nil;
+    NSInteger code = 1;
+#ifdef HAVE_LCMS
+    cmsContext lcmsContext = cmsCreateContext(NULL, NULL);
+    cmsHPROFILE hSource = NULL, hDestination = NULL, hProof = NULL;
+    failure = openProfile(lcmsContext, source, @"source", &hSource);
+    if (!failure && outFormat == ImagePixelFormatLabFloat) {
+        hDestination = cmsCreateLab4ProfileTHR(lcmsContext, NULL);
+    } else if (!failure) {
+        failure = openProfile(lcmsContext, destination, @"destination", &hDestination);
+    }
+    if (!failure && proof) failure = openProfile(lcmsContext, proof, @"proof", &hProof);
+    if (!failure) {
+        cmsColorSpaceSignature inSpace = isCMYKFormat(inFormat) ? cmsSigCmykData : cmsSigRgbData;
+        cmsColorSpaceSignature outSpace = isCMYKFormat(outFormat) ? cmsSigCmykData : cmsSigRgbData;
+        if (outFormat == ImagePixelFormatLabFloat) outSpace = cmsSigLabData;
+        if (inFormat == ImagePixelFormatLabFloat) {
+            failure = @"Lab is an output format only";
+        } else if (cmsGetColorSpace(hSource) != inSpace) {
+            failure = @"Input pixel format does not match the source profile color space";
+        } else if (cmsGetColorSpace(hDestination) != outSpace) {
+            failure = @"Output pixel format does not match the destination profile color space";
+        }
+    }
+    if (!failure) {
+        cmsHTRANSFORM xform;
+        if (hProof) {
+            xform = cmsCreateProofingTransformTHR(lcmsContext, hSource, lcmsFormat(inFormat),
+                                                  hDestination, lcmsFormat(outFormat), hProof,
+                                                  (cmsUInt32Number)intent, INTENT_RELATIVE_COLORIMETRIC,
+                                                  cmsFLAGS_SOFTPROOFING | cmsFLAGS_NOCACHE);
+        } else {
+            xform = cmsCreateTransformTHR(lcmsContext, hSource, lcmsFormat(inFormat),
+                                          hDestination, lcmsFormat(outFormat),
+                                          (cmsUInt32Number)intent, cmsFLAGS_NOCACHE);
+        }
+        if (xform) {
+            transform = xform;
+        } else {
+            failure = @"LittleCMS could not build the transform";
+            code = 2;
+        }
+    }
+    if (hSource) cmsCloseProfile(hSource);
+    if (hDestination) cmsCloseProfile(hDestination);
+    if (hProof) cmsCloseProfile(hProof);
+    // The context outlives the profiles; the transform still uses it
+    context = lcmsContext;
+#else
+    failure = @"Image transforms need LittleCMS";
+    code = 4;
+#endif
+
+    if (failure) {
+        if (error) {
+            *error = engineError(code, failure);
+        }
+        [self release];
+        return nil;
+    }
+    return self;
+}
+
+- (BOOL)transformPixels:(const void *)input
+          inputRowBytes:(NSUInteger)inputRowBytes
+               toPixels:(void *)output
+         outputRowBytes:(NSUInteger)outputRowBytes
+                  width:(NSUInteger)width
+                 height:(NSUInteger)height
+                  error:(NSError **)error {
+    NSUInteger inPixel = ImagePixelFormatBytesPerPixel(inputFormat);
+    NSUInteger outPixel = ImagePixelFormatBytesPerPixel(outputFormat);
+    NSString *failure = nil;
+    if (inputRowBytes < width * inPixel || outputRowBytes < width * outPixel ||
+        inputRowBytes > 0xFFFFFFFFu || outputRowBytes > 0xFFFFFFFFu) {
+        failure = @"Row stride is smaller than a row of pixels";
+    } else if ((const void *)output == input && (inPixel != outPixel || inputRowBytes != outputRowBytes)) {
+        failure = @"In-place conversion needs equal pixel sizes and row strides";
+    }
+    if (failure) {
+        if (error) {
+            *error = engineError(3, failure);
+        }
+        return NO;
+    }
+
+    NSDate *start = [NSDate date];
+    NSUInteger pixels = width * height;
+    if (pixels == 0) {
+        lastElapsedTime = 0.0;
+        lastMegapixelsPerSecond = 0.0;
+        return YES;
+    }
+    NSUInteger workers = workerCount ? workerCount : [[NSProcessInfo processInfo] activeProcessorCount];
+    NSUInteger tileW = (tileWidth && pixels >= kImageParallelMinPixels && workers > 1) ? MIN(tileWidth, width) : width;
+    NSUInteger tileH = (tileHeight && pixels >= kImageParallelMinPixels && workers > 1) ? MIN(tileHeight, height) : height;
+
+    NSMutableArray *operations = [NSMutableArray array];
+    NSUInteger x, y;
+    for (y = 0; y < height; y += tileH) {
+        for (x = 0; x < width; x += tileW) {
+            ImageTileOperation *op = [[ImageTileOperation alloc]
+                initWithTransform:transform
+                            input:(const uint8_t *)input + y * inputRowBytes + x * inPixel
+                    inputRowBytes:inputRowBytes
+                           output:(uint8_t *)output + y * outputRowBytes + x * outPixel
+                   outputRowBytes:outputRowBytes
+                            width:MIN(tileW, width - x)
+                           height:MIN(tileH, height - y)];
+            [operations addObject:op];
+            [op release];
+        }
+    }
+
+    if ([operations count] == 1) {
+        [[operations objectAtIndex:0] start];
+    } else if ([operations count] > 1) {
+        NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:(NSInteger)workers];
+        [queue addOperations:operations waitUntilFinished:YES];
+        [queue release];
+    }
+
+    lastElapsedTime = -[start timeIntervalSinceNow];
+    lastMegapixelsPerSecond = (lastElapsedTime > 0.0) ? (double)pixels / 1.0e6 / lastElapsedTime : 0.0;
+    return YES;
+}
+
+- (void)dealloc {
+#ifdef HAVE_LCMS
+    if (transform) cmsDeleteTransform((cmsHTRANSFORM)transform);
+    if (context) cmsDeleteContext((cmsContext)context);
+#endif
+    [super dealloc];
+}
+
+@end
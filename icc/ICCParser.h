@@ -11,11 +11,24 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class ICCProfile;
 
-@interface ICCParser : NSObject
+@interface ICCParser : NSObject {
+    BOOL lazyTagDecoding;
+}
+
+// When YES, parsing reads only the header and tag directory straight from the
+// profile bytes (no LittleCMS); each tag decodes its payload on first access.
+// Default NO: every tag is decoded during the parse.
+@property (nonatomic) BOOL lazyTagDecoding;
 
 - (ICCProfile *)parseProfileFromPath:(NSString *)path error:(NSError **)error;
 - (ICCProfile *)parseProfileFromData:(NSData *)data error:(NSError **)error;
 
+// ICCTag subclass used for a tag signature (e.g. ICCTagTRC for "rTRC")
++ (Class)tagClassForSignature:(NSString *)signature;
+
+// Four-character form of a header or tag signature (e.g. "prtr", "CMYK")
++ (NSString *)stringForSignature:(uint32_t)signature;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -12,16 +12,102 @@
 #import "ICCTagMatrix.h"
 #import "ICCTagLUT.h"
 #import "ICCTagMetadata.h"
+#import "ICCProfileIO.h"
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
-#include <wchar.h>
 #endif
 
+// Fixed ICC header size; the tag count and directory follow it
+static const NSUInteger kICCHeaderSize = 128;
+static const NSUInteger kICCTagEntrySize = 12;
+
+static uint32_t readUInt32BE(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint16_t readUInt16BE(const uint8_t *p) {
+    return (uint16_t)(((uint16_t)p[0] << 8) | (uint16_t)p[1]);
+}
+
+static double readS15Fixed16(const uint8_t *p) {
+    return (double)(int32_t)readUInt32BE(p) / 65536.0;
+}
+
+static NSString *signatureString(uint32_t sig) {
+    return [NSString stringWithFormat:@"%c%c%c%c",
+            (char)((sig >> 24) & 0xFF),
+            (char)((sig >> 16) & 0xFF),
+            (char)((sig >> 8) & 0xFF),
+            (char)(sig & 0xFF)];
+}
+
+// Header dateTimeNumber at offset 24: year, month, day, hours, minutes,
+// seconds (UTC). Falls back to now when the fields do not form a date.
+static NSDate *headerCreationDate(const uint8_t *bytes) {
+    NSDateComponents *components = [[NSDateComponents alloc] init];
+    [components setYear:readUInt16BE(bytes + 24)];
+    [components setMonth:readUInt16BE(bytes + 26)];
+    [components setDay:readUInt16BE(bytes + 28)];
+    [components setHour:readUInt16BE(bytes + 30)];
+    [components setMinute:readUInt16BE(bytes + 32)];
+    [components setSecond:readUInt16BE(bytes + 34)];
+    NSCalendar *calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSGregorianCalendar];
+    [calendar setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
+    NSDate *created = [calendar dateFromComponents:components];
+    [calendar release];
+    [components release];
+    return created ? created : [NSDate date];
+}
+
+// Payload range of each tag in the directory (empty if the directory runs
+// past the data), so eagerly decoded tags still know their source bytes
+static NSDictionary *tagPayloadRanges(NSData *data) {
+    NSMutableDictionary *ranges = [NSMutableDictionary dictionary];
+    NSUInteger length = [data length];
+    const uint8_t *bytes = (const uint8_t *)[data bytes];
+    if (length < kICCHeaderSize + 4) return ranges;
+    uint32_t tagCount = readUInt32BE(bytes + kICCHeaderSize);
+    if (tagCount > (length - kICCHeaderSize - 4) / kICCTagEntrySize) return ranges;
+    NSUInteger i;
+    for (i = 0; i < tagCount; i++) {
+        const uint8_t *entry = bytes + kICCHeaderSize + 4 + i * kICCTagEntrySize;
+        uint32_t offset = readUInt32BE(entry + 4);
+        uint32_t size = readUInt32BE(entry + 8);
+        if (offset > length || size > length - offset) continue;
+        [ranges setObject:[NSValue valueWithRange:NSMakeRange(offset, size)]
+                   forKey:signatureString(readUInt32BE(entry))];
+    }
+    return ranges;
+}
+
 @implementation ICCParser
 
+@synthesize lazyTagDecoding;
+
++ (NSString *)stringForSignature:(uint32_t)signature {
+    return signatureString(signature);
+}
+
++ (Class)tagClassForSignature:(NSString *)signature {
+    static NSSet *trcTags = nil, *metadataTags = nil, *lutTags = nil;
+    if (!trcTags) {
+        trcTags = [[NSSet alloc] initWithObjects:@"rTRC", @"gTRC", @"bTRC", @"kTRC", nil];
+        // Colorants (XYZ values) are shown as text until there is a ColorantTag class
+        metadataTags = [[NSSet alloc] initWithObjects:@"rXYZ", @"gXYZ", @"bXYZ",
+                        @"desc", @"cprt", @"dmnd", @"dmdd", nil];
+        lutTags = [[NSSet alloc] initWithObjects:@"A2B0", @"A2B1", @"A2B2",
+                   @"B2A0", @"B2A1", @"B2A2", @"gamt", @"pre0", @"pre1", @"pre2", nil];
+    }
+    if ([trcTags containsObject:signature]) return [ICCTagTRC class];
+    if ([metadataTags containsObject:signature]) return [ICCTagMetadata class];
+    if ([lutTags containsObject:signature]) return [ICCTagLUT class];
+    return [ICCTag class];
+}
+
 - (ICCProfile *)parseProfileFromPath:(NSString *)path error:(NSError **)error {
-    NSData *data = [NSData dataWithContentsOfFile:path];
+    // Mapped, not read: the profile keeps the mapping as its profileData
+    NSData *data = ICCMappedDataWithContentsOfFile(path);
     if (!data) {
         if (error) {
             *error = [NSError errorWithDomain:@"SmallICCer" 
@@ -35,11 +121,13 @@
 }
 
 - (ICCProfile *)parseProfileFromData:(NSData *)data error:(NSError **)error {
+    if (lazyTagDecoding) {
+        return [self parseTagDirectoryFromData:data error:error];
+    }
 #ifdef HAVE_LCMS
-    const void *profileData = [data bytes];
     NSUInteger profileSize = [data length];
     
-    cmsHPROFILE hProfile = cmsOpenProfileFromMem(profileData, profileSize);
+    cmsHPROFILE hProfile = ICCOpenProfileFromData(NULL, data);
     if (!hProfile) {
         if (error) {
             *error = [NSError errorWithDomain:@"SmallICCer" 
@@ -55,6 +143,7 @@
     // Parse header
     cmsUInt32Number size = (cmsUInt32Number)profileSize;
     profile.profileSize = size;
+    profile.profileData = data;
     
     // Get version
     cmsUInt32Number version = cmsGetProfileVersion(hProfile);
@@ -71,8 +160,8 @@
     cmsColorSpaceSignature pcsColorSpace = cmsGetPCS(hProfile);
     profile.pcsColorSpace = pcsColorSpace;
     
-    // Get creation date (simplified - would need proper date parsing)
-    profile.creationDate = [NSDate date]; // Placeholder
+    // Get creation date (LittleCMS accepted the data, so the header is complete)
+    profile.creationDate = headerCreationDate((const uint8_t *)[data bytes]);
     
     // Get rendering intent
     cmsUInt32Number renderingIntent = cmsGetHeaderRenderingIntent(hProfile);
@@ -89,18 +178,23 @@
     }
     
     // Parse tags
+    NSDictionary *ranges = tagPayloadRanges(data);
     cmsUInt32Number tagCount = cmsGetTagCount(hProfile);
     cmsUInt32Number i;
     for (i = 0; i < tagCount; i++) {
         cmsTagSignature tagSig = cmsGetTagSignature(hProfile, i);
-        NSString *tagSignature = [NSString stringWithFormat:@"%c%c%c%c",
-                                  (char)((tagSig >> 24) & 0xFF),
-                                  (char)((tagSig >> 16) & 0xFF),
-                                  (char)((tagSig >> 8) & 0xFF),
-                                  (char)(tagSig & 0xFF)];
-        
+        NSString *tagSignature = signatureString(tagSig);
         ICCTag *tag = [self parseTag:hProfile signature:tagSig stringSignature:tagSignature];
+        NSValue *range = [ranges objectForKey:tagSignature];
+        if (!tag && range) {
+            // Types LittleCMS cannot read are kept as raw payloads, so writing
+            // the profile still copies them
+            tag = [[[ICCTag alloc] initWithData:NULL signature:tagSignature] autorelease];
+        }
         if (tag) {
+            if (range) {
+                [tag setSourceData:data range:[range rangeValue]];
+            }
             [profile setTag:tag withSignature:tagSignature];
         }
     }
@@ -118,67 +212,83 @@
 #endif
 }
 
-- (ICCTag *)parseTag:(cmsHPROFILE)hProfile signature:(cmsTagSignature)tagSig stringSignature:(NSString *)tagSignature {
 #ifdef HAVE_LCMS
-    // Check for TRC tags (Red, Green, Blue)
-    if (tagSig == cmsSigRedTRCTag || tagSig == cmsSigGreenTRCTag || tagSig == cmsSigBlueTRCTag) {
-        cmsToneCurve *curve = (cmsToneCurve *)cmsReadTag(hProfile, tagSig);
-        if (curve) {
-            ICCTagTRC *trcTag = [[ICCTagTRC alloc] initWithData:curve signature:tagSignature];
-            [trcTag loadFromToneCurve:curve];
-            return [trcTag autorelease];
-        }
+- (ICCTag *)parseTag:(cmsHPROFILE)hProfile signature:(cmsTagSignature)tagSig stringSignature:(NSString *)tagSignature {
+    void *tagData = cmsReadTag(hProfile, tagSig);
+    if (!tagData) return nil;
+    Class tagClass = [ICCParser tagClassForSignature:tagSignature];
+    ICCTag *tag = [[tagClass alloc] initWithData:tagData signature:tagSignature];
+    [tag loadFromTagData:tagData];
+    return [tag autorelease];
+}
+#endif
+
+// Lazy parse: header fields and the tag directory only. Tags sharing one
+// payload (e.g. gray TRCs linked across channels) each get their own entry.
+- (ICCProfile *)parseTagDirectoryFromData:(NSData *)data error:(NSError **)error {
+    NSUInteger length = [data length];
+    const uint8_t *bytes = (const uint8_t *)[data bytes];
+    uint32_t tagCount = (length >= kICCHeaderSize + 4) ? readUInt32BE(bytes + kICCHeaderSize) : 0;
+    BOOL valid = (length >= kICCHeaderSize + 4 && readUInt32BE(bytes + 36) == 0x61637370 && // 'acsp'
+                  tagCount <= (length - kICCHeaderSize - 4) / kICCTagEntrySize);
+    NSUInteger i;
+    for (i = 0; valid && i < tagCount; i++) {
+        const uint8_t *entry = bytes + kICCHeaderSize + 4 + i * kICCTagEntrySize;
+        uint32_t offset = readUInt32BE(entry + 4);
+        uint32_t size = readUInt32BE(entry + 8);
+        valid = (offset <= length && size <= length - offset);
     }
-    
-    // Check for colorant tags (XYZ values)
-    if (tagSig == cmsSigRedColorantTag || tagSig == cmsSigGreenColorantTag || 
-        tagSig == cmsSigBlueColorantTag) {
-        cmsCIEXYZ *xyz = (cmsCIEXYZ *)cmsReadTag(hProfile, tagSig);
-        if (xyz) {
-            // Store as metadata for now - could create a ColorantTag class
-            ICCTagMetadata *metaTag = [[ICCTagMetadata alloc] initWithData:xyz signature:tagSignature];
-            NSString *xyzString = [NSString stringWithFormat:@"X=%.6f Y=%.6f Z=%.6f", 
-                                   xyz->X, xyz->Y, xyz->Z];
-            metaTag.textValue = xyzString;
-            return [metaTag autorelease];
+    if (!valid) {
+        if (error) {
+            *error = [NSError errorWithDomain:@"SmallICCer" 
+                                         code:2 
+                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                               @"Failed to parse ICC profile", NSLocalizedDescriptionKey, nil]];
         }
+        return nil;
     }
     
-    // Check for text tags (description, copyright, etc.)
-    if (tagSig == cmsSigProfileDescriptionTag || tagSig == cmsSigCopyrightTag ||
-        tagSig == cmsSigDeviceMfgDescTag || tagSig == cmsSigDeviceModelDescTag) {
-        wchar_t *text = (wchar_t *)cmsReadTag(hProfile, tagSig);
-        if (text) {
-            ICCTagMetadata *metaTag = [[ICCTagMetadata alloc] initWithData:text signature:tagSignature];
-            // Convert wide string to NSString
-            NSString *nsString = [NSString stringWithCharacters:(const unichar *)text 
-                                                          length:wcslen(text)];
-            metaTag.textValue = nsString;
-            return [metaTag autorelease];
-        }
-    }
+    ICCProfile *profile = [[ICCProfile alloc] init];
+    profile.profileSize = length;
+    profile.profileData = data;
+    profile.preferredCMM = signatureString(readUInt32BE(bytes + 4));
+    profile.version = bytes[8];
+    profile.deviceClass = readUInt32BE(bytes + 12);
+    profile.dataColorSpace = readUInt32BE(bytes + 16);
+    profile.pcsColorSpace = readUInt32BE(bytes + 20);
+    profile.platformSignature = signatureString(readUInt32BE(bytes + 40));
+    profile.flags = readUInt32BE(bytes + 44);
+    profile.deviceManufacturer = signatureString(readUInt32BE(bytes + 48));
+    profile.deviceModel = signatureString(readUInt32BE(bytes + 52));
+    profile.deviceAttributes = (NSUInteger)readUInt32BE(bytes + 60);
+    profile.renderingIntent = readUInt32BE(bytes + 64);
+    profile.profileCreator = signatureString(readUInt32BE(bytes + 80));
     
-    // Check for LUT tags
-    if (tagSig == cmsSigAToB0Tag || tagSig == cmsSigAToB1Tag || tagSig == cmsSigAToB2Tag ||
-        tagSig == cmsSigBToA0Tag || tagSig == cmsSigBToA1Tag || tagSig == cmsSigBToA2Tag) {
-        cmsPipeline *pipeline = (cmsPipeline *)cmsReadTag(hProfile, tagSig);
-        if (pipeline) {
-            ICCTagLUT *lutTag = [[ICCTagLUT alloc] initWithData:pipeline signature:tagSignature];
-            [lutTag loadFromPipeline:pipeline];
-            return [lutTag autorelease];
-        }
-    }
+    profile.creationDate = headerCreationDate(bytes);
     
-    // Generic tag for anything else
-    void *tagData = cmsReadTag(hProfile, tagSig);
-    if (tagData) {
-        return [[[ICCTag alloc] initWithData:tagData signature:tagSignature] autorelease];
+    for (i = 0; i < tagCount; i++) {
+        const uint8_t *entry = bytes + kICCHeaderSize + 4 + i * kICCTagEntrySize;
+        NSString *tagSignature = signatureString(readUInt32BE(entry));
+        NSRange range = NSMakeRange(readUInt32BE(entry + 4), readUInt32BE(entry + 8));
+        
+        // Media white point, as the eager parse reports it: 'XYZ ' type, 8-byte type header
+        if ([tagSignature isEqualToString:@"wtpt"] && range.length >= 20 &&
+            readUInt32BE(bytes + range.location) == 0x58595A20) {
+            const uint8_t *xyz = bytes + range.location + 8;
+            profile.pcsIlluminant = [NSArray arrayWithObjects:
+                                     [NSNumber numberWithDouble:readS15Fixed16(xyz)],
+                                     [NSNumber numberWithDouble:readS15Fixed16(xyz + 4)],
+                                     [NSNumber numberWithDouble:readS15Fixed16(xyz + 8)],
+                                     nil];
+        }
+        
+        Class tagClass = [ICCParser tagClassForSignature:tagSignature];
+        ICCTag *tag = [[tagClass alloc] initWithSignature:tagSignature profileData:data range:range];
+        [profile setTag:tag withSignature:tagSignature];
+        [tag release];
     }
     
-    return nil;
-#else
-    return nil;
-#endif
+    return [profile autorelease];
 }
 
 @end
@@ -31,6 +31,9 @@ NS_ASSUME_NONNULL_BEGIN
     
     // Tag table
     NSMutableDictionary *tags;
+    
+    // Original profile bytes (kept so transforms can be built from the source profile)
+    NSData *profileData;
 }
 
 @property (nonatomic) NSUInteger profileSize;
@@ -49,6 +52,7 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, retain) NSArray *pcsIlluminant;
 @property (nonatomic, retain) NSString *profileCreator;
 @property (nonatomic, retain) NSMutableDictionary *tags;
+@property (nonatomic, retain, nullable) NSData *profileData;
 
 - (ICCTag *)tagWithSignature:(NSString *)signature;
 - (void)setTag:(ICCTag *)tag withSignature:(NSString *)signature;
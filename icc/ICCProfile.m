@@ -26,6 +26,7 @@
 @synthesize pcsIlluminant;
 @synthesize profileCreator;
 @synthesize tags;
+@synthesize profileData;
 
 - (id)init {
     self = [super init];
@@ -61,6 +62,7 @@
     [pcsIlluminant release];
     [profileCreator release];
     [tags release];
+    [profileData release];
     [super dealloc];
 }
 
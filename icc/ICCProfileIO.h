@@ -0,0 +1,50 @@
+//
+//  ICCProfileIO.h
+//  SmallICCer
+//
+//  Zero-copy access to profile bytes: memory-mapped file loading, byte-range
+//  views that keep their backing data alive, LittleCMS profiles opened
+//  over caller-owned bytes (cmsOpenProfileFromMem copies the whole block),
+//  and the big-endian field writers tag serializers share.
+//
+
+#import <Foundation/Foundation.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Read-only view of a byte range inside another NSData. Retains the parent,
+// so a slice of a mapped file keeps the mapping alive; -copy returns self.
+@interface ICCDataSlice : NSData {
+    NSData *parent;
+    const void *start;
+    NSUInteger sliceLength;
+}
+
+- (id)initWithData:(NSData *)data range:(NSRange)range;
+
+@end
+
+// Map a file read-only (falls back to reading it when mapping is unsupported)
+NSData * _Nullable ICCMappedDataWithContentsOfFile(NSString *path);
+
+// Big-endian ICC fields appended to a tag payload
+void ICCAppendUInt8(NSMutableData *data, uint8_t value);
+void ICCAppendUInt16(NSMutableData *data, uint16_t value);
+void ICCAppendUInt32(NSMutableData *data, uint32_t value);
+void ICCAppendS15Fixed16(NSMutableData *data, double value);
+// 0.0-1.0 as a 16-bit value (clamped)
+void ICCAppendUnit16(NSMutableData *data, float value);
+// Zero bytes up to the next 4-byte boundary
+void ICCAppendPadding(NSMutableData *data);
+
+#ifdef HAVE_LCMS
+// Open a profile that reads straight from data's bytes. LittleCMS reads tags
+// lazily through the handler, so data must outlive the returned profile.
+cmsHPROFILE _Nullable ICCOpenProfileFromData(cmsContext _Nullable context, NSData *data);
+#endif
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,166 @@
+//
+//  ICCProfileIO.m
+//  SmallICCer
+//
+//  ICC Profile IO implementation.
+//  The IO handler is a read-only cursor over the caller's bytes; it owns no
+//  buffer, so opening a mapped profile never copies it.
+//
+
+#import "ICCProfileIO.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
+
+#ifdef HAVE_LCMS
+// struct _cms_io_handler is only defined for plugins; lcms2.h keeps it opaque
+#include <lcms2_plugin.h>
+#endif
+
+@implementation ICCDataSlice
+
+- (id)initWithData:(NSData *)data range:(NSRange)range {
+    self = [super init];
+    if (self) {
+        parent = [data retain];
+        start = (const uint8_t *)[data bytes] + range.location;
+        sliceLength = range.length;
+    }
+    return self;
+}
+
+// GNUstep's -[NSData init] forwards here; the slice has no buffer of its own
+- (id)initWithBytesNoCopy:(void *)buffer length:(NSUInteger)bufferSize freeWhenDone:(BOOL)shouldFree {
+    return self;
+}
+
+- (const void *)bytes {
+    return start;
+}
+
+- (NSUInteger)length {
+    return sliceLength;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    return [self retain];
+}
+
+- (void)dealloc {
+    [parent release];
+    [super dealloc];
+}
+
+@end
+
+NSData *ICCMappedDataWithContentsOfFile(NSString *path) {
+    NSData *data = [NSData dataWithContentsOfMappedFile:path];
+    return data ? data : [NSData dataWithContentsOfFile:path];
+}
+
+void ICCAppendUInt8(NSMutableData *data, uint8_t value) {
+    [data appendBytes:&value length:1];
+}
+
+void ICCAppendUInt16(NSMutableData *data, uint16_t value) {
+    uint8_t bytes[2] = {(uint8_t)(value >> 8), (uint8_t)value};
+    [data appendBytes:bytes length:2];
+}
+
+void ICCAppendUInt32(NSMutableData *data, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value};
+    [data appendBytes:bytes length:4];
+}
+
+void ICCAppendS15Fixed16(NSMutableData *data, double value) {
+    // Representable range is -32768.0 to 32767.99998
+    double fixed = floor(fmin(fmax(value, -32768.0), 32767.0) * 65536.0 + 0.5);
+    ICCAppendUInt32(data, (uint32_t)(int32_t)fixed);
+}
+
+void ICCAppendUnit16(NSMutableData *data, float value) {
+    ICCAppendUInt16(data, (uint16_t)(fminf(fmaxf(value, 0.0f), 1.0f) * 65535.0f + 0.5f));
+}
+
+void ICCAppendPadding(NSMutableData *data) {
+    static const uint8_t zeros[3] = {0, 0, 0};
+    NSUInteger remainder = [data length] & 3;
+    if (remainder) {
+        [data appendBytes:zeros length:4 - remainder];
+    }
+}
+
+#ifdef HAVE_LCMS
+typedef struct {
+    const cmsUInt8Number *bytes;
+    cmsUInt32Number size;
+    cmsUInt32Number pointer;
+    BOOL *closed;           // Set when LittleCMS closes the handler while opening
+} ICCByteStream;
+
+static cmsUInt32Number byteStreamRead(cmsIOHANDLER *io, void *buffer, cmsUInt32Number size, cmsUInt32Number count) {
+    ICCByteStream *stream = (ICCByteStream *)io->stream;
+    cmsUInt64Number length = (cmsUInt64Number)size * count;
+    if (length > stream->size - stream->pointer) return 0;
+    memcpy(buffer, stream->bytes + stream->pointer, (size_t)length);
+    stream->pointer += (cmsUInt32Number)length;
+    return count;
+}
+
+static cmsBool byteStreamSeek(cmsIOHANDLER *io, cmsUInt32Number offset) {
+    ICCByteStream *stream = (ICCByteStream *)io->stream;
+    if (offset > stream->size) return FALSE;
+    stream->pointer = offset;
+    return TRUE;
+}
+
+static cmsUInt32Number byteStreamTell(cmsIOHANDLER *io) {
+    return ((ICCByteStream *)io->stream)->pointer;
+}
+
+static cmsBool byteStreamWrite(cmsIOHANDLER *io, cmsUInt32Number size, const void *buffer) {
+    return FALSE; // Read-only
+}
+
+static cmsBool byteStreamClose(cmsIOHANDLER *io) {
+    ICCByteStream *stream = (ICCByteStream *)io->stream;
+    if (stream->closed) *stream->closed = YES;
+    free(stream);
+    free(io);
+    return TRUE;
+}
+
+cmsHPROFILE ICCOpenProfileFromData(cmsContext context, NSData *data) {
+    if ([data length] == 0 || [data length] > 0xFFFFFFFFu) return NULL;
+    ICCByteStream *stream = (ICCByteStream *)calloc(1, sizeof(ICCByteStream));
+    cmsIOHANDLER *io = (cmsIOHANDLER *)calloc(1, sizeof(cmsIOHANDLER));
+    if (!stream || !io) {
+        free(stream);
+        free(io);
+        return NULL;
+    }
+    stream->bytes = (const cmsUInt8Number *)[data bytes];
+    stream->size = (cmsUInt32Number)[data length];
+    io->stream = stream;
+    io->ContextID = context;
+    io->ReportedSize = stream->size;
+    strcpy(io->PhysicalFileName, "**mapped**");
+    io->Read = byteStreamRead;
+    io->Seek = byteStreamSeek;
+    io->Tell = byteStreamTell;
+    io->Write = byteStreamWrite;
+    io->Close = byteStreamClose;
+    // An unreadable header closes the handler with the profile; a failed
+    // placeholder allocation returns before the profile takes it
+    BOOL closed = NO;
+    stream->closed = &closed;
+    cmsHPROFILE profile = cmsOpenProfileFromIOhandlerTHR(context, io);
+    if (profile) {
+        stream->closed = NULL;
+    } else if (!closed) {
+        free(stream);
+        free(io);
+    }
+    return profile;
+}
+#endif
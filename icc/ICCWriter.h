@@ -13,6 +13,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 @interface ICCWriter : NSObject
 
+// Complete profile bytes: header, tag directory and tag payloads. The header
+// is the source profile's when there is one (class, color spaces, intent and
+// major version updated, profile ID cleared), otherwise built from the
+// profile fields. Fails when an edited tag has no encoder.
+- (nullable NSData *)dataForProfile:(ICCProfile *)profile error:(NSError **)error;
+
 - (BOOL)writeProfile:(ICCProfile *)profile toPath:(NSString *)path error:(NSError **)error;
 
 @end
@@ -2,280 +2,227 @@
 //  ICCWriter.m
 //  SmallICCer
 //
-//  ICC Writer implementation using LittleCMS
+//  ICC Writer implementation.
+//  The profile is laid out in one buffer: header, tag directory, then each
+//  distinct payload at a 4-byte boundary. Unmodified tags hand back their
+//  source bytes (slices of the mapped file), so copying one costs a single
+//  memcpy; tags with identical payloads, such as linked gray TRCs, share one
+//  copy. Tags that have neither source bytes nor an encoder are left out.
 //
 
 #import "ICCWriter.h"
 #import "ICCProfile.h"
 #import "ICCTag.h"
-#import "ICCTagTRC.h"
-#import "ICCTagMatrix.h"
-#import "ICCTagLUT.h"
-#import "ICCTagMetadata.h"
+#import <stdlib.h>
+#import <string.h>
 
-#ifdef HAVE_LCMS
-#include <lcms2.h>
-#include <wchar.h>
-#endif
+static const NSUInteger kICCHeaderSize = 128;
+static const NSUInteger kICCTagEntrySize = 12;
+
+static void writeUInt32BE(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static void writeUInt16BE(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static uint32_t signatureValue(NSString *signature) {
+    uint32_t value = 0;
+    NSUInteger k;
+    for (k = 0; k < 4; k++) {
+        unichar c = (k < [signature length]) ? [signature characterAtIndex:k] : ' ';
+        value = (value << 8) | (c & 0xFF);
+    }
+    return value;
+}
+
+// Source directory order first (keeps the original layout), new tags after
+static NSInteger compareTagOrder(id a, id b, void *context) {
+    ICCProfile *profile = (ICCProfile *)context;
+    ICCTag *tagA = [profile tagWithSignature:a];
+    ICCTag *tagB = [profile tagWithSignature:b];
+    NSUInteger locationA = [tagA sourcePayload] ? [tagA payloadRange].location : NSUIntegerMax;
+    NSUInteger locationB = [tagB sourcePayload] ? [tagB payloadRange].location : NSUIntegerMax;
+    if (locationA != locationB) {
+        return (locationA < locationB) ? NSOrderedAscending : NSOrderedDescending;
+    }
+    return [a compare:b];
+}
 
 @implementation ICCWriter
 
-- (BOOL)writeProfile:(ICCProfile *)profile toPath:(NSString *)path error:(NSError **)error {
-#ifdef HAVE_LCMS
-    // Get primaries and white point from profile or use defaults
-    cmsCIExyY whitePoint;
-    cmsCIExyYTRIPLE primaries;
-    
-    // Try to get white point from profile
-    if ([profile pcsIlluminant] && [[profile pcsIlluminant] count] >= 3) {
-        NSArray *illuminant = [profile pcsIlluminant];
-        // Convert XYZ to xyY (simplified - would need proper conversion)
-        whitePoint.x = 0.3457; // Default D50
-        whitePoint.y = 0.3585;
-        whitePoint.Y = 1.0;
-    } else {
-        cmsWhitePointFromTemp(&whitePoint, 5000); // D50
-        whitePoint.x = 0.3457;
-        whitePoint.y = 0.3585;
-        whitePoint.Y = 1.0;
-    }
-    
-    // Try to get primaries from colorant tags
-    ICCTag *redColorant = [profile tagWithSignature:@"rXYZ"];
-    ICCTag *greenColorant = [profile tagWithSignature:@"gXYZ"];
-    ICCTag *blueColorant = [profile tagWithSignature:@"bXYZ"];
-    
-    // Default sRGB primaries
-    primaries.Red.x = 0.6400;
-    primaries.Red.y = 0.3300;
-    primaries.Red.Y = 1.0;
-    primaries.Green.x = 0.3000;
-    primaries.Green.y = 0.6000;
-    primaries.Green.Y = 1.0;
-    primaries.Blue.x = 0.1500;
-    primaries.Blue.y = 0.0600;
-    primaries.Blue.Y = 1.0;
-    
-    // Get TRC curves from profile
-    ICCTag *redTRC = [profile tagWithSignature:@"rTRC"];
-    ICCTag *greenTRC = [profile tagWithSignature:@"gTRC"];
-    ICCTag *blueTRC = [profile tagWithSignature:@"bTRC"];
-    
-    cmsToneCurve *curves[3] = {NULL, NULL, NULL};
-    cmsToneCurve *defaultGamma = cmsBuildGamma(NULL, 2.2);
-    
-    // Convert ICCTagTRC to cmsToneCurve
-    BOOL needFreeCurves[3] = {NO, NO, NO};
-    
-    if ([redTRC isKindOfClass:[ICCTagTRC class]]) {
-        curves[0] = [self toneCurveFromICCTagTRC:(ICCTagTRC *)redTRC];
-        if (curves[0]) needFreeCurves[0] = YES;
-    }
-    if (!curves[0]) {
-        curves[0] = defaultGamma;
-        needFreeCurves[0] = NO; // Don't free defaultGamma yet
-    }
-    
-    if ([greenTRC isKindOfClass:[ICCTagTRC class]]) {
-        curves[1] = [self toneCurveFromICCTagTRC:(ICCTagTRC *)greenTRC];
-        if (curves[1]) needFreeCurves[1] = YES;
-    }
-    if (!curves[1]) {
-        curves[1] = defaultGamma;
-        needFreeCurves[1] = NO;
-    }
-    
-    if ([blueTRC isKindOfClass:[ICCTagTRC class]]) {
-        curves[2] = [self toneCurveFromICCTagTRC:(ICCTagTRC *)blueTRC];
-        if (curves[2]) needFreeCurves[2] = YES;
-    }
-    if (!curves[2]) {
-        curves[2] = defaultGamma;
-        needFreeCurves[2] = NO;
-    }
-    
-    // Create profile (makes copies of curves)
-    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
-    
-    // Free curves we created (cmsCreateRGBProfileTHR makes copies)
-    if (needFreeCurves[0] && curves[0]) cmsFreeToneCurve(curves[0]);
-    if (needFreeCurves[1] && curves[1]) cmsFreeToneCurve(curves[1]);
-    if (needFreeCurves[2] && curves[2]) cmsFreeToneCurve(curves[2]);
-    cmsFreeToneCurve(defaultGamma);
-    
-    if (!hProfile) {
-        if (error) {
-            *error = [NSError errorWithDomain:@"SmallICCer" 
-                                         code:1 
-                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-                                               @"Failed to create profile", NSLocalizedDescriptionKey, nil]];
-        }
-        return NO;
-    }
-    
-    // Write all tags from profile
-    NSArray *tagSignatures = [profile allTagSignatures];
-    for (NSString *signature in tagSignatures) {
+- (NSError *)errorWithCode:(NSInteger)code description:(NSString *)description {
+    return [NSError errorWithDomain:@"SmallICCer"
+                               code:code
+                           userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                     description, NSLocalizedDescriptionKey, nil]];
+}
+
+// The profile's version (major number) wins over the source header's, so
+// setting it converts the profile
+- (NSUInteger)majorVersionOfProfile:(ICCProfile *)profile {
+    NSUInteger version = [profile version];
+    if (version >= 2 && version <= 5) return version;
+    NSData *source = [profile profileData];
+    if ([source length] >= kICCHeaderSize) {
+        return ((const uint8_t *)[source bytes])[8];
+    }
+    return 4;
+}
+
+// Latest minor revision of a major version
+static uint32_t versionField(NSUInteger major) {
+    return (uint32_t)((major << 24) | ((major >= 4) ? 0x300000 : 0x100000));
+}
+
+// Header from the profile fields, for profiles without source bytes
+- (void)buildHeader:(uint8_t *)header forProfile:(ICCProfile *)profile majorVersion:(NSUInteger)major {
+    writeUInt32BE(header + 4, [profile preferredCMM] ? signatureValue([profile preferredCMM]) : 0);
+    writeUInt32BE(header + 8, versionField(major));
+
+    NSDate *created = [profile creationDate] ? [profile creationDate] : [NSDate date];
+    NSCalendar *calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSGregorianCalendar];
+    [calendar setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
+    NSDateComponents *components = [calendar components:(NSYearCalendarUnit | NSMonthCalendarUnit | NSDayCalendarUnit |
+                                                          NSHourCalendarUnit | NSMinuteCalendarUnit | NSSecondCalendarUnit)
+                                               fromDate:created];
+    writeUInt16BE(header + 24, (uint16_t)[components year]);
+    writeUInt16BE(header + 26, (uint16_t)[components month]);
+    writeUInt16BE(header + 28, (uint16_t)[components day]);
+    writeUInt16BE(header + 30, (uint16_t)[components hour]);
+    writeUInt16BE(header + 32, (uint16_t)[components minute]);
+    writeUInt16BE(header + 34, (uint16_t)[components second]);
+    [calendar release];
+
+    writeUInt32BE(header + 36, 0x61637370); // 'acsp'
+    writeUInt32BE(header + 40, [profile platformSignature] ? signatureValue([profile platformSignature]) : 0);
+    writeUInt32BE(header + 44, (uint32_t)[profile flags]);
+    writeUInt32BE(header + 48, [profile deviceManufacturer] ? signatureValue([profile deviceManufacturer]) : 0);
+    writeUInt32BE(header + 52, [profile deviceModel] ? signatureValue([profile deviceModel]) : 0);
+    writeUInt32BE(header + 60, (uint32_t)[profile deviceAttributes]);
+    // The header illuminant is always D50 (s15Fixed16)
+    writeUInt32BE(header + 68, 0x0000F6D6);
+    writeUInt32BE(header + 72, 0x00010000);
+    writeUInt32BE(header + 76, 0x0000D32D);
+    writeUInt32BE(header + 80, [profile profileCreator] ? signatureValue([profile profileCreator]) : 0);
+}
+
+- (NSData *)dataForProfile:(ICCProfile *)profile error:(NSError **)error {
+    NSUInteger major = [self majorVersionOfProfile:profile];
+    NSArray *signatures = [[profile allTagSignatures] sortedArrayUsingFunction:compareTagOrder context:profile];
+
+    // Payloads, with entries pointing at the first identical one
+    NSMutableArray *entrySignatures = [NSMutableArray array];
+    NSMutableArray *payloads = [NSMutableArray array];
+    NSUInteger tagCount = [signatures count];
+    NSUInteger *payloadIndex = (NSUInteger *)malloc((tagCount ? tagCount : 1) * sizeof(NSUInteger));
+    NSUInteger i, j, entryCount = 0;
+    for (i = 0; i < tagCount; i++) {
+        NSString *signature = [signatures objectAtIndex:i];
+        if ([signature length] != 4) continue;
         ICCTag *tag = [profile tagWithSignature:signature];
-        if (!tag) continue;
-        
-        // Skip TRC tags as they're already in the profile
-        if ([signature isEqualToString:@"rTRC"] || 
-            [signature isEqualToString:@"gTRC"] || 
-            [signature isEqualToString:@"bTRC"]) {
-            continue;
-        }
-        
-        // Convert signature string to cmsTagSignature
-        // Use helper method (defined below)
-        cmsTagSignature tagSig = 0;
-        if ([signature length] == 4) {
-            const char *chars = [signature UTF8String];
-            tagSig |= ((cmsUInt32Number)chars[0]) << 24;
-            tagSig |= ((cmsUInt32Number)chars[1]) << 16;
-            tagSig |= ((cmsUInt32Number)chars[2]) << 8;
-            tagSig |= ((cmsUInt32Number)chars[3]);
-        }
-        
-        // Write tag based on type
-        if ([tag isKindOfClass:[ICCTagTRC class]]) {
-            cmsToneCurve *curve = [self toneCurveFromICCTagTRC:(ICCTagTRC *)tag];
-            if (curve) {
-                cmsWriteTag(hProfile, tagSig, curve);
-                cmsFreeToneCurve(curve);
-            }
-        } else if ([tag isKindOfClass:[ICCTagMatrix class]]) {
-            // Matrix tags are typically part of the profile structure, not separate tags
-            // But we can write them if needed
-        } else if ([tag isKindOfClass:[ICCTagLUT class]]) {
-            ICCTagLUT *lutTag = (ICCTagLUT *)tag;
-            // LUT tags need pipeline - would need to reconstruct from LUT data
-            // For now, skip (complex implementation needed)
-        } else if ([tag isKindOfClass:[ICCTagMetadata class]]) {
-            ICCTagMetadata *metaTag = (ICCTagMetadata *)tag;
-            NSString *text = [metaTag textValue];
-            if (text) {
-                // Convert NSString to wide string
-                NSUInteger length = [text length];
-                wchar_t *wtext = (wchar_t *)malloc((length + 1) * sizeof(wchar_t));
-                if (wtext) {
-                    [text getCharacters:(unichar *)wtext range:NSMakeRange(0, length)];
-                    wtext[length] = 0;
-                    cmsWriteTag(hProfile, tagSig, wtext);
-                    free(wtext);
-                }
+        NSData *payload = [tag serializeForVersion:major];
+        NSUInteger length = [payload length];
+        if (length == 0 && [tag isModified]) {
+            // Writing the stale source bytes would silently drop the edit
+            free(payloadIndex);
+            if (error) {
+                *error = [self errorWithCode:5
+                                 description:[NSString stringWithFormat:@"Edited tag %@ cannot be encoded", signature]];
             }
+            return nil;
         }
-    }
-    
-    // Set profile description if available
-    ICCTag *descTag = [profile tagWithSignature:@"desc"];
-    if (descTag && [descTag isKindOfClass:[ICCTagMetadata class]]) {
-        NSString *desc = [(ICCTagMetadata *)descTag textValue];
-        if (desc) {
-            NSUInteger length = [desc length];
-            wchar_t *wdesc = (wchar_t *)malloc((length + 1) * sizeof(wchar_t));
-            if (wdesc) {
-                [desc getCharacters:(unichar *)wdesc range:NSMakeRange(0, length)];
-                wdesc[length] = 0;
-                cmsWriteTag(hProfile, cmsSigProfileDescriptionTag, wdesc);
-                free(wdesc);
+        if (length == 0) continue;
+        for (j = 0; j < [payloads count]; j++) {
+            NSData *other = [payloads objectAtIndex:j];
+            if ([other length] == length &&
+                ([other bytes] == [payload bytes] || memcmp([other bytes], [payload bytes], length) == 0)) {
+                break;
             }
         }
+        if (j == [payloads count]) {
+            [payloads addObject:payload];
+        }
+        payloadIndex[entryCount++] = j;
+        [entrySignatures addObject:signature];
     }
-    
-    // Save to memory first
-    cmsUInt32Number size = 0;
-    cmsSaveProfileToMem(hProfile, NULL, &size);
-    
-    if (size == 0) {
-        cmsCloseProfile(hProfile);
+
+    // Layout: every payload starts on a 4-byte boundary
+    NSUInteger payloadCount = [payloads count];
+    uint64_t *offsets = (uint64_t *)malloc((payloadCount ? payloadCount : 1) * sizeof(uint64_t));
+    uint64_t total = kICCHeaderSize + 4 + entryCount * kICCTagEntrySize;
+    for (j = 0; j < payloadCount; j++) {
+        offsets[j] = total;
+        total = (total + [[payloads objectAtIndex:j] length] + 3) & ~(uint64_t)3;
+    }
+    if (total > 0xFFFFFFFFu) {
+        free(payloadIndex);
+        free(offsets);
         if (error) {
-            *error = [NSError errorWithDomain:@"SmallICCer" 
-                                         code:2 
-                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-                                               @"Failed to determine profile size", NSLocalizedDescriptionKey, nil]];
+            *error = [self errorWithCode:2 description:@"Profile exceeds the 4 GB ICC size limit"];
         }
-        return NO;
+        return nil;
     }
-    
-    void *buffer = malloc(size);
+
+    uint8_t *buffer = (uint8_t *)calloc((size_t)total, 1);
     if (!buffer) {
-        cmsCloseProfile(hProfile);
+        free(payloadIndex);
+        free(offsets);
         if (error) {
-            *error = [NSError errorWithDomain:@"SmallICCer" 
-                                         code:3 
-                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-                                               @"Failed to allocate memory", NSLocalizedDescriptionKey, nil]];
+            *error = [self errorWithCode:3 description:@"Failed to allocate memory"];
         }
-        return NO;
-    }
-    
-    cmsSaveProfileToMem(hProfile, buffer, &size);
-    cmsCloseProfile(hProfile);
-    
-    // Write to file
-    NSData *data = [NSData dataWithBytes:buffer length:size];
-    BOOL success = [data writeToFile:path atomically:YES];
-    
-    free(buffer);
-    
-    if (!success && error) {
-        *error = [NSError errorWithDomain:@"SmallICCer" 
-                                     code:4 
-                                 userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-                                           @"Failed to write file", NSLocalizedDescriptionKey, nil]];
+        return nil;
     }
-    return success;
-#else
-    if (error) {
-        *error = [NSError errorWithDomain:@"SmallICCer" 
-                                     code:5 
-                                 userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
-                                           @"LittleCMS not available", NSLocalizedDescriptionKey, nil]];
-    }
-    return NO;
-#endif
-}
 
-#ifdef HAVE_LCMS
-- (cmsToneCurve *)toneCurveFromICCTagTRC:(ICCTagTRC *)trcTag {
-    NSArray *points = [trcTag curvePoints];
-    if (!points || [points count] == 0) {
-        return cmsBuildGamma(NULL, 2.2); // Default gamma
-    }
-    
-    NSUInteger count = [points count];
-    cmsFloat32Number *table = (cmsFloat32Number *)malloc(count * sizeof(cmsFloat32Number));
-    if (!table) {
-        return cmsBuildGamma(NULL, 2.2);
+    NSData *source = [profile profileData];
+    if ([source length] >= kICCHeaderSize) {
+        memcpy(buffer, [source bytes], kICCHeaderSize);
+        if (buffer[8] != major) {
+            writeUInt32BE(buffer + 8, versionField(major));
+        }
+        // The profile ID is an MD5 of the old contents; zero means not computed
+        memset(buffer + 84, 0, 16);
+    } else {
+        [self buildHeader:buffer forProfile:profile majorVersion:major];
     }
-    
-    NSUInteger i;
-    for (i = 0; i < count; i++) {
-        table[i] = (cmsFloat32Number)[[points objectAtIndex:i] doubleValue];
+    writeUInt32BE(buffer, (uint32_t)total);
+    writeUInt32BE(buffer + 12, (uint32_t)[profile deviceClass]);
+    writeUInt32BE(buffer + 16, (uint32_t)[profile dataColorSpace]);
+    writeUInt32BE(buffer + 20, (uint32_t)[profile pcsColorSpace]);
+    writeUInt32BE(buffer + 64, (uint32_t)[profile renderingIntent]);
+
+    writeUInt32BE(buffer + kICCHeaderSize, (uint32_t)entryCount);
+    for (i = 0; i < entryCount; i++) {
+        uint8_t *entry = buffer + kICCHeaderSize + 4 + i * kICCTagEntrySize;
+        NSData *payload = [payloads objectAtIndex:payloadIndex[i]];
+        writeUInt32BE(entry, signatureValue([entrySignatures objectAtIndex:i]));
+        writeUInt32BE(entry + 4, (uint32_t)offsets[payloadIndex[i]]);
+        writeUInt32BE(entry + 8, (uint32_t)[payload length]);
+    }
+    for (j = 0; j < payloadCount; j++) {
+        NSData *payload = [payloads objectAtIndex:j];
+        memcpy(buffer + offsets[j], [payload bytes], [payload length]);
     }
-    
-    cmsToneCurve *curve = cmsBuildTabulatedToneCurve16(NULL, count, table);
-    free(table);
-    
-    return curve ? curve : cmsBuildGamma(NULL, 2.2);
+
+    free(payloadIndex);
+    free(offsets);
+    return [NSData dataWithBytesNoCopy:buffer length:(NSUInteger)total freeWhenDone:YES];
 }
 
-- (cmsTagSignature)tagSignatureFromString:(NSString *)signature {
-    if ([signature length] != 4) {
-        return 0;
+- (BOOL)writeProfile:(ICCProfile *)profile toPath:(NSString *)path error:(NSError **)error {
+    NSData *data = [self dataForProfile:profile error:error];
+    if (!data) return NO;
+
+    BOOL success = [data writeToFile:path atomically:YES];
+    if (!success && error) {
+        *error = [self errorWithCode:4 description:@"Failed to write file"];
     }
-    
-    const char *chars = [signature UTF8String];
-    cmsTagSignature sig = 0;
-    sig |= ((cmsUInt32Number)chars[0]) << 24;
-    sig |= ((cmsUInt32Number)chars[1]) << 16;
-    sig |= ((cmsUInt32Number)chars[2]) << 8;
-    sig |= ((cmsUInt32Number)chars[3]);
-    
-    return sig;
+    return success;
 }
-#endif
 
 @end
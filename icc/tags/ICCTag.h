@@ -12,13 +12,47 @@ NS_ASSUME_NONNULL_BEGIN
 @interface ICCTag : NSObject {
     NSString *signature;
     NSData *rawData;
+    NSData *sourceData;    // Whole profile holding the payload (lazy tags only)
+    NSRange payloadRange;  // Tag payload within sourceData, from the tag directory
+    BOOL needsDecode;
+    BOOL modified;         // Edited since parsing; source bytes no longer match
 }
 
 @property (nonatomic, retain) NSString *signature;
 @property (nonatomic, retain) NSData *rawData;
 
 - (id)initWithData:(void *)data signature:(NSString *)sig;
-- (NSData *)serialize;
+
+// Lazy tag: records where the payload lives and decodes it on first access
+// to a decoded property. rawData is the payload bytes themselves.
+- (id)initWithSignature:(NSString *)sig profileData:(NSData *)data range:(NSRange)range;
+
+// Record where an already decoded tag's payload lives in the profile bytes
+- (void)setSourceData:(NSData *)data range:(NSRange)range;
+
+// ICC tag payload (type signature onward). Unmodified tags return their
+// source bytes; subclasses encode edited values. nil for edits that cannot
+// be encoded (ICCWriter then fails), empty when there is no payload at all.
+- (nullable NSData *)serialize;
+// Serialization for a profile of the given major version (text tags differ
+// between v2 and v4); defaults to -serialize
+- (nullable NSData *)serializeForVersion:(NSUInteger)majorVersion;
+
+// Source payload while the tag is unmodified, otherwise nil
+- (nullable NSData *)sourcePayload;
+- (BOOL)isModified;
+// Subclass setters call this
+- (void)markModified;
+
+// Fill decoded properties from a LittleCMS tag pointer (as returned by
+// cmsReadTag). The base class keeps nothing; subclasses override.
+- (void)loadFromTagData:(void *)data;
+
+// Decode a lazy tag now (no-op once decoded or for eagerly parsed tags).
+// Subclass accessors call this; not thread-safe for a single tag.
+- (void)decodeIfNeeded;
+- (BOOL)isDecoded;
+- (NSRange)payloadRange;
 
 @end
 
@@ -6,11 +6,11 @@
 //
 
 #import "ICCTag.h"
+#import "ICCProfileIO.h"
 
 @implementation ICCTag
 
 @synthesize signature;
-@synthesize rawData;
 
 - (id)initWithData:(void *)data signature:(NSString *)sig {
     self = [super init];
@@ -23,13 +23,105 @@
     return self;
 }
 
-- (NSData *)serialize {
+// Plain init still runs the subclass defaults
+- (id)init {
+    return [self initWithData:NULL signature:nil];
+}
+
+- (id)initWithSignature:(NSString *)sig profileData:(NSData *)data range:(NSRange)range {
+    // Subclass defaults stay in place until the payload is decoded
+    self = [self initWithData:NULL signature:sig];
+    if (self) {
+        [rawData release];
+        rawData = nil;
+        sourceData = [data retain];
+        payloadRange = range;
+        needsDecode = YES;
+    }
+    return self;
+}
+
+- (NSData *)rawData {
+    if (!rawData && sourceData) {
+        rawData = [[ICCDataSlice alloc] initWithData:sourceData range:payloadRange];
+    }
     return rawData;
 }
 
+- (void)setRawData:(NSData *)data {
+    [data retain];
+    [rawData release];
+    rawData = data;
+}
+
+- (void)setSourceData:(NSData *)data range:(NSRange)range {
+    [data retain];
+    [sourceData release];
+    sourceData = data;
+    payloadRange = range;
+    [rawData release];
+    rawData = nil;
+    modified = NO;
+}
+
+// The base class has no encoder: once edited, the source bytes are stale
+- (NSData *)serialize {
+    return modified ? nil : [self rawData];
+}
+
+- (NSData *)serializeForVersion:(NSUInteger)majorVersion {
+    return [self serialize];
+}
+
+- (NSData *)sourcePayload {
+    return (modified || !sourceData) ? nil : [self rawData];
+}
+
+- (BOOL)isModified {
+    return modified;
+}
+
+- (void)markModified {
+    modified = YES;
+}
+
+- (void)loadFromTagData:(void *)data {
+}
+
+- (void)decodeIfNeeded {
+    if (!needsDecode) return;
+    needsDecode = NO;
+#ifdef HAVE_LCMS
+    if ([signature length] != 4) return;
+    cmsUInt32Number tagSig = 0;
+    NSUInteger k;
+    for (k = 0; k < 4; k++) {
+        tagSig = (tagSig << 8) | ([signature characterAtIndex:k] & 0xFF);
+    }
+    cmsHPROFILE hProfile = ICCOpenProfileFromData(NULL, sourceData);
+    if (!hProfile) return;
+    void *payload = cmsReadTag(hProfile, (cmsTagSignature)tagSig);
+    if (payload) {
+        [self loadFromTagData:payload];
+        // Decoding fills the same setters edits use; the tag still matches its source
+        modified = NO;
+    }
+    cmsCloseProfile(hProfile);
+#endif
+}
+
+- (BOOL)isDecoded {
+    return !needsDecode;
+}
+
+- (NSRange)payloadRange {
+    return payloadRange;
+}
+
 - (void)dealloc {
     [signature release];
     [rawData release];
+    [sourceData release];
     [super dealloc];
 }
 
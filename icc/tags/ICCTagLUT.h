@@ -4,23 +4,69 @@
 //
 //  Look-Up Table (LUT) tag
 //
+//  A LUT is a chain of stages kept in packed float arrays: per-channel
+//  curves, a matrix with offset, and N-dimensional CLUT grids. Values are in
+//  the tag's normalized 0.0-1.0 encoding (as cmsPipelineEvalFloat uses), so
+//  lookups need no LittleCMS transform. 3-input grids use tetrahedral
+//  interpolation, 4-input grids interpolate linearly between two tetrahedral
+//  lookups, and other sizes are multilinear.
+//
 
 #import "ICCTag.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
+// Channels per stage (ICC allows up to 15)
+extern const NSUInteger kICCTagLUTMaxChannels;
+
+typedef enum {
+    ICCLUTStageCurves,
+    ICCLUTStageMatrix,
+    ICCLUTStageCLUT
+} ICCLUTStageKind;
+
 @interface ICCTagLUT : ICCTag {
     NSUInteger inputChannels;
     NSUInteger outputChannels;
     NSUInteger gridPoints;
     NSData *lutData;
+    NSMutableArray *stages;
 }
 
+// Channel counts follow the stages once there are any
 @property (nonatomic) NSUInteger inputChannels;
 @property (nonatomic) NSUInteger outputChannels;
+
+// Grid points along the first input of the first CLUT stage, and that
+// stage's packed values (outputs per node, last input varying fastest).
+// The stored values are only used while the tag has no CLUT stage; setting
+// lutData of the right length replaces the CLUT values.
 @property (nonatomic) NSUInteger gridPoints;
 @property (nonatomic, retain) NSData *lutData;
 
+- (NSUInteger)stageCount;
+- (ICCLUTStageKind)kindOfStageAtIndex:(NSUInteger)index;
+- (void)removeAllStages;
+
+// Each stage's inputs must match the previous stage's outputs. NO (and no
+// change) for mismatched or out-of-range channel counts.
+// Curves: channels tables of samples uniformly spaced values each.
+- (BOOL)appendCurvesWithTables:(const float *)tables channels:(NSUInteger)channels samples:(NSUInteger)samples;
+// Matrix: outputs x inputs, row-major; offset (outputs values) may be NULL.
+- (BOOL)appendMatrix:(const float *)matrix
+              offset:(nullable const float *)offset
+              inputs:(NSUInteger)inputs
+             outputs:(NSUInteger)outputs;
+// CLUT: grid[i] >= 2 points along input i; values as described for lutData.
+- (BOOL)appendCLUTWithGrid:(const NSUInteger *)grid
+                    inputs:(NSUInteger)inputs
+                   outputs:(NSUInteger)outputs
+                    values:(const float *)values;
+
+// Interleaved batch lookup: count pixels of inputChannels in, outputChannels
+// out. Without stages the input channels are passed through.
+- (void)evaluate:(const float *)input output:(float *)output count:(NSUInteger)count;
+
 - (void)lookupInput:(const double *)input output:(double *)output;
 - (void)loadFromPipeline:(void *)pipeline; // Load from cmsPipeline
 
@@ -2,21 +2,215 @@
 //  ICCTagLUT.m
 //  SmallICCer
 //
-//  LUT Tag implementation
+//  LUT Tag implementation.
+//  Batches run stage by stage over blocks of pixels, so each inner loop
+//  applies one kernel to contiguous interleaved data. Pipelines are read
+//  through the public LittleCMS API only: CLUT grid sizes come from an
+//  inspecting sampler, and every stage is evaluated on its own (curves on a
+//  ramp, matrices on unit vectors, CLUTs at their nodes) to fill the tables.
+//  Edited tags serialize as lutAtoBType or lutBtoAType with 16-bit CLUTs,
+//  or as lut16Type for version 2 profiles; chains that do not fit the
+//  element order are resampled into one CLUT.
 //
 
 #import "ICCTagLUT.h"
+#import "ICCProfileIO.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
 #endif
 
-@implementation ICCTagLUT
+const NSUInteger kICCTagLUTMaxChannels = 16;
+
+static const NSUInteger kBlockPixels = 64;
+static const NSUInteger kCurveSamples = 4096;
+static const NSUInteger kMultilinearMaxInputs = 8;
+
+@interface ICCLUTStage : NSObject {
+@public
+    ICCLUTStageKind kind;
+    NSUInteger inputs;
+    NSUInteger outputs;
+    NSUInteger samples;                     // Curves: entries per channel
+    NSUInteger grid[16];                    // CLUT: points per input
+    NSUInteger strides[16];                 // CLUT: floats between neighbours along each input
+    NSData *values;                         // Curve tables, matrix then offset, or CLUT nodes
+    const float *v;
+}
+@end
+
+@implementation ICCLUTStage
+
+- (void)setValues:(const float *)data count:(NSUInteger)count {
+    [values release];
+    values = [[NSData alloc] initWithBytes:data length:count * sizeof(float)];
+    v = (const float *)[values bytes];
+}
+
+- (void)dealloc {
+    [values release];
+    [super dealloc];
+}
+
+@end
+
+// Grid for resampling a whole chain: coarser as inputs grow, so the node
+// count stays under half a million
+static NSUInteger resampleGridPoints(NSUInteger inputs) {
+    static const NSUInteger points[9] = {33, 33, 33, 33, 17, 9, 7, 5, 5};
+    return (inputs < 9) ? points[inputs] : 0;
+}
+
+// Retained CLUT stage, or nil for a grid with fewer than two points on an input
+static ICCLUTStage *newCLUTStage(const NSUInteger *grid, NSUInteger inputs, NSUInteger outputs, const float *values) {
+    ICCLUTStage *stage = [[ICCLUTStage alloc] init];
+    stage->kind = ICCLUTStageCLUT;
+    stage->inputs = inputs;
+    stage->outputs = outputs;
+    NSUInteger i, stride = outputs;
+    for (i = inputs; i > 0; i--) {
+        if (grid[i - 1] < 2) {
+            [stage release];
+            return nil;
+        }
+        stage->grid[i - 1] = grid[i - 1];
+        stage->strides[i - 1] = stride;
+        stride *= grid[i - 1];
+    }
+    [stage setValues:values count:stride];
+    return stage;
+}
+
+static inline float clampUnit(float x) {
+    // fmaxf maps NaN to 0
+    return fminf(fmaxf(x, 0.0f), 1.0f);
+}
 
-@synthesize inputChannels;
-@synthesize outputChannels;
-@synthesize gridPoints;
-@synthesize lutData;
+// Grid cell along one input: lower node index and fraction within the cell
+static inline NSUInteger gridCell(float x, NSUInteger points, float *fraction) {
+    float position = clampUnit(x) * (float)(points - 1);
+    NSUInteger i = (NSUInteger)position;
+    i = (i < points - 2) ? i : points - 2;
+    *fraction = position - (float)i;
+    return i;
+}
+
+static void evaluateCurves(ICCLUTStage *s, const float *in, float *out, NSUInteger count) {
+    NSUInteger p, c, n = s->samples, channels = s->inputs;
+    for (p = 0; p < count; p++) {
+        for (c = 0; c < channels; c++) {
+            const float *table = s->v + c * n;
+            float t;
+            NSUInteger i = gridCell(in[p * channels + c], n, &t);
+            out[p * channels + c] = table[i] + t * (table[i + 1] - table[i]);
+        }
+    }
+}
+
+static void evaluateMatrix(ICCLUTStage *s, const float *in, float *out, NSUInteger count) {
+    NSUInteger p, i, j, nIn = s->inputs, nOut = s->outputs;
+    const float *m = s->v;
+    const float *offset = s->v + nIn * nOut;
+    for (p = 0; p < count; p++) {
+        for (j = 0; j < nOut; j++) {
+            float sum = offset[j];
+            for (i = 0; i < nIn; i++) {
+                sum += m[j * nIn + i] * in[p * nIn + i];
+            }
+            out[p * nOut + j] = sum;
+        }
+    }
+}
+
+// Tetrahedral interpolation in the cell at base, following LittleCMS's
+// six-tetrahedron split of the cube: walk from the origin to the far corner
+// one axis at a time, largest fraction first
+static inline void tetrahedral(const float *base, NSUInteger sx, NSUInteger sy, NSUInteger sz,
+                               float rx, float ry, float rz, NSUInteger nOut, float *out) {
+    NSUInteger a, b, c = sx + sy + sz;
+    float t1, t2, t3;
+    if (rx >= ry && ry >= rz) {
+        a = sx; b = sx + sy; t1 = rx; t2 = ry; t3 = rz;
+    } else if (rx >= rz && rz >= ry) {
+        a = sx; b = sx + sz; t1 = rx; t2 = rz; t3 = ry;
+    } else if (rz >= rx && rx >= ry) {
+        a = sz; b = sx + sz; t1 = rz; t2 = rx; t3 = ry;
+    } else if (ry >= rx && rx >= rz) {
+        a = sy; b = sx + sy; t1 = ry; t2 = rx; t3 = rz;
+    } else if (ry >= rz && rz >= rx) {
+        a = sy; b = sy + sz; t1 = ry; t2 = rz; t3 = rx;
+    } else {
+        a = sz; b = sy + sz; t1 = rz; t2 = ry; t3 = rx;
+    }
+    NSUInteger k;
+    for (k = 0; k < nOut; k++) {
+        float c0 = base[k], ca = base[a + k], cb = base[b + k], cc = base[c + k];
+        out[k] = c0 + t1 * (ca - c0) + t2 * (cb - ca) + t3 * (cc - cb);
+    }
+}
+
+static void evaluateCLUT3(ICCLUTStage *s, const float *in, float *out, NSUInteger count) {
+    NSUInteger p, nOut = s->outputs;
+    for (p = 0; p < count; p++) {
+        float rx, ry, rz;
+        NSUInteger x = gridCell(in[p * 3 + 0], s->grid[0], &rx);
+        NSUInteger y = gridCell(in[p * 3 + 1], s->grid[1], &ry);
+        NSUInteger z = gridCell(in[p * 3 + 2], s->grid[2], &rz);
+        const float *base = s->v + x * s->strides[0] + y * s->strides[1] + z * s->strides[2];
+        tetrahedral(base, s->strides[0], s->strides[1], s->strides[2], rx, ry, rz, nOut, out + p * nOut);
+    }
+}
+
+static void evaluateCLUT4(ICCLUTStage *s, const float *in, float *out, NSUInteger count) {
+    NSUInteger p, k, nOut = s->outputs;
+    float upper[16];
+    for (p = 0; p < count; p++) {
+        float rk, rx, ry, rz;
+        NSUInteger i = gridCell(in[p * 4 + 0], s->grid[0], &rk);
+        NSUInteger x = gridCell(in[p * 4 + 1], s->grid[1], &rx);
+        NSUInteger y = gridCell(in[p * 4 + 2], s->grid[2], &ry);
+        NSUInteger z = gridCell(in[p * 4 + 3], s->grid[3], &rz);
+        const float *base = s->v + i * s->strides[0] + x * s->strides[1] + y * s->strides[2] + z * s->strides[3];
+        float *lower = out + p * nOut;
+        tetrahedral(base, s->strides[1], s->strides[2], s->strides[3], rx, ry, rz, nOut, lower);
+        tetrahedral(base + s->strides[0], s->strides[1], s->strides[2], s->strides[3], rx, ry, rz, nOut, upper);
+        for (k = 0; k < nOut; k++) {
+            lower[k] += rk * (upper[k] - lower[k]);
+        }
+    }
+}
+
+static void evaluateCLUTMultilinear(ICCLUTStage *s, const float *in, float *out, NSUInteger count) {
+    NSUInteger p, i, k, corner, nIn = s->inputs, nOut = s->outputs;
+    NSUInteger cell[16];
+    float r[16];
+    for (p = 0; p < count; p++) {
+        NSUInteger origin = 0;
+        for (i = 0; i < nIn; i++) {
+            cell[i] = gridCell(in[p * nIn + i], s->grid[i], &r[i]);
+            origin += cell[i] * s->strides[i];
+        }
+        float *o = out + p * nOut;
+        for (k = 0; k < nOut; k++) o[k] = 0.0f;
+        for (corner = 0; corner < ((NSUInteger)1 << nIn); corner++) {
+            float weight = 1.0f;
+            NSUInteger offset = origin;
+            for (i = 0; i < nIn; i++) {
+                BOOL high = (corner >> i) & 1;
+                weight *= high ? r[i] : 1.0f - r[i];
+                offset += high ? s->strides[i] : 0;
+            }
+            for (k = 0; k < nOut; k++) {
+                o[k] += weight * s->v[offset + k];
+            }
+        }
+    }
+}
+
+@implementation ICCTagLUT
 
 - (id)initWithData:(void *)data signature:(NSString *)sig {
     self = [super initWithData:data signature:sig];
@@ -25,36 +219,630 @@
         outputChannels = 3;
         gridPoints = 17; // Common default
         lutData = [[NSData alloc] init];
+        stages = [[NSMutableArray alloc] init];
     }
     return self;
 }
 
+- (ICCLUTStage *)firstCLUTStage {
+    NSUInteger i;
+    for (i = 0; i < [stages count]; i++) {
+        ICCLUTStage *stage = [stages objectAtIndex:i];
+        if (stage->kind == ICCLUTStageCLUT) return stage;
+    }
+    return nil;
+}
+
+- (NSUInteger)inputChannels {
+    [self decodeIfNeeded];
+    return [stages count] ? ((ICCLUTStage *)[stages objectAtIndex:0])->inputs : inputChannels;
+}
+
+- (void)setInputChannels:(NSUInteger)channels {
+    [self decodeIfNeeded];
+    [self markModified];
+    inputChannels = channels;
+}
+
+- (NSUInteger)outputChannels {
+    [self decodeIfNeeded];
+    return [stages count] ? ((ICCLUTStage *)[stages lastObject])->outputs : outputChannels;
+}
+
+- (void)setOutputChannels:(NSUInteger)channels {
+    [self decodeIfNeeded];
+    [self markModified];
+    outputChannels = channels;
+}
+
+- (NSUInteger)gridPoints {
+    [self decodeIfNeeded];
+    ICCLUTStage *clut = [self firstCLUTStage];
+    return clut ? clut->grid[0] : gridPoints;
+}
+
+- (void)setGridPoints:(NSUInteger)points {
+    [self decodeIfNeeded];
+    [self markModified];
+    gridPoints = points;
+}
+
+- (NSData *)lutData {
+    [self decodeIfNeeded];
+    ICCLUTStage *clut = [self firstCLUTStage];
+    return clut ? clut->values : lutData;
+}
+
+- (void)setLutData:(NSData *)data {
+    [self decodeIfNeeded];
+    [self markModified];
+    ICCLUTStage *clut = [self firstCLUTStage];
+    if (clut && [data length] == [clut->values length]) {
+        [clut setValues:(const float *)[data bytes] count:[data length] / sizeof(float)];
+    }
+    [data retain];
+    [lutData release];
+    lutData = data;
+}
+
+- (NSUInteger)stageCount {
+    [self decodeIfNeeded];
+    return [stages count];
+}
+
+- (ICCLUTStageKind)kindOfStageAtIndex:(NSUInteger)index {
+    [self decodeIfNeeded];
+    return ((ICCLUTStage *)[stages objectAtIndex:index])->kind;
+}
+
+- (void)removeAllStages {
+    [self decodeIfNeeded];
+    [self markModified];
+    [stages removeAllObjects];
+}
+
+- (BOOL)canAppendInputs:(NSUInteger)inputs outputs:(NSUInteger)outputs {
+    if (inputs == 0 || outputs == 0 || inputs > kICCTagLUTMaxChannels || outputs > kICCTagLUTMaxChannels) {
+        return NO;
+    }
+    return [stages count] == 0 || ((ICCLUTStage *)[stages lastObject])->outputs == inputs;
+}
+
+- (void)appendStage:(ICCLUTStage *)stage {
+    [stages addObject:stage];
+    [stage release];
+    [self markModified];
+}
+
+- (BOOL)appendCurvesWithTables:(const float *)tables channels:(NSUInteger)channels samples:(NSUInteger)samples {
+    [self decodeIfNeeded];
+    if (![self canAppendInputs:channels outputs:channels] || samples < 2) return NO;
+    ICCLUTStage *stage = [[ICCLUTStage alloc] init];
+    stage->kind = ICCLUTStageCurves;
+    stage->inputs = channels;
+    stage->outputs = channels;
+    stage->samples = samples;
+    [stage setValues:tables count:channels * samples];
+    [self appendStage:stage];
+    return YES;
+}
+
+- (BOOL)appendMatrix:(const float *)matrix
+              offset:(const float *)offset
+              inputs:(NSUInteger)inputs
+             outputs:(NSUInteger)outputs {
+    [self decodeIfNeeded];
+    if (![self canAppendInputs:inputs outputs:outputs]) return NO;
+    NSUInteger count = inputs * outputs + outputs;
+    float *packed = (float *)calloc(count, sizeof(float));
+    memcpy(packed, matrix, inputs * outputs * sizeof(float));
+    if (offset) {
+        memcpy(packed + inputs * outputs, offset, outputs * sizeof(float));
+    }
+    ICCLUTStage *stage = [[ICCLUTStage alloc] init];
+    stage->kind = ICCLUTStageMatrix;
+    stage->inputs = inputs;
+    stage->outputs = outputs;
+    [stage setValues:packed count:count];
+    free(packed);
+    [self appendStage:stage];
+    return YES;
+}
+
+- (BOOL)appendCLUTWithGrid:(const NSUInteger *)grid
+                    inputs:(NSUInteger)inputs
+                   outputs:(NSUInteger)outputs
+                    values:(const float *)nodeValues {
+    [self decodeIfNeeded];
+    if (![self canAppendInputs:inputs outputs:outputs]) return NO;
+    // Multilinear lookups visit 2^inputs corners
+    if (inputs > kMultilinearMaxInputs) return NO;
+    ICCLUTStage *stage = newCLUTStage(grid, inputs, outputs, nodeValues);
+    if (!stage) return NO;
+    [self appendStage:stage];
+    return YES;
+}
+
+- (void)evaluate:(const float *)input output:(float *)output count:(NSUInteger)count {
+    [self decodeIfNeeded];
+    NSUInteger stageCount = [stages count];
+    if (stageCount == 0) {
+        NSUInteger p, i, nIn = MAX(inputChannels, 1);
+        for (p = 0; p < count; p++) {
+            for (i = 0; i < outputChannels; i++) {
+                output[p * outputChannels + i] = input[p * nIn + i % nIn];
+            }
+        }
+        return;
+    }
+
+    ICCLUTStage *first = [stages objectAtIndex:0];
+    ICCLUTStage *last = [stages lastObject];
+    float buffers[2][kBlockPixels * 16];
+    NSUInteger start;
+    for (start = 0; start < count; start += kBlockPixels) {
+        NSUInteger n = MIN(kBlockPixels, count - start);
+        const float *in = input + start * first->inputs;
+        NSUInteger s;
+        for (s = 0; s < stageCount; s++) {
+            ICCLUTStage *stage = [stages objectAtIndex:s];
+            // The last stage writes straight into the caller's buffer
+            float *out = (s == stageCount - 1) ? output + start * last->outputs : buffers[s & 1];
+            switch (stage->kind) {
+                case ICCLUTStageCurves:
+                    evaluateCurves(stage, in, out, n);
+                    break;
+                case ICCLUTStageMatrix:
+                    evaluateMatrix(stage, in, out, n);
+                    break;
+                case ICCLUTStageCLUT:
+                    if (stage->inputs == 3) {
+                        evaluateCLUT3(stage, in, out, n);
+                    } else if (stage->inputs == 4) {
+                        evaluateCLUT4(stage, in, out, n);
+                    } else {
+                        evaluateCLUTMultilinear(stage, in, out, n);
+                    }
+                    break;
+            }
+            in = out;
+        }
+    }
+}
+
 - (void)lookupInput:(const double *)input output:(double *)output {
-    // Simplified LUT lookup - would need proper trilinear interpolation
-    // for a full implementation
+    [self decodeIfNeeded];
+    float in[16], out[16];
+    NSUInteger i, nIn = MIN([self inputChannels], kICCTagLUTMaxChannels);
+    NSUInteger nOut = MIN([self outputChannels], kICCTagLUTMaxChannels);
+    for (i = 0; i < nIn; i++) in[i] = (float)input[i];
+    [self evaluate:in output:out count:1];
+    for (i = 0; i < nOut; i++) output[i] = out[i];
+}
+
+#ifdef HAVE_LCMS
+typedef struct {
+    NSUInteger inputs;
+    cmsUInt16Number minStep[cmsMAXCHANNELS];
+} CLUTGridProbe;
+
+// Smallest non-zero node coordinate per input gives the grid spacing
+static cmsInt32Number probeCLUTNode(const cmsUInt16Number In[], cmsUInt16Number Out[], void *Cargo) {
+    CLUTGridProbe *probe = (CLUTGridProbe *)Cargo;
     NSUInteger i;
-    for (i = 0; i < outputChannels; i++) {
-        output[i] = input[i % inputChannels]; // Pass-through for now
+    (void)Out;
+    for (i = 0; i < probe->inputs; i++) {
+        if (In[i] > 0 && In[i] < probe->minStep[i]) probe->minStep[i] = In[i];
     }
+    return TRUE;
 }
 
+// Evaluate a stage (or whole pipeline) on its own
+static cmsPipeline *pipelineWithStage(cmsStage *stage) {
+    cmsPipeline *single = cmsPipelineAlloc(NULL, cmsStageInputChannels(stage), cmsStageOutputChannels(stage));
+    if (!single) return NULL;
+    cmsStage *copy = cmsStageDup(stage);
+    if (!copy || !cmsPipelineInsertStage(single, cmsAT_END, copy)) {
+        if (copy) cmsStageFree(copy);
+        cmsPipelineFree(single);
+        return NULL;
+    }
+    return single;
+}
+
+// Node values in our layout (last input fastest), from evaluating at each node
+static float *sampleGrid(const cmsPipeline *lut, const NSUInteger *grid, NSUInteger inputs, NSUInteger outputs) {
+    NSUInteger i, nodes = 1;
+    for (i = 0; i < inputs; i++) nodes *= grid[i];
+    float *values = (float *)malloc(nodes * outputs * sizeof(float));
+    if (!values) return NULL;
+    cmsFloat32Number in[cmsMAXCHANNELS];
+    NSUInteger node;
+    for (node = 0; node < nodes; node++) {
+        NSUInteger rest = node;
+        for (i = inputs; i > 0; i--) {
+            in[i - 1] = (cmsFloat32Number)(rest % grid[i - 1]) / (cmsFloat32Number)(grid[i - 1] - 1);
+            rest /= grid[i - 1];
+        }
+        cmsPipelineEvalFloat(in, values + node * outputs, lut);
+    }
+    return values;
+}
+
+- (BOOL)appendStageFromLittleCMS:(cmsStage *)stage {
+    NSUInteger nIn = cmsStageInputChannels(stage);
+    NSUInteger nOut = cmsStageOutputChannels(stage);
+    if (nIn == 0 || nOut == 0 || nIn > kICCTagLUTMaxChannels || nOut > kICCTagLUTMaxChannels) return NO;
+    cmsStageSignature type = cmsStageType(stage);
+    if (type != cmsSigCurveSetElemType && type != cmsSigMatrixElemType && type != cmsSigCLutElemType) return NO;
+    cmsPipeline *single = pipelineWithStage(stage);
+    if (!single) return NO;
+
+    BOOL appended = NO;
+    cmsFloat32Number in[cmsMAXCHANNELS], out[cmsMAXCHANNELS];
+    NSUInteger i, j;
+    if (type == cmsSigCurveSetElemType) {
+        // Every channel's curve sampled on the same ramp
+        float *tables = (float *)malloc(nIn * kCurveSamples * sizeof(float));
+        for (j = 0; j < kCurveSamples; j++) {
+            for (i = 0; i < nIn; i++) in[i] = (cmsFloat32Number)j / (kCurveSamples - 1);
+            cmsPipelineEvalFloat(in, out, single);
+            for (i = 0; i < nIn; i++) tables[i * kCurveSamples + j] = out[i];
+        }
+        appended = [self appendCurvesWithTables:tables channels:nIn samples:kCurveSamples];
+        free(tables);
+    } else if (type == cmsSigMatrixElemType) {
+        // Affine: the origin gives the offset, unit vectors the columns
+        float *matrix = (float *)malloc(nIn * nOut * sizeof(float));
+        float offset[16];
+        memset(in, 0, sizeof(in));
+        cmsPipelineEvalFloat(in, out, single);
+        for (j = 0; j < nOut; j++) offset[j] = out[j];
+        for (i = 0; i < nIn; i++) {
+            memset(in, 0, sizeof(in));
+            in[i] = 1.0f;
+            cmsPipelineEvalFloat(in, out, single);
+            for (j = 0; j < nOut; j++) matrix[j * nIn + i] = out[j] - offset[j];
+        }
+        appended = [self appendMatrix:matrix offset:offset inputs:nIn outputs:nOut];
+        free(matrix);
+    } else {
+        CLUTGridProbe probe;
+        probe.inputs = nIn;
+        for (i = 0; i < cmsMAXCHANNELS; i++) probe.minStep[i] = 0xFFFF;
+        NSUInteger grid[16];
+        if (cmsStageSampleCLut16bit(stage, probeCLUTNode, &probe, SAMPLER_INSPECT)) {
+            for (i = 0; i < nIn; i++) {
+                grid[i] = (NSUInteger)floor(65535.0 / probe.minStep[i] + 0.5) + 1;
+            }
+            float *values = sampleGrid(single, grid, nIn, nOut);
+            if (values) {
+                appended = [self appendCLUTWithGrid:grid inputs:nIn outputs:nOut values:values];
+                free(values);
+            }
+        }
+    }
+    cmsPipelineFree(single);
+    return appended;
+}
+#endif
+
 - (void)loadFromPipeline:(void *)pipeline {
 #ifdef HAVE_LCMS
     cmsPipeline *lut = (cmsPipeline *)pipeline;
     if (!lut) return;
-    
+
     // Get pipeline information
     inputChannels = cmsPipelineInputChannels(lut);
     outputChannels = cmsPipelineOutputChannels(lut);
-    
-    // Store pipeline reference (would need to properly serialize in full implementation)
-    // For now, just store metadata
-    gridPoints = 17; // Common default
+    [stages removeAllObjects];
+
+    BOOL complete = YES;
+    cmsStage *stage;
+    for (stage = cmsPipelineGetPtrToFirstStage(lut); stage && complete; stage = cmsStageNext(stage)) {
+        complete = [self appendStageFromLittleCMS:stage];
+    }
+    if (complete) return;
+
+    // Stage types without a packed form: resample the whole pipeline
+    [stages removeAllObjects];
+    NSUInteger resolution = resampleGridPoints(inputChannels);
+    NSUInteger grid[16];
+    NSUInteger i;
+    if (inputChannels == 0 || inputChannels > kMultilinearMaxInputs || outputChannels == 0 ||
+        outputChannels > kICCTagLUTMaxChannels) {
+        return;
+    }
+    for (i = 0; i < inputChannels; i++) grid[i] = resolution;
+    float *values = sampleGrid(lut, grid, inputChannels, outputChannels);
+    if (values) {
+        [self appendCLUTWithGrid:grid inputs:inputChannels outputs:outputChannels values:values];
+        free(values);
+    }
 #endif
 }
 
+- (void)loadFromTagData:(void *)data {
+    [self loadFromPipeline:data];
+}
+
+// lutAtoBType/lutBtoAType elements, in header offset order
+enum { kSlotB, kSlotMatrix, kSlotM, kSlotCLUT, kSlotA, kSlotCount };
+
+// lut16Type elements, in evaluation order
+enum { kLut16Matrix, kLut16Input, kLut16CLUT, kLut16Output, kLut16SlotCount };
+
+static const NSUInteger kICCMaxChannels = 15;
+static const NSUInteger kLut16MaxEntries = 4096;
+
+// Which side of each LUT tag faces the PCS, and so whether it is written as
+// lutAtoBType or lutBtoAType. The gamut tag maps PCS to one gamut channel;
+// preview tags map PCS to PCS through the device, and like lcms they are
+// written as lutBtoAType.
+static const struct {
+    const char *signature;
+    BOOL towardPCS;
+} kLUTDirections[] = {
+    {"A2B0", YES}, {"A2B1", YES}, {"A2B2", YES},
+    {"B2A0", NO}, {"B2A1", NO}, {"B2A2", NO},
+    {"gamt", NO}, {"pre0", NO}, {"pre1", NO}, {"pre2", NO}
+};
+
+// Device to PCS unless the table says otherwise
+static BOOL lutTowardPCS(NSString *signature) {
+    const char *sig = [signature UTF8String];
+    NSUInteger i;
+    for (i = 0; sig && i < sizeof(kLUTDirections) / sizeof(kLUTDirections[0]); i++) {
+        if (strcmp(sig, kLUTDirections[i].signature) == 0) return kLUTDirections[i].towardPCS;
+    }
+    return YES;
+}
+
+static void appendCurveSet(NSMutableData *payload, ICCLUTStage *curves, NSUInteger channels) {
+    NSUInteger c, i;
+    for (c = 0; c < channels; c++) {
+        ICCAppendUInt32(payload, 0x63757276); // 'curv'
+        ICCAppendUInt32(payload, 0);
+        if (!curves) {
+            ICCAppendUInt32(payload, 0); // Identity
+            continue;
+        }
+        ICCAppendUInt32(payload, (uint32_t)curves->samples);
+        const float *table = curves->v + c * curves->samples;
+        for (i = 0; i < curves->samples; i++) {
+            ICCAppendUnit16(payload, table[i]);
+        }
+        ICCAppendPadding(payload);
+    }
+}
+
+// 3x3 matrix then offsets; identity when there is no matrix stage
+static void appendMatrixElement(NSMutableData *payload, ICCLUTStage *matrix) {
+    NSUInteger i;
+    for (i = 0; i < 12; i++) {
+        ICCAppendS15Fixed16(payload, matrix ? matrix->v[i] : ((i < 9 && i % 4 == 0) ? 1.0 : 0.0));
+    }
+}
+
+static void appendCLUTElement(NSMutableData *payload, ICCLUTStage *clut) {
+    NSUInteger i, count = [clut->values length] / sizeof(float);
+    for (i = 0; i < 16; i++) {
+        ICCAppendUInt8(payload, (i < clut->inputs) ? (uint8_t)clut->grid[i] : 0);
+    }
+    ICCAppendUInt8(payload, 2); // 16-bit precision
+    ICCAppendUInt8(payload, 0);
+    ICCAppendUInt16(payload, 0);
+    for (i = 0; i < count; i++) {
+        ICCAppendUnit16(payload, clut->v[i]);
+    }
+    ICCAppendPadding(payload);
+}
+
+// Match the chain against the element order: A, CLUT, M, matrix, B for
+// device to PCS tags, B, matrix, M, CLUT, A the other way round. Either way
+// B is matched first, working inward from its end of the chain.
+- (BOOL)assignStages:(ICCLUTStage **)slots towardPCS:(BOOL)aToB {
+    static const ICCLUTStageKind slotKinds[kSlotCount] = {
+        ICCLUTStageCurves, ICCLUTStageMatrix, ICCLUTStageCurves, ICCLUTStageCLUT, ICCLUTStageCurves
+    };
+    NSUInteger k, slot = 0, count = [stages count];
+    for (k = 0; k < count; k++) {
+        ICCLUTStage *stage = [stages objectAtIndex:aToB ? count - 1 - k : k];
+        if (stage->inputs > kICCMaxChannels || stage->outputs > kICCMaxChannels) return NO;
+        while (slot < kSlotCount && slotKinds[slot] != stage->kind) slot++;
+        if (slot == kSlotCount) return NO;
+        slots[slot++] = stage;
+    }
+    // A curves need a CLUT; M curves go with a 3x3 matrix (identity if absent)
+    if (slots[kSlotA] && !slots[kSlotCLUT]) return NO;
+    if (slots[kSlotMatrix] && (slots[kSlotMatrix]->inputs != 3 || slots[kSlotMatrix]->outputs != 3)) return NO;
+    if (slots[kSlotM] && slots[kSlotM]->inputs != 3) return NO;
+    if (slots[kSlotCLUT]) {
+        for (k = 0; k < slots[kSlotCLUT]->inputs; k++) {
+            if (slots[kSlotCLUT]->grid[k] > 255) return NO;
+        }
+    }
+    return YES;
+}
+
+// Match the chain against lut16Type's fixed order: a 3x3 matrix without
+// offset, input tables, a CLUT with the same grid on every input, output
+// tables. The CLUT is required; tables hold 2 to 4096 entries.
+- (BOOL)assignLut16Stages:(ICCLUTStage **)slots {
+    static const ICCLUTStageKind slotKinds[kLut16SlotCount] = {
+        ICCLUTStageMatrix, ICCLUTStageCurves, ICCLUTStageCLUT, ICCLUTStageCurves
+    };
+    NSUInteger k, slot = 0, count = [stages count];
+    for (k = 0; k < count; k++) {
+        ICCLUTStage *stage = [stages objectAtIndex:k];
+        if (stage->inputs > kICCMaxChannels || stage->outputs > kICCMaxChannels) return NO;
+        if (stage->kind == ICCLUTStageCurves && stage->samples > kLut16MaxEntries) return NO;
+        while (slot < kLut16SlotCount && slotKinds[slot] != stage->kind) slot++;
+        if (slot == kLut16SlotCount) return NO;
+        slots[slot++] = stage;
+    }
+    ICCLUTStage *matrix = slots[kLut16Matrix];
+    if (matrix && (matrix->inputs != 3 || matrix->outputs != 3 ||
+                   matrix->v[9] != 0.0f || matrix->v[10] != 0.0f || matrix->v[11] != 0.0f)) {
+        return NO;
+    }
+    ICCLUTStage *clut = slots[kLut16CLUT];
+    if (!clut || clut->grid[0] > 255) return NO;
+    for (k = 1; k < clut->inputs; k++) {
+        if (clut->grid[k] != clut->grid[0]) return NO;
+    }
+    return YES;
+}
+
+// The whole chain sampled on one grid; nil when it has too many channels
+- (ICCLUTStage *)newResampledStage {
+    NSUInteger nIn = [self inputChannels], nOut = [self outputChannels];
+    NSUInteger points = resampleGridPoints(nIn);
+    if (points == 0 || nIn == 0 || nOut == 0 || nOut > kICCMaxChannels) return nil;
+    NSUInteger grid[16];
+    NSUInteger i, node, nodes = 1;
+    for (i = 0; i < nIn; i++) {
+        grid[i] = points;
+        nodes *= points;
+    }
+    float *coordinates = (float *)malloc(nodes * nIn * sizeof(float));
+    float *values = (float *)malloc(nodes * nOut * sizeof(float));
+    ICCLUTStage *stage = nil;
+    if (coordinates && values) {
+        for (node = 0; node < nodes; node++) {
+            NSUInteger rest = node;
+            for (i = nIn; i > 0; i--) {
+                coordinates[node * nIn + i - 1] = (float)(rest % points) / (float)(points - 1);
+                rest /= points;
+            }
+        }
+        [self evaluate:coordinates output:values count:nodes];
+        stage = newCLUTStage(grid, nIn, nOut, values);
+    }
+    free(coordinates);
+    free(values);
+    return stage;
+}
+
+- (NSData *)serialize {
+    NSData *source = [self sourcePayload];
+    if (source) return source;
+    [self decodeIfNeeded];
+    if ([stages count] == 0) return [super serialize];
+
+    BOOL aToB = lutTowardPCS(signature);
+    ICCLUTStage *slots[kSlotCount] = {nil, nil, nil, nil, nil};
+    ICCLUTStage *resampled = nil;
+    if (![self assignStages:slots towardPCS:aToB]) {
+        resampled = [self newResampledStage];
+        if (!resampled) return [super serialize];
+        memset(slots, 0, sizeof(slots));
+        slots[kSlotCLUT] = resampled;
+    }
+
+    NSUInteger nIn = [self inputChannels], nOut = [self outputChannels];
+    NSMutableData *payload = [NSMutableData data];
+    uint32_t offsets[kSlotCount] = {0, 0, 0, 0, 0};
+    ICCAppendUInt32(payload, aToB ? 0x6D414220 : 0x6D424120); // 'mAB ' or 'mBA '
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt8(payload, (uint8_t)nIn);
+    ICCAppendUInt8(payload, (uint8_t)nOut);
+    ICCAppendUInt16(payload, 0);
+    [payload increaseLengthBy:kSlotCount * 4]; // Offsets, filled in below
+
+    // B curves are required; they face the PCS side
+    offsets[kSlotB] = (uint32_t)[payload length];
+    appendCurveSet(payload, slots[kSlotB], aToB ? nOut : nIn);
+    if (slots[kSlotMatrix] || slots[kSlotM]) {
+        offsets[kSlotMatrix] = (uint32_t)[payload length];
+        appendMatrixElement(payload, slots[kSlotMatrix]);
+        offsets[kSlotM] = (uint32_t)[payload length];
+        appendCurveSet(payload, slots[kSlotM], 3);
+    }
+    if (slots[kSlotCLUT]) {
+        offsets[kSlotCLUT] = (uint32_t)[payload length];
+        appendCLUTElement(payload, slots[kSlotCLUT]);
+        offsets[kSlotA] = (uint32_t)[payload length];
+        appendCurveSet(payload, slots[kSlotA], aToB ? nIn : nOut);
+    }
+    [resampled release];
+
+    uint8_t *header = (uint8_t *)[payload mutableBytes] + 12;
+    NSUInteger i;
+    for (i = 0; i < kSlotCount; i++) {
+        header[i * 4] = (uint8_t)(offsets[i] >> 24);
+        header[i * 4 + 1] = (uint8_t)(offsets[i] >> 16);
+        header[i * 4 + 2] = (uint8_t)(offsets[i] >> 8);
+        header[i * 4 + 3] = (uint8_t)offsets[i];
+    }
+    return payload;
+}
+
+// Identity tables (two entries) when there is no curve stage
+static void appendLut16Tables(NSMutableData *payload, ICCLUTStage *curves, NSUInteger channels) {
+    NSUInteger c, i;
+    for (c = 0; c < channels; c++) {
+        if (!curves) {
+            ICCAppendUInt16(payload, 0);
+            ICCAppendUInt16(payload, 0xFFFF);
+            continue;
+        }
+        const float *table = curves->v + c * curves->samples;
+        for (i = 0; i < curves->samples; i++) {
+            ICCAppendUnit16(payload, table[i]);
+        }
+    }
+}
+
+// Version 2 has no lutAtoBType or lutBtoAType, so edited tags (and v4
+// sources) become lut16Type. Values are written in the tag's own encoding;
+// a Lab PCS is not converted to the legacy 16-bit Lab encoding.
+- (NSData *)serializeForVersion:(NSUInteger)majorVersion {
+    NSData *source = [self sourcePayload];
+    if (majorVersion >= 4) return [self serialize];
+    if (source && [source length] >= 4 &&
+        (memcmp([source bytes], "mft2", 4) == 0 || memcmp([source bytes], "mft1", 4) == 0)) {
+        return source;
+    }
+    [self decodeIfNeeded];
+    if ([stages count] == 0) return [super serialize];
+
+    ICCLUTStage *slots[kLut16SlotCount] = {nil, nil, nil, nil};
+    ICCLUTStage *resampled = nil;
+    if (![self assignLut16Stages:slots]) {
+        resampled = [self newResampledStage];
+        if (!resampled) return [super serialize];
+        memset(slots, 0, sizeof(slots));
+        slots[kLut16CLUT] = resampled;
+    }
+
+    NSUInteger nIn = [self inputChannels], nOut = [self outputChannels];
+    ICCLUTStage *clut = slots[kLut16CLUT];
+    NSMutableData *payload = [NSMutableData data];
+    NSUInteger i, count = [clut->values length] / sizeof(float);
+    ICCAppendUInt32(payload, 0x6D667432); // 'mft2'
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt8(payload, (uint8_t)nIn);
+    ICCAppendUInt8(payload, (uint8_t)nOut);
+    ICCAppendUInt8(payload, (uint8_t)clut->grid[0]);
+    ICCAppendUInt8(payload, 0);
+    for (i = 0; i < 9; i++) {
+        ICCAppendS15Fixed16(payload, slots[kLut16Matrix] ? slots[kLut16Matrix]->v[i] : ((i % 4 == 0) ? 1.0 : 0.0));
+    }
+    ICCAppendUInt16(payload, (uint16_t)(slots[kLut16Input] ? slots[kLut16Input]->samples : 2));
+    ICCAppendUInt16(payload, (uint16_t)(slots[kLut16Output] ? slots[kLut16Output]->samples : 2));
+    appendLut16Tables(payload, slots[kLut16Input], nIn);
+    for (i = 0; i < count; i++) {
+        ICCAppendUnit16(payload, clut->v[i]);
+    }
+    appendLut16Tables(payload, slots[kLut16Output], nOut);
+    [resampled release];
+    return payload;
+}
+
 - (void)dealloc {
     [lutData release];
+    [stages release];
     [super dealloc];
 }
 
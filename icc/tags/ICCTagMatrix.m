@@ -6,6 +6,7 @@
 //
 
 #import "ICCTagMatrix.h"
+#import "ICCProfileIO.h"
 
 @implementation ICCTagMatrix
 
@@ -41,6 +42,7 @@
 - (void)setMatrixElement:(NSUInteger)row col:(NSUInteger)col value:(double)value {
     if (row < 3 && col < 3) {
         matrix[row][col] = value;
+        [self markModified];
     }
 }
 
@@ -51,4 +53,26 @@
     return 0.0;
 }
 
+// s15Fixed16ArrayType: the matrix row by row, as chromaticAdaptationTag
+// stores it, then the offset when it is not zero
+- (NSData *)serialize {
+    NSData *source = [self sourcePayload];
+    if (source) return source;
+    NSMutableData *payload = [NSMutableData data];
+    NSUInteger i, j;
+    ICCAppendUInt32(payload, 0x73663332); // 'sf32'
+    ICCAppendUInt32(payload, 0);
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            ICCAppendS15Fixed16(payload, matrix[i][j]);
+        }
+    }
+    if (offset[0] != 0.0 || offset[1] != 0.0 || offset[2] != 0.0) {
+        for (i = 0; i < 3; i++) {
+            ICCAppendS15Fixed16(payload, offset[i]);
+        }
+    }
+    return payload;
+}
+
 @end
@@ -6,10 +6,18 @@
 //
 
 #import "ICCTagMetadata.h"
+#import "ICCProfileIO.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#include <wchar.h>
+#include <stdlib.h>
+#endif
 
 @implementation ICCTagMetadata
 
-@synthesize textValue;
 @synthesize locale;
 
 - (id)initWithData:(void *)data signature:(NSString *)sig {
@@ -21,6 +29,136 @@
     return self;
 }
 
+- (NSString *)textValue {
+    [self decodeIfNeeded];
+    return textValue;
+}
+
+- (void)setTextValue:(NSString *)text {
+    [self decodeIfNeeded];
+    [self markModified];
+    [text retain];
+    [textValue release];
+    textValue = text;
+}
+
+- (void)loadFromTagData:(void *)data {
+#ifdef HAVE_LCMS
+    if (!data) return;
+    NSString *text;
+    if ([signature isEqualToString:@"rXYZ"] || [signature isEqualToString:@"gXYZ"] ||
+        [signature isEqualToString:@"bXYZ"]) {
+        // Colorant XYZ values, shown as text for now - could create a ColorantTag class
+        cmsCIEXYZ *xyz = (cmsCIEXYZ *)data;
+        text = [NSString stringWithFormat:@"X=%.6f Y=%.6f Z=%.6f", xyz->X, xyz->Y, xyz->Z];
+    } else {
+        // Text tags (desc, cprt, dmnd, dmdd) come back as a multi-localized unicode list
+        cmsMLU *mlu = (cmsMLU *)data;
+        cmsUInt32Number bytes = cmsMLUgetWide(mlu, "en", "US", NULL, 0);
+        if (bytes == 0) return;
+        wchar_t *wide = (wchar_t *)malloc(bytes);
+        if (!wide) return;
+        cmsMLUgetWide(mlu, "en", "US", wide, bytes);
+        BOOL little = (NSHostByteOrder() == NS_LittleEndian);
+        NSStringEncoding encoding = (sizeof(wchar_t) == 4)
+            ? (little ? NSUTF32LittleEndianStringEncoding : NSUTF32BigEndianStringEncoding)
+            : (little ? NSUTF16LittleEndianStringEncoding : NSUTF16BigEndianStringEncoding);
+        text = [[[NSString alloc] initWithBytes:wide
+                                         length:wcslen(wide) * sizeof(wchar_t)
+                                       encoding:encoding] autorelease];
+        free(wide);
+        if (!text) return;
+    }
+    [text retain];
+    [textValue release];
+    textValue = text;
+#endif
+}
+
+- (BOOL)isColorant {
+    return [signature isEqualToString:@"rXYZ"] || [signature isEqualToString:@"gXYZ"] ||
+           [signature isEqualToString:@"bXYZ"];
+}
+
+// Source bytes can be kept when their type exists in the target version
+- (BOOL)sourceTypeFitsVersion:(NSUInteger)majorVersion {
+    NSData *source = [self sourcePayload];
+    if ([source length] < 4 || [self isColorant]) return YES;
+    BOOL mluc = memcmp([source bytes], "mluc", 4) == 0;
+    return (majorVersion >= 4) ? mluc : !mluc;
+}
+
+// Two-letter language and country codes from a locale such as "en_US"
+static uint16_t localeCode(NSString *code, uint16_t fallback) {
+    if ([code length] != 2) return fallback;
+    return (uint16_t)((([code characterAtIndex:0] & 0xFF) << 8) | ([code characterAtIndex:1] & 0xFF));
+}
+
+// Colorants become 'XYZ ' again; text is 'mluc' in v4 profiles, and
+// 'text' (cprt) or 'desc' (the description tags) in v2 profiles
+- (NSData *)serializeForVersion:(NSUInteger)majorVersion {
+    NSData *source = [self sourcePayload];
+    if (source && [self sourceTypeFitsVersion:majorVersion]) return source;
+    [self decodeIfNeeded];
+    NSMutableData *payload = [NSMutableData data];
+    NSUInteger i;
+
+    if ([self isColorant]) {
+        double xyz[3];
+        if (!textValue || sscanf([textValue UTF8String], "X=%lf Y=%lf Z=%lf", &xyz[0], &xyz[1], &xyz[2]) != 3) {
+            return [super serialize];
+        }
+        ICCAppendUInt32(payload, 0x58595A20); // 'XYZ '
+        ICCAppendUInt32(payload, 0);
+        for (i = 0; i < 3; i++) {
+            ICCAppendS15Fixed16(payload, xyz[i]);
+        }
+        return payload;
+    }
+
+    NSString *text = textValue ? textValue : @"";
+    if (majorVersion >= 4) {
+        NSData *utf16 = [text dataUsingEncoding:NSUTF16BigEndianStringEncoding];
+        NSArray *parts = [locale componentsSeparatedByString:@"_"];
+        ICCAppendUInt32(payload, 0x6D6C7563); // 'mluc'
+        ICCAppendUInt32(payload, 0);
+        ICCAppendUInt32(payload, 1);  // Records
+        ICCAppendUInt32(payload, 12); // Record size
+        ICCAppendUInt16(payload, localeCode([parts count] > 0 ? [parts objectAtIndex:0] : nil, 0x656E)); // 'en'
+        ICCAppendUInt16(payload, localeCode([parts count] > 1 ? [parts objectAtIndex:1] : nil, 0x5553)); // 'US'
+        ICCAppendUInt32(payload, (uint32_t)[utf16 length]);
+        ICCAppendUInt32(payload, 28); // String follows the record
+        [payload appendData:utf16];
+        return payload;
+    }
+
+    NSData *ascii = [text dataUsingEncoding:NSASCIIStringEncoding allowLossyConversion:YES];
+    if ([signature isEqualToString:@"cprt"]) {
+        ICCAppendUInt32(payload, 0x74657874); // 'text'
+        ICCAppendUInt32(payload, 0);
+        [payload appendData:ascii];
+        ICCAppendUInt8(payload, 0);
+        return payload;
+    }
+    ICCAppendUInt32(payload, 0x64657363); // 'desc'
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt32(payload, (uint32_t)[ascii length] + 1);
+    [payload appendData:ascii];
+    ICCAppendUInt8(payload, 0);
+    // No Unicode or ScriptCode strings: language and counts zero, and the
+    // fixed 67-byte Macintosh description
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt32(payload, 0);
+    ICCAppendUInt16(payload, 0);
+    ICCAppendUInt8(payload, 0);
+    [payload increaseLengthBy:67];
+    return payload;
+}
+
+- (NSData *)serialize {
+    return [self serializeForVersion:4];
+}
+
 - (void)dealloc {
     [textValue release];
     [locale release];
@@ -9,17 +9,46 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+// Entries in the inverse lookup table (uniform in output, 0.0 to 1.0)
+extern const NSUInteger kICCTagTRCInverseTableSize;
+
 @interface ICCTagTRC : ICCTag {
-    NSArray *curvePoints; // Array of curve values
-    NSUInteger curveType; // 0=parametric, 1=table
+    NSUInteger curveType;      // 0=parametric, 1=table
+    float *table;              // Table curves: tableCount uniformly spaced samples
+    NSUInteger tableCount;
+    NSUInteger parametricType; // ICC parametricCurveType function 0-4
+    double parameters[7];      // As stored in the tag (unused entries zero)
+    double segment[7];         // Same curve as function 4 coefficients g, a, b, c, d, e, f
+    float *inverseTable;       // kICCTagTRCInverseTableSize entries
 }
 
+// Table samples as NSNumbers (parametric curves are sampled at 256 points).
+// Setting replaces the curve with a table.
 @property (nonatomic, retain) NSArray *curvePoints;
 @property (nonatomic) NSUInteger curveType;
 
+// Contiguous table (NULL for parametric curves)
+- (const float *)tableValues;
+- (NSUInteger)tableCount;
+- (void)setTableValues:(const float *)values count:(NSUInteger)count;
+
+// ICC parametric curve: function type 0-4 with 1, 3, 4, 5 or 7 parameters
++ (NSUInteger)parameterCountForParametricType:(NSUInteger)type;
+- (NSUInteger)parametricType;
+- (const double *)parameters;
+- (void)setParametricType:(NSUInteger)type parameters:(const double *)params;
+
 - (double)valueAtPosition:(double)position; // 0.0 to 1.0
 - (void)loadFromToneCurve:(void *)toneCurve; // Load from cmsToneCurve
 
+// Batch evaluation, clamped to 0.0 to 1.0 on input; input and output may alias
+- (void)evaluate:(const float *)input output:(float *)output count:(NSUInteger)count;
+
+// Inverse through a precomputed table over the curve made monotonic
+// (non-decreasing); outputs the curve never reaches map to 0.0 or 1.0
+- (double)inverseValueAtPosition:(double)value;
+- (void)evaluateInverse:(const float *)input output:(float *)output count:(NSUInteger)count;
+
 @end
 
 NS_ASSUME_NONNULL_END
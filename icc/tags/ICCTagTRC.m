@@ -2,83 +2,352 @@
 //  ICCTagTRC.m
 //  SmallICCer
 //
-//  TRC Tag implementation
+//  TRC Tag implementation.
+//  Parametric curves are evaluated in ICC function 4 form,
+//  Y = (aX + b)^g + e for X >= d, cX + f otherwise, which covers types 0-4.
+//  Both pieces are computed and one selected, so evaluation has no
+//  data-dependent branches; tables use clamped linear interpolation.
 //
 
 #import "ICCTagTRC.h"
+#import "ICCProfileIO.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
 #endif
 
+const NSUInteger kICCTagTRCInverseTableSize = 4096;
+
+static const NSUInteger kSampledCurvePoints = 256;
+static const NSUInteger kMaxTableCount = 4096;
+static const NSUInteger kVersion2TableCount = 1024;
+
+static inline float evaluateTable(const float *values, NSUInteger count, float x) {
+    // fmaxf maps NaN to 0
+    x = fminf(fmaxf(x, 0.0f), 1.0f);
+    float position = x * (float)(count - 1);
+    NSUInteger i = (NSUInteger)position;
+    i = (i < count - 2) ? i : count - 2;
+    float t = position - (float)i;
+    return values[i] + t * (values[i + 1] - values[i]);
+}
+
+static inline float evaluateSegment(const double *s, float x) {
+    x = fminf(fmaxf(x, 0.0f), 1.0f);
+    float base = fmaxf((float)s[1] * x + (float)s[2], 0.0f);
+    float power = powf(base, (float)s[0]) + (float)s[5];
+    float linear = (float)s[3] * x + (float)s[6];
+    return (x >= (float)s[4]) ? power : linear;
+}
+
 @implementation ICCTagTRC
 
-@synthesize curvePoints;
-@synthesize curveType;
++ (NSUInteger)parameterCountForParametricType:(NSUInteger)type {
+    static const NSUInteger counts[5] = {1, 3, 4, 5, 7};
+    return (type < 5) ? counts[type] : 0;
+}
 
 - (id)initWithData:(void *)data signature:(NSString *)sig {
     self = [super initWithData:data signature:sig];
     if (self) {
-        curvePoints = [[NSArray alloc] init];
-        curveType = 1; // Default to table
+        inverseTable = (float *)malloc(kICCTagTRCInverseTableSize * sizeof(float));
+        // Identity until decoded or set
+        float identity[2] = {0.0f, 1.0f};
+        [self replaceTable:identity count:2];
     }
     return self;
 }
 
-- (double)valueAtPosition:(double)position {
-    if (position < 0.0) position = 0.0;
-    if (position > 1.0) position = 1.0;
-    
-    if ([curvePoints count] == 0) {
-        return position; // Linear default
+// Forward curve sampled, forced non-decreasing, then inverted by walking both
+// axes once
+- (void)rebuildInverse {
+    NSUInteger n = kICCTagTRCInverseTableSize;
+    float *forward = (float *)malloc(n * sizeof(float));
+    NSUInteger i, j;
+    for (i = 0; i < n; i++) {
+        forward[i] = (float)i / (float)(n - 1);
+    }
+    [self evaluateDecoded:forward output:forward count:n];
+    for (i = 1; i < n; i++) {
+        if (forward[i] < forward[i - 1]) forward[i] = forward[i - 1];
     }
-    
+
+    i = 0;
+    for (j = 0; j < n; j++) {
+        float y = (float)j / (float)(n - 1);
+        while (i < n - 2 && forward[i + 1] < y) i++;
+        float x;
+        if (y <= forward[0]) {
+            x = 0.0f;
+        } else if (y >= forward[n - 1]) {
+            x = 1.0f;
+        } else {
+            float span = forward[i + 1] - forward[i];
+            float t = (span > 0.0f) ? (y - forward[i]) / span : 0.0f;
+            x = ((float)i + fminf(fmaxf(t, 0.0f), 1.0f)) / (float)(n - 1);
+        }
+        inverseTable[j] = x;
+    }
+    free(forward);
+}
+
+- (void)replaceTable:(const float *)values count:(NSUInteger)count {
+    free(table);
+    // Two entries minimum keeps the interpolation free of special cases
+    tableCount = (count < 2) ? 2 : count;
+    table = (float *)malloc(tableCount * sizeof(float));
+    if (count == 0) {
+        table[0] = 0.0f;
+        table[1] = 1.0f;
+    } else if (count == 1) {
+        table[0] = table[1] = values[0];
+    } else {
+        memcpy(table, values, count * sizeof(float));
+    }
+    curveType = 1;
+    [self rebuildInverse];
+}
+
+- (void)replaceParametricType:(NSUInteger)type parameters:(const double *)params {
+    NSUInteger count = [ICCTagTRC parameterCountForParametricType:type];
+    if (count == 0) return;
+    memset(parameters, 0, sizeof(parameters));
+    memcpy(parameters, params, count * sizeof(double));
+    parametricType = type;
+
+    double g = parameters[0], a = parameters[1], b = parameters[2];
+    double threshold = (a != 0.0) ? -b / a : 0.0;
+    segment[0] = g;
+    segment[1] = (type == 0) ? 1.0 : a;
+    segment[2] = (type == 0) ? 0.0 : b;
+    segment[3] = (type >= 3) ? parameters[3] : 0.0;
+    segment[4] = (type >= 3) ? parameters[4] : ((type == 0) ? 0.0 : threshold);
+    segment[5] = (type == 2) ? parameters[3] : ((type == 4) ? parameters[5] : 0.0);
+    segment[6] = (type == 2) ? parameters[3] : ((type == 4) ? parameters[6] : 0.0);
+
+    free(table);
+    table = NULL;
+    tableCount = 0;
+    curveType = 0;
+    [self rebuildInverse];
+}
+
+- (NSArray *)curvePoints {
+    [self decodeIfNeeded];
+    if (curveType == 1) {
+        NSMutableArray *points = [NSMutableArray arrayWithCapacity:tableCount];
+        NSUInteger i;
+        for (i = 0; i < tableCount; i++) {
+            [points addObject:[NSNumber numberWithDouble:table[i]]];
+        }
+        return points;
+    }
+    float samples[kSampledCurvePoints];
+    NSUInteger i;
+    for (i = 0; i < kSampledCurvePoints; i++) {
+        samples[i] = (float)i / (float)(kSampledCurvePoints - 1);
+    }
+    [self evaluateDecoded:samples output:samples count:kSampledCurvePoints];
+    NSMutableArray *points = [NSMutableArray arrayWithCapacity:kSampledCurvePoints];
+    for (i = 0; i < kSampledCurvePoints; i++) {
+        [points addObject:[NSNumber numberWithDouble:samples[i]]];
+    }
+    return points;
+}
+
+- (void)setCurvePoints:(NSArray *)points {
+    [self decodeIfNeeded];
+    [self markModified];
+    NSUInteger i, count = [points count];
+    float *values = (float *)malloc((count ? count : 1) * sizeof(float));
+    for (i = 0; i < count; i++) {
+        values[i] = [[points objectAtIndex:i] floatValue];
+    }
+    [self replaceTable:values count:count];
+    free(values);
+}
+
+- (NSUInteger)curveType {
+    [self decodeIfNeeded];
+    return curveType;
+}
+
+- (void)setCurveType:(NSUInteger)type {
+    [self decodeIfNeeded];
+    if (type == curveType) return;
+    [self markModified];
+    if (type == 0) {
+        // Table to parametric fits nothing: the curve is reset to gamma 1.0
+        double gamma = 1.0;
+        [self replaceParametricType:0 parameters:&gamma];
+    } else {
+        NSArray *points = [self curvePoints];
+        [self setCurvePoints:points];
+    }
+}
+
+- (const float *)tableValues {
+    [self decodeIfNeeded];
+    return table;
+}
+
+- (NSUInteger)tableCount {
+    [self decodeIfNeeded];
+    return tableCount;
+}
+
+- (void)setTableValues:(const float *)values count:(NSUInteger)count {
+    [self decodeIfNeeded];
+    [self markModified];
+    [self replaceTable:values count:count];
+}
+
+- (NSUInteger)parametricType {
+    [self decodeIfNeeded];
+    return parametricType;
+}
+
+- (const double *)parameters {
+    [self decodeIfNeeded];
+    return parameters;
+}
+
+- (void)setParametricType:(NSUInteger)type parameters:(const double *)params {
+    [self decodeIfNeeded];
+    [self markModified];
+    [self replaceParametricType:type parameters:params];
+}
+
+- (void)evaluateDecoded:(const float *)input output:(float *)output count:(NSUInteger)count {
+    NSUInteger i;
     if (curveType == 1) {
-        // Table-based interpolation
-        NSUInteger count = [curvePoints count];
-        double index = position * (count - 1);
-        NSUInteger lowerIndex = (NSUInteger)floor(index);
-        NSUInteger upperIndex = (NSUInteger)ceil(index);
-        
-        if (lowerIndex == upperIndex) {
-            return [[curvePoints objectAtIndex:lowerIndex] doubleValue];
+        for (i = 0; i < count; i++) {
+            output[i] = evaluateTable(table, tableCount, input[i]);
         }
-        
-        double lowerValue = [[curvePoints objectAtIndex:lowerIndex] doubleValue];
-        double upperValue = [[curvePoints objectAtIndex:upperIndex] doubleValue];
-        double t = index - lowerIndex;
-        
-        return lowerValue + t * (upperValue - lowerValue);
     } else {
-        // Parametric curve (simplified - would need full parametric formula)
-        return position;
+        for (i = 0; i < count; i++) {
+            output[i] = evaluateSegment(segment, input[i]);
+        }
+    }
+}
+
+- (void)evaluate:(const float *)input output:(float *)output count:(NSUInteger)count {
+    [self decodeIfNeeded];
+    [self evaluateDecoded:input output:output count:count];
+}
+
+- (double)valueAtPosition:(double)position {
+    float value = (float)position;
+    [self evaluate:&value output:&value count:1];
+    return value;
+}
+
+- (void)evaluateInverse:(const float *)input output:(float *)output count:(NSUInteger)count {
+    [self decodeIfNeeded];
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        output[i] = evaluateTable(inverseTable, kICCTagTRCInverseTableSize, input[i]);
     }
 }
 
+- (double)inverseValueAtPosition:(double)value {
+    float x = (float)value;
+    [self evaluateInverse:&x output:&x count:1];
+    return x;
+}
+
 - (void)loadFromToneCurve:(void *)toneCurve {
 #ifdef HAVE_LCMS
     cmsToneCurve *curve = (cmsToneCurve *)toneCurve;
     if (!curve) return;
-    
-    // Sample the curve at regular intervals
-    NSMutableArray *points = [NSMutableArray array];
-    NSUInteger sampleCount = 256; // Sample 256 points
+
+#if LCMS_VERSION >= 2130
+    // LittleCMS numbers the ICC functions from 1; negative types are inverses
+    cmsInt32Number type = cmsGetToneCurveParametricType(curve);
+    cmsFloat64Number *params = cmsGetToneCurveParams(curve);
+    if (type >= 1 && type <= 5 && params) {
+        [self replaceParametricType:(NSUInteger)(type - 1) parameters:params];
+        return;
+    }
+#endif
+
+    // Tables keep their own resolution; anything else is sampled
+    NSUInteger count = cmsGetToneCurveEstimatedTableEntries(curve);
+    if (count < 2 || count > kMaxTableCount) count = kSampledCurvePoints;
+    float *values = (float *)malloc(count * sizeof(float));
     NSUInteger i;
-    
-    for (i = 0; i < sampleCount; i++) {
-        double input = (double)i / (sampleCount - 1);
-        cmsFloat32Number output = cmsEvalToneCurveFloat(curve, input);
-        [points addObject:[NSNumber numberWithDouble:output]];
-    }
-    
-    [curvePoints release];
-    curvePoints = [points retain];
-    curveType = 1; // Table-based
+    for (i = 0; i < count; i++) {
+        values[i] = cmsEvalToneCurveFloat(curve, (cmsFloat32Number)i / (count - 1));
+    }
+    [self replaceTable:values count:count];
+    free(values);
 #endif
 }
 
+- (void)loadFromTagData:(void *)data {
+    [self loadFromToneCurve:data];
+}
+
+// parametricCurveType ('para') or curveType ('curv') with 16-bit entries.
+// Version 2 has no 'para': a pure gamma becomes a one-entry 'curv' and other
+// functions are sampled.
+- (NSData *)serializeForVersion:(NSUInteger)majorVersion {
+    NSData *source = [self sourcePayload];
+    if (source && (majorVersion >= 4 || ([source length] >= 4 && memcmp([source bytes], "curv", 4) == 0))) {
+        return source;
+    }
+    [self decodeIfNeeded];
+    NSMutableData *payload = [NSMutableData data];
+    NSUInteger i;
+    if (curveType == 0 && majorVersion < 4) {
+        ICCAppendUInt32(payload, 0x63757276); // 'curv'
+        ICCAppendUInt32(payload, 0);
+        if (parametricType == 0 && parameters[0] > 0.0 && parameters[0] < 256.0) {
+            ICCAppendUInt32(payload, 1);
+            ICCAppendUInt16(payload, (uint16_t)(parameters[0] * 256.0 + 0.5)); // u8Fixed8
+        } else {
+            float samples[kVersion2TableCount];
+            NSUInteger count = kVersion2TableCount;
+            for (i = 0; i < count; i++) {
+                samples[i] = (float)i / (float)(count - 1);
+            }
+            [self evaluateDecoded:samples output:samples count:count];
+            ICCAppendUInt32(payload, (uint32_t)count);
+            for (i = 0; i < count; i++) {
+                ICCAppendUnit16(payload, samples[i]);
+            }
+        }
+        ICCAppendPadding(payload);
+    } else if (curveType == 0) {
+        ICCAppendUInt32(payload, 0x70617261); // 'para'
+        ICCAppendUInt32(payload, 0);
+        ICCAppendUInt16(payload, (uint16_t)parametricType);
+        ICCAppendUInt16(payload, 0);
+        NSUInteger count = [ICCTagTRC parameterCountForParametricType:parametricType];
+        for (i = 0; i < count; i++) {
+            ICCAppendS15Fixed16(payload, parameters[i]);
+        }
+    } else {
+        ICCAppendUInt32(payload, 0x63757276); // 'curv'
+        ICCAppendUInt32(payload, 0);
+        ICCAppendUInt32(payload, (uint32_t)tableCount);
+        for (i = 0; i < tableCount; i++) {
+            ICCAppendUnit16(payload, table[i]);
+        }
+    }
+    return payload;
+}
+
+- (NSData *)serialize {
+    return [self serializeForVersion:4];
+}
+
 - (void)dealloc {
-    [curvePoints release];
+    free(table);
+    free(inverseTable);
     [super dealloc];
 }
 
@@ -1,8 +1,29 @@
 #version 450
 
+// Shared by both backends; see simple.vert
+
+#ifdef SMALLICCER_GL
+in vec3 fragColor;
+in vec3 fragPosition;
+uniform float alpha;
+uniform int shading; // Nonzero: light triangles by their facet normal
+#else
 layout(location = 0) in vec3 fragColor;
+#endif
+
 layout(location = 0) out vec4 outColor;
 
 void main() {
+#ifdef SMALLICCER_GL
+    vec3 color = fragColor;
+    if (shading != 0) {
+        // Flat facet normal from the screen-space derivatives, lit from
+        // both sides because the surfaces are seen through
+        vec3 normal = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+        color *= 0.45 + 0.55 * abs(dot(normal, normalize(vec3(0.6, 0.7, 0.4))));
+    }
+    outColor = vec4(color, alpha);
+#else
     outColor = vec4(fragColor, 1.0);
+#endif
 }
@@ -1,11 +1,33 @@
 #version 450
 
+// Shared by both backends. The OpenGL path replaces the version line with
+// "#version 330 core" and defines SMALLICCER_GL.
+
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
 
+#ifdef SMALLICCER_GL
+layout(location = 1) in vec3 inColor;
+uniform mat4 mvp;
+uniform vec3 instanceStep; // Offset between instances (zero when not instanced)
+out vec3 fragColor;
+out vec3 fragPosition;     // Lab position, for facet normals
+#else
+layout(push_constant) uniform PushConstants {
+    mat4 mvp;
+    vec4 color; // Model color, set per draw
+} push;
 layout(location = 0) out vec3 fragColor;
+#endif
 
 void main() {
-    gl_Position = vec4(inPosition, 1.0);
+#ifdef SMALLICCER_GL
+    fragPosition = inPosition + instanceStep * float(gl_InstanceID);
+    gl_Position = mvp * vec4(fragPosition, 1.0);
     fragColor = inColor;
+#else
+    gl_Position = push.mvp * vec4(inPosition, 1.0);
+    fragColor = push.color.rgb;
+    // Point lists must write the size; Vulkan has no default
+    gl_PointSize = 1.0;
+#endif
 }
@@ -129,15 +129,15 @@ else
 fi
 
 # Run tests
-run_test "ColorConverter" "color/ColorConverter.m color/ColorSpace.m color/StandardColorSpaces.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+run_test "ColorConverter" "color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 
-run_test "ICCTagEditing" "icc/ICCProfile.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+run_test "ICCTagEditing" "icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 
 run_test "CIELABSpaceModel" "visualization/CIELABSpaceModel.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 
 run_test "SettingsManager" "app/SettingsManager.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 
-run_test "GamutComparator" "visualization/GamutComparator.m visualization/Gamut3DModel.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+run_test "GamutComparator" "visualization/GamutComparator.m visualization/GamutSpatialIndex.m visualization/GamutMeshLOD.m visualization/Gamut3DModel.m icc/ICCProfileIO.m color/GamutHull.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 
 # RenderBackend test - only compile backends that are available
 # Skip Vulkan and Metal for now (they require platform-specific headers)
@@ -161,19 +161,41 @@ if [ -z "$GLU_LIBS" ]; then
         GLU_LIBS="-lGLU"
     fi
 fi
-run_test "RenderBackend" "visualization/RenderBackend.m visualization/OpenGLBackend.m visualization/Gamut3DModel.m visualization/CIELABSpaceModel.m visualization/Renderer3D.m app/SettingsManager.m ../SmallStep/SmallStep/Core/SSPlatform.m" "$COMMON_INCLUDES -I../SmallStep/SmallStep/Core -I../app" "$COMMON_LIBS -lgnustep-gui $OPENGL_LIBS $GLU_LIBS" "$COMMON_CFLAGS"
+# EGL lets the offscreen test render without a display (llvmpipe will do)
+RENDER_CFLAGS="$COMMON_CFLAGS"
+EGL_LIBS=""
+if pkg-config --exists egl 2>/dev/null; then
+    EGL_LIBS=$(pkg-config --libs egl)
+    RENDER_CFLAGS="$RENDER_CFLAGS -DHAVE_EGL=1"
+fi
+run_test "RenderBackend" "visualization/RenderBackend.m visualization/OpenGLBackend.m visualization/GamutMeshLOD.m visualization/Gamut3DModel.m icc/ICCProfileIO.m visualization/CIELABSpaceModel.m visualization/Renderer3D.m app/SettingsManager.m ../SmallStep/SmallStep/Core/SSPlatform.m" "$COMMON_INCLUDES -I../SmallStep/SmallStep/Core -I../app" "$COMMON_LIBS -lgnustep-gui $OPENGL_LIBS $GLU_LIBS $EGL_LIBS" "$RENDER_CFLAGS"
 
 # Tests requiring LittleCMS
 if [ "$HAVE_LCMS" = "1" ]; then
-    run_test "ICCParser" "icc/ICCParser.m icc/ICCProfile.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    run_test "ICCParser" "icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m app/ProfileLibraryScanner.m color/GamutCalculator.m color/GamutHull.m color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m visualization/Gamut3DModel.m visualization/GamutComparator.m visualization/GamutSpatialIndex.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    
+    run_test "ICCWriter" "icc/ICCWriter.m app/ProfileBatchProcessor.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    
+    run_test "GamutCalculator" "color/GamutCalculator.m color/GamutHull.m color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m visualization/Gamut3DModel.m visualization/GamutComparator.m visualization/GamutSpatialIndex.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    
+    run_test "ImageTransformEngine" "color/ImageTransformEngine.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    
+    run_test "ImageGamutAnalyzer" "visualization/ImageGamutAnalyzer.m visualization/GamutSpatialIndex.m visualization/Gamut3DModel.m color/ImageTransformEngine.m color/GamutCalculator.m color/GamutHull.m color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    
+    run_test "DeviceLinkBaker" "color/DeviceLinkBaker.m color/ImageTransformEngine.m icc/ICCWriter.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
     
-    run_test "ICCWriter" "icc/ICCWriter.m icc/ICCParser.m icc/ICCProfile.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    run_test "GamutCache" "visualization/GamutCache.m visualization/GamutMeshLOD.m visualization/Gamut3DModel.m color/GamutCalculator.m color/GamutHull.m color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
     
-    run_test "GamutCalculator" "color/GamutCalculator.m color/ColorConverter.m color/ColorSpace.m color/StandardColorSpaces.m icc/ICCProfile.m icc/ICCParser.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
+    run_test "ProfileLoadPipeline" "app/ProfileLoadPipeline.m visualization/GamutCache.m visualization/GamutMeshLOD.m visualization/Gamut3DModel.m color/GamutCalculator.m color/GamutHull.m color/ColorConverter.m color/ColorTransform.m color/ColorSpace.m color/StandardColorSpaces.m icc/ICCParser.m icc/ICCProfile.m icc/ICCProfileIO.m icc/tags/ICCTag.m icc/tags/ICCTagTRC.m icc/tags/ICCTagMatrix.m icc/tags/ICCTagLUT.m icc/tags/ICCTagMetadata.m" "$COMMON_INCLUDES" "$COMMON_LIBS" "$COMMON_CFLAGS"
 else
     echo "SKIPPED: ICCParser (LittleCMS not available)"
     echo "SKIPPED: ICCWriter (LittleCMS not available)"
     echo "SKIPPED: GamutCalculator (LittleCMS not available)"
+    echo "SKIPPED: ImageTransformEngine (LittleCMS not available)"
+    echo "SKIPPED: ImageGamutAnalyzer (LittleCMS not available)"
+    echo "SKIPPED: DeviceLinkBaker (LittleCMS not available)"
+    echo "SKIPPED: GamutCache (LittleCMS not available)"
+    echo "SKIPPED: ProfileLoadPipeline (LittleCMS not available)"
     echo ""
 fi
 
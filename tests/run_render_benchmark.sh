@@ -0,0 +1,48 @@
+#!/bin/bash
+# Run the headless render benchmark on software rasterizers (Mesa llvmpipe
+# for OpenGL, lavapipe for Vulkan) so frame times can be compared between
+# builds on machines without a GPU or display. Build it first with `make`
+# in the top-level directory. Extra arguments go to SmallICCerRenderBench.
+# Results are written to tests/obj/render_<backend>.json and .csv.
+
+cd "$(dirname "$0")"
+cd ..
+
+BENCH=./obj/SmallICCerRenderBench
+if [ ! -x "$BENCH" ]; then
+    echo "SKIPPED: render benchmark ($BENCH not built)"
+    exit 0
+fi
+mkdir -p tests/obj
+
+# Software OpenGL through an EGL pbuffer, no X server needed
+export LIBGL_ALWAYS_SOFTWARE=1
+export EGL_PLATFORM=${EGL_PLATFORM:-surfaceless}
+
+# Prefer lavapipe over any hardware Vulkan driver for comparable numbers
+LVP_ICD=$(ls /usr/share/vulkan/icd.d/lvp_icd*.json 2>/dev/null | head -1)
+if [ -n "$LVP_ICD" ] && [ -z "$VK_ICD_FILENAMES" ]; then
+    export VK_ICD_FILENAMES="$LVP_ICD"
+    export VK_DRIVER_FILES="$LVP_ICD"
+fi
+
+FAILURES=0
+for backend in opengl vulkan; do
+    if [ "$backend" = "vulkan" ] && [ -z "$VK_ICD_FILENAMES" ]; then
+        echo "SKIPPED: vulkan (lavapipe not installed)"
+        continue
+    fi
+    echo "Running render benchmark ($backend)..."
+    "$BENCH" --backend $backend --models 5 --frames 120 --width 640 --height 360 \
+        --json "tests/obj/render_$backend.json" --csv "tests/obj/render_$backend.csv" "$@"
+    result=$?
+    if [ $result -eq 1 ]; then
+        echo "SKIPPED: $backend (no offscreen device)"
+    elif [ $result -ne 0 ]; then
+        FAILURES=$((FAILURES + 1))
+        echo "FAILED: render benchmark ($backend)"
+    fi
+    echo ""
+done
+
+exit $FAILURES
@@ -11,7 +11,7 @@ FAILURES=0
 TOTAL=0
 
 # Run each test
-for test in test_ColorConverter test_ICCParser test_ICCWriter test_GamutCalculator test_RenderBackend test_CIELABSpaceModel test_ICCTagEditing; do
+for test in test_ColorConverter test_ICCParser test_ICCWriter test_GamutCalculator test_RenderBackend test_CIELABSpaceModel test_ICCTagEditing test_ImageTransformEngine test_ImageGamutAnalyzer test_DeviceLinkBaker test_GamutCache test_ProfileLoadPipeline; do
     if [ -f "./obj/$test" ]; then
         echo "Running $test..."
         TOTAL=$((TOTAL + 1))
@@ -2,11 +2,13 @@
 //  test_ColorConverter.m
 //  SmallICCer Tests
 //
-//  Unit tests for ColorConverter and StandardColorSpaces verification (Task 2.2).
+//  Unit tests for ColorConverter, ColorTransform batch conversion and
+//  StandardColorSpaces verification (Task 2.2).
 //
 
 #import <Foundation/Foundation.h>
 #import "ColorConverter.h"
+#import "ColorTransform.h"
 #import "StandardColorSpaces.h"
 #import "ColorSpace.h"
 #import <math.h>
@@ -165,6 +167,97 @@ int testXYChromaticityToXyz() {
     return 0;
 }
 
+int testColorTransformMatchesScalar() {
+    // Batch RGB -> Lab (odd count exercises the SIMD tail) vs. the scalar per-sample path
+    NSArray *all = [StandardColorSpaces allStandardSpaces];
+    const NSUInteger count = 103;
+    float rgb[103 * 3];
+    float lab[103 * 3];
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        rgb[i * 3 + 0] = (float)(i % 7) / 6.0f;
+        rgb[i * 3 + 1] = (float)((i / 7) % 5) / 4.0f;
+        rgb[i * 3 + 2] = (float)(i % 3) / 2.0f;
+    }
+    for (ColorSpace *cs in all) {
+        ColorTransform *transform = [ColorTransform transformWithColorSpace:cs];
+        [transform convertRGB:rgb toLab:lab count:count];
+        double wp[3];
+        [ColorConverter whitePointXyzFromColorSpace:[cs whitePoint] outXyz:wp];
+        for (i = 0; i < count; i++) {
+            double in[3] = { rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2] };
+            double xyz[3], expected[3];
+            [ColorConverter rgbToXyz:in xyz:xyz primaries:[cs primaries] whitePoint:[cs whitePoint]];
+            [ColorConverter xyzToLab:xyz lab:expected whitePoint:wp];
+            if (fabs(lab[i * 3] - expected[0]) > TOL ||
+                fabs(lab[i * 3 + 1] - expected[1]) > TOL ||
+                fabs(lab[i * 3 + 2] - expected[2]) > TOL) {
+                NSLog(@"ERROR: %@ sample %lu batch Lab (%f,%f,%f) != scalar (%f,%f,%f)", [cs name], (unsigned long)i,
+                      lab[i * 3], lab[i * 3 + 1], lab[i * 3 + 2], expected[0], expected[1], expected[2]);
+                return 1;
+            }
+        }
+    }
+    NSLog(@"PASS: ColorTransform batch RGB to Lab matches scalar path");
+    return 0;
+}
+
+int testColorTransformRoundTripInPlace() {
+    ColorTransform *transform = [ColorTransform transformWithColorSpace:[StandardColorSpaces adobeRGB]];
+    float buf[9 * 3];
+    float orig[9 * 3];
+    NSUInteger i;
+    for (i = 0; i < 9 * 3; i++) {
+        orig[i] = buf[i] = (float)((i * 5) % 11) / 10.0f;
+    }
+    [transform convertRGB:buf toXYZ:buf count:9];
+    [transform convertXYZ:buf toRGB:buf count:9];
+    for (i = 0; i < 9 * 3; i++) {
+        if (fabs(buf[i] - orig[i]) > TOL_STRICT) {
+            NSLog(@"ERROR: ColorTransform in-place round-trip component %lu: %f != %f", (unsigned long)i, buf[i], orig[i]);
+            return 1;
+        }
+    }
+    NSLog(@"PASS: ColorTransform in-place RGB -> XYZ -> RGB round-trip");
+    return 0;
+}
+
+int testXYZToRGBClampingMatches() {
+    // Out-of-gamut XYZ (negative and >1 channels) through the scalar and batch paths
+    static const float samples[5][3] = {
+        {0.0f, 0.0f, 0.0f}, {0.9505f, 1.0f, 1.089f}, {0.8f, 0.2f, 0.05f}, {0.1f, 0.6f, 0.05f}, {1.5f, 1.6f, 1.9f}
+    };
+    NSArray *all = [StandardColorSpaces allStandardSpaces];
+    float xyz[5 * 3];
+    float rgb[5 * 3];
+    NSUInteger i, c;
+    for (i = 0; i < 5 * 3; i++) {
+        xyz[i] = samples[i / 3][i % 3];
+    }
+    for (ColorSpace *cs in all) {
+        ColorTransform *transform = [ColorTransform transformWithColorSpace:cs];
+        [transform convertXYZ:xyz toRGB:rgb count:5];
+        for (i = 0; i < 5; i++) {
+            double in[3] = { xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2] };
+            double expected[3];
+            [ColorConverter xyzToRgb:in rgb:expected primaries:[cs primaries] whitePoint:[cs whitePoint]];
+            for (c = 0; c < 3; c++) {
+                float v = rgb[i * 3 + c];
+                if (v < 0.0f || v > 1.0f || expected[c] < 0.0 || expected[c] > 1.0) {
+                    NSLog(@"ERROR: %@ sample %lu not clamped: batch %f scalar %f", [cs name], (unsigned long)i, v, expected[c]);
+                    return 1;
+                }
+                if (fabs(v - expected[c]) > TOL) {
+                    NSLog(@"ERROR: %@ sample %lu batch RGB %f != scalar %f", [cs name], (unsigned long)i, v, expected[c]);
+                    return 1;
+                }
+            }
+        }
+    }
+    NSLog(@"PASS: Scalar and batch XYZ to RGB clamp out-of-gamut input identically");
+    return 0;
+}
+
 int main(int argc, const char * argv[]) {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
@@ -177,6 +270,9 @@ int main(int argc, const char * argv[]) {
     failures += testStandardColorSpacesExist();
     failures += testRoundTripEachStandardSpace();
     failures += testXYChromaticityToXyz();
+    failures += testColorTransformMatchesScalar();
+    failures += testColorTransformRoundTripInPlace();
+    failures += testXYZToRGBClampingMatches();
     
     if (failures == 0) {
         NSLog(@"All tests passed!");
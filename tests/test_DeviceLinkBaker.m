@@ -0,0 +1,177 @@
+//
+//  test_DeviceLinkBaker.m
+//  SmallICCer Tests
+//
+//  Unit tests for device link baking
+//
+
+#import <Foundation/Foundation.h>
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "ICCWriter.h"
+#import "DeviceLinkBaker.h"
+#import <math.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+int testDeviceLinkBaker() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *wide = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    ICCProfile *narrow = [parser parseProfileFromData:makeRGBProfileData(0.3000, 0.6000) error:&error];
+    [parser release];
+    if (!wide || !narrow) {
+        NSLog(@"ERROR: Failed to parse generated RGB profiles");
+        return 1;
+    }
+    
+    DeviceLinkBaker *tooFine = [[DeviceLinkBaker alloc] initWithSourceProfile:wide destinationProfile:narrow
+                                                                       intent:1 gridPoints:300 error:&error];
+    if (tooFine || [error code] != 2) {
+        NSLog(@"ERROR: A 300-point grid should be rejected");
+        [tooFine release];
+        return 1;
+    }
+    
+    const NSUInteger n = 17;
+    DeviceLinkBaker *baker = [[DeviceLinkBaker alloc] initWithSourceProfile:wide destinationProfile:narrow
+                                                                     intent:1 gridPoints:n error:&error];
+    if (!baker || ![baker bakeWithError:&error]) {
+        NSLog(@"ERROR: Baking failed: %@", [error localizedDescription]);
+        [baker release];
+        return 1;
+    }
+    if ([[baker table] length] != n * n * n * 3 * sizeof(float)) {
+        NSLog(@"ERROR: Unexpected table size %lu", (unsigned long)[[baker table] length]);
+        [baker release];
+        return 1;
+    }
+    
+    // Reference: the direct float transform at every node
+    cmsHPROFILE hWide = cmsOpenProfileFromMem([[wide profileData] bytes], (cmsUInt32Number)[[wide profileData] length]);
+    cmsHPROFILE hNarrow = cmsOpenProfileFromMem([[narrow profileData] bytes], (cmsUInt32Number)[[narrow profileData] length]);
+    cmsHTRANSFORM direct = cmsCreateTransform(hWide, TYPE_RGB_FLT, hNarrow, TYPE_RGB_FLT,
+                                              INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE);
+    cmsCloseProfile(hWide);
+    cmsCloseProfile(hNarrow);
+    
+    // The DeviceLink written through ICCWriter must reproduce the nodes
+    ICCProfile *link = [baker deviceLinkProfileWithDescription:@"Wide to narrow" copyright:@"Public domain" error:&error];
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    NSData *linkData = link ? [writer dataForProfile:link error:&error] : nil;
+    [writer release];
+    cmsHPROFILE hLink = linkData ? cmsOpenProfileFromMem([linkData bytes], (cmsUInt32Number)[linkData length]) : NULL;
+    cmsHTRANSFORM linked = hLink ? cmsCreateTransform(hLink, TYPE_RGB_FLT, NULL, TYPE_RGB_FLT,
+                                                      INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOCACHE) : NULL;
+    
+    int result = 0;
+    if (!linked || cmsGetDeviceClass(hLink) != cmsSigLinkClass) {
+        NSLog(@"ERROR: Written DeviceLink is not usable: %@", error ? [error localizedDescription] : @"LittleCMS rejected it");
+        result = 1;
+    }
+    
+    const float *table = (const float *)[[baker table] bytes];
+    NSUInteger r, g, b, k;
+    for (r = 0; r < n && result == 0; r += 4) {
+        for (g = 0; g < n && result == 0; g += 3) {
+            for (b = 0; b < n && result == 0; b += 5) {
+                float in[3] = {(float)r / (n - 1), (float)g / (n - 1), (float)b / (n - 1)};
+                float expected[3], viaLink[3];
+                cmsDoTransform(direct, in, expected, 1);
+                cmsDoTransform(linked, in, viaLink, 1);
+                const float *node = table + ((r * n + g) * n + b) * 3;
+                for (k = 0; k < 3; k++) {
+                    float clamped = fminf(fmaxf(expected[k], 0.0f), 1.0f);
+                    if (fabsf(node[k] - clamped) > 1e-4f || fabsf(viaLink[k] - clamped) > 1e-3f) {
+                        NSLog(@"ERROR: Node (%lu,%lu,%lu) channel %lu: baked %f, link %f, direct %f",
+                              (unsigned long)r, (unsigned long)g, (unsigned long)b, (unsigned long)k,
+                              node[k], viaLink[k], clamped);
+                        result = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    if (linked) cmsDeleteTransform(linked);
+    if (hLink) cmsCloseProfile(hLink);
+    cmsDeleteTransform(direct);
+    
+    // .cube: header lines then one line per node, red fastest
+    if (result == 0) {
+        NSData *cube = [baker cubeDataWithTitle:@"Wide to narrow" error:&error];
+        NSString *text = cube ? [[[NSString alloc] initWithData:cube encoding:NSASCIIStringEncoding] autorelease] : nil;
+        NSArray *lines = [[text stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]]
+                          componentsSeparatedByString:@"\n"];
+        const float *second = table + (1 * n * n) * 3; // r = 1, g = 0, b = 0
+        NSString *expectedSecond = [NSString stringWithFormat:@"%.6f %.6f %.6f", second[0], second[1], second[2]];
+        if ([lines count] != 4 + n * n * n || ![[lines objectAtIndex:1] isEqualToString:@"LUT_3D_SIZE 17"] ||
+            ![[lines objectAtIndex:5] isEqualToString:expectedSecond]) {
+            NSLog(@"ERROR: Unexpected .cube layout (%lu lines)", (unsigned long)[lines count]);
+            result = 1;
+        }
+    }
+    [baker release];
+    
+    if (result == 0) {
+        NSLog(@"PASS: Baked device link matches the direct transform as table, DeviceLink and .cube");
+    }
+    return result;
+}
+#else
+int testDeviceLinkBaker() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
+int main(int argc, const char * argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    int failures = 0;
+    failures += testDeviceLinkBaker();
+    
+    if (failures == 0) {
+        NSLog(@"All device link baker tests passed!");
+    } else {
+        NSLog(@"%d test(s) failed", failures);
+    }
+    
+    [pool release];
+    return failures;
+}
@@ -0,0 +1,202 @@
+//
+//  test_GamutCache.m
+//  SmallICCer Tests
+//
+//  Unit tests for the gamut model cache
+//
+
+#import <Foundation/Foundation.h>
+#import "GamutCache.h"
+#import "Gamut3DModel.h"
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "StandardColorSpaces.h"
+#import <unistd.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+int testGamutCacheReusesModels() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    ICCProfile *sameBytes = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    ICCProfile *other = [parser parseProfileFromData:makeRGBProfileData(0.3000, 0.6000) error:&error];
+    [parser release];
+    if (!profile || !sameBytes || !other) {
+        NSLog(@"ERROR: Failed to parse generated RGB profiles");
+        return 1;
+    }
+    
+    GamutCache *cache = [[GamutCache alloc] init];
+    Gamut3DModel *first = [cache gamutForProfile:profile resolution:9];
+    if ([first pointCount] != 9 * 9 * 9 || [first triangleCount] == 0) {
+        NSLog(@"ERROR: Cached profile gamut should hold the 9^3 lattice and its hull");
+        [cache release];
+        return 1;
+    }
+    // Same bytes in another profile object hit; other bytes or resolution miss
+    if ([cache gamutForProfile:sameBytes resolution:9] != first) {
+        NSLog(@"ERROR: Profile with identical bytes should reuse the cached model");
+        [cache release];
+        return 1;
+    }
+    if ([cache gamutForProfile:other resolution:9] == first || [cache gamutForProfile:profile resolution:5] == first) {
+        NSLog(@"ERROR: Different profile bytes or resolution must not share a model");
+        [cache release];
+        return 1;
+    }
+    // StandardColorSpaces hands out new objects; the key is their content
+    Gamut3DModel *space = [cache gamutForColorSpace:[StandardColorSpaces sRGB] resolution:9];
+    if ([cache gamutForColorSpace:[StandardColorSpaces sRGB] resolution:9] != space ||
+        [cache gamutForColorSpace:[StandardColorSpaces adobeRGB] resolution:9] == space) {
+        NSLog(@"ERROR: Color space gamuts should be keyed by primaries and white point");
+        [cache release];
+        return 1;
+    }
+    if ([cache count] != 5) {
+        NSLog(@"ERROR: Expected 5 cached gamuts, got %lu", (unsigned long)[cache count]);
+        [cache release];
+        return 1;
+    }
+    
+    // Shrinking the limit evicts least recently used entries first
+    [cache gamutForProfile:profile resolution:9];
+    [cache setMemoryLimit:[[first labData] length] + [[first triangleData] length]];
+    if ([cache count] != 1 || [cache memoryUsed] > [cache memoryLimit] ||
+        [cache gamutForProfile:profile resolution:9] != first) {
+        NSLog(@"ERROR: LRU eviction should keep only the most recently used gamut");
+        [cache release];
+        return 1;
+    }
+    [cache release];
+    
+    NSLog(@"PASS: Gamut cache reuses models by content and resolution with LRU eviction");
+    return 0;
+}
+
+int testGamutCacheDiskRoundTrip() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    [parser release];
+    if (!profile) {
+        NSLog(@"ERROR: Failed to parse generated RGB profile");
+        return 1;
+    }
+    NSString *dir = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                     [NSString stringWithFormat:@"test_gamut_cache_%d", (int)getpid()]];
+    [[NSFileManager defaultManager] createDirectoryAtPath:dir withIntermediateDirectories:YES attributes:nil error:NULL];
+    
+    GamutCache *cold = [[GamutCache alloc] init];
+    [cold setDiskDirectory:dir];
+    Gamut3DModel *computed = [[cold gamutForProfile:profile resolution:9] retain];
+    [cold release];
+    NSString *path = [dir stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"%016llx-9.gamut",
+                       (unsigned long long)[GamutCache contentHashForProfile:profile]]];
+    int result = 0;
+    if (![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+        NSLog(@"ERROR: Gamut file was not written to %@", path);
+        result = 1;
+    }
+    
+    // A fresh cache maps the file; buffers outlive the cache that loaded them
+    GamutCache *warm = [[GamutCache alloc] init];
+    [warm setDiskDirectory:dir];
+    Gamut3DModel *loaded = [[warm gamutForProfile:profile resolution:9] retain];
+    [warm release];
+    if (result == 0 && (![[loaded labData] isEqualToData:[computed labData]] ||
+                        ![[loaded triangleData] isEqualToData:[computed triangleData]])) {
+        NSLog(@"ERROR: Mapped gamut file differs from the computed gamut");
+        result = 1;
+    }
+    
+    // Wrong resolution or truncated files are rejected
+    if (result == 0 && [[[Gamut3DModel alloc] initWithContentsOfMappedFile:path
+                                                               contentHash:[GamutCache contentHashForProfile:profile]
+                                                                resolution:17
+                                                                      name:@"Profile"
+                                                                     error:&error] autorelease]) {
+        NSLog(@"ERROR: Gamut file loaded for the wrong resolution");
+        result = 1;
+    }
+    NSData *file = [NSData dataWithContentsOfFile:path];
+    [[file subdataWithRange:NSMakeRange(0, [file length] - 4)] writeToFile:path atomically:YES];
+    if (result == 0 && [[[Gamut3DModel alloc] initWithContentsOfMappedFile:path
+                                                               contentHash:[GamutCache contentHashForProfile:profile]
+                                                                resolution:9
+                                                                      name:@"Profile"
+                                                                     error:&error] autorelease]) {
+        NSLog(@"ERROR: Truncated gamut file should be rejected");
+        result = 1;
+    }
+    
+    [computed release];
+    [loaded release];
+    [[NSFileManager defaultManager] removeItemAtPath:dir error:NULL];
+    if (result == 0) NSLog(@"PASS: Gamut cache persists profile gamuts as mappable files");
+    return result;
+}
+#else
+int testGamutCacheReusesModels() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testGamutCacheDiskRoundTrip() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
+int main(int argc, const char * argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    int failures = 0;
+    failures += testGamutCacheReusesModels();
+    failures += testGamutCacheDiskRoundTrip();
+    
+    if (failures == 0) {
+        NSLog(@"All gamut cache tests passed!");
+    } else {
+        NSLog(@"%d test(s) failed", failures);
+    }
+    
+    [pool release];
+    return failures;
+}
@@ -7,10 +7,13 @@
 
 #import <Foundation/Foundation.h>
 #import "GamutCalculator.h"
+#import "Gamut3DModel.h"
+#import "GamutComparator.h"
 #import "ICCProfile.h"
 #import "ICCParser.h"
 #import "StandardColorSpaces.h"
 #import "ColorSpace.h"
+#import <math.h>
 
 int testGamutCalculatorInitialization() {
     GamutCalculator *calculator = [[GamutCalculator alloc] init];
@@ -116,6 +119,196 @@ int testComputeGamutForProfile() {
     return 0;
 }
 
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+static double maxChroma(NSData *packed) {
+    NSUInteger i, count = [packed length] / (3 * sizeof(float));
+    const float *lab = (const float *)[packed bytes];
+    double best = 0.0;
+    for (i = 0; i < count; i++) {
+        double c = sqrt(lab[i * 3 + 1] * lab[i * 3 + 1] + lab[i * 3 + 2] * lab[i * 3 + 2]);
+        if (c > best) best = c;
+    }
+    return best;
+}
+
+int testComputeGamutForProfileUsesProfile() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *narrow = [parser parseProfileFromData:makeRGBProfileData(0.3000, 0.6000) error:&error];
+    ICCProfile *wide = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    [parser release];
+    if (!narrow || !wide) {
+        NSLog(@"ERROR: Failed to parse generated RGB profiles");
+        return 1;
+    }
+    
+    GamutCalculator *calculator = [[GamutCalculator alloc] init];
+    [calculator setResolution:9];
+    NSData *narrowLab = [calculator computePackedGamutForProfile:narrow];
+    NSData *wideLab = [calculator computePackedGamutForProfile:wide];
+    [calculator release];
+    
+    if ([narrowLab length] != 9 * 9 * 9 * 3 * sizeof(float)) {
+        NSLog(@"ERROR: Expected 9^3 lattice points, got %lu", (unsigned long)([narrowLab length] / (3 * sizeof(float))));
+        return 1;
+    }
+    
+    // Last lattice point is device white: L* ~ 100, a* ~ b* ~ 0 (relative colorimetric, D50)
+    const float *lab = (const float *)[narrowLab bytes];
+    NSUInteger last = 9 * 9 * 9 - 1;
+    if (fabs(lab[last * 3] - 100.0) > 0.5 || fabs(lab[last * 3 + 1]) > 0.5 || fabs(lab[last * 3 + 2]) > 0.5) {
+        NSLog(@"ERROR: Device white should map to Lab (100,0,0), got (%f,%f,%f)",
+              lab[last * 3], lab[last * 3 + 1], lab[last * 3 + 2]);
+        return 1;
+    }
+    
+    // A wider green primary must produce a gamut with more chroma
+    if (maxChroma(wideLab) <= maxChroma(narrowLab)) {
+        NSLog(@"ERROR: Wide-gamut profile chroma %f should exceed narrow %f", maxChroma(wideLab), maxChroma(narrowLab));
+        return 1;
+    }
+    
+    NSLog(@"PASS: Gamut computation follows the profile transform and lattice resolution");
+    return 0;
+}
+
+int testStandardSpaceMatchesProfileGamut() {
+    // sRGB from LittleCMS (D50 PCS) and the built-in D65 sRGB space must
+    // describe the same gamut once the space is adapted to D50
+    cmsHPROFILE hProfile = cmsCreate_sRGBProfile();
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:data error:&error];
+    [parser release];
+    if (!profile) {
+        NSLog(@"ERROR: Failed to parse the LittleCMS sRGB profile");
+        return 1;
+    }
+    
+    GamutCalculator *calculator = [[GamutCalculator alloc] init];
+    [calculator setResolution:17];
+    NSData *profileLab = [calculator computePackedGamutForProfile:profile];
+    NSData *spaceLab = [calculator computePackedGamutForColorSpace:[StandardColorSpaces sRGB]];
+    Gamut3DModel *profileModel = [[Gamut3DModel alloc] initWithLabData:profileLab
+        triangles:[calculator computeConvexHullTrianglesForPackedLab:profileLab] name:@"sRGB profile"];
+    Gamut3DModel *spaceModel = [[Gamut3DModel alloc] initWithLabData:spaceLab
+        triangles:[calculator computeConvexHullTrianglesForPackedLab:spaceLab] name:@"sRGB"];
+    [calculator release];
+    
+    // Space white (last lattice point) lands on the D50 white like the profile's
+    const float *lab = (const float *)[spaceLab bytes];
+    NSUInteger last = 17 * 17 * 17 - 1;
+    int result = 0;
+    if (fabs(lab[last * 3] - 100.0) > 0.5 || fabs(lab[last * 3 + 1]) > 0.5 || fabs(lab[last * 3 + 2]) > 0.5) {
+        NSLog(@"ERROR: sRGB space white should map to D50 Lab (100,0,0), got (%f,%f,%f)",
+              lab[last * 3], lab[last * 3 + 1], lab[last * 3 + 2]);
+        result = 1;
+    }
+    
+    GamutComparator *comparator = [[GamutComparator alloc] init];
+    double coverage = [comparator computeCoverage:profileModel by:spaceModel];
+    double reverse = [comparator computeCoverage:spaceModel by:profileModel];
+    [comparator release];
+    [profileModel release];
+    [spaceModel release];
+    if (result == 0 && (coverage < 0.98 || reverse < 0.98)) {
+        NSLog(@"ERROR: sRGB profile and sRGB space should cover each other, got %f and %f", coverage, reverse);
+        result = 1;
+    }
+    if (result == 0) NSLog(@"PASS: sRGB space gamut matches the sRGB profile gamut in D50 Lab");
+    return result;
+}
+
+int testParallelGamutMatchesSerial() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    [parser release];
+    if (!profile) {
+        NSLog(@"ERROR: Failed to parse generated RGB profile");
+        return 1;
+    }
+    
+    // 33^3 is above the parallel threshold; 33 planes do not divide evenly into slabs
+    GamutCalculator *calculator = [[GamutCalculator alloc] init];
+    [calculator setResolution:33];
+    [calculator setWorkerCount:1];
+    NSData *serialProfile = [calculator computePackedGamutForProfile:profile];
+    NSData *serialSpace = [calculator computePackedGamutForColorSpace:[StandardColorSpaces displayP3]];
+    [calculator setWorkerCount:4];
+    NSData *parallelProfile = [calculator computePackedGamutForProfile:profile];
+    NSData *parallelSpace = [calculator computePackedGamutForColorSpace:[StandardColorSpaces displayP3]];
+    [calculator release];
+    
+    if ([serialProfile length] != 33 * 33 * 33 * 3 * sizeof(float)) {
+        NSLog(@"ERROR: Unexpected serial gamut size %lu", (unsigned long)[serialProfile length]);
+        return 1;
+    }
+    if (![serialProfile isEqualToData:parallelProfile]) {
+        NSLog(@"ERROR: Parallel LittleCMS gamut differs from serial result");
+        return 1;
+    }
+    // Slab boundaries shift which samples take the SIMD or scalar path, so allow float noise
+    if ([serialSpace length] != [parallelSpace length]) {
+        NSLog(@"ERROR: Parallel color space gamut size differs from serial result");
+        return 1;
+    }
+    const float *a = (const float *)[serialSpace bytes];
+    const float *b = (const float *)[parallelSpace bytes];
+    NSUInteger i;
+    for (i = 0; i < [serialSpace length] / sizeof(float); i++) {
+        if (fabs(a[i] - b[i]) > 1e-3) {
+            NSLog(@"ERROR: Parallel color space gamut differs from serial at %lu: %f vs %f",
+                  (unsigned long)i, a[i], b[i]);
+            return 1;
+        }
+    }
+    
+    NSLog(@"PASS: Parallel slab evaluation matches serial gamut");
+    return 0;
+}
+
 int testComputeGamutForColorSpace() {
     GamutCalculator *calculator = [[GamutCalculator alloc] init];
     
@@ -155,6 +348,45 @@ int testComputeGamutForColorSpace() {
     return 0;
 }
 
+int testComputePackedGamutForColorSpace() {
+    GamutCalculator *calculator = [[GamutCalculator alloc] init];
+    ColorSpace *sRGB = [StandardColorSpaces sRGB];
+    
+    NSData *packed = [calculator computePackedGamutForColorSpace:sRGB];
+    NSArray *boxed = [calculator computeGamutForColorSpace:sRGB];
+    
+    if (!packed || [packed length] == 0) {
+        NSLog(@"ERROR: Packed gamut should have points");
+        [calculator release];
+        return 1;
+    }
+    
+    NSUInteger count = [packed length] / (3 * sizeof(float));
+    if (count != [boxed count]) {
+        NSLog(@"ERROR: Packed count %lu != boxed count %lu", (unsigned long)count, (unsigned long)[boxed count]);
+        [calculator release];
+        return 1;
+    }
+    
+    // Packed and boxed views must agree point for point
+    const float *lab = (const float *)[packed bytes];
+    NSUInteger i;
+    for (i = 0; i < count; i += 97) {
+        NSArray *point = [boxed objectAtIndex:i];
+        if (fabs([[point objectAtIndex:0] doubleValue] - lab[i * 3]) > 1e-4 ||
+            fabs([[point objectAtIndex:1] doubleValue] - lab[i * 3 + 1]) > 1e-4 ||
+            fabs([[point objectAtIndex:2] doubleValue] - lab[i * 3 + 2]) > 1e-4) {
+            NSLog(@"ERROR: Packed point %lu differs from boxed point", (unsigned long)i);
+            [calculator release];
+            return 1;
+        }
+    }
+    
+    [calculator release];
+    NSLog(@"PASS: Packed gamut computation for color space");
+    return 0;
+}
+
 int testSampleRGBSpace() {
     GamutCalculator *calculator = [[GamutCalculator alloc] init];
     
@@ -203,11 +435,31 @@ int testComputeGamutForProfile() {
     return 0;
 }
 
+int testComputeGamutForProfileUsesProfile() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testStandardSpaceMatchesProfileGamut() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testParallelGamutMatchesSerial() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
 int testComputeGamutForColorSpace() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
 }
 
+int testComputePackedGamutForColorSpace() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
 int testSampleRGBSpace() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
@@ -220,7 +472,11 @@ int main(int argc, const char * argv[]) {
     int failures = 0;
     failures += testGamutCalculatorInitialization();
     failures += testComputeGamutForProfile();
+    failures += testComputeGamutForProfileUsesProfile();
+    failures += testStandardSpaceMatchesProfileGamut();
+    failures += testParallelGamutMatchesSerial();
     failures += testComputeGamutForColorSpace();
+    failures += testComputePackedGamutForColorSpace();
     failures += testSampleRGBSpace();
     
     if (failures == 0) {
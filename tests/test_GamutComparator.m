@@ -2,12 +2,16 @@
 //  test_GamutComparator.m
 //  SmallICCer Tests
 //
-//  Unit tests for GamutComparator (volume, volume difference, overlap).
+//  Unit tests for GamutComparator (volume, volume difference, overlap)
+//  and the GamutHull boundary meshes and their levels of detail.
 //
 
 #import <Foundation/Foundation.h>
 #import "GamutComparator.h"
 #import "Gamut3DModel.h"
+#import "GamutHull.h"
+#import "GamutSpatialIndex.h"
+#import "GamutMeshLOD.h"
 #import <math.h>
 
 static NSArray *makeVertices(double minL, double maxL, double minA, double maxA, double minB, double maxB) {
@@ -39,7 +43,7 @@ int testComputeVolume() {
         return 1;
     }
     if (vol != (50 - 0) * (50 - (-50)) * (50 - (-50))) {
-        NSLog(@"ERROR: volume should be bounding box L*50 * a*100 * b*100, got %f", vol);
+        NSLog(@"ERROR: hull volume of the box should be L*50 * a*100 * b*100, got %f", vol);
         return 1;
     }
     NSLog(@"PASS: computeVolume");
@@ -100,6 +104,381 @@ int testFindOverlap() {
     return 0;
 }
 
+int testPackedLabData() {
+    NSArray *verts = makeVertices(0, 50, -50, 50, -50, 50);
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithVertices:verts faces:nil name:@"Packed"];
+    if ([model pointCount] != [verts count]) {
+        NSLog(@"ERROR: pointCount should match vertex count, got %lu", (unsigned long)[model pointCount]);
+        [model release];
+        return 1;
+    }
+    const float *pts = [model labPoints];
+    NSArray *last = [verts lastObject];
+    NSUInteger n = [model pointCount] - 1;
+    if (pts[n * 3] != [[last objectAtIndex:0] floatValue] ||
+        pts[n * 3 + 1] != [[last objectAtIndex:1] floatValue] ||
+        pts[n * 3 + 2] != [[last objectAtIndex:2] floatValue]) {
+        NSLog(@"ERROR: packed Lab data does not match vertices");
+        [model release];
+        return 1;
+    }
+    
+    Gamut3DModel *copy = [[Gamut3DModel alloc] initWithLabData:[model labData] faces:nil name:@"Copy"];
+    if ([[copy vertices] count] != [verts count]) {
+        NSLog(@"ERROR: vertices compatibility view should rebuild from packed data");
+        [copy release];
+        [model release];
+        return 1;
+    }
+    [copy release];
+    [model release];
+    NSLog(@"PASS: packed Lab data / vertices view");
+    return 0;
+}
+
+// Signed volume enclosed by outward triangles (divergence theorem)
+static double meshVolume(const float *pts, NSData *triangles) {
+    NSUInteger i, count = [triangles length] / (3 * sizeof(uint32_t));
+    const uint32_t *idx = (const uint32_t *)[triangles bytes];
+    double volume = 0.0;
+    for (i = 0; i < count; i++) {
+        const float *a = pts + idx[i * 3] * 3;
+        const float *b = pts + idx[i * 3 + 1] * 3;
+        const float *c = pts + idx[i * 3 + 2] * 3;
+        volume += a[0] * (b[1] * c[2] - b[2] * c[1])
+                - a[1] * (b[0] * c[2] - b[2] * c[0])
+                + a[2] * (b[0] * c[1] - b[1] * c[0]);
+    }
+    return volume / 6.0;
+}
+
+int testConvexHullOfLattice() {
+    // 6 x 11 x 11 grid: most points are interior or coplanar with a side
+    NSArray *verts = makeVertices(0, 50, -50, 50, -50, 50);
+    NSData *lab = [Gamut3DModel labDataFromVertices:verts];
+    const float *pts = (const float *)[lab bytes];
+    NSUInteger pointCount = [verts count];
+    NSData *triangles = [GamutHull convexHullTrianglesForPoints:pts count:pointCount];
+    NSUInteger triangleCount = [triangles length] / (3 * sizeof(uint32_t));
+    if (triangleCount < 12) {
+        NSLog(@"ERROR: hull of a box needs at least 12 triangles, got %lu", (unsigned long)triangleCount);
+        return 1;
+    }
+    double volume = meshVolume(pts, triangles);
+    if (fabs(volume - 50.0 * 100.0 * 100.0) > 1e-3) {
+        NSLog(@"ERROR: hull volume should be 500000, got %f", volume);
+        return 1;
+    }
+    
+    // Every point must lie on or below every face plane
+    const uint32_t *idx = (const uint32_t *)[triangles bytes];
+    NSUInteger t, p;
+    for (t = 0; t < triangleCount; t++) {
+        const float *a = pts + idx[t * 3] * 3;
+        const float *b = pts + idx[t * 3 + 1] * 3;
+        const float *c = pts + idx[t * 3 + 2] * 3;
+        double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        double w[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        double n[3] = {u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0]};
+        double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (p = 0; p < pointCount; p++) {
+            const float *q = pts + p * 3;
+            double dist = (n[0] * (q[0] - a[0]) + n[1] * (q[1] - a[1]) + n[2] * (q[2] - a[2])) / len;
+            if (dist > 1e-3) {
+                NSLog(@"ERROR: point %lu lies outside hull face %lu by %f", (unsigned long)p, (unsigned long)t, dist);
+                return 1;
+            }
+        }
+    }
+    
+    float flat[4 * 3] = {0, 0, 0, 10, 0, 0, 0, 10, 0, 10, 10, 0};
+    if ([[GamutHull convexHullTrianglesForPoints:flat count:4] length] != 0) {
+        NSLog(@"ERROR: hull of coplanar points should be empty");
+        return 1;
+    }
+    NSLog(@"PASS: convex hull of lattice (%lu triangles)", (unsigned long)triangleCount);
+    return 0;
+}
+
+int testSegmentMaximaBoundary() {
+    NSArray *verts = makeVertices(0, 100, -50, 50, -50, 50);
+    NSData *lab = [Gamut3DModel labDataFromVertices:verts];
+    const float *pts = (const float *)[lab bytes];
+    float center[3] = {50.0f, 0.0f, 0.0f};
+    NSData *triangles = [GamutHull segmentMaximaTrianglesForPoints:pts count:[verts count] center:center
+                                                       hueSegments:36 elevationSegments:18];
+    NSUInteger i, count = [triangles length] / sizeof(uint32_t);
+    if (count == 0) {
+        NSLog(@"ERROR: segment maxima descriptor produced no triangles");
+        return 1;
+    }
+    const uint32_t *idx = (const uint32_t *)[triangles bytes];
+    for (i = 0; i < count; i++) {
+        if (idx[i] >= [verts count]) {
+            NSLog(@"ERROR: descriptor index %u out of range", idx[i]);
+            return 1;
+        }
+    }
+    // Inscribed in the box, so no larger than it and not far below it
+    double volume = meshVolume(pts, triangles);
+    double hullVolume = 100.0 * 100.0 * 100.0;
+    if (volume <= 0.8 * hullVolume || volume > hullVolume + 1e-3) {
+        NSLog(@"ERROR: descriptor volume %f out of range for box %f", volume, hullVolume);
+        return 1;
+    }
+    NSLog(@"PASS: segment maxima boundary (%lu triangles)", (unsigned long)(count / 3));
+    return 0;
+}
+
+int testModelTriangleData() {
+    NSArray *verts = makeVertices(0, 50, -50, 50, -50, 50);
+    NSData *lab = [Gamut3DModel labDataFromVertices:verts];
+    NSData *triangles = [GamutHull convexHullTrianglesForPoints:(const float *)[lab bytes] count:[verts count]];
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:lab triangles:triangles name:@"Hull"];
+    if ([model triangleCount] * 3 * sizeof(uint32_t) != [triangles length] ||
+        [[model faces] count] != [model triangleCount]) {
+        NSLog(@"ERROR: faces view should match packed triangles");
+        [model release];
+        return 1;
+    }
+    NSArray *firstFace = [[model faces] objectAtIndex:0];
+    if ([[firstFace objectAtIndex:2] unsignedIntValue] != [model triangleIndices][2]) {
+        NSLog(@"ERROR: faces view indices do not match packed triangles");
+        [model release];
+        return 1;
+    }
+    NSUInteger revision = [model revision];
+    [model setFaces:[NSArray arrayWithObject:firstFace]];
+    if ([model triangleCount] != 1) {
+        NSLog(@"ERROR: setFaces should repack triangle data");
+        [model release];
+        return 1;
+    }
+    NSUInteger colorRevision = [model colorRevision];
+    [model setColorRed:1.0f green:0.0f blue:0.0f];
+    if ([model revision] != revision + 1) {
+        NSLog(@"ERROR: Geometry setters should bump the model revision, color should not");
+        [model release];
+        return 1;
+    }
+    if ([model colorRevision] != colorRevision + 1) {
+        NSLog(@"ERROR: setColorRed:green:blue: should bump the color revision");
+        [model release];
+        return 1;
+    }
+    [model release];
+    NSLog(@"PASS: Gamut3DModel triangle data / faces view / revision");
+    return 0;
+}
+
+int testIntersectionAndCoverage() {
+    GamutComparator *comp = [[GamutComparator alloc] init];
+    // Boxes L*[0,50] and L*[20,70] over the same a*/b* square: they share L*[20,50]
+    NSArray *v1 = makeVertices(0, 50, -50, 50, -50, 50);
+    NSArray *v2 = makeVertices(20, 70, -50, 50, -50, 50);
+    Gamut3DModel *m1 = [[Gamut3DModel alloc] initWithVertices:v1 faces:nil name:@"A"];
+    Gamut3DModel *m2 = [[Gamut3DModel alloc] initWithVertices:v2 faces:nil name:@"B"];
+    double inter = [comp computeIntersectionVolume:m1 and:m2];
+    double uni = [comp computeUnionVolume:m1 and:m2];
+    double coverage = [comp computeCoverage:m1 by:m2];
+    double selfCoverage = [comp computeCoverage:m1 by:m1];
+    [m1 release];
+    [m2 release];
+    [comp release];
+    
+    if (fabs(inter - 300000.0) > 300.0) {
+        NSLog(@"ERROR: intersection volume should be 300000, got %f", inter);
+        return 1;
+    }
+    if (fabs(uni - 700000.0) > 700.0) {
+        NSLog(@"ERROR: union volume should be 700000, got %f", uni);
+        return 1;
+    }
+    if (fabs(coverage - 0.6) > 1e-3 || fabs(selfCoverage - 1.0) > 1e-3) {
+        NSLog(@"ERROR: coverage should be 0.6 (self 1.0), got %f (self %f)", coverage, selfCoverage);
+        return 1;
+    }
+    NSLog(@"PASS: intersection, union and coverage volumes");
+    return 0;
+}
+
+int testComputeVolumeFromTriangles() {
+    // Right tetrahedron with legs 6: volume 36, given as an explicit mesh
+    float corners[4 * 3] = {0, 0, 0, 6, 0, 0, 0, 6, 0, 0, 0, 6};
+    uint32_t faces[4 * 3] = {0, 2, 1, 0, 1, 3, 0, 3, 2, 1, 2, 3};
+    NSData *lab = [NSData dataWithBytes:corners length:sizeof(corners)];
+    NSData *triangles = [NSData dataWithBytes:faces length:sizeof(faces)];
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:lab triangles:triangles name:@"Tetra"];
+    GamutComparator *comp = [[GamutComparator alloc] init];
+    double vol = [comp computeVolume:model];
+    [comp release];
+    [model release];
+    if (fabs(vol - 36.0) > 1e-9) {
+        NSLog(@"ERROR: tetrahedron volume should be 36, got %f", vol);
+        return 1;
+    }
+    NSLog(@"PASS: computeVolume from triangles");
+    return 0;
+}
+
+int testSpatialIndexQueries() {
+    NSArray *verts = makeVertices(0, 50, -50, 50, -50, 50);
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithVertices:verts faces:nil name:@"Grid"];
+    GamutSpatialIndex *index = [GamutSpatialIndex indexForGamut:model cellSize:1.0];
+    [model release];
+    if (!index || [index pointCount] != [verts count]) {
+        NSLog(@"ERROR: spatial index should cover every point");
+        return 1;
+    }
+    
+    float onGrid[3] = {20.0f, 0.0f, 0.0f};
+    float nearGrid[3] = {20.5f, 0.5f, 0.0f};
+    float farAway[3] = {25.0f, 5.0f, 5.0f};
+    if (![index hasPointWithinRadius:1.0 ofPoint:nearGrid] || [index hasPointWithinRadius:1.0 ofPoint:farAway]) {
+        NSLog(@"ERROR: radius query hit/miss is wrong");
+        return 1;
+    }
+    // The grid point itself plus its 6 axis neighbours at distance 10
+    NSUInteger found = [[index indicesOfPointsWithinRadius:10.0 ofPoint:onGrid] count];
+    if (found != 7) {
+        NSLog(@"ERROR: expected 7 points within radius 10, got %lu", (unsigned long)found);
+        return 1;
+    }
+    
+    float inside[3] = {25.0f, 3.0f, -7.0f};
+    float above[3] = {60.0f, 0.0f, 0.0f};
+    float beside[3] = {25.0f, 55.0f, 0.0f};
+    if (![index containsPoint:inside] || [index containsPoint:above] || [index containsPoint:beside]) {
+        NSLog(@"ERROR: point-in-gamut test is wrong");
+        return 1;
+    }
+    NSLog(@"PASS: spatial index radius and containment queries");
+    return 0;
+}
+
+int testPointsInsideGamut() {
+    GamutComparator *comp = [[GamutComparator alloc] init];
+    // Inner box L*[0,50] against outer box L*[15,75], a*/b* [-60,60]: the
+    // L* = 20..50 layers (4 of 6, 121 points each) are inside
+    NSArray *v1 = makeVertices(0, 50, -50, 50, -50, 50);
+    NSArray *v2 = makeVertices(15, 75, -60, 60, -60, 60);
+    Gamut3DModel *m1 = [[Gamut3DModel alloc] initWithVertices:v1 faces:nil name:@"A"];
+    Gamut3DModel *m2 = [[Gamut3DModel alloc] initWithVertices:v2 faces:nil name:@"B"];
+    NSIndexSet *inside = [comp indicesOfPoints:m1 insideGamut:m2];
+    GamutSpatialIndex *first = [comp spatialIndexForGamut:m2];
+    GamutSpatialIndex *second = [comp spatialIndexForGamut:m2];
+    [m1 release];
+    [m2 release];
+    [comp release];
+    if ([inside count] != 4 * 121) {
+        NSLog(@"ERROR: expected 484 points inside, got %lu", (unsigned long)[inside count]);
+        return 1;
+    }
+    if (first != second) {
+        NSLog(@"ERROR: spatial index should be reused for the same model");
+        return 1;
+    }
+    NSLog(@"PASS: indicesOfPoints:insideGamut: and index reuse");
+    return 0;
+}
+
+// Latitude/longitude sphere around (50, 0, 0), counter-clockwise from outside
+static Gamut3DModel *makeSphereModel(double radius, NSUInteger slices, NSUInteger stacks) {
+    NSMutableData *lab = [NSMutableData data];
+    NSMutableData *tris = [NSMutableData data];
+    float p[3];
+    uint32_t t[3];
+    NSUInteger i, j;
+    for (i = 0; i <= stacks; i++) {
+        double theta = M_PI * (double)i / (double)stacks;
+        for (j = 0; j < slices; j++) {
+            double phi = 2.0 * M_PI * (double)j / (double)slices;
+            p[0] = (float)(50.0 + radius * cos(theta));
+            p[1] = (float)(radius * sin(theta) * cos(phi));
+            p[2] = (float)(radius * sin(theta) * sin(phi));
+            [lab appendBytes:p length:sizeof(p)];
+        }
+    }
+    for (i = 0; i < stacks; i++) {
+        for (j = 0; j < slices; j++) {
+            uint32_t a = (uint32_t)(i * slices + j), b = (uint32_t)(i * slices + (j + 1) % slices);
+            uint32_t c = a + (uint32_t)slices, d = b + (uint32_t)slices;
+            if (i > 0) {
+                t[0] = a; t[1] = c; t[2] = b;
+                [tris appendBytes:t length:sizeof(t)];
+            }
+            if (i < stacks - 1) {
+                t[0] = b; t[1] = c; t[2] = d;
+                [tris appendBytes:t length:sizeof(t)];
+            }
+        }
+    }
+    return [[[Gamut3DModel alloc] initWithLabData:lab triangles:tris name:@"Sphere"] autorelease];
+}
+
+int testMeshLevelsOfDetail() {
+    Gamut3DModel *sphere = makeSphereModel(40.0, 128, 64);
+    double fullVolume = meshVolume([sphere labPoints], [sphere triangleData]);
+    NSArray *levels = [GamutMeshLOD levelsOfDetailForModel:sphere];
+    if ([levels count] < 2) {
+        NSLog(@"ERROR: expected several levels for %lu triangles, got %lu",
+              (unsigned long)[sphere triangleCount], (unsigned long)[levels count]);
+        return 1;
+    }
+    NSUInteger i, k, previous = [sphere triangleCount];
+    for (i = 0; i < [levels count]; i++) {
+        Gamut3DModel *level = [levels objectAtIndex:i];
+        const uint32_t *idx = [level triangleIndices];
+        if ([level triangleCount] * 2 > previous) {
+            NSLog(@"ERROR: level %lu has %lu triangles, more than half of %lu",
+                  (unsigned long)i, (unsigned long)[level triangleCount], (unsigned long)previous);
+            return 1;
+        }
+        for (k = 0; k < [level triangleCount] * 3; k++) {
+            if (idx[k] >= [level pointCount]) {
+                NSLog(@"ERROR: level %lu index %u out of range", (unsigned long)i, idx[k]);
+                return 1;
+            }
+        }
+        previous = [level triangleCount];
+    }
+    // Clustering moves vertices inward only slightly, and keeps the winding
+    Gamut3DModel *first = [levels objectAtIndex:0];
+    double volume = meshVolume([first labPoints], [first triangleData]);
+    if (fabs(volume - fullVolume) > 0.05 * fullVolume) {
+        NSLog(@"ERROR: first level volume %f too far from %f", volume, fullVolume);
+        return 1;
+    }
+
+    [sphere setLevelsOfDetail:levels];
+    if ([GamutMeshLOD meshForModel:sphere zoom:1.0f quality:2] != sphere) {
+        NSLog(@"ERROR: full mesh should be drawn within the high quality budget");
+        return 1;
+    }
+    NSUInteger budget = [GamutMeshLOD triangleBudgetForZoom:0.4f quality:1];
+    Gamut3DModel *far = [GamutMeshLOD meshForModel:sphere zoom:0.4f quality:1];
+    if (far == sphere || ([far triangleCount] > budget && far != [levels lastObject])) {
+        NSLog(@"ERROR: zoomed out mesh has %lu triangles for a budget of %lu",
+              (unsigned long)[far triangleCount], (unsigned long)budget);
+        return 1;
+    }
+    if ([GamutMeshLOD triangleBudgetForZoom:1.0f quality:0] >= [GamutMeshLOD triangleBudgetForZoom:1.0f quality:2]) {
+        NSLog(@"ERROR: low quality should allow fewer triangles than high");
+        return 1;
+    }
+
+    Gamut3DModel *points = [[Gamut3DModel alloc] initWithLabData:[sphere labData] triangles:nil name:@"Points"];
+    NSUInteger pointLevels = [[GamutMeshLOD levelsOfDetailForModel:points] count];
+    [points release];
+    if (pointLevels != 0) {
+        NSLog(@"ERROR: point clouds should have no levels of detail");
+        return 1;
+    }
+    NSLog(@"PASS: mesh levels of detail (%lu triangles in %lu levels)",
+          (unsigned long)[sphere triangleCount], (unsigned long)[levels count]);
+    return 0;
+}
+
 int main(int argc, const char * argv[]) {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     int failures = 0;
@@ -107,6 +486,15 @@ int main(int argc, const char * argv[]) {
     failures += testComputeVolumeEmpty();
     failures += testComputeVolumeDifference();
     failures += testFindOverlap();
+    failures += testPackedLabData();
+    failures += testConvexHullOfLattice();
+    failures += testSegmentMaximaBoundary();
+    failures += testModelTriangleData();
+    failures += testIntersectionAndCoverage();
+    failures += testComputeVolumeFromTriangles();
+    failures += testSpatialIndexQueries();
+    failures += testPointsInsideGamut();
+    failures += testMeshLevelsOfDetail();
     if (failures == 0) {
         NSLog(@"All GamutComparator tests passed!");
     } else {
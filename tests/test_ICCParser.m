@@ -11,6 +11,10 @@
 #import "ICCTag.h"
 #import "ICCTagTRC.h"
 #import "ICCTagMetadata.h"
+#import "ICCProfileIO.h"
+#import "ProfileLibraryScanner.h"
+#import <unistd.h>
+#import <math.h>
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
@@ -225,6 +229,226 @@ int testParseProfileTags() {
     NSLog(@"PASS: Profile tag parsing");
     return 0;
 }
+// sRGB-primaries, gamma 2.2 matrix/TRC profile serialized by LittleCMS
+static NSData *makeTestRGBProfileData(void) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    cmsCIExyYTRIPLE primaries = {
+        {0.6400, 0.3300, 1.0},
+        {0.3000, 0.6000, 1.0},
+        {0.1500, 0.0600, 1.0}
+    };
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    NSData *profileData = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return profileData;
+}
+
+int testLazyTagDecoding() {
+    NSData *profileData = makeTestRGBProfileData();
+    
+    NSError *error = nil;
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCProfile *eager = [parser parseProfileFromData:profileData error:&error];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *lazy = [parser parseProfileFromData:profileData error:&error];
+    ICCProfile *invalid = [parser parseProfileFromData:[NSData dataWithBytes:"invalid" length:7] error:&error];
+    [parser release];
+    if (!eager || !lazy || invalid) {
+        NSLog(@"ERROR: Lazy parse should accept the profile and reject invalid data");
+        return 1;
+    }
+    
+    // Header fields match the LittleCMS parse
+    if ([lazy version] != [eager version] || [lazy deviceClass] != [eager deviceClass] ||
+        [lazy dataColorSpace] != [eager dataColorSpace] || [lazy pcsColorSpace] != [eager pcsColorSpace] ||
+        [lazy renderingIntent] != [eager renderingIntent] ||
+        fabs([[[lazy pcsIlluminant] objectAtIndex:0] doubleValue] -
+             [[[eager pcsIlluminant] objectAtIndex:0] doubleValue]) > 1e-4) {
+        NSLog(@"ERROR: Lazy header fields differ from the eager parse");
+        return 1;
+    }
+    NSSet *eagerTags = [NSSet setWithArray:[eager allTagSignatures]];
+    if (![eagerTags isEqualToSet:[NSSet setWithArray:[lazy allTagSignatures]]]) {
+        NSLog(@"ERROR: Lazy tag directory differs: %@ vs %@", [lazy allTagSignatures], [eager allTagSignatures]);
+        return 1;
+    }
+    
+    // Tags keep the directory entry and decode on first access
+    ICCTagTRC *trc = (ICCTagTRC *)[lazy tagWithSignature:@"rTRC"];
+    if (![trc isKindOfClass:[ICCTagTRC class]] || [trc isDecoded] || [[trc rawData] length] == 0) {
+        NSLog(@"ERROR: Lazy rTRC should be an undecoded ICCTagTRC with its payload bytes");
+        return 1;
+    }
+    NSArray *eagerPoints = [(ICCTagTRC *)[eager tagWithSignature:@"rTRC"] curvePoints];
+    if (![[trc curvePoints] isEqualToArray:eagerPoints] || ![trc isDecoded]) {
+        NSLog(@"ERROR: Lazy rTRC should decode to the eager curve on access");
+        return 1;
+    }
+    ICCTagMetadata *desc = (ICCTagMetadata *)[lazy tagWithSignature:@"desc"];
+    NSString *eagerText = [(ICCTagMetadata *)[eager tagWithSignature:@"desc"] textValue];
+    if (desc && (![[desc textValue] isEqualToString:eagerText] || [eagerText length] == 0)) {
+        NSLog(@"ERROR: Lazy description '%@' should match '%@'", [desc textValue], eagerText);
+        return 1;
+    }
+    
+    NSLog(@"PASS: Lazy tag decoding");
+    return 0;
+}
+int testHeaderCreationDate() {
+    // Stamp 2001-02-03 04:05:06 UTC into the header dateTimeNumber
+    NSMutableData *profileData = [NSMutableData dataWithData:makeTestRGBProfileData()];
+    static const uint8_t stamp[12] = { 0x07, 0xD1, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04, 0x00, 0x05, 0x00, 0x06 };
+    [profileData replaceBytesInRange:NSMakeRange(24, sizeof(stamp)) withBytes:stamp];
+    
+    NSError *error = nil;
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCProfile *eager = [parser parseProfileFromData:profileData error:&error];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *lazy = [parser parseProfileFromData:profileData error:&error];
+    [parser release];
+    if (!eager || !lazy) {
+        NSLog(@"ERROR: Failed to parse the stamped profile");
+        return 1;
+    }
+    
+    NSTimeInterval expected = 981173106.0;
+    if (fabs([[eager creationDate] timeIntervalSince1970] - expected) > 0.5 ||
+        fabs([[lazy creationDate] timeIntervalSince1970] - expected) > 0.5) {
+        NSLog(@"ERROR: Creation date should be 2001-02-03 04:05:06 UTC, got %@ (eager) and %@ (lazy)",
+              [eager creationDate], [lazy creationDate]);
+        return 1;
+    }
+    
+    NSLog(@"PASS: Header creation date decoded by eager and lazy parses");
+    return 0;
+}
+
+int testParseMappedProfile() {
+    NSData *profileData = makeTestRGBProfileData();
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"test_mapped_profile.icc"];
+    if (![profileData writeToFile:path atomically:YES]) {
+        NSLog(@"ERROR: Failed to write test profile");
+        return 1;
+    }
+    
+    NSError *error = nil;
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCProfile *eager = [[parser parseProfileFromPath:path error:&error] retain];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *lazy = [[parser parseProfileFromPath:path error:&error] retain];
+    [parser release];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    
+    int result = 0;
+    if (!eager || !lazy || ![[lazy profileData] isEqualToData:profileData] ||
+        [(ICCTagTRC *)[eager tagWithSignature:@"rTRC"] curveType] != 0 ||
+        fabs([(ICCTagTRC *)[eager tagWithSignature:@"rTRC"] parameters][0] - 2.2) > 0.01) {
+        NSLog(@"ERROR: Mapped profile should parse to the file contents, with a gamma 2.2 rTRC");
+        result = 1;
+    }
+    
+    // Tag bytes are views into the profile's (mapped) data, not copies
+    const uint8_t *base = (const uint8_t *)[[lazy profileData] bytes];
+    ICCTag *trc = [lazy tagWithSignature:@"rTRC"];
+    NSRange range = [trc payloadRange];
+    if (result == 0 && ((const uint8_t *)[[trc rawData] bytes] != base + range.location ||
+                        [[trc rawData] length] != range.length)) {
+        NSLog(@"ERROR: Lazy tag rawData should point into the profile data");
+        result = 1;
+    }
+    
+    // Profiles opened over caller-owned bytes read the same header and tags
+    cmsHPROFILE hProfile = ICCOpenProfileFromData(NULL, profileData);
+    if (result == 0 && (!hProfile || cmsGetColorSpace(hProfile) != cmsSigRgbData ||
+                        !cmsReadTag(hProfile, cmsSigRedTRCTag))) {
+        NSLog(@"ERROR: ICCOpenProfileFromData should open the profile in place");
+        result = 1;
+    }
+    if (hProfile) cmsCloseProfile(hProfile);
+    
+    [eager release];
+    [lazy release];
+    if (result == 0) NSLog(@"PASS: Memory-mapped profile loading");
+    return result;
+}
+int testProfileLibraryScan() {
+    NSData *profileData = makeTestRGBProfileData();
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *root = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"test_profile_library_%d", (int)getpid()]];
+    NSString *nested = [root stringByAppendingPathComponent:@"nested"];
+    NSString *indexPath = [root stringByAppendingPathComponent:@"index.plist"];
+    [fm createDirectoryAtPath:nested withIntermediateDirectories:YES attributes:nil error:NULL];
+    [profileData writeToFile:[root stringByAppendingPathComponent:@"display.icc"] atomically:YES];
+    [profileData writeToFile:[nested stringByAppendingPathComponent:@"copy.ICM"] atomically:YES];
+    [[NSData dataWithBytes:"invalid" length:7] writeToFile:[root stringByAppendingPathComponent:@"broken.icc"] atomically:YES];
+    [profileData writeToFile:[root stringByAppendingPathComponent:@"notes.txt"] atomically:YES];
+    
+    int result = 0;
+    NSError *error = nil;
+    ProfileLibraryScanner *scanner = [[ProfileLibraryScanner alloc] initWithIndexPath:indexPath];
+    [scanner setGamutResolution:5];
+    [scanner setBatchSize:1];
+    if (![scanner scanDirectory:root error:&error] || [scanner count] != 2 || [scanner lastParsedCount] != 3) {
+        NSLog(@"ERROR: Scan should index the two profiles and drop the broken one (%lu indexed)",
+              (unsigned long)[scanner count]);
+        result = 1;
+    }
+    NSDictionary *entry = [scanner entryForPath:[root stringByAppendingPathComponent:@"display.icc"]];
+    if (result == 0 && (![[entry objectForKey:kProfileIndexDeviceClassKey] isEqualToString:@"mntr"] ||
+                        ![[entry objectForKey:kProfileIndexColorSpaceKey] isEqualToString:@"RGB "] ||
+                        [[entry objectForKey:kProfileIndexGamutVolumeKey] doubleValue] <= 0.0)) {
+        NSLog(@"ERROR: Entry should record the header signatures and a gamut volume: %@", entry);
+        result = 1;
+    }
+    if (result == 0 && ([[scanner entriesMatchingText:@"copy"] count] != 1 ||
+                        [[scanner entriesWithDeviceClass:@"mntr" colorSpace:@"RGB "] count] != 2 ||
+                        [[scanner entriesWithDeviceClass:@"prtr" colorSpace:nil] count] != 0)) {
+        NSLog(@"ERROR: Search and filters should match the indexed entries");
+        result = 1;
+    }
+    
+    // Unchanged files, including the one that failed, are skipped; removed files leave the index
+    [fm removeItemAtPath:[nested stringByAppendingPathComponent:@"copy.ICM"] error:NULL];
+    if (result == 0 && (![scanner scanDirectory:root error:&error] || [scanner lastSkippedCount] != 2 ||
+                        [scanner lastParsedCount] != 0 || [scanner count] != 1)) {
+        NSLog(@"ERROR: Rescan should skip the unchanged and broken files and forget the removed one");
+        result = 1;
+    }
+    [scanner release];
+    
+    // The saved index (failures included) is reloaded, so a new scanner parses nothing
+    scanner = [[ProfileLibraryScanner alloc] initWithIndexPath:indexPath];
+    if (result == 0 && ([scanner count] != 1 || ![scanner scanDirectory:root error:&error] ||
+                        [scanner lastSkippedCount] != 2 || [scanner lastParsedCount] != 0)) {
+        NSLog(@"ERROR: Reloaded index should skip the unchanged and broken files");
+        result = 1;
+    }
+    
+    // A failed file is parsed again once it changes
+    [profileData writeToFile:[root stringByAppendingPathComponent:@"broken.icc"] atomically:YES];
+    if (result == 0 && (![scanner scanDirectory:root error:&error] || [scanner lastParsedCount] != 1 ||
+                        [scanner count] != 2)) {
+        NSLog(@"ERROR: A repaired file should be parsed and indexed on the next scan");
+        result = 1;
+    }
+    [scanner release];
+    [fm removeItemAtPath:root error:NULL];
+    
+    if (result == 0) NSLog(@"PASS: Profile library scan");
+    return result;
+}
 #else
 int testParseValidProfile() {
     NSLog(@"SKIP: LittleCMS not available");
@@ -235,6 +459,26 @@ int testParseProfileTags() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
 }
+
+int testLazyTagDecoding() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testHeaderCreationDate() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testParseMappedProfile() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testProfileLibraryScan() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
 #endif
 
 int main(int argc, const char * argv[]) {
@@ -246,6 +490,10 @@ int main(int argc, const char * argv[]) {
     failures += testParseNonexistentFile();
     failures += testParseValidProfile();
     failures += testParseProfileTags();
+    failures += testLazyTagDecoding();
+    failures += testHeaderCreationDate();
+    failures += testParseMappedProfile();
+    failures += testProfileLibraryScan();
     
     if (failures == 0) {
         NSLog(@"All ICC parser tests passed!");
@@ -12,6 +12,13 @@
 #import "ICCTagLUT.h"
 #import "ICCTagMetadata.h"
 #import "ICCProfile.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
 
 int testICCTagBase() {
     ICCTag *tag = [[ICCTag alloc] initWithData:NULL signature:@"test"];
@@ -27,6 +34,22 @@ int testICCTagBase() {
         return 1;
     }
     
+    // Raw tags pass their source bytes through until edited; after that
+    // there is nothing to write
+    NSData *profileBytes = [@"headerpayload" dataUsingEncoding:NSASCIIStringEncoding];
+    [tag setSourceData:profileBytes range:NSMakeRange(6, 7)];
+    if (![[tag serialize] isEqualToData:[@"payload" dataUsingEncoding:NSASCIIStringEncoding]]) {
+        NSLog(@"ERROR: Raw tag should serialize its source bytes");
+        [tag release];
+        return 1;
+    }
+    [tag markModified];
+    if ([tag serialize] != nil) {
+        NSLog(@"ERROR: Edited raw tag should have no payload");
+        [tag release];
+        return 1;
+    }
+    
     [tag release];
     NSLog(@"PASS: ICCTag base class");
     return 0;
@@ -57,6 +80,55 @@ int testICCTagTRC() {
     return 0;
 }
 
+int testTRCEvaluation() {
+    ICCTagTRC *trcTag = [[ICCTagTRC alloc] init];
+    
+    // Table: interpolation, clamping, and batch matching single values
+    float table[5] = {0.0f, 0.1f, 0.3f, 0.6f, 1.0f};
+    [trcTag setTableValues:table count:5];
+    float input[4] = {-0.5f, 0.125f, 0.5f, 2.0f};
+    float output[4];
+    [trcTag evaluate:input output:output count:4];
+    if ([trcTag curveType] != 1 || [trcTag tableCount] != 5 || [[trcTag curvePoints] count] != 5 ||
+        fabs(output[0]) > 1e-6 || fabs(output[1] - 0.05) > 1e-6 || fabs(output[2] - 0.3) > 1e-6 ||
+        fabs(output[3] - 1.0) > 1e-6 || fabs([trcTag valueAtPosition:0.125] - output[1]) > 1e-6) {
+        NSLog(@"ERROR: Table TRC evaluation is wrong");
+        [trcTag release];
+        return 1;
+    }
+    if (fabs([trcTag inverseValueAtPosition:0.3] - 0.5) > 1e-3 || fabs([trcTag inverseValueAtPosition:0.05] - 0.125) > 1e-3) {
+        NSLog(@"ERROR: Table TRC inverse is wrong");
+        [trcTag release];
+        return 1;
+    }
+    
+    // Parametric function 3 with the sRGB coefficients
+    double srgb[5] = {2.4, 1.0 / 1.055, 0.055 / 1.055, 1.0 / 12.92, 0.04045};
+    [trcTag setParametricType:3 parameters:srgb];
+    if ([trcTag curveType] != 0 || [trcTag tableValues] != NULL ||
+        fabs([trcTag valueAtPosition:0.5] - 0.214041) > 1e-4 ||
+        fabs([trcTag valueAtPosition:0.02] - 0.02 / 12.92) > 1e-6 ||
+        fabs([trcTag inverseValueAtPosition:0.214041] - 0.5) > 1e-3 ||
+        [[trcTag curvePoints] count] != 256) {
+        NSLog(@"ERROR: Parametric TRC evaluation is wrong");
+        [trcTag release];
+        return 1;
+    }
+    
+    // Function 2 adds c on both sides of the threshold
+    double offset[4] = {1.0, 1.0, -0.5, 0.25};
+    [trcTag setParametricType:2 parameters:offset];
+    if (fabs([trcTag valueAtPosition:0.25] - 0.25) > 1e-6 || fabs([trcTag valueAtPosition:0.75] - 0.5) > 1e-6) {
+        NSLog(@"ERROR: Parametric function 2 should be (x - 0.5) + 0.25 above 0.5 and 0.25 below");
+        [trcTag release];
+        return 1;
+    }
+    
+    [trcTag release];
+    NSLog(@"PASS: TRC evaluation and inverse");
+    return 0;
+}
+
 int testICCTagMatrix() {
     ICCTagMatrix *matrixTag = [[ICCTagMatrix alloc] init];
     
@@ -78,6 +150,17 @@ int testICCTagMatrix() {
         return 1;
     }
     
+    // Edits serialize as s15Fixed16ArrayType; a zero offset is left out
+    [matrixTag setMatrixElement:0 col:1 value:0.5];
+    NSData *payload = [matrixTag serialize];
+    const uint8_t *bytes = (const uint8_t *)[payload bytes];
+    if ([payload length] != 8 + 9 * 4 || memcmp(bytes, "sf32", 4) != 0 ||
+        bytes[12] != 0x00 || bytes[13] != 0x00 || bytes[14] != 0x80 || bytes[15] != 0x00) {
+        NSLog(@"ERROR: Edited matrix did not serialize");
+        [matrixTag release];
+        return 1;
+    }
+    
     [matrixTag release];
     NSLog(@"PASS: ICCTagMatrix");
     return 0;
@@ -103,6 +186,301 @@ int testICCTagLUT() {
     return 0;
 }
 
+int testLUTEvaluation() {
+    ICCTagLUT *lutTag = [[ICCTagLUT alloc] init];
+    NSUInteger i, j, k, l, c;
+    
+    // 3D CLUT sampling a linear function: tetrahedral lookup is exact
+    NSUInteger grid3[3] = {5, 4, 3};
+    float *nodes = (float *)malloc(5 * 4 * 3 * 2 * sizeof(float));
+    for (i = 0; i < 5; i++) {
+        for (j = 0; j < 4; j++) {
+            for (k = 0; k < 3; k++) {
+                float *node = nodes + ((i * 4 + j) * 3 + k) * 2;
+                float x = i / 4.0f, y = j / 3.0f, z = k / 2.0f;
+                node[0] = 0.5f * x + 0.3f * y + 0.2f * z;
+                node[1] = x - y * z;
+            }
+        }
+    }
+    if (![lutTag appendCLUTWithGrid:grid3 inputs:3 outputs:2 values:nodes] ||
+        [lutTag inputChannels] != 3 || [lutTag outputChannels] != 2 || [lutTag gridPoints] != 5 ||
+        [[lutTag lutData] length] != 5 * 4 * 3 * 2 * sizeof(float)) {
+        NSLog(@"ERROR: 3D CLUT stage not stored");
+        free(nodes);
+        [lutTag release];
+        return 1;
+    }
+    free(nodes);
+    float rgb[9] = {0.1f, 0.7f, 0.35f, 1.0f, 0.0f, 0.5f, 1.5f, -1.0f, 0.9f};
+    float result[6];
+    [lutTag evaluate:rgb output:result count:3];
+    for (i = 0; i < 3; i++) {
+        float x = fminf(fmaxf(rgb[i * 3], 0.0f), 1.0f);
+        float y = fminf(fmaxf(rgb[i * 3 + 1], 0.0f), 1.0f);
+        float z = rgb[i * 3 + 2];
+        if (fabs(result[i * 2] - (0.5f * x + 0.3f * y + 0.2f * z)) > 1e-5) {
+            NSLog(@"ERROR: Tetrahedral lookup of a linear CLUT is wrong at pixel %lu", (unsigned long)i);
+            [lutTag release];
+            return 1;
+        }
+    }
+    
+    // Mismatched or out-of-range stages are rejected and leave the chain alone
+    float matrix3[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    NSUInteger flat[2] = {2, 1};
+    if ([lutTag appendMatrix:matrix3 offset:NULL inputs:3 outputs:3] ||
+        [lutTag appendCLUTWithGrid:flat inputs:2 outputs:2 values:result] || [lutTag stageCount] != 1) {
+        NSLog(@"ERROR: Invalid LUT stages should be rejected");
+        [lutTag release];
+        return 1;
+    }
+    
+    // Curves, matrix with offset, then a 4D CLUT of the sum of its inputs
+    [lutTag removeAllStages];
+    float curves[2 * 3] = {0.0f, 0.25f, 1.0f, 1.0f, 0.5f, 0.0f};
+    float matrix[4 * 2] = {1, 0, 0, 1, 0.5f, 0.5f, 0, 0};
+    float offset[4] = {0, 0, 0, 0.25f};
+    NSUInteger grid4[4] = {3, 3, 3, 3};
+    float *sums = (float *)malloc(81 * sizeof(float));
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            for (k = 0; k < 3; k++) {
+                for (l = 0; l < 3; l++) {
+                    sums[((i * 3 + j) * 3 + k) * 3 + l] = (i + j + k + l) / 8.0f;
+                }
+            }
+        }
+    }
+    BOOL built = [lutTag appendCurvesWithTables:curves channels:2 samples:3] &&
+                 [lutTag appendMatrix:matrix offset:offset inputs:2 outputs:4] &&
+                 [lutTag appendCLUTWithGrid:grid4 inputs:4 outputs:1 values:sums];
+    free(sums);
+    if (!built || [lutTag stageCount] != 3 || [lutTag kindOfStageAtIndex:1] != ICCLUTStageMatrix ||
+        [lutTag inputChannels] != 2 || [lutTag outputChannels] != 1 || [lutTag gridPoints] != 3) {
+        NSLog(@"ERROR: Curve, matrix and 4D CLUT stages not chained");
+        [lutTag release];
+        return 1;
+    }
+    // More pixels than one internal block
+    NSUInteger count = 200;
+    float *pairs = (float *)malloc(count * 2 * sizeof(float));
+    float *sumsOut = (float *)malloc(count * sizeof(float));
+    for (c = 0; c < count; c++) {
+        pairs[c * 2] = (float)c / (count - 1);
+        pairs[c * 2 + 1] = 1.0f - (float)c / (count - 1);
+    }
+    [lutTag evaluate:pairs output:sumsOut count:count];
+    for (c = 0; c < count; c++) {
+        float a = pairs[c * 2], b = pairs[c * 2 + 1];
+        float u = (a < 0.5f) ? 0.5f * a : 0.25f + 1.5f * (a - 0.5f);
+        float v = 1.0f - b;
+        float expected = (u + v + 0.5f * (u + v) + 0.25f) / 4.0f;
+        if (fabs(sumsOut[c] - expected) > 1e-5) {
+            NSLog(@"ERROR: Chained LUT lookup is %f, expected %f", sumsOut[c], expected);
+            free(pairs);
+            free(sumsOut);
+            [lutTag release];
+            return 1;
+        }
+    }
+    free(pairs);
+    free(sumsOut);
+    
+    double single[2] = {0.5, 0.5}, singleOut[1];
+    [lutTag lookupInput:single output:singleOut];
+    if (fabs(singleOut[0] - (0.25 + 0.5 + 0.375 + 0.25) / 4.0) > 1e-5) {
+        NSLog(@"ERROR: Single LUT lookup disagrees with the batch");
+        [lutTag release];
+        return 1;
+    }
+    
+    [lutTag release];
+    NSLog(@"PASS: LUT evaluation");
+    return 0;
+}
+
+// Device to PCS tags are lutAtoBType; gamut and preview tags start at the
+// PCS like B2Ax. Version 2 profiles get lut16Type.
+int testLUTSerializationTypes() {
+    NSArray *signatures = [NSArray arrayWithObjects:@"A2B0", @"B2A1", @"gamt", @"pre0", @"pre2", nil];
+    const char *types[5] = {"mAB ", "mBA ", "mBA ", "mBA ", "mBA "};
+    NSUInteger grid[3] = {2, 2, 2};
+    float nodes[8];
+    NSUInteger i;
+    for (i = 0; i < 8; i++) nodes[i] = (float)(i & 1);
+
+    for (i = 0; i < [signatures count]; i++) {
+        ICCTagLUT *lut = [[ICCTagLUT alloc] initWithData:NULL signature:[signatures objectAtIndex:i]];
+        [lut appendCLUTWithGrid:grid inputs:3 outputs:1 values:nodes];
+        NSData *v4 = [lut serialize];
+        NSData *v2 = [lut serializeForVersion:2];
+        // lut16Type: 52-byte header, two-entry identity tables, 8 one-channel nodes
+        if ([v4 length] < 4 || memcmp([v4 bytes], types[i], 4) != 0 ||
+            [v2 length] != 52 + 3 * 4 + 8 * 2 + 1 * 4 || memcmp([v2 bytes], "mft2", 4) != 0) {
+            NSLog(@"ERROR: %@ LUT serialized as the wrong type", [signatures objectAtIndex:i]);
+            [lut release];
+            return 1;
+        }
+        [lut release];
+    }
+    NSLog(@"PASS: LUT serialization types");
+    return 0;
+}
+
+#ifdef HAVE_LCMS
+static cmsInt32Number sampleTestCLUT(const cmsUInt16Number In[], cmsUInt16Number Out[], void *Cargo) {
+    (void)Cargo;
+    Out[0] = In[1];
+    Out[1] = (cmsUInt16Number)(((cmsUInt32Number)In[0] + In[2]) / 2);
+    Out[2] = (cmsUInt16Number)(((cmsUInt32Number)In[0] * In[2]) / 65535);
+    return TRUE;
+}
+
+// Largest difference between the tag and a LittleCMS pipeline over a 5^3 lattice
+static double maxLUTDifference(ICCTagLUT *lut, cmsPipeline *pipeline) {
+    float in[125 * 3], out[125 * 3];
+    cmsFloat32Number expected[3];
+    double worst = 0.0;
+    NSUInteger i, c;
+    for (i = 0; i < 125; i++) {
+        in[i * 3] = (float)(i / 25) / 4.0f;
+        in[i * 3 + 1] = (float)((i / 5) % 5) / 4.0f;
+        in[i * 3 + 2] = (float)(i % 5) / 4.0f;
+    }
+    [lut evaluate:in output:out count:125];
+    for (i = 0; i < 125; i++) {
+        cmsPipelineEvalFloat(in + i * 3, expected, pipeline);
+        for (c = 0; c < 3; c++) {
+            worst = MAX(worst, fabs(out[i * 3 + c] - expected[c]));
+        }
+    }
+    return worst;
+}
+
+// What LittleCMS reads back from a version 2 profile holding payload as A2B0
+static cmsPipeline *pipelineFromVersion2Payload(NSData *payload) {
+    cmsHPROFILE hProfile = cmsCreateProfilePlaceholder(NULL);
+    cmsPipeline *lut = NULL;
+    cmsUInt32Number size = 0;
+    if (!hProfile) return NULL;
+    cmsSetProfileVersion(hProfile, 2.1);
+    cmsSetDeviceClass(hProfile, cmsSigInputClass);
+    cmsSetColorSpace(hProfile, cmsSigRgbData);
+    cmsSetPCS(hProfile, cmsSigXYZData);
+    if (cmsWriteRawTag(hProfile, cmsSigAToB0Tag, [payload bytes], (cmsUInt32Number)[payload length]) &&
+        cmsSaveProfileToMem(hProfile, NULL, &size)) {
+        void *bytes = malloc(size);
+        if (bytes && cmsSaveProfileToMem(hProfile, bytes, &size)) {
+            cmsHPROFILE reopened = cmsOpenProfileFromMem(bytes, size);
+            cmsPipeline *read = reopened ? (cmsPipeline *)cmsReadTag(reopened, cmsSigAToB0Tag) : NULL;
+            if (read) lut = cmsPipelineDup(read);
+            if (reopened) cmsCloseProfile(reopened);
+        }
+        free(bytes);
+    }
+    cmsCloseProfile(hProfile);
+    return lut;
+}
+
+int testLUTFromPipeline() {
+    // Gamma curves, a matrix with offset, then a 9-point CLUT
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsFloat64Number matrix[9] = {0.6, 0.3, 0.05, 0.2, 0.6, 0.1, 0.05, 0.1, 0.8};
+    cmsFloat64Number offset[3] = {0.02, 0.05, 0.0};
+    cmsPipeline *pipeline = cmsPipelineAlloc(NULL, 3, 3);
+    cmsStage *clut = cmsStageAllocCLut16bit(NULL, 9, 3, 3, NULL);
+    BOOL built = pipeline && clut && cmsStageSampleCLut16bit(clut, sampleTestCLUT, NULL, 0) &&
+                 cmsPipelineInsertStage(pipeline, cmsAT_END, cmsStageAllocToneCurves(NULL, 3, curves)) &&
+                 cmsPipelineInsertStage(pipeline, cmsAT_END, cmsStageAllocMatrix(NULL, 3, 3, matrix, offset)) &&
+                 cmsPipelineInsertStage(pipeline, cmsAT_END, clut);
+    cmsFreeToneCurve(gamma);
+    if (!built) {
+        NSLog(@"ERROR: Could not build the LittleCMS pipeline");
+        if (pipeline) cmsPipelineFree(pipeline);
+        return 1;
+    }
+
+    ICCTagLUT *lut = [[ICCTagLUT alloc] initWithData:NULL signature:@"A2B0"];
+    [lut loadFromPipeline:pipeline];
+    if ([lut stageCount] != 3 || [lut kindOfStageAtIndex:0] != ICCLUTStageCurves ||
+        [lut kindOfStageAtIndex:1] != ICCLUTStageMatrix || [lut kindOfStageAtIndex:2] != ICCLUTStageCLUT ||
+        [lut gridPoints] != 9) {
+        NSLog(@"ERROR: Pipeline stages not loaded one for one");
+        [lut release];
+        cmsPipelineFree(pipeline);
+        return 1;
+    }
+    double difference = maxLUTDifference(lut, pipeline);
+    if (difference > 2e-3) {
+        NSLog(@"ERROR: Loaded LUT differs from the pipeline by %f", difference);
+        [lut release];
+        cmsPipelineFree(pipeline);
+        return 1;
+    }
+    cmsPipelineFree(pipeline);
+
+    // Curves before the matrix do not fit lut16Type: the chain is resampled
+    cmsPipeline *readBack = pipelineFromVersion2Payload([lut serializeForVersion:2]);
+    difference = readBack ? maxLUTDifference(lut, readBack) : 1.0;
+    if (readBack) cmsPipelineFree(readBack);
+    [lut release];
+    if (difference > 5e-3) {
+        NSLog(@"ERROR: Resampled lut16Type differs from the LUT by %f", difference);
+        return 1;
+    }
+    NSLog(@"PASS: LUT from LittleCMS pipeline");
+    return 0;
+}
+
+int testLUTVersion2Serialization() {
+    // Input curves, CLUT and output curves map onto lut16Type element for element
+    float tables[3 * 256], inverted[3 * 2] = {1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f};
+    float nodes[125 * 3];
+    NSUInteger grid[3] = {5, 5, 5};
+    NSUInteger i;
+    for (i = 0; i < 3 * 256; i++) tables[i] = powf((float)(i % 256) / 255.0f, 1.8f);
+    for (i = 0; i < 125; i++) {
+        float r = (float)(i / 25) / 4.0f, g = (float)((i / 5) % 5) / 4.0f, b = (float)(i % 5) / 4.0f;
+        nodes[i * 3] = g;
+        nodes[i * 3 + 1] = (r + b) / 2.0f;
+        nodes[i * 3 + 2] = r * b;
+    }
+    ICCTagLUT *lut = [[ICCTagLUT alloc] initWithData:NULL signature:@"A2B0"];
+    [lut appendCurvesWithTables:tables channels:3 samples:256];
+    [lut appendCLUTWithGrid:grid inputs:3 outputs:3 values:nodes];
+    [lut appendCurvesWithTables:inverted channels:3 samples:2];
+
+    NSData *payload = [lut serializeForVersion:2];
+    if ([payload length] != 52 + 3 * 256 * 2 + 125 * 3 * 2 + 3 * 2 * 2) {
+        NSLog(@"ERROR: lut16Type payload is %lu bytes", (unsigned long)[payload length]);
+        [lut release];
+        return 1;
+    }
+    cmsPipeline *readBack = pipelineFromVersion2Payload(payload);
+    double difference = readBack ? maxLUTDifference(lut, readBack) : 1.0;
+    if (readBack) cmsPipelineFree(readBack);
+    [lut release];
+    if (difference > 2e-3) {
+        NSLog(@"ERROR: lut16Type read back differs from the LUT by %f", difference);
+        return 1;
+    }
+    NSLog(@"PASS: LUT version 2 serialization");
+    return 0;
+}
+#else
+int testLUTFromPipeline() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testLUTVersion2Serialization() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
 int testICCTagMetadata() {
     ICCTagMetadata *metaTag = [[ICCTagMetadata alloc] init];
     
@@ -175,8 +553,13 @@ int main(int argc, const char * argv[]) {
     int failures = 0;
     failures += testICCTagBase();
     failures += testICCTagTRC();
+    failures += testTRCEvaluation();
     failures += testICCTagMatrix();
     failures += testICCTagLUT();
+    failures += testLUTEvaluation();
+    failures += testLUTSerializationTypes();
+    failures += testLUTFromPipeline();
+    failures += testLUTVersion2Serialization();
     failures += testICCTagMetadata();
     failures += testProfileTagAccess();
     
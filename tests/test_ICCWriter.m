@@ -6,10 +6,15 @@
 //
 
 #import <Foundation/Foundation.h>
+#import <math.h>
+#import <string.h>
 #import "ICCWriter.h"
 #import "ICCProfile.h"
 #import "ICCParser.h"
 #import "ICCTagTRC.h"
+#import "ICCTagLUT.h"
+#import "ICCTagMetadata.h"
+#import "ProfileBatchProcessor.h"
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
@@ -215,6 +220,227 @@ int testWriteReadRoundTrip() {
     return 0;
 }
 
+static uint32_t readBE32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Offset and size of a tag in written profile bytes (NO if absent)
+static BOOL findTag(NSData *data, uint32_t signature, uint32_t *offset, uint32_t *size) {
+    const uint8_t *bytes = (const uint8_t *)[data bytes];
+    uint32_t count = readBE32(bytes + 128), i;
+    for (i = 0; i < count; i++) {
+        const uint8_t *entry = bytes + 132 + i * 12;
+        if (readBE32(entry) == signature) {
+            *offset = readBE32(entry + 4);
+            *size = readBE32(entry + 8);
+            return YES;
+        }
+    }
+    return NO;
+}
+
+int testWriteDirectSerialization() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    [parser setLazyTagDecoding:YES];
+    
+    cmsCIExyY whitePoint = {0.3457, 0.3585, 1.0};
+    cmsCIExyYTRIPLE primaries = {{0.64, 0.33, 1.0}, {0.30, 0.60, 1.0}, {0.15, 0.06, 1.0}};
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    NSMutableData *sourceData = [NSMutableData dataWithLength:size];
+    cmsSaveProfileToMem(hProfile, [sourceData mutableBytes], &size);
+    cmsCloseProfile(hProfile);
+    
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:sourceData error:&error];
+    
+    // Untouched profile: every payload is copied from the source
+    NSData *copied = [writer dataForProfile:profile error:&error];
+    uint32_t offset = 0, length = 0;
+    NSRange wtpt = [[profile tagWithSignature:@"wtpt"] payloadRange];
+    if (!copied || !findTag(copied, 0x77747074, &offset, &length) || length != wtpt.length ||
+        memcmp((const uint8_t *)[copied bytes] + offset, (const uint8_t *)[sourceData bytes] + wtpt.location, length) != 0 ||
+        readBE32((const uint8_t *)[copied bytes]) != [copied length]) {
+        NSLog(@"ERROR: Unmodified tags should be copied byte for byte");
+        [parser release];
+        [writer release];
+        return 1;
+    }
+    
+    // Edits: new description, linear TRCs (identical, so stored once), and an A2B0 LUT
+    ICCTagMetadata *desc = (ICCTagMetadata *)[profile tagWithSignature:@"desc"];
+    [desc setTextValue:@"Edited profile"];
+    double linear = 1.0;
+    NSArray *channels = [NSArray arrayWithObjects:@"rTRC", @"gTRC", @"bTRC", nil];
+    NSUInteger i;
+    for (i = 0; i < 3; i++) {
+        [(ICCTagTRC *)[profile tagWithSignature:[channels objectAtIndex:i]] setParametricType:0 parameters:&linear];
+    }
+    ICCTagLUT *lut = [[ICCTagLUT alloc] initWithData:NULL signature:@"A2B0"];
+    NSUInteger grid[3] = {2, 2, 2};
+    float nodes[24];
+    for (i = 0; i < 8; i++) {
+        // Swap the first two channels
+        nodes[i * 3] = (i >> 1) & 1;
+        nodes[i * 3 + 1] = (i >> 2) & 1;
+        nodes[i * 3 + 2] = i & 1;
+    }
+    float tables[6] = {0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 1.0f};
+    [lut appendCurvesWithTables:tables channels:3 samples:2];
+    [lut appendCLUTWithGrid:grid inputs:3 outputs:3 values:nodes];
+    [profile setTag:lut withSignature:@"A2B0"];
+    [lut release];
+    
+    NSData *written = [writer dataForProfile:profile error:&error];
+    uint32_t rOffset = 0, gOffset = 0, bOffset = 0, a2bOffset = 0;
+    if (!written || !findTag(written, 0x72545243, &rOffset, &length) || !findTag(written, 0x67545243, &gOffset, &length) ||
+        !findTag(written, 0x62545243, &bOffset, &length) || rOffset != gOffset || rOffset != bOffset ||
+        !findTag(written, 0x41324230, &a2bOffset, &length) || (a2bOffset & 3) != 0) {
+        NSLog(@"ERROR: Identical TRCs should share one aligned payload");
+        [parser release];
+        [writer release];
+        return 1;
+    }
+    
+    // LittleCMS reads the edits back
+    hProfile = cmsOpenProfileFromMem([written bytes], (cmsUInt32Number)[written length]);
+    cmsToneCurve *rTRC = hProfile ? (cmsToneCurve *)cmsReadTag(hProfile, cmsSigRedTRCTag) : NULL;
+    cmsPipeline *a2b = hProfile ? (cmsPipeline *)cmsReadTag(hProfile, cmsSigAToB0Tag) : NULL;
+    cmsMLU *mlu = hProfile ? (cmsMLU *)cmsReadTag(hProfile, cmsSigProfileDescriptionTag) : NULL;
+    char text[64] = {0};
+    cmsFloat32Number in[3] = {0.2f, 0.7f, 0.4f}, out[3] = {0, 0, 0};
+    if (a2b) cmsPipelineEvalFloat(in, out, a2b);
+    if (mlu) cmsMLUgetASCII(mlu, "en", "US", text, sizeof(text));
+    BOOL readBack = rTRC && fabs(cmsEvalToneCurveFloat(rTRC, 0.5f) - 0.5) < 1e-4 && a2b &&
+                    fabs(out[0] - 0.7f) < 1e-3 && fabs(out[1] - 0.2f) < 1e-3 && fabs(out[2] - 0.4f) < 1e-3 &&
+                    strcmp(text, "Edited profile") == 0;
+    if (hProfile) cmsCloseProfile(hProfile);
+    if (!readBack) {
+        NSLog(@"ERROR: Serialized TRC, LUT or description tag did not read back");
+        [parser release];
+        [writer release];
+        return 1;
+    }
+    
+    [parser release];
+    [writer release];
+    NSLog(@"PASS: Direct tag serialization");
+    return 0;
+}
+
+// Collects batch results by status
+@interface BatchResultCollector : NSObject <ProfileBatchProcessorDelegate> {
+    NSMutableArray *results;
+}
+- (NSArray *)results;
+@end
+
+@implementation BatchResultCollector
+- (id)init {
+    self = [super init];
+    if (self) {
+        results = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+- (void)batchProcessor:(ProfileBatchProcessor *)processor didProcessFile:(NSDictionary *)result {
+    [results addObject:result];
+}
+- (NSArray *)results {
+    return results;
+}
+- (void)dealloc {
+    [results release];
+    [super dealloc];
+}
+@end
+
+int testBatchProcessor() {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *root = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"SmallICCerBatch-%d", [[NSProcessInfo processInfo] processIdentifier]]];
+    NSString *input = [root stringByAppendingPathComponent:@"in"];
+    NSString *output = [root stringByAppendingPathComponent:@"out"];
+    [fm createDirectoryAtPath:[input stringByAppendingPathComponent:@"sub"] withIntermediateDirectories:YES attributes:nil error:NULL];
+    
+    // Two v4 matrix/TRC profiles, one a directory level down
+    cmsCIExyY whitePoint = {0.3457, 0.3585, 1.0};
+    cmsCIExyYTRIPLE primaries = {{0.64, 0.33, 1.0}, {0.30, 0.60, 1.0}, {0.15, 0.06, 1.0}};
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    cmsSaveProfileToFile(hProfile, [[input stringByAppendingPathComponent:@"a.icc"] fileSystemRepresentation]);
+    cmsSaveProfileToFile(hProfile, [[input stringByAppendingPathComponent:@"sub/b.icm"] fileSystemRepresentation]);
+    cmsCloseProfile(hProfile);
+    
+    NSDictionary *edits = [NSDictionary dictionaryWithObjectsAndKeys:
+                           @"Batch edited", kProfileBatchDescriptionKey,
+                           [NSNumber numberWithInteger:2], kProfileBatchVersionKey, nil];
+    NSError *error = nil;
+    ProfileBatchProcessor *processor = [[ProfileBatchProcessor alloc] initWithEdits:edits error:&error];
+    BatchResultCollector *collector = [[BatchResultCollector alloc] init];
+    [processor setOutputDirectory:output];
+    [processor setWorkerCount:2];
+    [processor setDelegate:collector];
+    NSArray *paths = [NSArray arrayWithObjects:input, [root stringByAppendingPathComponent:@"missing.icc"], nil];
+    BOOL success = [processor processPaths:paths];
+    
+    // The missing path fails; both profiles are written mirrored, as version 2
+    NSString *written = [output stringByAppendingPathComponent:@"sub/b.icm"];
+    hProfile = cmsOpenProfileFromFile([written fileSystemRepresentation], "r");
+    char text[64] = {0};
+    cmsMLU *mlu = hProfile ? (cmsMLU *)cmsReadTag(hProfile, cmsSigProfileDescriptionTag) : NULL;
+    if (mlu) cmsMLUgetASCII(mlu, "en", "US", text, sizeof(text));
+    BOOL converted = hProfile && (int)cmsGetProfileVersion(hProfile) == 2 && strcmp(text, "Batch edited") == 0 &&
+                     cmsReadTag(hProfile, cmsSigRedTRCTag) != NULL;
+    if (hProfile) cmsCloseProfile(hProfile);
+    if (success || [processor writtenCount] != 2 || [processor failedCount] != 1 ||
+        [[collector results] count] != 3 || !converted) {
+        NSLog(@"ERROR: Batch run should write both profiles as version 2 and report the missing path");
+        [processor release];
+        [collector release];
+        [fm removeItemAtPath:root error:NULL];
+        return 1;
+    }
+    
+    // Same edits again: outputs already match, nothing is rewritten
+    paths = [NSArray arrayWithObject:input];
+    success = [processor processPaths:paths];
+    if (!success || [processor unchangedCount] != 2 || [processor writtenCount] != 0) {
+        NSLog(@"ERROR: Second batch run should leave identical outputs unchanged");
+        [processor release];
+        [collector release];
+        [fm removeItemAtPath:root error:NULL];
+        return 1;
+    }
+    
+    // Dry run into a new directory: counted apart from writes, nothing created
+    NSString *dryOutput = [root stringByAppendingPathComponent:@"dry"];
+    [processor setOutputDirectory:dryOutput];
+    [processor setDryRun:YES];
+    success = [processor processPaths:paths];
+    if (!success || [processor dryRunCount] != 2 || [processor writtenCount] != 0 ||
+        [fm fileExistsAtPath:dryOutput]) {
+        NSLog(@"ERROR: Dry run should count would-be writes and write nothing");
+        [processor release];
+        [collector release];
+        [fm removeItemAtPath:root error:NULL];
+        return 1;
+    }
+    
+    [processor release];
+    [collector release];
+    [fm removeItemAtPath:root error:NULL];
+    NSLog(@"PASS: Batch processor");
+    return 0;
+}
+
 int testWriteInvalidPath() {
     ICCWriter *writer = [[ICCWriter alloc] init];
     ICCProfile *profile = [[ICCProfile alloc] init];
@@ -242,12 +468,66 @@ int testWriteInvalidPath() {
     NSLog(@"PASS: Invalid path handling");
     return 0;
 }
+
+int testWriteRawTags() {
+    // sRGB plus a private tag type LittleCMS cannot read
+    static const uint8_t privatePayload[16] = {'z', 'z', 'z', 'z', 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8};
+    cmsHPROFILE hProfile = cmsCreate_sRGBProfile();
+    cmsWriteRawTag(hProfile, (cmsTagSignature)0x7A7A7A7A, privatePayload, sizeof(privatePayload));
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    NSMutableData *sourceData = [NSMutableData dataWithLength:size];
+    cmsSaveProfileToMem(hProfile, [sourceData mutableBytes], &size);
+    cmsCloseProfile(hProfile);
+    
+    // Eager parse: the unreadable tag is kept and written back unchanged
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    NSError *error = nil;
+    ICCProfile *profile = [parser parseProfileFromData:sourceData error:&error];
+    NSData *written = profile ? [writer dataForProfile:profile error:&error] : nil;
+    uint32_t offset = 0, length = 0;
+    if (![profile tagWithSignature:@"zzzz"] || !written || !findTag(written, 0x7A7A7A7A, &offset, &length) ||
+        length != sizeof(privatePayload) ||
+        memcmp((const uint8_t *)[written bytes] + offset, privatePayload, length) != 0) {
+        NSLog(@"ERROR: Tag LittleCMS cannot read was not passed through");
+        [parser release];
+        [writer release];
+        return 1;
+    }
+    
+    // An edit to a tag without an encoder fails the write
+    [[profile tagWithSignature:@"zzzz"] markModified];
+    error = nil;
+    written = [writer dataForProfile:profile error:&error];
+    if (written || [error code] != 5) {
+        NSLog(@"ERROR: Edited raw tag should fail the write");
+        [parser release];
+        [writer release];
+        return 1;
+    }
+    
+    [parser release];
+    [writer release];
+    NSLog(@"PASS: Raw tag pass-through");
+    return 0;
+}
 #else
 int testWriteProfile() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
 }
 
+int testWriteDirectSerialization() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
+int testBatchProcessor() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+
 int testWriteReadRoundTrip() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
@@ -257,6 +537,11 @@ int testWriteInvalidPath() {
     NSLog(@"SKIP: LittleCMS not available");
     return 0;
 }
+
+int testWriteRawTags() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
 #endif
 
 int main(int argc, const char * argv[]) {
@@ -266,7 +551,10 @@ int main(int argc, const char * argv[]) {
     failures += testWriterInitialization();
     failures += testWriteProfile();
     failures += testWriteReadRoundTrip();
+    failures += testWriteDirectSerialization();
+    failures += testBatchProcessor();
     failures += testWriteInvalidPath();
+    failures += testWriteRawTags();
     
     if (failures == 0) {
         NSLog(@"All ICC writer tests passed!");
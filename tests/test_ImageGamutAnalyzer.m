@@ -0,0 +1,181 @@
+//
+//  test_ImageGamutAnalyzer.m
+//  SmallICCer Tests
+//
+//  Unit tests for image out-of-gamut analysis
+//
+
+#import <Foundation/Foundation.h>
+#import "GamutCalculator.h"
+#import "Gamut3DModel.h"
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "ImageGamutAnalyzer.h"
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+int testImageGamutAnalyzer() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *wide = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    ICCProfile *narrow = [parser parseProfileFromData:makeRGBProfileData(0.3000, 0.6000) error:&error];
+    [parser release];
+    if (!wide || !narrow) {
+        NSLog(@"ERROR: Failed to parse generated RGB profiles");
+        return 1;
+    }
+    
+    GamutCalculator *calculator = [[GamutCalculator alloc] init];
+    [calculator setResolution:17];
+    NSData *narrowLab = [calculator computePackedGamutForProfile:narrow];
+    NSData *narrowTriangles = [calculator computeConvexHullTrianglesForPackedLab:narrowLab];
+    [calculator release];
+    Gamut3DModel *gamut = [[Gamut3DModel alloc] initWithLabData:narrowLab triangles:narrowTriangles name:@"Narrow"];
+    
+    ImageGamutAnalyzer *analyzer = [[ImageGamutAnalyzer alloc] initWithImageProfile:wide
+                                                                       pixelFormat:ImagePixelFormatRGB8
+                                                                             gamut:gamut
+                                                                           binSize:0.0
+                                                                             error:&error];
+    // A tiny bin size would size the histograms by the billions of voxels
+    ImageGamutAnalyzer *fine = [[ImageGamutAnalyzer alloc] initWithImageProfile:wide
+                                                                   pixelFormat:ImagePixelFormatRGB8
+                                                                         gamut:gamut
+                                                                       binSize:1e-6
+                                                                         error:&error];
+    double fineBinSize = [fine binSize];
+    [fine release];
+    [gamut release];
+    if (!analyzer) {
+        NSLog(@"ERROR: Analyzer creation failed: %@", [error localizedDescription]);
+        return 1;
+    }
+    if (fineBinSize != 1.0) {
+        NSLog(@"ERROR: Bin size should be clamped to 1, got %f", fineBinSize);
+        [analyzer release];
+        return 1;
+    }
+    
+    // 512x512 image in the wide profile: left half mid gray, right half its pure green
+    const NSUInteger width = 512, height = 512;
+    NSMutableData *image = [NSMutableData dataWithLength:width * height * 3];
+    uint8_t *pixels = (uint8_t *)[image mutableBytes];
+    NSUInteger x, y;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint8_t *p = pixels + (y * width + x) * 3;
+            if (x < width / 2) {
+                p[0] = p[1] = p[2] = 128;
+            } else {
+                p[0] = 0; p[1] = 255; p[2] = 0;
+            }
+        }
+    }
+    
+    // Stream it in two bands of rows
+    int result = 0;
+    if (![analyzer addPixels:pixels rowBytes:width * 3 width:width height:height / 2 error:&error] ||
+        ![analyzer addPixels:pixels + (height / 2) * width * 3 rowBytes:width * 3 width:width height:height / 2 error:&error]) {
+        NSLog(@"ERROR: addPixels failed: %@", [error localizedDescription]);
+        result = 1;
+    } else if ([analyzer totalPixels] != width * height) {
+        NSLog(@"ERROR: Expected %lu pixels, counted %llu", (unsigned long)(width * height),
+              (unsigned long long)[analyzer totalPixels]);
+        result = 1;
+    } else if ([analyzer outsidePixels] != width * height / 2) {
+        // Gray sits inside the narrow gamut; the wide green primary does not
+        NSLog(@"ERROR: Expected %lu out-of-gamut pixels, counted %llu", (unsigned long)(width * height / 2),
+              (unsigned long long)[analyzer outsidePixels]);
+        result = 1;
+    }
+    
+    if (result == 0) {
+        NSUInteger dims[3];
+        [analyzer getHistogramDimensions:dims];
+        const uint64_t *histogram = [analyzer histogram];
+        uint64_t sum = 0;
+        NSUInteger i;
+        for (i = 0; i < dims[0] * dims[1] * dims[2]; i++) sum += histogram[i];
+        NSData *lightness = [analyzer lightnessHistogram];
+        const uint64_t *bins = (const uint64_t *)[lightness bytes];
+        uint64_t lightnessSum = 0;
+        for (i = 0; i < [lightness length] / sizeof(uint64_t); i++) lightnessSum += bins[i];
+        if (sum != width * height || lightnessSum != width * height) {
+            NSLog(@"ERROR: Histograms hold %llu and %llu pixels, expected %lu",
+                  (unsigned long long)sum, (unsigned long long)lightnessSum, (unsigned long)(width * height));
+            result = 1;
+        } else if ([[analyzer heatOverlayModels] count] == 0) {
+            NSLog(@"ERROR: Out-of-gamut pixels should produce a heat overlay");
+            result = 1;
+        }
+    }
+    
+    [analyzer reset];
+    if (result == 0 && ([analyzer totalPixels] != 0 || [analyzer outsideFraction] != 0.0)) {
+        NSLog(@"ERROR: reset should clear the counts");
+        result = 1;
+    }
+    [analyzer release];
+    
+    if (result == 0) {
+        NSLog(@"PASS: Image gamut analysis counts out-of-gamut pixels across bands");
+    }
+    return result;
+}
+#else
+int testImageGamutAnalyzer() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
+int main(int argc, const char * argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    int failures = 0;
+    failures += testImageGamutAnalyzer();
+    
+    if (failures == 0) {
+        NSLog(@"All image gamut analyzer tests passed!");
+    } else {
+        NSLog(@"%d test(s) failed", failures);
+    }
+    
+    [pool release];
+    return failures;
+}
@@ -0,0 +1,166 @@
+//
+//  test_ImageTransformEngine.m
+//  SmallICCer Tests
+//
+//  Unit tests for tiled image conversion
+//
+
+#import <Foundation/Foundation.h>
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "ImageTransformEngine.h"
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+int testImageTransformEngine() {
+    ICCParser *parser = [[ICCParser alloc] init];
+    NSError *error = nil;
+    ICCProfile *wide = [parser parseProfileFromData:makeRGBProfileData(0.2100, 0.7100) error:&error];
+    ICCProfile *narrow = [parser parseProfileFromData:makeRGBProfileData(0.3000, 0.6000) error:&error];
+    [parser release];
+    if (!wide || !narrow) {
+        NSLog(@"ERROR: Failed to parse generated RGB profiles");
+        return 1;
+    }
+    
+    // RGB16 image with padded rows, above the parallel threshold
+    NSUInteger width = 400, height = 300, rowBytes = width * 6 + 16;
+    NSMutableData *source = [NSMutableData dataWithLength:rowBytes * height];
+    NSUInteger x, y;
+    for (y = 0; y < height; y++) {
+        uint16_t *row = (uint16_t *)((uint8_t *)[source mutableBytes] + y * rowBytes);
+        for (x = 0; x < width; x++) {
+            row[x * 3] = (uint16_t)(x * 163);
+            row[x * 3 + 1] = (uint16_t)(y * 218);
+            row[x * 3 + 2] = (uint16_t)((x * y) & 0xFFFF);
+        }
+    }
+    
+    // Reference: one LittleCMS call per row
+    NSMutableData *expected = [NSMutableData dataWithLength:rowBytes * height];
+    cmsHPROFILE hWide = cmsOpenProfileFromMem([[wide profileData] bytes], (cmsUInt32Number)[[wide profileData] length]);
+    cmsHPROFILE hNarrow = cmsOpenProfileFromMem([[narrow profileData] bytes], (cmsUInt32Number)[[narrow profileData] length]);
+    cmsHTRANSFORM xform = cmsCreateTransform(hWide, TYPE_RGB_16, hNarrow, TYPE_RGB_16,
+                                             INTENT_PERCEPTUAL, cmsFLAGS_NOCACHE);
+    for (y = 0; y < height; y++) {
+        cmsDoTransform(xform, (const uint8_t *)[source bytes] + y * rowBytes,
+                       (uint8_t *)[expected mutableBytes] + y * rowBytes, (cmsUInt32Number)width);
+    }
+    cmsDeleteTransform(xform);
+    cmsCloseProfile(hWide);
+    cmsCloseProfile(hNarrow);
+    
+    ImageTransformEngine *engine = [[ImageTransformEngine alloc] initWithSourceProfile:wide
+                                                                    destinationProfile:narrow
+                                                                          proofProfile:nil
+                                                                           inputFormat:ImagePixelFormatRGB16
+                                                                          outputFormat:ImagePixelFormatRGB16
+                                                                                intent:INTENT_PERCEPTUAL
+                                                                                 error:&error];
+    if (!engine) {
+        NSLog(@"ERROR: Failed to create image transform engine: %@", error);
+        return 1;
+    }
+    // Tiles that do not divide the image evenly
+    [engine setTileWidth:96];
+    [engine setTileHeight:16];
+    [engine setWorkerCount:4];
+    NSMutableData *output = [NSMutableData dataWithLength:rowBytes * height];
+    BOOL converted = [engine transformPixels:[source bytes] inputRowBytes:rowBytes
+                                    toPixels:[output mutableBytes] outputRowBytes:rowBytes
+                                       width:width height:height error:&error];
+    NSMutableData *inPlace = [NSMutableData dataWithData:source];
+    BOOL convertedInPlace = [engine transformPixels:[inPlace bytes] inputRowBytes:rowBytes
+                                           toPixels:[inPlace mutableBytes] outputRowBytes:rowBytes
+                                              width:width height:height error:&error];
+    double throughput = [engine lastMegapixelsPerSecond];
+    [engine release];
+    
+    // Row padding is never written, so whole buffers compare
+    if (!converted || ![output isEqualToData:expected]) {
+        NSLog(@"ERROR: Tiled parallel conversion differs from LittleCMS row conversion");
+        return 1;
+    }
+    if (!convertedInPlace || ![inPlace isEqualToData:output]) {
+        NSLog(@"ERROR: In-place conversion differs from out-of-place conversion");
+        return 1;
+    }
+    if (!(throughput > 0.0)) {
+        NSLog(@"ERROR: Throughput should be reported after a conversion");
+        return 1;
+    }
+    
+    // CMYK input does not fit an RGB source profile
+    engine = [[ImageTransformEngine alloc] initWithSourceProfile:wide
+                                              destinationProfile:narrow
+                                                    proofProfile:nil
+                                                     inputFormat:ImagePixelFormatCMYK8
+                                                    outputFormat:ImagePixelFormatRGB8
+                                                          intent:INTENT_PERCEPTUAL
+                                                           error:&error];
+    if (engine) {
+        [engine release];
+        NSLog(@"ERROR: Pixel format and profile color space mismatch should fail");
+        return 1;
+    }
+    
+    NSLog(@"PASS: Tiled image transform matches LittleCMS (%.1f MP/s)", throughput);
+    return 0;
+}
+#else
+int testImageTransformEngine() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
+int main(int argc, const char * argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    int failures = 0;
+    failures += testImageTransformEngine();
+    
+    if (failures == 0) {
+        NSLog(@"All image transform engine tests passed!");
+    } else {
+        NSLog(@"%d test(s) failed", failures);
+    }
+    
+    [pool release];
+    return failures;
+}
@@ -0,0 +1,187 @@
+//
+//  test_ProfileLoadPipeline.m
+//  SmallICCer Tests
+//
+//  Unit tests for background profile loading
+//
+
+#import <Foundation/Foundation.h>
+#import "Gamut3DModel.h"
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "ProfileLoadPipeline.h"
+#import <unistd.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+
+// Build an RGB matrix/TRC profile (D50, gamma 2.2) with the given green primary
+static NSData *makeRGBProfileData(double greenX, double greenY) {
+    cmsCIExyY whitePoint;
+    whitePoint.x = 0.3457;
+    whitePoint.y = 0.3585;
+    whitePoint.Y = 1.0;
+    
+    cmsCIExyYTRIPLE primaries;
+    primaries.Red.x = 0.6400;
+    primaries.Red.y = 0.3300;
+    primaries.Red.Y = 1.0;
+    primaries.Green.x = greenX;
+    primaries.Green.y = greenY;
+    primaries.Green.Y = 1.0;
+    primaries.Blue.x = 0.1500;
+    primaries.Blue.y = 0.0600;
+    primaries.Blue.Y = 1.0;
+    
+    cmsToneCurve *gamma = cmsBuildGamma(NULL, 2.2);
+    cmsToneCurve *curves[3] = {gamma, gamma, gamma};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(gamma);
+    
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hProfile, NULL, &size);
+    void *buffer = malloc(size);
+    cmsSaveProfileToMem(hProfile, buffer, &size);
+    cmsCloseProfile(hProfile);
+    
+    NSData *data = [NSData dataWithBytes:buffer length:size];
+    free(buffer);
+    return data;
+}
+
+// Records pipeline deliveries for testProfileLoadPipeline
+@interface PipelineRecorder : NSObject <ProfileLoadPipelineDelegate> {
+@public
+    NSMutableArray *loadedPaths;
+    NSUInteger errorCount;
+    NSUInteger progressCount;
+    Gamut3DModel *gamut;
+}
+@end
+
+@implementation PipelineRecorder
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        loadedPaths = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didLoadProfile:(ICCProfile *)profile path:(NSString *)path {
+    [loadedPaths addObject:path];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didFailWithError:(NSError *)error path:(NSString *)path {
+    errorCount++;
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didComputeGamut:(Gamut3DModel *)model forProfile:(ICCProfile *)profile {
+    [model retain];
+    [gamut release];
+    gamut = model;
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline progress:(double)fraction stage:(NSString *)stage {
+    progressCount++;
+}
+
+- (void)dealloc {
+    [loadedPaths release];
+    [gamut release];
+    [super dealloc];
+}
+
+@end
+
+// Spin the main run loop until the pipeline has delivered its last result
+static BOOL waitForPipeline(ProfileLoadPipeline *pipeline) {
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:30.0];
+    while ([pipeline isBusy] && [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode
+                                 beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    // Flush progress messages queued behind the final delivery
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    return ![pipeline isBusy];
+}
+
+int testProfileLoadPipeline() {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"test_pipeline_%d.icc", (int)getpid()]];
+    if (![makeRGBProfileData(0.2100, 0.7100) writeToFile:path atomically:YES]) {
+        NSLog(@"ERROR: Failed to write test profile");
+        return 1;
+    }
+    
+    int result = 0;
+    PipelineRecorder *recorder = [[PipelineRecorder alloc] init];
+    ProfileLoadPipeline *pipeline = [[ProfileLoadPipeline alloc] init];
+    [pipeline setDelegate:recorder];
+    
+    // The superseded (failing) request must not be delivered
+    [pipeline loadProfileFromPath:@"/nonexistent/stale.icc"];
+    [pipeline loadProfileFromPath:path];
+    if (!waitForPipeline(pipeline) || [recorder->loadedPaths count] != 1 ||
+        ![[recorder->loadedPaths lastObject] isEqualToString:path] || recorder->errorCount != 0 ||
+        recorder->progressCount == 0) {
+        NSLog(@"ERROR: Only the latest load should be delivered (%lu loads, %lu errors)",
+              (unsigned long)[recorder->loadedPaths count], (unsigned long)recorder->errorCount);
+        result = 1;
+    }
+    
+    ICCParser *parser = [[ICCParser alloc] init];
+    ICCProfile *profile = [parser parseProfileFromPath:path error:NULL];
+    [parser release];
+    if (result == 0) {
+        [pipeline computeGamutForProfile:profile resolution:7];
+        if (!waitForPipeline(pipeline) || [recorder->gamut pointCount] != 7 * 7 * 7 ||
+            [recorder->gamut triangleCount] == 0) {
+            NSLog(@"ERROR: Pipeline should deliver the 7^3 profile gamut with its hull");
+            result = 1;
+        }
+    }
+    
+    // Cancelled requests deliver nothing
+    if (result == 0) {
+        [recorder->gamut release];
+        recorder->gamut = nil;
+        [pipeline computeGamutForProfile:profile resolution:11];
+        [pipeline cancel];
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.5]];
+        if ([pipeline isBusy] || recorder->gamut) {
+            NSLog(@"ERROR: Cancelled gamut request should not be delivered");
+            result = 1;
+        }
+    }
+    
+    [pipeline setDelegate:nil];
+    [pipeline release];
+    [recorder release];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+    if (result == 0) NSLog(@"PASS: Profile load pipeline delivers only the latest request");
+    return result;
+}
+#else
+int testProfileLoadPipeline() {
+    NSLog(@"SKIP: LittleCMS not available");
+    return 0;
+}
+#endif
+
+int main(int argc, const char * argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    int failures = 0;
+    failures += testProfileLoadPipeline();
+    
+    if (failures == 0) {
+        NSLog(@"All profile load pipeline tests passed!");
+    } else {
+        NSLog(@"%d test(s) failed", failures);
+    }
+    
+    [pool release];
+    return failures;
+}
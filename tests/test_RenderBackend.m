@@ -11,6 +11,14 @@
 #import "OpenGLBackend.h"
 #import "Gamut3DModel.h"
 #import "Renderer3D.h"
+#import <math.h>
+#import <stdlib.h>
+
+#if defined(__APPLE__) && !defined(__GNUSTEP__)
+#import <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
 
 // Try to find SSPlatform.h
 #if __has_include("SSPlatform.h")
@@ -182,6 +190,107 @@ int testBackendFactoryFallback() {
     return 0;
 }
 
+// Clip coordinates of (x, y, z, 1) under a column-major matrix
+static void clipPoint(const float *m, float x, float y, float z, float *clip) {
+    int row;
+    for (row = 0; row < 4; row++) {
+        clip[row] = m[row] * x + m[4 + row] * y + m[8 + row] * z + m[12 + row];
+    }
+}
+
+int testCameraMatrix() {
+    float gl[16], vk[16], c[4];
+    RenderBackendCameraMatrix(gl, 0.0f, 0.0f, 1.0f, 1.0f, NO);
+    RenderBackendCameraMatrix(vk, 0.0f, 0.0f, 1.0f, 1.0f, YES);
+
+    // The origin is 200 units in front of the camera, at the center
+    clipPoint(gl, 0.0f, 0.0f, 0.0f, c);
+    if (fabsf(c[0]) > 1e-3f || fabsf(c[1]) > 1e-3f || fabsf(c[3] - 200.0f) > 1e-2f ||
+        c[2] / c[3] <= -1.0f || c[2] / c[3] >= 1.0f) {
+        NSLog(@"ERROR: Camera matrix puts the origin at (%f, %f, %f, %f)", c[0], c[1], c[2], c[3]);
+        return 1;
+    }
+    float glDepth = c[2] / c[3];
+    clipPoint(vk, 0.0f, 0.0f, 0.0f, c);
+    float vkDepth = c[2] / c[3];
+    if (vkDepth <= 0.0f || vkDepth >= 1.0f || fabsf(vkDepth - 0.5f * (glDepth + 1.0f)) > 1e-4f) {
+        NSLog(@"ERROR: Vulkan depth %f does not match GL depth %f", vkDepth, glDepth);
+        return 1;
+    }
+
+    // Up on screen is +Y in GL clip space and -Y in Vulkan's
+    float glUp[4], vkUp[4];
+    clipPoint(gl, 0.0f, 50.0f, 0.0f, glUp);
+    clipPoint(vk, 0.0f, 50.0f, 0.0f, vkUp);
+    if (glUp[1] <= 0.0f || fabsf(vkUp[1] + glUp[1]) > 1e-3f) {
+        NSLog(@"ERROR: Camera matrix Y (GL %f, Vulkan %f)", glUp[1], vkUp[1]);
+        return 1;
+    }
+
+    // Zooming in moves the camera closer
+    RenderBackendCameraMatrix(gl, 30.0f, 45.0f, 2.0f, 1.5f, NO);
+    clipPoint(gl, 0.0f, 0.0f, 0.0f, c);
+    if (fabsf(c[3] - 100.0f) > 1e-2f) {
+        NSLog(@"ERROR: Camera at zoom 2 is %f from the origin, expected 100", c[3]);
+        return 1;
+    }
+    NSLog(@"PASS: Camera matrix (GL and Vulkan clip space)");
+    return 0;
+}
+
+int testOffscreenRenderer() {
+    Renderer3D *renderer = [[Renderer3D alloc] initOffscreenWithWidth:64 height:64
+                                                          backendType:RenderBackendTypeOpenGL];
+    if (!renderer) {
+        NSLog(@"SKIP: Offscreen rendering (no EGL display or driver)");
+        return 0;
+    }
+    NSMutableData *lab = [NSMutableData dataWithLength:4 * 3 * sizeof(float)];
+    float *p = (float *)[lab mutableBytes];
+    p[0] = 50.0f;  p[1] = 0.0f;   p[2] = 0.0f;
+    p[3] = 80.0f;  p[4] = 40.0f;  p[5] = 0.0f;
+    p[6] = 80.0f;  p[7] = -20.0f; p[8] = 35.0f;
+    p[9] = 20.0f;  p[10] = 0.0f;  p[11] = -40.0f;
+    uint32_t tris[12] = {0, 2, 1, 0, 1, 3, 0, 3, 2, 1, 2, 3};
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:lab
+                                                      triangles:[NSData dataWithBytes:tris length:sizeof(tris)]
+                                                           name:@"Tetrahedron"];
+    [renderer addGamutModel:model];
+    [model release];
+    int frame;
+    for (frame = 0; frame < 8; frame++) {
+        [renderer setRotationX:20.0f rotationY:frame * 45.0f zoom:1.0f];
+        [renderer render];
+    }
+    [renderer finishFrames];
+    double gpuTime = [renderer lastFrameGPUTime];
+
+    // The pbuffer context is still current: the last frame must show more
+    // than the default 0.1 gray background
+    unsigned char pixels[64 * 64 * 4];
+    glReadPixels(0, 0, 64, 64, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    NSUInteger drawn = 0;
+    NSUInteger i;
+    for (i = 0; i < 64 * 64; i++) {
+        if (abs((int)pixels[i * 4 + 0] - 26) > 2 || abs((int)pixels[i * 4 + 1] - 26) > 2 ||
+            abs((int)pixels[i * 4 + 2] - 26) > 2) {
+            drawn++;
+        }
+    }
+    [renderer release];
+    if (gpuTime > 1.0) {
+        NSLog(@"ERROR: Offscreen frame took %f s on the GPU", gpuTime);
+        return 1;
+    }
+    if (drawn == 0) {
+        NSLog(@"ERROR: Offscreen frame shows only the clear color");
+        return 1;
+    }
+    NSLog(@"PASS: Offscreen rendering (8 frames, %lu pixels drawn, last GPU time %.3f ms)",
+          (unsigned long)drawn, gpuTime * 1000.0);
+    return 0;
+}
+
 int main(int argc, const char * argv[]) {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
@@ -195,6 +304,8 @@ int main(int argc, const char * argv[]) {
     failures += testRenderer3DClearGamutModels();
     failures += testRenderer3DApplySettings();
     failures += testBackendFactoryFallback();
+    failures += testCameraMatrix();
+    failures += testOffscreenRenderer();
     
     if (failures == 0) {
         NSLog(@"All renderer backend tests passed!");
@@ -84,6 +84,22 @@ int testBackgroundColor() {
     return 0;
 }
 
+int testCacheDirectory() {
+    NSString *dir = [[SettingsManager sharedManager] cacheDirectory];
+    if (!dir) {
+        NSLog(@"WARN: No user cache directory available (may be OK in a sandbox)");
+        return 0;
+    }
+    BOOL isDirectory = NO;
+    if (![[dir lastPathComponent] isEqualToString:@"SmallICCer"] ||
+        ![[NSFileManager defaultManager] fileExistsAtPath:dir isDirectory:&isDirectory] || !isDirectory) {
+        NSLog(@"ERROR: cacheDirectory should be an existing SmallICCer directory, got %@", dir);
+        return 1;
+    }
+    NSLog(@"PASS: cacheDirectory");
+    return 0;
+}
+
 int main(int argc, const char * argv[]) {
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     int failures = 0;
@@ -92,6 +108,7 @@ int main(int argc, const char * argv[]) {
     failures += testSaveSettings();
     failures += testShowGridShowAxes();
     failures += testBackgroundColor();
+    failures += testCacheDirectory();
     if (failures == 0) {
         NSLog(@"All SettingsManager tests passed!");
     } else {
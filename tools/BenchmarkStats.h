@@ -0,0 +1,21 @@
+//
+//  BenchmarkStats.h
+//  SmallICCer
+//
+//  Timing helpers shared by the benchmark tools: a monotonic clock and
+//  nearest-rank percentiles over per-run times.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef struct {
+    double min, p50, p90, p99, max, mean;
+    NSUInteger count; // Samples used; 0 when none were measured
+} BenchmarkStats;
+
+// Seconds on a clock that never jumps (not wall-clock time)
+double BenchmarkSeconds(void);
+
+// Statistics over the non-negative samples; negative samples mark runs
+// that could not be measured and are left out
+BenchmarkStats BenchmarkStatsFromSamples(const double *samples, NSUInteger count);
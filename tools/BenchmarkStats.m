@@ -0,0 +1,54 @@
+//
+//  BenchmarkStats.m
+//  SmallICCer
+//
+
+#import "BenchmarkStats.h"
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+double BenchmarkSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Nearest-rank percentile of count sorted values
+static double percentile(const double *sorted, NSUInteger count, double p) {
+    NSUInteger rank = (NSUInteger)ceil(p / 100.0 * (double)count);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+BenchmarkStats BenchmarkStatsFromSamples(const double *samples, NSUInteger count) {
+    BenchmarkStats stats = {-1.0, -1.0, -1.0, -1.0, -1.0, -1.0, 0};
+    double *sorted = (double *)malloc((count ? count : 1) * sizeof(double));
+    double sum = 0.0;
+    NSUInteger i, n = 0;
+    if (!sorted) return stats;
+    for (i = 0; i < count; i++) {
+        if (samples[i] >= 0.0) {
+            sorted[n++] = samples[i];
+            sum += samples[i];
+        }
+    }
+    if (n > 0) {
+        qsort(sorted, n, sizeof(double), compareDoubles);
+        stats.min = sorted[0];
+        stats.p50 = percentile(sorted, n, 50.0);
+        stats.p90 = percentile(sorted, n, 90.0);
+        stats.p99 = percentile(sorted, n, 99.0);
+        stats.max = sorted[n - 1];
+        stats.mean = sum / (double)n;
+        stats.count = n;
+    }
+    free(sorted);
+    return stats;
+}
@@ -0,0 +1,190 @@
+//
+//  SmallICCerBatch.m
+//  SmallICCer
+//
+//  Headless batch tool: applies the same edits to many profiles in parallel.
+//  One tab-separated line per file (status, input, output, bytes, message)
+//  goes to stdout and the report file as soon as that file is done.
+//
+//  Exit status: 0 all files succeeded, 1 some files failed, 2 usage error.
+//
+
+#import <Foundation/Foundation.h>
+#import "ProfileBatchProcessor.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+@interface BatchReporter : NSObject <ProfileBatchProcessorDelegate> {
+    NSFileHandle *reportHandle;
+    BOOL quiet;
+}
+- (id)initWithReportHandle:(NSFileHandle *)handle quiet:(BOOL)q;
+@end
+
+@implementation BatchReporter
+
+- (id)initWithReportHandle:(NSFileHandle *)handle quiet:(BOOL)q {
+    self = [super init];
+    if (self) {
+        reportHandle = [handle retain];
+        quiet = q;
+    }
+    return self;
+}
+
+// Tabs and newlines would break the columns
+static NSString *reportField(id value) {
+    NSString *field = value ? [value description] : @"";
+    field = [field stringByReplacingOccurrencesOfString:@"\t" withString:@" "];
+    return [field stringByReplacingOccurrencesOfString:@"\n" withString:@" "];
+}
+
+- (void)batchProcessor:(ProfileBatchProcessor *)processor didProcessFile:(NSDictionary *)result {
+    NSString *line = [NSString stringWithFormat:@"%@\t%@\t%@\t%@\t%@\n",
+                      reportField([result objectForKey:kProfileBatchStatusKey]),
+                      reportField([result objectForKey:kProfileBatchPathKey]),
+                      reportField([result objectForKey:kProfileBatchOutputPathKey]),
+                      reportField([result objectForKey:kProfileBatchBytesKey]),
+                      reportField([result objectForKey:kProfileBatchMessageKey])];
+    NSData *bytes = [line dataUsingEncoding:NSUTF8StringEncoding];
+    if (!quiet) {
+        fwrite([bytes bytes], 1, [bytes length], stdout);
+        fflush(stdout);
+    }
+    [reportHandle writeData:bytes];
+}
+
+- (void)dealloc {
+    [reportHandle release];
+    [super dealloc];
+}
+
+@end
+
+static void printUsage(void) {
+    fprintf(stderr,
+            "Usage: SmallICCerBatch [options] <profile or directory>...\n"
+            "\n"
+            "Edits:\n"
+            "  --description TEXT   Set the 'desc' text\n"
+            "  --copyright TEXT     Set the 'cprt' text\n"
+            "  --gamma G            Replace the TRCs with a pure gamma\n"
+            "  --trc-from PROFILE   Replace the TRCs with those of PROFILE\n"
+            "  --version 2|4        Convert to this major version\n"
+            "  --regenerate         Re-encode every tag that has an encoder\n"
+            "\n"
+            "Output:\n"
+            "  --output DIR         Write under DIR (default: rewrite in place)\n"
+            "  --report FILE        Write the per-file report to FILE\n"
+            "  --jobs N             Worker count (default: one per core)\n"
+            "  --dry-run            Apply edits without writing anything\n"
+            "  --quiet              Do not print per-file lines\n");
+}
+
+int main(int argc, const char *argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableDictionary *edits = [NSMutableDictionary dictionary];
+    NSMutableArray *paths = [NSMutableArray array];
+    NSString *outputDirectory = nil;
+    NSString *reportPath = nil;
+    NSUInteger jobs = 0;
+    BOOL dryRun = NO;
+    BOOL quiet = NO;
+    BOOL usageError = NO;
+    int i;
+
+    for (i = 1; i < argc && !usageError; i++) {
+        NSString *option = [NSString stringWithUTF8String:argv[i]];
+        BOOL takesValue = [option isEqualToString:@"--description"] || [option isEqualToString:@"--copyright"] ||
+                          [option isEqualToString:@"--gamma"] || [option isEqualToString:@"--trc-from"] ||
+                          [option isEqualToString:@"--version"] || [option isEqualToString:@"--output"] ||
+                          [option isEqualToString:@"--report"] || [option isEqualToString:@"--jobs"];
+        NSString *value = nil;
+        if (takesValue) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                usageError = YES;
+                break;
+            }
+            value = [NSString stringWithUTF8String:argv[++i]];
+        }
+
+        if ([option isEqualToString:@"--description"]) {
+            [edits setObject:value forKey:kProfileBatchDescriptionKey];
+        } else if ([option isEqualToString:@"--copyright"]) {
+            [edits setObject:value forKey:kProfileBatchCopyrightKey];
+        } else if ([option isEqualToString:@"--gamma"]) {
+            [edits setObject:[NSNumber numberWithDouble:[value doubleValue]] forKey:kProfileBatchGammaKey];
+        } else if ([option isEqualToString:@"--trc-from"]) {
+            [edits setObject:value forKey:kProfileBatchTRCProfileKey];
+        } else if ([option isEqualToString:@"--version"]) {
+            [edits setObject:[NSNumber numberWithInteger:[value integerValue]] forKey:kProfileBatchVersionKey];
+        } else if ([option isEqualToString:@"--regenerate"]) {
+            [edits setObject:[NSNumber numberWithBool:YES] forKey:kProfileBatchRegenerateKey];
+        } else if ([option isEqualToString:@"--output"]) {
+            outputDirectory = value;
+        } else if ([option isEqualToString:@"--report"]) {
+            reportPath = value;
+        } else if ([option isEqualToString:@"--jobs"]) {
+            jobs = (NSUInteger)MAX([value integerValue], 0);
+        } else if ([option isEqualToString:@"--dry-run"]) {
+            dryRun = YES;
+        } else if ([option isEqualToString:@"--quiet"]) {
+            quiet = YES;
+        } else if ([option hasPrefix:@"-"]) {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            usageError = YES;
+        } else {
+            [paths addObject:option];
+        }
+    }
+
+    if (!usageError && [edits objectForKey:kProfileBatchGammaKey] && [edits objectForKey:kProfileBatchTRCProfileKey]) {
+        fprintf(stderr, "--gamma and --trc-from cannot be combined\n");
+        usageError = YES;
+    }
+    if (usageError || [paths count] == 0) {
+        printUsage();
+        [pool release];
+        return 2;
+    }
+
+    NSError *error = nil;
+    ProfileBatchProcessor *processor = [[ProfileBatchProcessor alloc] initWithEdits:edits error:&error];
+    if (!processor) {
+        fprintf(stderr, "%s\n", [[error localizedDescription] UTF8String]);
+        [pool release];
+        return 2;
+    }
+
+    NSFileHandle *reportHandle = nil;
+    if (reportPath) {
+        if (![[NSFileManager defaultManager] createFileAtPath:reportPath contents:nil attributes:nil] ||
+            !(reportHandle = [NSFileHandle fileHandleForWritingAtPath:reportPath])) {
+            fprintf(stderr, "Cannot create report %s\n", [reportPath UTF8String]);
+            [processor release];
+            [pool release];
+            return 2;
+        }
+        [reportHandle writeData:[@"status\tpath\toutput\tbytes\tmessage\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+
+    BatchReporter *reporter = [[BatchReporter alloc] initWithReportHandle:reportHandle quiet:quiet];
+    [processor setOutputDirectory:[outputDirectory stringByStandardizingPath]];
+    [processor setWorkerCount:jobs];
+    [processor setDryRun:dryRun];
+    [processor setDelegate:reporter];
+
+    BOOL success = [processor processPaths:paths];
+    [reportHandle closeFile];
+    fprintf(stderr, "%lu %s, %lu unchanged, %lu failed\n",
+            (unsigned long)(dryRun ? [processor dryRunCount] : [processor writtenCount]),
+            dryRun ? "would be written" : "written",
+            (unsigned long)[processor unchangedCount],
+            (unsigned long)[processor failedCount]);
+
+    [processor release];
+    [reporter release];
+    [pool release];
+    return success ? 0 : 1;
+}
@@ -0,0 +1,708 @@
+//
+//  SmallICCerBench.m
+//  SmallICCer
+//
+//  Micro-benchmarks for the color, ICC and gamut hot paths. Each case is
+//  timed over several runs of a fixed input. Short cases loop inside a run,
+//  so that a run lasts at least kMinRunSeconds. Times are reported per
+//  iteration, as min/median/mean/max, with JSON and CSV output for tracking
+//  regressions between releases.
+//
+//  Inputs are generated the same way every time: pseudo-random RGB samples
+//  from a fixed seed, and a built-in corpus of LittleCMS profiles (matrix/TRC
+//  with gamma or 4096-entry curves, and 17^3 and 33^3 CLUTs). --corpus adds
+//  profiles from disk. Lattices run on one worker unless --jobs says
+//  otherwise, so runs on different machines stay comparable.
+//
+//  Exit status: 0 all cases ran, 1 a case failed or results not written,
+//  2 usage error.
+//
+
+#import <Foundation/Foundation.h>
+#import "BenchmarkStats.h"
+#import "ColorConverter.h"
+#import "ColorTransform.h"
+#import "ColorSpace.h"
+#import "StandardColorSpaces.h"
+#import "GamutCalculator.h"
+#import "ICCParser.h"
+#import "ICCWriter.h"
+#import "ICCProfile.h"
+#import "ICCTag.h"
+#import "ICCTagLUT.h"
+#import "Gamut3DModel.h"
+#import "GamutComparator.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
+
+static const double kMinRunSeconds = 0.01;
+static const NSUInteger kDefaultSamples = 1048576;
+// The scalar API builds its matrix per call; fewer samples keep it quick
+static const NSUInteger kScalarSampleDivisor = 16;
+static const NSUInteger kLatticeResolutions[3] = {17, 33, 65};
+static const NSUInteger kCompareResolution = 33;
+
+#ifdef HAVE_LCMS
+static cmsInt32Number identitySampler(const cmsUInt16Number in[], cmsUInt16Number out[], void *cargo) {
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+    return TRUE;
+}
+
+// sRGB primaries on D50. tableSize 0 uses a pure 2.2 gamma, otherwise a
+// sampled curve; gridPoints > 0 adds an identity AToB0 CLUT of that size.
+static NSData *makeProfileData(cmsUInt32Number tableSize, cmsUInt32Number gridPoints) {
+    cmsCIExyY whitePoint = {0.3457, 0.3585, 1.0};
+    cmsCIExyYTRIPLE primaries = {
+        {0.6400, 0.3300, 1.0},
+        {0.3000, 0.6000, 1.0},
+        {0.1500, 0.0600, 1.0}
+    };
+    cmsToneCurve *curve = NULL;
+    if (tableSize > 0) {
+        cmsUInt16Number *table = (cmsUInt16Number *)malloc(tableSize * sizeof(cmsUInt16Number));
+        cmsUInt32Number i;
+        if (!table) return nil;
+        for (i = 0; i < tableSize; i++) {
+            double x = (double)i / (double)(tableSize - 1);
+            table[i] = (cmsUInt16Number)(pow(x, 2.2) * 65535.0 + 0.5);
+        }
+        curve = cmsBuildTabulatedToneCurve16(NULL, tableSize, table);
+        free(table);
+    } else {
+        curve = cmsBuildGamma(NULL, 2.2);
+    }
+    if (!curve) return nil;
+    cmsToneCurve *curves[3] = {curve, curve, curve};
+    cmsHPROFILE hProfile = cmsCreateRGBProfileTHR(NULL, &whitePoint, &primaries, curves);
+    cmsFreeToneCurve(curve);
+    if (!hProfile) return nil;
+
+    if (gridPoints > 0) {
+        cmsPipeline *pipeline = cmsPipelineAlloc(NULL, 3, 3);
+        cmsStage *clut = cmsStageAllocCLut16bit(NULL, gridPoints, 3, 3, NULL);
+        if (pipeline && clut && cmsStageSampleCLut16bit(clut, identitySampler, NULL, 0)) {
+            cmsPipelineInsertStage(pipeline, cmsAT_END, clut);
+            clut = NULL;
+            cmsWriteTag(hProfile, cmsSigAToB0Tag, pipeline);
+        }
+        if (clut) cmsStageFree(clut);
+        if (pipeline) cmsPipelineFree(pipeline);
+    }
+
+    NSData *data = nil;
+    cmsUInt32Number size = 0;
+    if (cmsSaveProfileToMem(hProfile, NULL, &size)) {
+        NSMutableData *bytes = [NSMutableData dataWithLength:size];
+        if (cmsSaveProfileToMem(hProfile, [bytes mutableBytes], &size)) data = bytes;
+    }
+    cmsCloseProfile(hProfile);
+    return data;
+}
+#endif
+
+static NSString *jsonString(NSString *string) {
+    NSMutableString *escaped = [NSMutableString stringWithString:string];
+    [escaped replaceOccurrencesOfString:@"\\" withString:@"\\\\" options:0 range:NSMakeRange(0, [escaped length])];
+    [escaped replaceOccurrencesOfString:@"\"" withString:@"\\\"" options:0 range:NSMakeRange(0, [escaped length])];
+    return [NSString stringWithFormat:@"\"%@\"", escaped];
+}
+
+@interface MicroBenchmarks : NSObject {
+    NSUInteger repeatCount;
+    NSUInteger warmupCount;
+    NSString *filter;
+    NSMutableArray *results;
+    NSUInteger failureCount;
+    BOOL caseFailed;
+    double sink; // Keeps results alive so the work is not optimized away
+
+    // Inputs of the case being measured
+    NSUInteger sampleCount;
+    float *rgbSamples;
+    float *scratch;
+    ColorSpace *colorSpace;
+    ColorTransform *transform;
+    NSData *profileBytes;
+    ICCProfile *profile;
+    NSString *tempPath;
+    GamutCalculator *calculator;
+    NSUInteger latticeResolution;
+    NSData *latticeLab;
+    Gamut3DModel *gamutA;
+    Gamut3DModel *gamutB;
+    GamutComparator *comparator;
+}
+- (id)initWithRepeat:(NSUInteger)repeat warmup:(NSUInteger)warmup filter:(NSString *)text;
+- (void)runColorCasesWithSamples:(NSUInteger)count;
+- (void)runICCCasesWithCorpus:(NSArray *)corpus;
+- (void)runGamutCasesWithWorkers:(NSUInteger)workers corpus:(NSArray *)corpus;
+- (NSArray *)results;
+- (NSUInteger)failureCount;
+@end
+
+@implementation MicroBenchmarks
+
+- (id)initWithRepeat:(NSUInteger)repeat warmup:(NSUInteger)warmup filter:(NSString *)text {
+    self = [super init];
+    if (self) {
+        repeatCount = repeat;
+        warmupCount = warmup;
+        filter = [text copy];
+        results = [[NSMutableArray alloc] init];
+        tempPath = [[NSTemporaryDirectory() stringByAppendingPathComponent:
+                     [NSString stringWithFormat:@"SmallICCerBench-%d.icc", (int)getpid()]] retain];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSFileManager defaultManager] removeItemAtPath:tempPath error:NULL];
+    free(rgbSamples);
+    free(scratch);
+    [filter release];
+    [results release];
+    [colorSpace release];
+    [transform release];
+    [profileBytes release];
+    [profile release];
+    [tempPath release];
+    [calculator release];
+    [latticeLab release];
+    [gamutA release];
+    [gamutB release];
+    [comparator release];
+    [super dealloc];
+}
+
+- (NSArray *)results {
+    return results;
+}
+
+- (NSUInteger)failureCount {
+    return failureCount;
+}
+
+- (BOOL)wants:(NSString *)name {
+    return !filter || [name rangeOfString:filter].location != NSNotFound;
+}
+
+- (double)timeIterations:(NSUInteger)iterations selector:(SEL)selector {
+    NSUInteger i;
+    double start = BenchmarkSeconds();
+    for (i = 0; i < iterations && !caseFailed; i++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        [self performSelector:selector];
+        [pool release];
+    }
+    return BenchmarkSeconds() - start;
+}
+
+// Times selector (one iteration of the case) and records a result; items is
+// the work one iteration does, in unit
+- (void)measure:(NSString *)name selector:(SEL)selector items:(double)items unit:(NSString *)unit {
+    if (![self wants:name]) return;
+    caseFailed = NO;
+
+    // The first run also finds how many iterations fill kMinRunSeconds
+    double first = [self timeIterations:1 selector:selector];
+    NSUInteger iterations = 1;
+    if (first < kMinRunSeconds) {
+        iterations = (NSUInteger)ceil(kMinRunSeconds / (first > 1e-7 ? first : 1e-7));
+    }
+    NSUInteger run;
+    for (run = 0; run < warmupCount && !caseFailed; run++) {
+        [self timeIterations:iterations selector:selector];
+    }
+    double *times = (double *)malloc(repeatCount * sizeof(double));
+    for (run = 0; run < repeatCount && times && !caseFailed; run++) {
+        times[run] = [self timeIterations:iterations selector:selector] / (double)iterations;
+    }
+    if (caseFailed || !times) {
+        free(times);
+        failureCount++;
+        fprintf(stderr, "FAILED: %s\n", [name UTF8String]);
+        return;
+    }
+    BenchmarkStats stats = BenchmarkStatsFromSamples(times, repeatCount);
+    free(times);
+
+    NSDictionary *result = [NSDictionary dictionaryWithObjectsAndKeys:
+                            name, @"name",
+                            unit, @"unit",
+                            [NSNumber numberWithDouble:items], @"items",
+                            [NSNumber numberWithUnsignedInteger:iterations], @"iterations",
+                            [NSNumber numberWithDouble:stats.min], @"min",
+                            [NSNumber numberWithDouble:stats.p50], @"median",
+                            [NSNumber numberWithDouble:stats.mean], @"mean",
+                            [NSNumber numberWithDouble:stats.max], @"max",
+                            nil];
+    [results addObject:result];
+    printf("%-40s %10.4f ms median  %10.4f ms min  %12.0f %s/s\n", [name UTF8String],
+           stats.p50 * 1000.0, stats.min * 1000.0, items / stats.p50, [unit UTF8String]);
+    fflush(stdout);
+}
+
+#pragma mark - Color conversion
+
+- (void)runConverterScalar {
+    double white[3], rgb[3], xyz[3], lab[3];
+    NSArray *primaries = [colorSpace primaries];
+    NSArray *whitePoint = [colorSpace whitePoint];
+    NSUInteger i, count = sampleCount / kScalarSampleDivisor;
+    [ColorConverter whitePointXyzFromColorSpace:whitePoint outXyz:white];
+    for (i = 0; i < count; i++) {
+        rgb[0] = rgbSamples[i * 3];
+        rgb[1] = rgbSamples[i * 3 + 1];
+        rgb[2] = rgbSamples[i * 3 + 2];
+        [ColorConverter rgbToXyz:rgb xyz:xyz primaries:primaries whitePoint:whitePoint];
+        [ColorConverter xyzToLab:xyz lab:lab whitePoint:white];
+        sink += lab[0];
+    }
+}
+
+- (void)runTransformTwoStep {
+    [transform convertRGB:rgbSamples toXYZ:scratch count:sampleCount];
+    [transform convertXYZ:scratch toLab:scratch count:sampleCount];
+    sink += scratch[0];
+}
+
+- (void)runTransformFused {
+    [transform convertRGB:rgbSamples toLab:scratch count:sampleCount];
+    sink += scratch[0];
+}
+
+- (void)runColorCasesWithSamples:(NSUInteger)count {
+    if (![self wants:@"color.converter.scalar"] && ![self wants:@"color.transform.rgb-xyz-lab"] &&
+        ![self wants:@"color.transform.rgb-lab"]) {
+        return;
+    }
+    sampleCount = count;
+    rgbSamples = (float *)malloc(count * 3 * sizeof(float));
+    scratch = (float *)malloc(count * 3 * sizeof(float));
+    if (!rgbSamples || !scratch) {
+        fprintf(stderr, "FAILED: color cases (out of memory)\n");
+        failureCount++;
+        return;
+    }
+    // Fixed-seed LCG, so every run converts the same colors
+    uint32_t state = 12345u;
+    NSUInteger i;
+    for (i = 0; i < count * 3; i++) {
+        state = state * 1664525u + 1013904223u;
+        rgbSamples[i] = (float)(state >> 8) / 16777216.0f;
+    }
+    colorSpace = [[StandardColorSpaces sRGB] retain];
+    transform = [[ColorTransform alloc] initWithColorSpace:colorSpace];
+
+    [self measure:@"color.converter.scalar" selector:@selector(runConverterScalar)
+            items:(double)(count / kScalarSampleDivisor) unit:@"samples"];
+    [self measure:@"color.transform.rgb-xyz-lab" selector:@selector(runTransformTwoStep)
+            items:(double)count unit:@"samples"];
+    [self measure:@"color.transform.rgb-lab" selector:@selector(runTransformFused)
+            items:(double)count unit:@"samples"];
+}
+
+#pragma mark - ICC parsing and writing
+
+- (void)runParseFull {
+    ICCParser *parser = [[ICCParser alloc] init];
+    if (![parser parseProfileFromData:profileBytes error:NULL]) caseFailed = YES;
+    [parser release];
+}
+
+- (void)runParseLazy {
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    if (![parser parseProfileFromData:profileBytes error:NULL]) caseFailed = YES;
+    [parser release];
+}
+
+- (void)runWriteData {
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    NSData *data = [writer dataForProfile:profile error:NULL];
+    if (!data) caseFailed = YES;
+    sink += (double)[data length];
+    [writer release];
+}
+
+- (void)runWriteFile {
+    ICCWriter *writer = [[ICCWriter alloc] init];
+    if (![writer writeProfile:profile toPath:tempPath error:NULL]) caseFailed = YES;
+    [writer release];
+}
+
+// Parsed copy of profileBytes; encoded re-encodes every tag that the
+// writer would (as SmallICCerBatch --regenerate does) instead of copying
+- (ICCProfile *)profileForWriting:(BOOL)encoded {
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *parsed = [parser parseProfileFromData:profileBytes error:NULL];
+    [parser release];
+    if (!parsed || !encoded) return parsed;
+    NSArray *signatures = [parsed allTagSignatures];
+    NSUInteger i;
+    for (i = 0; i < [signatures count]; i++) {
+        ICCTag *tag = [parsed tagWithSignature:[signatures objectAtIndex:i]];
+        // Version 2 LUTs keep their lut8/lut16 source bytes, and raw tags
+        // have no encoder, so both are copied
+        if ([tag isKindOfClass:[ICCTagLUT class]] && [parsed version] < 4) continue;
+        if ([tag isMemberOfClass:[ICCTag class]]) continue;
+        [tag decodeIfNeeded];
+        [tag markModified];
+    }
+    return parsed;
+}
+
+- (void)runICCCasesWithCorpus:(NSArray *)corpus {
+    NSUInteger i;
+    for (i = 0; i < [corpus count]; i++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSDictionary *entry = [corpus objectAtIndex:i];
+        NSString *name = [entry objectForKey:@"name"];
+        [profileBytes release];
+        profileBytes = [[entry objectForKey:@"data"] retain];
+        double bytes = (double)[profileBytes length];
+
+#ifdef HAVE_LCMS
+        [self measure:[@"icc.parse.full." stringByAppendingString:name]
+             selector:@selector(runParseFull) items:bytes unit:@"bytes"];
+#endif
+        [self measure:[@"icc.parse.lazy." stringByAppendingString:name]
+             selector:@selector(runParseLazy) items:bytes unit:@"bytes"];
+
+        [profile release];
+        profile = [[self profileForWriting:NO] retain];
+        if (profile) {
+            [self measure:[@"icc.write.copy." stringByAppendingString:name]
+                 selector:@selector(runWriteData) items:bytes unit:@"bytes"];
+            [self measure:[@"icc.write.file." stringByAppendingString:name]
+                 selector:@selector(runWriteFile) items:bytes unit:@"bytes"];
+        }
+        [profile release];
+        profile = [[self profileForWriting:YES] retain];
+        if (profile) {
+            [self measure:[@"icc.write.encode." stringByAppendingString:name]
+                 selector:@selector(runWriteData) items:bytes unit:@"bytes"];
+        }
+        if (!profile && [self wants:[@"icc.write." stringByAppendingString:name]]) {
+            fprintf(stderr, "FAILED: icc.write.%s (profile does not parse)\n", [name UTF8String]);
+            failureCount++;
+        }
+        [profile release];
+        profile = nil;
+        [pool release];
+    }
+}
+
+#pragma mark - Gamuts
+
+- (void)runLatticeForColorSpace {
+    NSData *lab = [calculator computePackedGamutForColorSpace:colorSpace];
+    if ([lab length] == 0) caseFailed = YES;
+}
+
+- (void)runLatticeForProfile {
+    NSData *lab = [calculator computePackedGamutForProfile:profile];
+    if ([lab length] == 0) caseFailed = YES;
+}
+
+- (void)runConvexHull {
+    NSData *triangles = [calculator computeConvexHullTrianglesForPackedLab:latticeLab];
+    if ([triangles length] == 0) caseFailed = YES;
+}
+
+- (void)runVolume {
+    sink += [comparator computeVolume:gamutA] + [comparator computeVolume:gamutB];
+}
+
+- (void)runIntersection {
+    sink += [comparator computeIntersectionVolume:gamutA and:gamutB];
+}
+
+- (void)runCoverage {
+    sink += [comparator computeCoverage:gamutA by:gamutB];
+}
+
+- (void)runOverlap {
+    sink += (double)[[comparator findOverlap:gamutA and:gamutB] count];
+}
+
+- (Gamut3DModel *)newGamutForColorSpace:(ColorSpace *)space {
+    NSData *lab = [calculator computePackedGamutForColorSpace:space];
+    NSData *triangles = [calculator computeConvexHullTrianglesForPackedLab:lab];
+    return [[Gamut3DModel alloc] initWithLabData:lab triangles:triangles name:[space name]];
+}
+
+- (void)runGamutCasesWithWorkers:(NSUInteger)workers corpus:(NSArray *)corpus {
+    calculator = [[GamutCalculator alloc] init];
+    [calculator setWorkerCount:workers];
+    [colorSpace release];
+    colorSpace = [[StandardColorSpaces sRGB] retain];
+
+#ifdef HAVE_LCMS
+    // The matrix/TRC profile of the built-in corpus goes through LittleCMS
+    [profile release];
+    profile = nil;
+    if ([corpus count] > 0) {
+        ICCParser *parser = [[ICCParser alloc] init];
+        [parser setLazyTagDecoding:YES];
+        profile = [[parser parseProfileFromData:[[corpus objectAtIndex:0] objectForKey:@"data"] error:NULL] retain];
+        [parser release];
+    }
+#endif
+
+    NSUInteger r;
+    for (r = 0; r < 3; r++) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        latticeResolution = kLatticeResolutions[r];
+        [calculator setResolution:latticeResolution];
+        double samples = (double)(latticeResolution * latticeResolution * latticeResolution);
+        NSString *suffix = [NSString stringWithFormat:@"%lu", (unsigned long)latticeResolution];
+
+        [self measure:[@"gamut.lattice.space." stringByAppendingString:suffix]
+             selector:@selector(runLatticeForColorSpace) items:samples unit:@"samples"];
+        if (profile) {
+            [self measure:[@"gamut.lattice.profile." stringByAppendingString:suffix]
+                 selector:@selector(runLatticeForProfile) items:samples unit:@"samples"];
+        }
+        if ([self wants:[@"gamut.hull." stringByAppendingString:suffix]]) {
+            [latticeLab release];
+            latticeLab = [[calculator computePackedGamutForColorSpace:colorSpace] retain];
+            [self measure:[@"gamut.hull." stringByAppendingString:suffix]
+                 selector:@selector(runConvexHull) items:samples unit:@"samples"];
+        }
+        [pool release];
+    }
+
+    if (![self wants:@"gamut.compare.volume"] && ![self wants:@"gamut.compare.intersection"] &&
+        ![self wants:@"gamut.compare.coverage"] && ![self wants:@"gamut.compare.overlap"]) {
+        return;
+    }
+    [calculator setResolution:kCompareResolution];
+    gamutA = [self newGamutForColorSpace:[StandardColorSpaces sRGB]];
+    gamutB = [self newGamutForColorSpace:[StandardColorSpaces displayP3]];
+    comparator = [[GamutComparator alloc] init];
+    double points = (double)([gamutA pointCount] + [gamutB pointCount]);
+    // Spatial indexes are built by the first run and reused after that,
+    // as the gamut view does
+    [self measure:@"gamut.compare.volume" selector:@selector(runVolume)
+            items:(double)([gamutA triangleCount] + [gamutB triangleCount]) unit:@"triangles"];
+    [self measure:@"gamut.compare.intersection" selector:@selector(runIntersection) items:points unit:@"points"];
+    [self measure:@"gamut.compare.coverage" selector:@selector(runCoverage) items:points unit:@"points"];
+    [self measure:@"gamut.compare.overlap" selector:@selector(runOverlap) items:points unit:@"points"];
+}
+
+@end
+
+// Built-in profiles, then .icc/.icm files from the given paths
+static NSArray *loadCorpus(NSArray *paths) {
+    NSMutableArray *corpus = [NSMutableArray array];
+#ifdef HAVE_LCMS
+    struct { const char *name; cmsUInt32Number tableSize, gridPoints; } builtIn[4] = {
+        {"matrix-gamma", 0, 0}, {"matrix-table", 4096, 0}, {"clut17", 0, 17}, {"clut33", 0, 33}
+    };
+    int b;
+    for (b = 0; b < 4; b++) {
+        NSData *data = makeProfileData(builtIn[b].tableSize, builtIn[b].gridPoints);
+        if (data) {
+            [corpus addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                               [NSString stringWithUTF8String:builtIn[b].name], @"name", data, @"data", nil]];
+        }
+    }
+#endif
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSUInteger i;
+    for (i = 0; i < [paths count]; i++) {
+        NSString *path = [paths objectAtIndex:i];
+        NSMutableArray *files = [NSMutableArray array];
+        BOOL isDirectory = NO;
+        if ([fileManager fileExistsAtPath:path isDirectory:&isDirectory] && isDirectory) {
+            NSDirectoryEnumerator *enumerator = [fileManager enumeratorAtPath:path];
+            NSString *relative;
+            while ((relative = [enumerator nextObject])) {
+                NSString *extension = [[relative pathExtension] lowercaseString];
+                if ([extension isEqualToString:@"icc"] || [extension isEqualToString:@"icm"]) {
+                    [files addObject:[path stringByAppendingPathComponent:relative]];
+                }
+            }
+            [files sortUsingSelector:@selector(compare:)];
+        } else {
+            [files addObject:path];
+        }
+        NSUInteger f;
+        for (f = 0; f < [files count]; f++) {
+            NSString *file = [files objectAtIndex:f];
+            NSData *data = [NSData dataWithContentsOfFile:file];
+            if (!data) {
+                fprintf(stderr, "Cannot read %s\n", [file UTF8String]);
+                continue;
+            }
+            [corpus addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                               [[file lastPathComponent] stringByDeletingPathExtension], @"name", data, @"data", nil]];
+        }
+    }
+    return corpus;
+}
+
+static NSString *resultsJSON(NSArray *results, NSUInteger repeat, NSUInteger warmup, NSUInteger workers) {
+    NSMutableString *json = [NSMutableString stringWithString:@"{\n  \"tool\": \"SmallICCerBench\",\n"];
+#ifdef HAVE_LCMS
+    [json appendString:@"  \"lcms\": true,\n"];
+#else
+    [json appendString:@"  \"lcms\": false,\n"];
+#endif
+    [json appendFormat:@"  \"repeat\": %lu,\n  \"warmup\": %lu,\n  \"jobs\": %lu,\n  \"results\": [",
+                       (unsigned long)repeat, (unsigned long)warmup, (unsigned long)workers];
+    NSUInteger i;
+    for (i = 0; i < [results count]; i++) {
+        NSDictionary *r = [results objectAtIndex:i];
+        double median = [[r objectForKey:@"median"] doubleValue];
+        [json appendFormat:@"%@\n    {\"name\": %@, \"items\": %.0f, \"unit\": %@, \"iterations\": %lu, "
+                           @"\"min_ms\": %.6f, \"median_ms\": %.6f, \"mean_ms\": %.6f, \"max_ms\": %.6f, "
+                           @"\"items_per_second\": %.1f}",
+                           (i > 0) ? @"," : @"", jsonString([r objectForKey:@"name"]),
+                           [[r objectForKey:@"items"] doubleValue], jsonString([r objectForKey:@"unit"]),
+                           (unsigned long)[[r objectForKey:@"iterations"] unsignedIntegerValue],
+                           [[r objectForKey:@"min"] doubleValue] * 1000.0, median * 1000.0,
+                           [[r objectForKey:@"mean"] doubleValue] * 1000.0,
+                           [[r objectForKey:@"max"] doubleValue] * 1000.0,
+                           [[r objectForKey:@"items"] doubleValue] / median];
+    }
+    [json appendString:@"\n  ]\n}\n"];
+    return json;
+}
+
+static NSString *resultsCSV(NSArray *results) {
+    NSMutableString *csv = [NSMutableString stringWithString:
+                            @"name,items,unit,iterations,min_ms,median_ms,mean_ms,max_ms,items_per_second\n"];
+    NSUInteger i;
+    for (i = 0; i < [results count]; i++) {
+        NSDictionary *r = [results objectAtIndex:i];
+        double median = [[r objectForKey:@"median"] doubleValue];
+        // Profile names come from file names; commas would shift the columns
+        NSString *name = [[r objectForKey:@"name"] stringByReplacingOccurrencesOfString:@"," withString:@"_"];
+        [csv appendFormat:@"%@,%.0f,%@,%lu,%.6f,%.6f,%.6f,%.6f,%.1f\n", name,
+                          [[r objectForKey:@"items"] doubleValue], [r objectForKey:@"unit"],
+                          (unsigned long)[[r objectForKey:@"iterations"] unsignedIntegerValue],
+                          [[r objectForKey:@"min"] doubleValue] * 1000.0, median * 1000.0,
+                          [[r objectForKey:@"mean"] doubleValue] * 1000.0,
+                          [[r objectForKey:@"max"] doubleValue] * 1000.0,
+                          [[r objectForKey:@"items"] doubleValue] / median];
+    }
+    return csv;
+}
+
+static void printUsage(void) {
+    fprintf(stderr,
+            "Usage: SmallICCerBench [options]\n"
+            "\n"
+            "Cases: color.*, icc.parse.*, icc.write.*, gamut.lattice.*, gamut.hull.*,\n"
+            "gamut.compare.* (per profile and lattice resolution 17/33/65)\n"
+            "\n"
+            "Options:\n"
+            "  --filter TEXT        Only run cases whose name contains TEXT\n"
+            "  --corpus PATH        Also benchmark this profile, or the .icc/.icm files under it\n"
+            "  --samples N          RGB samples per color conversion run (default: 1048576)\n"
+            "  --repeat N           Measured runs per case (default: 5)\n"
+            "  --warmup N           Unmeasured runs per case (default: 1)\n"
+            "  --jobs N             Gamut lattice workers, 0 = one per core (default: 1)\n"
+            "  --json FILE          Write the results to FILE as JSON\n"
+            "  --csv FILE           Write the results to FILE as CSV\n");
+}
+
+int main(int argc, const char *argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *corpusPaths = [NSMutableArray array];
+    NSString *filter = nil;
+    NSString *jsonPath = nil;
+    NSString *csvPath = nil;
+    NSInteger samples = (NSInteger)kDefaultSamples;
+    NSInteger repeat = 5;
+    NSInteger warmup = 1;
+    NSInteger jobs = 1;
+    BOOL usageError = NO;
+    int i;
+
+    for (i = 1; i < argc && !usageError; i++) {
+        NSString *option = [NSString stringWithUTF8String:argv[i]];
+        BOOL takesValue = ![option isEqualToString:@"--help"];
+        NSString *value = nil;
+        if (takesValue) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                usageError = YES;
+                break;
+            }
+            value = [NSString stringWithUTF8String:argv[++i]];
+        }
+
+        if ([option isEqualToString:@"--help"]) {
+            usageError = YES;
+        } else if ([option isEqualToString:@"--filter"]) {
+            filter = value;
+        } else if ([option isEqualToString:@"--corpus"]) {
+            [corpusPaths addObject:value];
+        } else if ([option isEqualToString:@"--samples"]) {
+            samples = [value integerValue];
+        } else if ([option isEqualToString:@"--repeat"]) {
+            repeat = [value integerValue];
+        } else if ([option isEqualToString:@"--warmup"]) {
+            warmup = [value integerValue];
+        } else if ([option isEqualToString:@"--jobs"]) {
+            jobs = [value integerValue];
+        } else if ([option isEqualToString:@"--json"]) {
+            jsonPath = value;
+        } else if ([option isEqualToString:@"--csv"]) {
+            csvPath = value;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", [option UTF8String]);
+            usageError = YES;
+        }
+    }
+
+    if (!usageError && (samples < (NSInteger)kScalarSampleDivisor || repeat < 1 || warmup < 0 || jobs < 0)) {
+        fprintf(stderr, "Option value out of range\n");
+        usageError = YES;
+    }
+    if (usageError) {
+        printUsage();
+        [pool release];
+        return 2;
+    }
+
+    NSArray *corpus = loadCorpus(corpusPaths);
+    MicroBenchmarks *bench = [[MicroBenchmarks alloc] initWithRepeat:(NSUInteger)repeat
+                                                              warmup:(NSUInteger)warmup
+                                                              filter:filter];
+    [bench runColorCasesWithSamples:(NSUInteger)samples];
+    [bench runICCCasesWithCorpus:corpus];
+    [bench runGamutCasesWithWorkers:(NSUInteger)jobs corpus:corpus];
+
+    NSArray *results = [bench results];
+    int status = ([bench failureCount] > 0) ? 1 : 0;
+    if ([results count] == 0) {
+        fprintf(stderr, "No case matches%s%s\n", filter ? " " : "", filter ? [filter UTF8String] : "");
+        status = 1;
+    }
+    if (jsonPath && ![resultsJSON(results, (NSUInteger)repeat, (NSUInteger)warmup, (NSUInteger)jobs)
+                      writeToFile:jsonPath atomically:YES encoding:NSUTF8StringEncoding error:NULL]) {
+        fprintf(stderr, "Cannot write %s\n", [jsonPath UTF8String]);
+        status = 1;
+    }
+    if (csvPath && ![resultsCSV(results) writeToFile:csvPath atomically:YES encoding:NSUTF8StringEncoding error:NULL]) {
+        fprintf(stderr, "Cannot write %s\n", [csvPath UTF8String]);
+        status = 1;
+    }
+
+    [bench release];
+    [pool release];
+    return status;
+}
@@ -0,0 +1,272 @@
+//
+//  SmallICCerRenderBench.m
+//  SmallICCer
+//
+//  Headless render benchmark: draws N gamut models into an offscreen target
+//  while the camera orbits once around the Lab space, and reports CPU and GPU
+//  frame time percentiles. Every frame is finished before the next starts,
+//  so its CPU and GPU times belong to the same frame. Runs on software
+//  rasterizers (llvmpipe, lavapipe) as well as real GPUs.
+//
+//  Exit status: 0 frames rendered, 1 the backend asked for cannot render
+//  offscreen here or results not written, 2 usage error.
+//
+
+#import <Foundation/Foundation.h>
+#import "Renderer3D.h"
+#import "RenderBackend.h"
+#import "Gamut3DModel.h"
+#import "GamutMeshLOD.h"
+#import "GamutCalculator.h"
+#import "StandardColorSpaces.h"
+#import "CIELABSpaceModel.h"
+#import "BenchmarkStats.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static NSString *statsJSON(BenchmarkStats stats) {
+    if (stats.count == 0) return @"null";
+    return [NSString stringWithFormat:@"{\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}",
+            stats.p50 * 1000.0, stats.p90 * 1000.0, stats.p99 * 1000.0, stats.max * 1000.0, stats.mean * 1000.0];
+}
+
+static void printStats(const char *label, BenchmarkStats stats) {
+    if (stats.count == 0) {
+        printf("%-6s n/a\n", label);
+        return;
+    }
+    printf("%-6s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms  mean %8.3f ms\n", label,
+           stats.p50 * 1000.0, stats.p90 * 1000.0, stats.p99 * 1000.0, stats.max * 1000.0, stats.mean * 1000.0);
+}
+
+static BOOL writeString(NSString *string, NSString *path) {
+    return [string writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+}
+
+static void printUsage(void) {
+    fprintf(stderr,
+            "Usage: SmallICCerRenderBench [options]\n"
+            "\n"
+            "Scene:\n"
+            "  --backend opengl|vulkan  Backend to render with (default: opengl)\n"
+            "  --models N           Gamut models drawn, cycling the standard spaces (default: 5)\n"
+            "  --resolution R       Lattice samples per channel of each gamut (default: 33)\n"
+            "  --quality 0|1|2      Rendering quality, picks the mesh level of detail (default: 1)\n"
+            "  --zoom Z             Camera zoom (default: 1)\n"
+            "  --width W            Target width in pixels (default: 1280)\n"
+            "  --height H           Target height in pixels (default: 720)\n"
+            "\n"
+            "Run:\n"
+            "  --frames F           Measured frames over one full orbit (default: 360)\n"
+            "  --warmup W           Unmeasured frames first (default: 10)\n"
+            "  --csv FILE           Write per-frame times (ms) to FILE\n"
+            "  --json FILE          Write the summary to FILE\n");
+}
+
+int main(int argc, const char *argv[]) {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    RenderBackendType backendType = RenderBackendTypeOpenGL;
+    NSInteger modelCount = 5;
+    NSInteger resolution = 33;
+    NSInteger quality = 1;
+    float zoom = 1.0f;
+    NSInteger width = 1280;
+    NSInteger height = 720;
+    NSInteger frameCount = 360;
+    NSInteger warmupCount = 10;
+    NSString *csvPath = nil;
+    NSString *jsonPath = nil;
+    BOOL usageError = NO;
+    int i;
+
+    for (i = 1; i < argc && !usageError; i++) {
+        NSString *option = [NSString stringWithUTF8String:argv[i]];
+        BOOL takesValue = ![option isEqualToString:@"--help"];
+        NSString *value = nil;
+        if (takesValue) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                usageError = YES;
+                break;
+            }
+            value = [NSString stringWithUTF8String:argv[++i]];
+        }
+
+        if ([option isEqualToString:@"--help"]) {
+            usageError = YES;
+        } else if ([option isEqualToString:@"--backend"]) {
+            if ([value isEqualToString:@"opengl"]) {
+                backendType = RenderBackendTypeOpenGL;
+            } else if ([value isEqualToString:@"vulkan"]) {
+                backendType = RenderBackendTypeVulkan;
+            } else {
+                fprintf(stderr, "Unknown backend %s\n", [value UTF8String]);
+                usageError = YES;
+            }
+        } else if ([option isEqualToString:@"--models"]) {
+            modelCount = [value integerValue];
+        } else if ([option isEqualToString:@"--resolution"]) {
+            resolution = [value integerValue];
+        } else if ([option isEqualToString:@"--quality"]) {
+            quality = [value integerValue];
+        } else if ([option isEqualToString:@"--zoom"]) {
+            zoom = [value floatValue];
+        } else if ([option isEqualToString:@"--width"]) {
+            width = [value integerValue];
+        } else if ([option isEqualToString:@"--height"]) {
+            height = [value integerValue];
+        } else if ([option isEqualToString:@"--frames"]) {
+            frameCount = [value integerValue];
+        } else if ([option isEqualToString:@"--warmup"]) {
+            warmupCount = [value integerValue];
+        } else if ([option isEqualToString:@"--csv"]) {
+            csvPath = value;
+        } else if ([option isEqualToString:@"--json"]) {
+            jsonPath = value;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", [option UTF8String]);
+            usageError = YES;
+        }
+    }
+
+    if (!usageError && (modelCount < 0 || resolution < 2 || quality < 0 || quality > 2 || zoom <= 0.0f ||
+                        width < 1 || height < 1 || frameCount < 1 || warmupCount < 0)) {
+        fprintf(stderr, "Option value out of range\n");
+        usageError = YES;
+    }
+    if (usageError) {
+        printUsage();
+        [pool release];
+        return 2;
+    }
+
+    Renderer3D *renderer = [[Renderer3D alloc] initOffscreenWithWidth:(NSUInteger)width
+                                                               height:(NSUInteger)height
+                                                          backendType:backendType];
+    // Renderer3D falls back to OpenGL; its frames would be reported as Vulkan's
+    if (!renderer || [renderer backendType] != backendType) {
+        fprintf(stderr, "%s cannot render offscreen here\n",
+                (backendType == RenderBackendTypeVulkan) ? "Vulkan" : "OpenGL");
+        [renderer release];
+        [pool release];
+        return 1;
+    }
+
+    // Same gamuts, colors and meshes the gamut view draws
+    static const float colors[5][3] = {
+        {1.0f, 0.3f, 0.3f}, {0.3f, 1.0f, 0.3f}, {0.3f, 0.5f, 1.0f}, {1.0f, 0.9f, 0.2f}, {0.9f, 0.3f, 1.0f}
+    };
+    NSArray *spaces = [StandardColorSpaces allStandardSpaces];
+    GamutCalculator *calc = [[GamutCalculator alloc] init];
+    [calc setResolution:(NSUInteger)resolution];
+    NSUInteger triangles = 0;
+    NSInteger m;
+    for (m = 0; m < modelCount; m++) {
+        NSAutoreleasePool *modelPool = [[NSAutoreleasePool alloc] init];
+        ColorSpace *space = [spaces objectAtIndex:(NSUInteger)m % [spaces count]];
+        NSData *lab = [calc computePackedGamutForColorSpace:space];
+        NSData *hull = [calc computeConvexHullTrianglesForPackedLab:lab];
+        Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:lab triangles:hull name:[space name]];
+        [model setLevelsOfDetail:[GamutMeshLOD levelsOfDetailForModel:model]];
+        const float *rgb = colors[m % 5];
+        [model setColorRed:rgb[0] green:rgb[1] blue:rgb[2]];
+        triangles += [[GamutMeshLOD meshForModel:model zoom:zoom quality:quality] triangleCount];
+        [renderer addGamutModel:model];
+        [model release];
+        [modelPool release];
+    }
+    [calc release];
+
+    CIELABSpaceModel *labSpace = [[CIELABSpaceModel alloc] init];
+    [renderer setLabSpaceModel:labSpace];
+    [labSpace release];
+    // Default background and the quality asked for, not the user's settings
+    [renderer setRenderingQuality:quality];
+
+    double *cpuTimes = (double *)calloc((size_t)frameCount, sizeof(double));
+    double *gpuTimes = (double *)calloc((size_t)frameCount, sizeof(double));
+    double *wallTimes = (double *)calloc((size_t)frameCount, sizeof(double));
+    if (!cpuTimes || !gpuTimes || !wallTimes) {
+        fprintf(stderr, "Out of memory\n");
+        free(cpuTimes);
+        free(gpuTimes);
+        free(wallTimes);
+        [renderer release];
+        [pool release];
+        return 1;
+    }
+
+    NSInteger frame;
+    for (frame = -warmupCount; frame < frameCount; frame++) {
+        NSAutoreleasePool *framePool = [[NSAutoreleasePool alloc] init];
+        float angle = (frame < 0) ? 0.0f : 360.0f * (float)frame / (float)frameCount;
+        [renderer setRotationX:25.0f rotationY:angle zoom:zoom];
+        double start = BenchmarkSeconds();
+        [renderer render];
+        double submitted = BenchmarkSeconds();
+        [renderer finishFrames];
+        double finished = BenchmarkSeconds();
+        if (frame >= 0) {
+            cpuTimes[frame] = submitted - start;
+            wallTimes[frame] = finished - start;
+            gpuTimes[frame] = [renderer lastFrameGPUTime];
+        }
+        [framePool release];
+    }
+
+    BenchmarkStats cpu = BenchmarkStatsFromSamples(cpuTimes, (NSUInteger)frameCount);
+    BenchmarkStats gpu = BenchmarkStatsFromSamples(gpuTimes, (NSUInteger)frameCount);
+    BenchmarkStats wall = BenchmarkStatsFromSamples(wallTimes, (NSUInteger)frameCount);
+    NSString *backendName = ([renderer backendType] == RenderBackendTypeVulkan) ? @"vulkan" : @"opengl";
+
+    printf("backend %s, %ld models, %lu triangles drawn, %ldx%ld, %ld frames\n",
+           [backendName UTF8String], (long)modelCount, (unsigned long)triangles,
+           (long)width, (long)height, (long)frameCount);
+    printStats("cpu", cpu);
+    printStats("gpu", gpu);
+    printStats("frame", wall);
+
+    int status = 0;
+    if (csvPath) {
+        NSMutableString *csv = [NSMutableString stringWithString:@"frame,cpu_ms,gpu_ms,frame_ms\n"];
+        for (frame = 0; frame < frameCount; frame++) {
+            NSString *gpuField = (gpuTimes[frame] >= 0.0) ?
+                [NSString stringWithFormat:@"%.4f", gpuTimes[frame] * 1000.0] : @"";
+            [csv appendFormat:@"%ld,%.4f,%@,%.4f\n", (long)frame, cpuTimes[frame] * 1000.0,
+                              gpuField, wallTimes[frame] * 1000.0];
+        }
+        if (!writeString(csv, csvPath)) {
+            fprintf(stderr, "Cannot write %s\n", [csvPath UTF8String]);
+            status = 1;
+        }
+    }
+    if (jsonPath) {
+        NSString *json = [NSString stringWithFormat:
+            @"{\n"
+            @"  \"backend\": \"%@\",\n"
+            @"  \"models\": %ld,\n"
+            @"  \"resolution\": %ld,\n"
+            @"  \"quality\": %ld,\n"
+            @"  \"triangles\": %lu,\n"
+            @"  \"width\": %ld,\n"
+            @"  \"height\": %ld,\n"
+            @"  \"frames\": %ld,\n"
+            @"  \"cpu_ms\": %@,\n"
+            @"  \"gpu_ms\": %@,\n"
+            @"  \"frame_ms\": %@\n"
+            @"}\n",
+            backendName, (long)modelCount, (long)resolution, (long)quality, (unsigned long)triangles,
+            (long)width, (long)height, (long)frameCount, statsJSON(cpu), statsJSON(gpu), statsJSON(wall)];
+        if (!writeString(json, jsonPath)) {
+            fprintf(stderr, "Cannot write %s\n", [jsonPath UTF8String]);
+            status = 1;
+        }
+    }
+
+    free(cpuTimes);
+    free(gpuTimes);
+    free(wallTimes);
+    [renderer release];
+    [pool release];
+    return status;
+}
@@ -6,19 +6,30 @@
 //
 
 #import <AppKit/AppKit.h>
+#import "ProfileLibraryScanner.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class AppController;
 
-@interface FileBrowserPanel : NSView {
+@interface FileBrowserPanel : NSView <NSTableViewDataSource, ProfileLibraryScannerDelegate> {
     AppController *appController;
     NSButton *openButton;
     NSButton *saveButton;
+    NSButton *scanButton;
+    NSSearchField *searchField;
+    NSScrollView *libraryScrollView;
+    NSTableView *libraryTable;   // One row per indexed path; double-click opens
+    NSArray *libraryEntries;     // Index entries shown in libraryTable, in row order
+    NSProgressIndicator *loadProgress;
+    NSTextField *loadStatusField;
 }
 
 - (id)initWithAppController:(AppController *)controller;
 
+// Show background load progress; a nil stage hides it
+- (void)setLoadProgress:(double)fraction stage:(nullable NSString *)stage;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -28,10 +28,138 @@
         [saveButton setTarget:self];
         [saveButton setAction:@selector(saveProfile:)];
         [self addSubview:saveButton];
+        
+        // Profile library: scan a folder, then search the index
+        scanButton = [[NSButton alloc] initWithFrame:NSMakeRect(230, 10, 100, 30)];
+        [scanButton setTitle:@"Scan Folder"];
+        [scanButton setTarget:self];
+        [scanButton setAction:@selector(scanFolder:)];
+        [self addSubview:scanButton];
+        
+        searchField = [[NSSearchField alloc] initWithFrame:NSMakeRect(340, 14, 160, 22)];
+        [searchField setTarget:self];
+        [searchField setAction:@selector(searchLibrary:)];
+        [self addSubview:searchField];
+        
+        // Library matches: description and "folder/file", so profiles sharing
+        // a description stay distinguishable; rows are index entries, not titles
+        libraryScrollView = [[NSScrollView alloc] initWithFrame:NSMakeRect(510, 2, 240, 46)];
+        [libraryScrollView setHasVerticalScroller:YES];
+        [libraryScrollView setBorderType:NSBezelBorder];
+        libraryTable = [[NSTableView alloc] initWithFrame:[[libraryScrollView contentView] bounds]];
+        NSTableColumn *descriptionColumn = [[NSTableColumn alloc] initWithIdentifier:@"description"];
+        [[descriptionColumn headerCell] setStringValue:@"Profile"];
+        [descriptionColumn setWidth:130];
+        [libraryTable addTableColumn:descriptionColumn];
+        [descriptionColumn release];
+        NSTableColumn *fileColumn = [[NSTableColumn alloc] initWithIdentifier:@"file"];
+        [[fileColumn headerCell] setStringValue:@"File"];
+        [fileColumn setWidth:100];
+        [libraryTable addTableColumn:fileColumn];
+        [fileColumn release];
+        [libraryTable setHeaderView:nil];
+        [libraryTable setDataSource:self];
+        [libraryTable setTarget:self];
+        [libraryTable setDoubleAction:@selector(openLibraryProfile:)];
+        [libraryScrollView setDocumentView:libraryTable];
+        [self addSubview:libraryScrollView];
+        libraryEntries = [[NSArray alloc] init];
+        [[appController profileLibrary] setDelegate:self];
+        [self reloadLibrary];
+        
+        loadProgress = [[NSProgressIndicator alloc] initWithFrame:NSMakeRect(760, 16, 100, 18)];
+        [loadProgress setIndeterminate:NO];
+        [loadProgress setMinValue:0.0];
+        [loadProgress setMaxValue:1.0];
+        [loadProgress setHidden:YES];
+        [self addSubview:loadProgress];
+        
+        loadStatusField = [[NSTextField alloc] initWithFrame:NSMakeRect(870, 16, 200, 18)];
+        [loadStatusField setEditable:NO];
+        [loadStatusField setBordered:NO];
+        [loadStatusField setDrawsBackground:NO];
+        [loadStatusField setFont:[NSFont systemFontOfSize:10.0]];
+        [loadStatusField setStringValue:@""];
+        [self addSubview:loadStatusField];
     }
     return self;
 }
 
+- (void)reloadLibrary {
+    NSArray *entries = [[appController profileLibrary] entriesMatchingText:[searchField stringValue]];
+    [entries retain];
+    [libraryEntries release];
+    libraryEntries = entries;
+    [libraryTable reloadData];
+}
+
+- (void)scanFolder:(id)sender {
+    SSFileDialog *openDialog = [SSFileDialog openDialog];
+    [openDialog setCanChooseFiles:NO];
+    [openDialog setCanChooseDirectories:YES];
+    
+    NSArray *urls = [openDialog showModal];
+    if (urls && [urls count] > 0) {
+        NSString *path = [[urls objectAtIndex:0] path];
+        // Runs on the library's queue; progress and the result come back below
+        if ([[appController profileLibrary] scanDirectoryInBackground:path]) {
+            [scanButton setEnabled:NO];
+            [self setLoadProgress:0.0 stage:@"Scanning folder"];
+        }
+    }
+}
+
+- (void)profileLibraryScanner:(ProfileLibraryScanner *)scanner progress:(double)fraction stage:(NSString *)stage {
+    [self setLoadProgress:fraction stage:stage];
+    // Entries from finished batches are already searchable
+    [self reloadLibrary];
+}
+
+- (void)profileLibraryScanner:(ProfileLibraryScanner *)scanner didFinishScanWithError:(NSError *)error {
+    [scanButton setEnabled:YES];
+    [self setLoadProgress:1.0 stage:nil];
+    [self reloadLibrary];
+    if (error) {
+        NSAlert *alert = [NSAlert alertWithError:error];
+        [alert runModal];
+    }
+}
+
+- (void)searchLibrary:(id)sender {
+    [self reloadLibrary];
+}
+
+- (void)openLibraryProfile:(id)sender {
+    NSInteger row = [libraryTable clickedRow];
+    if (row < 0) row = [libraryTable selectedRow];
+    if (row < 0 || row >= (NSInteger)[libraryEntries count]) return;
+    NSString *path = [[libraryEntries objectAtIndex:(NSUInteger)row] objectForKey:kProfileIndexPathKey];
+    [appController openProfileAtPath:path];
+}
+
+// NSTableViewDataSource methods
+- (NSInteger)numberOfRowsInTableView:(NSTableView *)tableView {
+    return (NSInteger)[libraryEntries count];
+}
+
+- (id)tableView:(NSTableView *)tableView objectValueForTableColumn:(NSTableColumn *)tableColumn row:(NSInteger)row {
+    if (row < 0 || row >= (NSInteger)[libraryEntries count]) return nil;
+    NSDictionary *entry = [libraryEntries objectAtIndex:(NSUInteger)row];
+    NSString *path = [entry objectForKey:kProfileIndexPathKey];
+    if ([[tableColumn identifier] isEqualToString:@"file"]) {
+        return [[[path stringByDeletingLastPathComponent] lastPathComponent]
+                stringByAppendingPathComponent:[path lastPathComponent]];
+    }
+    NSString *title = [entry objectForKey:kProfileIndexDescriptionKey];
+    return [title length] > 0 ? title : [path lastPathComponent];
+}
+
+- (void)setLoadProgress:(double)fraction stage:(NSString *)stage {
+    [loadProgress setDoubleValue:fraction];
+    [loadProgress setHidden:(stage == nil)];
+    [loadStatusField setStringValue:(stage ? stage : @"")];
+}
+
 - (void)openProfile:(id)sender {
     SSFileDialog *openDialog = [SSFileDialog openDialog];
     [openDialog setAllowedFileTypes:[NSArray arrayWithObject:@"icc"]];
@@ -41,11 +169,7 @@
     NSArray *urls = [openDialog showModal];
     if (urls && [urls count] > 0) {
         NSString *path = [[urls objectAtIndex:0] path];
-        NSError *error = nil;
-        if (![appController loadProfileFromPath:path error:&error]) {
-            NSAlert *alert = [NSAlert alertWithError:error];
-            [alert runModal];
-        }
+        [appController openProfileAtPath:path];
     }
 }
 
@@ -65,9 +189,20 @@
 }
 
 - (void)dealloc {
+    if ([[appController profileLibrary] delegate] == self) {
+        [[appController profileLibrary] setDelegate:nil];
+    }
     [appController release];
     [openButton release];
     [saveButton release];
+    [scanButton release];
+    [searchField release];
+    [libraryTable setDataSource:nil];
+    [libraryTable release];
+    [libraryScrollView release];
+    [libraryEntries release];
+    [loadProgress release];
+    [loadStatusField release];
     [super dealloc];
 }
 
@@ -9,16 +9,21 @@
 
 #import <AppKit/AppKit.h>
 #import "RenderBackend.h"
+#import "ProfileLoadPipeline.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @class ICCProfile;
 @class Renderer3D;
+@class Gamut3DModel;
 
-@interface GamutViewPanel : NSView <NSTableViewDataSource, NSTableViewDelegate> {
+@interface GamutViewPanel : NSView <NSTableViewDataSource, NSTableViewDelegate, ProfileLoadPipelineDelegate> {
     Renderer3D *renderer;
     NSView *glContentView;           // View passed to renderer (e.g. NSOpenGLView)
     ICCProfile *currentProfile;
+    Gamut3DModel *profileGamut;      // Shared cache model; nil while being computed
+    Gamut3DModel *profileModel;      // Our red wrapper over profileGamut's buffers, built once per gamut
+    ProfileLoadPipeline *gamutPipeline;
     NSPoint lastMouseLocation;
     RenderBackendType preferredBackend;
     NSMutableArray *comparisonEntries; // Array of dicts: @"model" -> Gamut3DModel, @"visible" -> NSNumber
@@ -27,13 +32,22 @@ NS_ASSUME_NONNULL_BEGIN
     NSTableView *comparisonTableView;
     NSTextField *statsTextField;
     CGFloat comparisonPanelWidth;
+    NSArray *overlayModels;          // Drawn over the gamuts (e.g. out-of-gamut heat); not in stats
 }
 
 - (id)initWithBackendType:(RenderBackendType)backendType;
+// Returns at once; the profile gamut is computed in the background and
+// drawn when ready, cancelling any gamut still pending for an earlier profile
 - (void)displayProfile:(ICCProfile *)profile;
 - (void)setPreferredBackend:(RenderBackendType)backendType;
 - (void)refreshFromSettings;
 
+// Profile gamut once computed (nil while pending or without a profile)
+- (nullable Gamut3DModel *)profileGamut;
+
+// Extra point models drawn over the gamuts until replaced; a new profile clears them
+- (void)setOverlayModels:(nullable NSArray *)models;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -12,6 +12,7 @@
 #import "CIELABSpaceModel.h"
 #import "GamutCalculator.h"
 #import "GamutComparator.h"
+#import "GamutCache.h"
 #import "StandardColorSpaces.h"
 #import "ColorSpace.h"
 #import "SettingsManager.h"
@@ -52,9 +53,18 @@ static const float kComparisonColors[][3] = {
         comparisonEntries = [[NSMutableArray alloc] init];
         comparisonPanelWidth = COMPARISON_PANEL_WIDTH;
         glContentView = nil;
+        currentProfile = nil;
+        profileGamut = nil;
+        profileModel = nil;
+        gamutPipeline = [[ProfileLoadPipeline alloc] init];
+        [gamutPipeline setDelegate:self];
 
         if (backendType == RenderBackendTypeOpenGL) {
             NSOpenGLPixelFormatAttribute attrs[] = {
+#if defined(__APPLE__) && !defined(__GNUSTEP__)
+                // Shader path; macOS only exposes GL 3.3+ in a core context
+                NSOpenGLPFAOpenGLProfile, NSOpenGLProfileVersion3_2Core,
+#endif
                 NSOpenGLPFADoubleBuffer,
                 NSOpenGLPFADepthSize, 24,
                 0
@@ -166,6 +176,19 @@ static const float kComparisonColors[][3] = {
     [renderer applySettings];
 }
 
+// Lattice resolution for gamut sampling, from SettingsManager.renderingQuality
+- (NSUInteger)gamutResolution {
+    return [GamutCalculator resolutionForRenderingQuality:[[SettingsManager sharedManager] renderingQuality]];
+}
+
+// Own model (name, color) over a cached gamut's shared point and triangle
+// buffers and levels of detail
+- (Gamut3DModel *)newModelFromCachedGamut:(Gamut3DModel *)cached name:(NSString *)name {
+    Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:[cached labData] triangles:[cached triangleData] name:name];
+    [model setLevelsOfDetail:[cached levelsOfDetail]];
+    return model;
+}
+
 - (void)addComparisonSelected:(id)sender {
     NSPopUpButton *pop = (NSPopUpButton *)sender;
     NSInteger idx = [pop indexOfSelectedItem];
@@ -180,10 +203,8 @@ static const float kComparisonColors[][3] = {
     }
     if (!space) return;
     NSString *name = [titles objectAtIndex:spaceIdx];
-    GamutCalculator *calc = [[GamutCalculator alloc] init];
-    NSArray *points = [calc computeGamutForColorSpace:space];
-    [calc release];
-    Gamut3DModel *model = [[Gamut3DModel alloc] initWithVertices:points faces:nil name:name];
+    Gamut3DModel *cached = [[GamutCache sharedCache] gamutForColorSpace:space resolution:[self gamutResolution]];
+    Gamut3DModel *model = [self newModelFromCachedGamut:cached name:name];
     const float *rgb = kComparisonColors[spaceIdx % 5];
     [model setColorRed:rgb[0] green:rgb[1] blue:rgb[2]];
     NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:
@@ -199,14 +220,8 @@ static const float kComparisonColors[][3] = {
 
 - (void)refreshGamuts {
     [renderer clearGamutModels];
-    if (currentProfile) {
-        GamutCalculator *calculator = [[GamutCalculator alloc] init];
-        NSArray *gamutPoints = [calculator computeGamutForProfile:currentProfile];
-        [calculator release];
-        Gamut3DModel *profileModel = [[Gamut3DModel alloc] initWithVertices:gamutPoints faces:nil name:@"Profile Gamut"];
-        [profileModel setColorRed:1.0 green:0.0 blue:0.0];
+    if (profileModel) {
         [renderer addGamutModel:profileModel];
-        [profileModel release];
     }
     NSUInteger i, count = [comparisonEntries count];
     for (i = 0; i < count; i++) {
@@ -215,6 +230,9 @@ static const float kComparisonColors[][3] = {
             [renderer addGamutModel:[entry objectForKey:@"model"]];
         }
     }
+    for (i = 0; i < [overlayModels count]; i++) {
+        [renderer addGamutModel:[overlayModels objectAtIndex:i]];
+    }
     CIELABSpaceModel *labModel = [[CIELABSpaceModel alloc] init];
     SettingsManager *settings = [SettingsManager sharedManager];
     [settings loadSettings];
@@ -239,14 +257,17 @@ static const float kComparisonColors[][3] = {
             Gamut3DModel *m = [models objectAtIndex:i];
             double vol = [comp computeVolume:m];
             if (i > 0) [text appendString:@"\n"];
-            [text appendFormat:@"%@: %.0f (approx. vol)", [m name], vol];
+            [text appendFormat:@"%@: %.0f (vol)", [m name], vol];
         }
         if ([models count] >= 2) {
-            double v0 = [comp computeVolume:[models objectAtIndex:0]];
-            double v1 = [comp computeVolume:[models objectAtIndex:1]];
-            double diff = [comp computeVolumeDifference:[models objectAtIndex:0] and:[models objectAtIndex:1]];
+            Gamut3DModel *first = [models objectAtIndex:0];
+            Gamut3DModel *second = [models objectAtIndex:1];
+            double v0 = [comp computeVolume:first];
+            double diff = [comp computeVolumeDifference:first and:second];
             double pct = (v0 > 0) ? (diff / v0 * 100.0) : 0;
             [text appendFormat:@"\nDifference: %.0f (%.1f%%)", diff, pct];
+            [text appendFormat:@"\n%@ covered by %@: %.1f%%", [first name], [second name],
+                [comp computeCoverage:first by:second] * 100.0];
         }
     }
     [comp release];
@@ -255,13 +276,8 @@ static const float kComparisonColors[][3] = {
 
 - (NSArray *)visibleGamutModelsForStats {
     NSMutableArray *arr = [NSMutableArray array];
-    if (currentProfile) {
-        GamutCalculator *calc = [[GamutCalculator alloc] init];
-        NSArray *pts = [calc computeGamutForProfile:currentProfile];
-        [calc release];
-        Gamut3DModel *pm = [[Gamut3DModel alloc] initWithVertices:pts faces:nil name:@"Profile"];
-        [arr addObject:pm];
-        [pm release];
+    if (profileModel) {
+        [arr addObject:profileModel];
     }
     NSUInteger i, c = [comparisonEntries count];
     for (i = 0; i < c; i++) {
@@ -274,11 +290,63 @@ static const float kComparisonColors[][3] = {
 }
 
 - (void)displayProfile:(ICCProfile *)profile {
+    [profile retain];
+    [currentProfile release];
     currentProfile = profile;
+    [profileGamut release];
+    profileGamut = nil;
+    [profileModel release];
+    profileModel = nil;
+    // An overlay belongs to the previous profile's gamut
+    [overlayModels release];
+    overlayModels = nil;
+    // Show the comparisons straight away; the profile gamut follows
     [self refreshGamuts];
+    if (currentProfile) {
+        [gamutPipeline computeGamutForProfile:currentProfile resolution:[self gamutResolution]];
+    } else {
+        [gamutPipeline cancel];
+    }
     [self setNeedsDisplay:YES];
 }
 
+- (Gamut3DModel *)profileGamut {
+    return profileGamut;
+}
+
+- (void)setOverlayModels:(NSArray *)models {
+    [models retain];
+    [overlayModels release];
+    overlayModels = models;
+    [self refreshGamuts];
+}
+
+#pragma mark - ProfileLoadPipelineDelegate
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didComputeGamut:(Gamut3DModel *)gamut forProfile:(ICCProfile *)profile {
+    if (profile != currentProfile) return;
+    [gamut retain];
+    [profileGamut release];
+    profileGamut = gamut;
+    // Same model every refresh, so the renderer keeps its uploaded buffers
+    [profileModel release];
+    profileModel = [self newModelFromCachedGamut:gamut name:@"Profile"];
+    [profileModel setColorRed:1.0 green:0.0 blue:0.0];
+    [self refreshGamuts];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline didFailToComputeGamutForProfile:(ICCProfile *)profile error:(NSError *)error {
+    if (profile != currentProfile) return;
+    // Replace the progress text; comparisons stay on screen
+    [self updateStats];
+    [statsTextField setStringValue:[NSString stringWithFormat:@"%@\n%@",
+                                    [error localizedDescription], [statsTextField stringValue]]];
+}
+
+- (void)profileLoadPipeline:(ProfileLoadPipeline *)pipeline progress:(double)fraction stage:(NSString *)stage {
+    [statsTextField setStringValue:[NSString stringWithFormat:@"%@...", stage]];
+}
+
 - (void)drawRect:(NSRect)dirtyRect {
     NSRect bounds = [self bounds];
     NSView *viewForViewport = glContentView ? glContentView : self;
@@ -360,6 +428,13 @@ static const float kComparisonColors[][3] = {
 }
 
 - (void)dealloc {
+    [gamutPipeline setDelegate:nil];
+    [gamutPipeline cancel];
+    [gamutPipeline release];
+    [profileGamut release];
+    [profileModel release];
+    [overlayModels release];
+    [currentProfile release];
     [comparisonEntries release];
     [renderer release];
     [super dealloc];
@@ -2,7 +2,9 @@
 //  HistogramAndCurvesPanel.h
 //  SmallICCer
 //
-//  For TRC visualization and editing
+//  For TRC visualization and editing, and per-image gamut analysis: an
+//  image's L* histogram and out-of-gamut share against the profile gamut,
+//  with the out-of-gamut heat drawn in the gamut view
 //
 
 #import <AppKit/AppKit.h>
@@ -11,6 +13,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class ICCProfile;
 @class ICCTagTRC;
+@class GamutViewPanel;
 
 @interface HistogramAndCurvesPanel : NSView {
     NSView *curveView;
@@ -18,9 +21,21 @@ NS_ASSUME_NONNULL_BEGIN
     ICCTagTRC *redTRC;
     ICCTagTRC *greenTRC;
     ICCTagTRC *blueTRC;
+    GamutViewPanel *gamutView;       // Not retained
+    NSButton *analyzeButton;
+    NSOperationQueue *analysisQueue;
+    NSUInteger analysisGeneration;   // Bumped per request; main thread only
+    NSData *lightnessHistogram;      // uint64_t pixels per L* bin of the last analysis
+    NSString *analysisSummary;
 }
 
+// Source of the profile gamut and target of the out-of-gamut overlay
+@property (nonatomic, assign, nullable) GamutViewPanel *gamutView;
+
 - (void)displayProfile:(ICCProfile *)profile;
+
+// Analyze an image against the current profile gamut in the background
+- (void)analyzeImageAtPath:(NSString *)path;
 - (void)drawCurve:(ICCTagTRC *)trc color:(NSColor *)color inRect:(NSRect)rect;
 
 @end
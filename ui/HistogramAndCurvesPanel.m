@@ -7,10 +7,22 @@
 
 #import "HistogramAndCurvesPanel.h"
 #import "ICCProfile.h"
+#import "ICCParser.h"
 #import "ICCTagTRC.h"
+#import "GamutViewPanel.h"
+#import "ImageGamutAnalyzer.h"
+#import <stdlib.h>
+#import <string.h>
+
+// Rows repacked at a time when the image has extra (alpha) samples
+static const NSUInteger kAnalysisBandRows = 256;
+
+static const float kLightnessHistogramHeight = 70.0f;
 
 @implementation HistogramAndCurvesPanel
 
+@synthesize gamutView;
+
 - (id)init {
     self = [super init];
     if (self) {
@@ -25,12 +37,187 @@
         redTRC = nil;
         greenTRC = nil;
         blueTRC = nil;
+        
+        analyzeButton = [[NSButton alloc] initWithFrame:NSMakeRect(8, bounds.size.height - 32, 140, 24)];
+        [analyzeButton setTitle:@"Analyze Image..."];
+        [analyzeButton setButtonType:NSButtonTypeMomentaryPushIn];
+        [analyzeButton setTarget:self];
+        [analyzeButton setAction:@selector(chooseImage:)];
+        [analyzeButton setAutoresizingMask:NSViewMaxXMargin | NSViewMinYMargin];
+        [self addSubview:analyzeButton];
+        
+        analysisQueue = [[NSOperationQueue alloc] init];
+        [analysisQueue setMaxConcurrentOperationCount:1];
     }
     return self;
 }
 
+#pragma mark - Image analysis
+
+- (void)chooseImage:(id)sender {
+    NSOpenPanel *panel = [NSOpenPanel openPanel];
+    [panel setAllowedFileTypes:[NSImage imageFileTypes]];
+    if ([panel runModal] == NSModalResponseOK) {
+        [self analyzeImageAtPath:[[panel URL] path]];
+    }
+}
+
+- (void)analyzeImageAtPath:(NSString *)path {
+    Gamut3DModel *gamut = [gamutView profileGamut];
+    analysisGeneration++;
+    [analysisQueue cancelAllOperations];
+    [lightnessHistogram release];
+    lightnessHistogram = nil;
+    [analysisSummary release];
+    if (!gamut) {
+        analysisSummary = [@"Load a profile and wait for its gamut before analyzing an image" retain];
+        [self setNeedsDisplay:YES];
+        return;
+    }
+    analysisSummary = [[NSString stringWithFormat:@"Analyzing %@...", [path lastPathComponent]] retain];
+    [self setNeedsDisplay:YES];
+    
+    NSDictionary *request = [NSDictionary dictionaryWithObjectsAndKeys:
+                             path, @"path",
+                             gamut, @"gamut",
+                             [NSNumber numberWithUnsignedInteger:analysisGeneration], @"generation",
+                             nil];
+    NSInvocationOperation *op = [[NSInvocationOperation alloc] initWithTarget:self
+                                                                     selector:@selector(runAnalysis:)
+                                                                       object:request];
+    [analysisQueue addOperation:op];
+    [op release];
+}
+
+// Background: decode the image, stream it through the analyzer in bands
+- (void)runAnalysis:(NSDictionary *)request {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *path = [request objectForKey:@"path"];
+    NSMutableDictionary *result = [NSMutableDictionary dictionaryWithObject:[request objectForKey:@"generation"]
+                                                                     forKey:@"generation"];
+    NSString *failure = nil;
+    NSError *error = nil;
+    
+    NSBitmapImageRep *rep = [NSBitmapImageRep imageRepWithContentsOfFile:path];
+    BOOL cmyk = [[rep colorSpaceName] isEqualToString:NSDeviceCMYKColorSpace];
+    NSUInteger channels = cmyk ? 4 : 3;
+    NSInteger bitsPerSample = [rep bitsPerSample];
+    if (!rep) {
+        failure = @"Could not read the image";
+    } else if ([rep isPlanar] || (bitsPerSample != 8 && bitsPerSample != 16) ||
+               [rep samplesPerPixel] < (NSInteger)channels) {
+        failure = @"Only interleaved 8/16-bit RGB and CMYK images can be analyzed";
+    }
+    
+    ImageGamutAnalyzer *analyzer = nil;
+    if (!failure) {
+        ImagePixelFormat format = cmyk ? ImagePixelFormatCMYK8 : ImagePixelFormatRGB8;
+        if (bitsPerSample == 16) format = cmyk ? ImagePixelFormatCMYK16 : ImagePixelFormatRGB16;
+        NSData *embedded = [rep valueForProperty:NSImageColorSyncProfileData];
+        ICCProfile *imageProfile = nil;
+        if (embedded) {
+            ICCParser *parser = [[ICCParser alloc] init];
+            [parser setLazyTagDecoding:YES];
+            imageProfile = [parser parseProfileFromData:embedded error:NULL];
+            [parser release];
+        }
+        if (!imageProfile) imageProfile = [ImageGamutAnalyzer defaultImageProfile];
+        analyzer = imageProfile ? [[ImageGamutAnalyzer alloc] initWithImageProfile:imageProfile
+                                                                      pixelFormat:format
+                                                                            gamut:[request objectForKey:@"gamut"]
+                                                                          binSize:0.0
+                                                                            error:&error] : nil;
+        if (!analyzer) {
+            failure = error ? [error localizedDescription] : @"The image has no usable profile";
+        }
+    }
+    
+    if (!failure) {
+        NSUInteger width = (NSUInteger)[rep pixelsWide], height = (NSUInteger)[rep pixelsHigh];
+        NSUInteger sampleBytes = (NSUInteger)bitsPerSample / 8;
+        NSUInteger pixelBytes = channels * sampleBytes;
+        NSUInteger sourcePixelBytes = (NSUInteger)[rep bitsPerPixel] / 8;
+        const uint8_t *bitmap = [rep bitmapData];
+        NSUInteger sourceRowBytes = (NSUInteger)[rep bytesPerRow];
+        if (sourcePixelBytes == pixelBytes) {
+            if (![analyzer addPixels:bitmap rowBytes:sourceRowBytes width:width height:height error:&error]) {
+                failure = [error localizedDescription];
+            }
+        } else {
+            // Drop alpha (and any other extra samples) a band of rows at a time
+            uint8_t *band = (uint8_t *)malloc(kAnalysisBandRows * width * pixelBytes);
+            NSUInteger row, x, y;
+            for (row = 0; band && row < height && !failure; row += kAnalysisBandRows) {
+                NSUInteger rows = MIN(kAnalysisBandRows, height - row);
+                for (y = 0; y < rows; y++) {
+                    const uint8_t *src = bitmap + (row + y) * sourceRowBytes;
+                    uint8_t *dst = band + y * width * pixelBytes;
+                    for (x = 0; x < width; x++) {
+                        memcpy(dst + x * pixelBytes, src + x * sourcePixelBytes, pixelBytes);
+                    }
+                }
+                if (![analyzer addPixels:band rowBytes:width * pixelBytes width:width height:rows error:&error]) {
+                    failure = [error localizedDescription];
+                }
+            }
+            if (!band) failure = @"Failed to allocate memory";
+            free(band);
+        }
+    }
+    
+    if (failure) {
+        [result setObject:failure forKey:@"summary"];
+    } else {
+        [result setObject:[NSString stringWithFormat:@"%@: %.2f%% out of gamut (%llu of %llu pixels)",
+                           [path lastPathComponent], [analyzer outsideFraction] * 100.0,
+                           (unsigned long long)[analyzer outsidePixels],
+                           (unsigned long long)[analyzer totalPixels]]
+                   forKey:@"summary"];
+        [result setObject:[analyzer lightnessHistogram] forKey:@"lightness"];
+        [result setObject:[analyzer heatOverlayModels] forKey:@"overlay"];
+    }
+    [analyzer release];
+    [self performSelectorOnMainThread:@selector(finishAnalysis:) withObject:result waitUntilDone:NO];
+    [pool release];
+}
+
+- (void)finishAnalysis:(NSDictionary *)result {
+    if ([[result objectForKey:@"generation"] unsignedIntegerValue] != analysisGeneration) return;
+    [analysisSummary release];
+    analysisSummary = [[result objectForKey:@"summary"] retain];
+    [lightnessHistogram release];
+    lightnessHistogram = [[result objectForKey:@"lightness"] retain];
+    NSArray *overlay = [result objectForKey:@"overlay"];
+    if (overlay) {
+        [gamutView setOverlayModels:overlay];
+    }
+    [self setNeedsDisplay:YES];
+}
+
+// Pixels per L* bin as bars, L* 0 at the left
+- (void)drawLightnessHistogramInRect:(NSRect)rect {
+    NSUInteger bins = [lightnessHistogram length] / sizeof(uint64_t);
+    const uint64_t *counts = (const uint64_t *)[lightnessHistogram bytes];
+    uint64_t maxCount = 0;
+    NSUInteger i;
+    for (i = 0; i < bins; i++) {
+        if (counts[i] > maxCount) maxCount = counts[i];
+    }
+    [[NSColor colorWithCalibratedWhite:0.95 alpha:1.0] set];
+    NSRectFill(rect);
+    if (maxCount == 0) return;
+    [[NSColor darkGrayColor] set];
+    CGFloat barWidth = rect.size.width / bins;
+    for (i = 0; i < bins; i++) {
+        CGFloat barHeight = rect.size.height * (CGFloat)counts[i] / (CGFloat)maxCount;
+        NSRectFill(NSMakeRect(rect.origin.x + i * barWidth, rect.origin.y, barWidth, barHeight));
+    }
+}
+
 - (void)displayProfile:(ICCProfile *)profile {
-    currentProfile = [profile retain];
+    [profile retain];
+    [currentProfile release];
+    currentProfile = profile;
     
     // Get TRC tags
     [redTRC release];
@@ -56,6 +243,19 @@
     [[NSColor whiteColor] set];
     NSRectFill(bounds);
     
+    // Image analysis: summary next to the button, L* histogram along the bottom
+    float histogramHeight = lightnessHistogram ? kLightnessHistogramHeight : 0.0f;
+    if (analysisSummary) {
+        NSDictionary *summaryAttrs = @{
+            NSFontAttributeName: [NSFont systemFontOfSize:10.0],
+            NSForegroundColorAttributeName: [NSColor blackColor]
+        };
+        [analysisSummary drawAtPoint:NSMakePoint(156, bounds.size.height - 26) withAttributes:summaryAttrs];
+    }
+    if (lightnessHistogram) {
+        [self drawLightnessHistogramInRect:NSMakeRect(40, 4, bounds.size.width - 80, histogramHeight - 8)];
+    }
+    
     if (!redTRC && !greenTRC && !blueTRC) {
         // No TRC data to display
         NSDictionary *attrs = @{
@@ -79,9 +279,9 @@
     // X axis (input: 0.0 to 1.0)
     float margin = 40;
     float plotWidth = bounds.size.width - 2 * margin;
-    float plotHeight = bounds.size.height - 2 * margin;
+    float plotHeight = bounds.size.height - 2 * margin - histogramHeight;
     float plotX = margin;
-    float plotY = margin;
+    float plotY = margin + histogramHeight;
     
     // Horizontal axis
     [axes moveToPoint:NSMakePoint(plotX, plotY)];
@@ -165,21 +365,25 @@
 }
 
 - (void)drawCurve:(ICCTagTRC *)trc color:(NSColor *)color inRect:(NSRect)rect {
-    NSArray *points = [trc curvePoints];
-    if ([points count] == 0) {
+    // One sample per point of width, evaluated in a single batch
+    NSUInteger pointCount = (rect.size.width > 2.0) ? (NSUInteger)rect.size.width : 2;
+    float *samples = (float *)malloc(pointCount * sizeof(float));
+    if (!samples) {
         return;
     }
+    NSUInteger i;
+    for (i = 0; i < pointCount; i++) {
+        samples[i] = (float)i / (pointCount - 1);
+    }
+    [trc evaluate:samples output:samples count:pointCount];
     
     NSBezierPath *curve = [NSBezierPath bezierPath];
     [curve setLineWidth:2.0];
     [color set];
     
-    NSUInteger pointCount = [points count];
-    BOOL firstPoint = YES;
-    
-    for (NSUInteger i = 0; i < pointCount; i++) {
+    for (i = 0; i < pointCount; i++) {
         double input = (double)i / (pointCount - 1);
-        double output = [[points objectAtIndex:i] doubleValue];
+        double output = samples[i];
         
         // Clamp output to valid range
         if (output < 0.0) output = 0.0;
@@ -190,18 +394,24 @@
         
         NSPoint point = NSMakePoint(x, y);
         
-        if (firstPoint) {
+        if (i == 0) {
             [curve moveToPoint:point];
-            firstPoint = NO;
         } else {
             [curve lineToPoint:point];
         }
     }
+    free(samples);
     
     [curve stroke];
 }
 
 - (void)dealloc {
+    [analysisQueue cancelAllOperations];
+    [analysisQueue waitUntilAllOperationsAreFinished];
+    [analysisQueue release];
+    [analyzeButton release];
+    [lightnessHistogram release];
+    [analysisSummary release];
     [curveView release];
     [currentProfile release];
     [redTRC release];
@@ -36,6 +36,9 @@ NS_ASSUME_NONNULL_BEGIN
 - (id)initWithAppController:(AppController *)controller;
 - (void)profileDidLoad:(ICCProfile *)profile;
 
+// Background load progress; a nil stage hides the indicator
+- (void)profileLoadProgress:(double)fraction stage:(nullable NSString *)stage;
+
 @end
 
 NS_ASSUME_NONNULL_END
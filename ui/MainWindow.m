@@ -80,6 +80,7 @@
         histogramCurves = [[HistogramAndCurvesPanel alloc] init];
         [histogramCurves setFrame:NSMakeRect(0, 0, 800, 200)];
         [histogramCurves setAutoresizingMask:NSViewWidthSizable | NSViewHeightSizable];
+        [histogramCurves setGamutView:gamutView];
         
         [rightSplit addSubview:gamutView];
         [rightSplit addSubview:histogramCurves];
@@ -102,9 +103,15 @@
 - (void)profileDidLoad:(ICCProfile *)profile {
     [profileInspector displayProfile:profile];
     [tagEditor displayProfile:profile];
+    [histogramCurves displayProfile:profile];
+    // Starts the gamut in the background; the view fills in when it is ready
     [gamutView displayProfile:profile];
 }
 
+- (void)profileLoadProgress:(double)fraction stage:(NSString *)stage {
+    [fileBrowser setLoadProgress:fraction stage:stage];
+}
+
 - (void)dealloc {
     [appController release];
     [profileInspector release];
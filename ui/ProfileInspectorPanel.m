@@ -100,7 +100,9 @@
 }
 
 - (void)displayProfile:(ICCProfile *)profile {
-    currentProfile = [profile retain];
+    [profile retain];
+    [currentProfile release];
+    currentProfile = profile;
     
     // Update metadata view with formatted text
     NSMutableAttributedString *metadata = [[NSMutableAttributedString alloc] init];
@@ -201,7 +201,9 @@
 }
 
 - (void)displayProfile:(ICCProfile *)profile {
-    currentProfile = [profile retain];
+    [profile retain];
+    [currentProfile release];
+    currentProfile = profile;
     
     // Populate tag selector
     [tagSelector removeAllItems];
@@ -274,22 +276,30 @@
     NSMutableString *curveInfo = [NSMutableString string];
     [curveInfo appendFormat:@"TRC Tag: %@\n", [tag signature]];
     [curveInfo appendFormat:@"Curve Type: %s\n", [tag curveType] == 0 ? "Parametric" : "Table"];
-    [curveInfo appendString:@"\nCurve Points:\n"];
     
-    NSArray *points = [tag curvePoints];
-    if ([points count] > 0) {
-        NSUInteger sampleCount = MIN(20, [points count]); // Show first 20 points
+    if ([tag curveType] == 0) {
+        // Native coefficients; names follow the ICC parametricCurveType table
+        static const char *names[7] = {"g", "a", "b", "c", "d", "e", "f"};
+        NSUInteger count = [ICCTagTRC parameterCountForParametricType:[tag parametricType]];
+        const double *params = [tag parameters];
+        [curveInfo appendFormat:@"Function Type: %lu\n\nParameters:\n", (unsigned long)[tag parametricType]];
+        NSUInteger i;
+        for (i = 0; i < count; i++) {
+            [curveInfo appendFormat:@"  %s = %.6f\n", names[i], params[i]];
+        }
+    } else {
+        [curveInfo appendString:@"\nCurve Points:\n"];
+        const float *values = [tag tableValues];
+        NSUInteger count = [tag tableCount];
+        NSUInteger sampleCount = MIN(20, count); // Show first 20 points
         NSUInteger i;
         for (i = 0; i < sampleCount; i++) {
-            double input = (double)i / (sampleCount - 1);
-            double output = [[points objectAtIndex:i] doubleValue];
-            [curveInfo appendFormat:@"  Input: %.3f -> Output: %.6f\n", input, output];
+            double input = (double)i / (count - 1);
+            [curveInfo appendFormat:@"  Input: %.3f -> Output: %.6f\n", input, values[i]];
         }
-        if ([points count] > sampleCount) {
-            [curveInfo appendFormat:@"  ... (%lu more points)\n", (unsigned long)([points count] - sampleCount)];
+        if (count > sampleCount) {
+            [curveInfo appendFormat:@"  ... (%lu more points)\n", (unsigned long)(count - sampleCount)];
         }
-    } else {
-        [curveInfo appendString:@"  (No curve points)\n"];
     }
     
     [[trcCurveView textStorage] setAttributedString:[[[NSAttributedString alloc] initWithString:curveInfo] autorelease]];
@@ -320,6 +330,17 @@
     [lutInfo appendFormat:@"Output Channels: %lu\n", (unsigned long)[tag outputChannels]];
     [lutInfo appendFormat:@"Grid Points: %lu\n", (unsigned long)[tag gridPoints]];
     
+    NSUInteger i, stageCount = [tag stageCount];
+    if (stageCount > 0) {
+        [lutInfo appendString:@"Stages:"];
+        for (i = 0; i < stageCount; i++) {
+            ICCLUTStageKind kind = [tag kindOfStageAtIndex:i];
+            NSString *name = (kind == ICCLUTStageCurves) ? @"Curves" : ((kind == ICCLUTStageMatrix) ? @"Matrix" : @"CLUT");
+            [lutInfo appendFormat:@"%@ %@", (i == 0) ? @"" : @" ->", name];
+        }
+        [lutInfo appendString:@"\n"];
+    }
+    
     NSData *data = [tag lutData];
     if (data) {
         [lutInfo appendFormat:@"LUT Data Size: %lu bytes\n", (unsigned long)[data length]];
@@ -4,26 +4,85 @@
 //
 //  Stores mesh/point cloud representing a gamut in Lab space
 //
+//  Models from GamutCache are shared between threads, so every accessor is
+//  serialized on the model. Buffers and raw pointers handed out stay valid
+//  until the caller's autorelease pool drains, even if a setter replaces them.
+//
 
 #import <Foundation/Foundation.h>
 
 NS_ASSUME_NONNULL_BEGIN
 
 @interface Gamut3DModel : NSObject {
-    NSArray *vertices; // Array of NSArray with 3 NSNumber (Lab coordinates)
-    NSArray *faces;    // Array of NSArray with vertex indices
+    NSData *labData;   // Packed interleaved float L*, a*, b* triples
+    NSArray *vertices; // Compatibility view: NSArray of NSArray with 3 NSNumber (built on demand)
+    NSData *triangleData; // Packed uint32_t index triples, counter-clockwise from outside
+    NSArray *faces;    // Compatibility view: Array of NSArray with vertex indices (built on demand)
     NSString *name;
     float color[3];    // RGB color for rendering
+    NSUInteger revision;
+    NSUInteger colorRevision;
+    NSArray *levelsOfDetail; // Decimated copies of the mesh, finest first
 }
 
 @property (nonatomic, retain) NSArray *vertices;
-@property (nonatomic, retain) NSArray *faces;
+@property (nonatomic, retain, nullable) NSArray *faces;
 @property (nonatomic, retain) NSString *name;
 @property (nonatomic) float *color;
 
+// Packed Lab storage: 3 floats (L*, a*, b*) per point
+@property (nonatomic, readonly) NSData *labData;
+
+// Packed triangle storage: 3 uint32_t point indices per face (nil when no mesh)
+@property (nonatomic, copy, nullable) NSData *triangleData;
+
 - (id)initWithVertices:(NSArray *)verts faces:(NSArray *)fs name:(NSString *)n;
+- (id)initWithLabData:(NSData *)data faces:(nullable NSArray *)fs name:(NSString *)n;
+- (id)initWithLabData:(NSData *)data triangles:(nullable NSData *)tris name:(NSString *)n;
 - (void)setColorRed:(float)r green:(float)g blue:(float)b;
 
+// Bumped by every geometry setter, so renderers holding GPU copies know
+// when to upload the model again
+@property (nonatomic, readonly) NSUInteger revision;
+
+// Bumped by setColorRed:green:blue: only; recoloring leaves the geometry
+// revision alone, so it never re-uploads the mesh
+@property (nonatomic, readonly) NSUInteger colorRevision;
+
+// Coarser meshes for drawing at a distance (see GamutMeshLOD), finest
+// first; nil until built. Replacing the points or triangles drops them.
+@property (nonatomic, retain, nullable) NSArray *levelsOfDetail;
+
+// Raw access to the packed points (pointCount * 3 floats)
+- (const float *)labPoints;
+- (NSUInteger)pointCount;
+
+// Raw access to the packed triangles (triangleCount * 3 indices)
+- (const uint32_t *)triangleIndices;
+- (NSUInteger)triangleCount;
+
+// Gamut files: a 48-byte header (magic, version, profile content hash and
+// ICC profile ID, resolution, counts) followed by the packed points and the
+// packed triangles, in native byte order. Loading maps the file and points
+// labData/triangleData into the mapping, so nothing is parsed or copied.
+// Files written for another hash, resolution or byte order are rejected.
+- (nullable id)initWithContentsOfMappedFile:(NSString *)path
+                                contentHash:(uint64_t)hash
+                                 resolution:(NSUInteger)resolution
+                                       name:(NSString *)n
+                                      error:(NSError **)error;
+- (BOOL)writeToFile:(NSString *)path
+        contentHash:(uint64_t)hash
+          profileID:(nullable NSData *)profileID
+         resolution:(NSUInteger)resolution
+              error:(NSError **)error;
+
+// Pack an NSArray of 3-NSNumber points into interleaved floats
++ (NSData *)labDataFromVertices:(NSArray *)verts;
+
+// Pack an NSArray of 3-NSNumber index arrays into uint32_t triples
++ (NSData *)triangleDataFromFaces:(NSArray *)fs;
+
 @end
 
 NS_ASSUME_NONNULL_END
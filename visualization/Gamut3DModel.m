@@ -6,17 +6,85 @@
 //
 
 #import "Gamut3DModel.h"
+#import "ICCProfileIO.h"
+#import <string.h>
+
+static const uint32_t kGamutFileMagic = 0x4d475349; // "ISGM" in little-endian files
+static const uint32_t kGamutFileVersion = 1;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t contentHash;   // GamutCache hash of the profile bytes
+    uint8_t profileID[16];  // ICC header profile ID (zero when absent)
+    uint32_t resolution;
+    uint32_t pointCount;    // Followed by pointCount * 3 floats
+    uint32_t triangleCount; // then triangleCount * 3 uint32_t
+    uint32_t reserved;
+} GamutFileHeader;
+
+static NSError *gamutFileError(NSInteger code, NSString *description) {
+    return [NSError errorWithDomain:@"SmallICCer"
+                               code:code
+                           userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                     description, NSLocalizedDescriptionKey, nil]];
+}
 
 @implementation Gamut3DModel
 
-@synthesize vertices;
-@synthesize faces;
 @synthesize name;
 
++ (NSData *)labDataFromVertices:(NSArray *)verts {
+    NSUInteger count = [verts count];
+    NSMutableData *data = [NSMutableData dataWithLength:count * 3 * sizeof(float)];
+    float *out = (float *)[data mutableBytes];
+    NSUInteger i, n = 0;
+    for (i = 0; i < count; i++) {
+        NSArray *point = [verts objectAtIndex:i];
+        if ([point count] >= 3) {
+            out[n * 3 + 0] = [[point objectAtIndex:0] floatValue];
+            out[n * 3 + 1] = [[point objectAtIndex:1] floatValue];
+            out[n * 3 + 2] = [[point objectAtIndex:2] floatValue];
+            n++;
+        }
+    }
+    // Drop slots for malformed points so pointCount matches real data
+    [data setLength:n * 3 * sizeof(float)];
+    return data;
+}
+
++ (NSData *)triangleDataFromFaces:(NSArray *)fs {
+    NSUInteger count = [fs count];
+    NSMutableData *data = [NSMutableData dataWithLength:count * 3 * sizeof(uint32_t)];
+    uint32_t *out = (uint32_t *)[data mutableBytes];
+    NSUInteger i, n = 0;
+    for (i = 0; i < count; i++) {
+        NSArray *face = [fs objectAtIndex:i];
+        if ([face count] >= 3) {
+            out[n * 3 + 0] = [[face objectAtIndex:0] unsignedIntValue];
+            out[n * 3 + 1] = [[face objectAtIndex:1] unsignedIntValue];
+            out[n * 3 + 2] = [[face objectAtIndex:2] unsignedIntValue];
+            n++;
+        }
+    }
+    [data setLength:n * 3 * sizeof(uint32_t)];
+    return data;
+}
+
 - (id)initWithVertices:(NSArray *)verts faces:(NSArray *)fs name:(NSString *)n {
-    self = [super init];
+    self = [self initWithLabData:[Gamut3DModel labDataFromVertices:verts] faces:fs name:n];
     if (self) {
         vertices = [verts retain];
+    }
+    return self;
+}
+
+- (id)initWithLabData:(NSData *)data faces:(NSArray *)fs name:(NSString *)n {
+    self = [super init];
+    if (self) {
+        labData = data ? [data copy] : [[NSData alloc] init];
+        vertices = nil;
+        triangleData = fs ? [[Gamut3DModel triangleDataFromFaces:fs] retain] : nil;
         faces = [fs retain];
         name = [n retain];
         color[0] = 1.0;
@@ -26,19 +94,257 @@
     return self;
 }
 
+- (id)initWithLabData:(NSData *)data triangles:(NSData *)tris name:(NSString *)n {
+    self = [self initWithLabData:data faces:nil name:n];
+    if (self) {
+        triangleData = [tris copy];
+    }
+    return self;
+}
+
+- (id)initWithContentsOfMappedFile:(NSString *)path
+                       contentHash:(uint64_t)hash
+                        resolution:(NSUInteger)resolution
+                              name:(NSString *)n
+                             error:(NSError **)error {
+    NSData *file = ICCMappedDataWithContentsOfFile(path);
+    if (!file) {
+        if (error) *error = gamutFileError(1, @"Failed to read gamut file");
+        [self release];
+        return nil;
+    }
+    NSUInteger length = [file length];
+    const uint8_t *bytes = (const uint8_t *)[file bytes];
+    GamutFileHeader header;
+    if (length < sizeof(header)) {
+        if (error) *error = gamutFileError(2, @"Invalid gamut file");
+        [self release];
+        return nil;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    size_t pointBytes = (size_t)header.pointCount * 3 * sizeof(float);
+    size_t triangleBytes = (size_t)header.triangleCount * 3 * sizeof(uint32_t);
+    if (header.magic != kGamutFileMagic || header.version != kGamutFileVersion ||
+        header.contentHash != hash || header.resolution != resolution ||
+        length != sizeof(header) + pointBytes + triangleBytes) {
+        if (error) *error = gamutFileError(2, @"Invalid gamut file");
+        [self release];
+        return nil;
+    }
+    // Out-of-range indices would send the renderer outside the point buffer
+    const uint32_t *tris = (const uint32_t *)(bytes + sizeof(header) + pointBytes);
+    NSUInteger i;
+    for (i = 0; i < (NSUInteger)header.triangleCount * 3; i++) {
+        if (tris[i] >= header.pointCount) {
+            if (error) *error = gamutFileError(2, @"Invalid gamut file");
+            [self release];
+            return nil;
+        }
+    }
+
+    self = [self initWithLabData:nil faces:nil name:n];
+    if (self) {
+        [labData release];
+        labData = [[ICCDataSlice alloc] initWithData:file range:NSMakeRange(sizeof(header), pointBytes)];
+        // Slices retain the mapping, so models sharing these buffers keep it alive
+        triangleData = [[ICCDataSlice alloc] initWithData:file
+                                                    range:NSMakeRange(sizeof(header) + pointBytes, triangleBytes)];
+    }
+    return self;
+}
+
+- (BOOL)writeToFile:(NSString *)path
+        contentHash:(uint64_t)hash
+          profileID:(NSData *)profileID
+         resolution:(NSUInteger)resolution
+              error:(NSError **)error {
+    GamutFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kGamutFileMagic;
+    header.version = kGamutFileVersion;
+    header.contentHash = hash;
+    if ([profileID length] == sizeof(header.profileID)) {
+        memcpy(header.profileID, [profileID bytes], sizeof(header.profileID));
+    }
+    header.resolution = (uint32_t)resolution;
+    NSData *points = [self labData];
+    NSData *triangles = [self triangleData];
+    header.pointCount = (uint32_t)([points length] / (3 * sizeof(float)));
+    header.triangleCount = (uint32_t)([triangles length] / (3 * sizeof(uint32_t)));
+
+    NSMutableData *file = [NSMutableData dataWithCapacity:sizeof(header) + [points length] + [triangles length]];
+    [file appendBytes:&header length:sizeof(header)];
+    [file appendData:points];
+    if (triangles) [file appendData:triangles];
+    if (![file writeToFile:path atomically:YES]) {
+        if (error) *error = gamutFileError(3, @"Failed to write gamut file");
+        return NO;
+    }
+    return YES;
+}
+
+// Buffers handed out are retained and autoreleased, so a setter on another
+// thread cannot free them while the caller's pool is alive
+- (NSData *)labData {
+    @synchronized(self) {
+        return [[labData retain] autorelease];
+    }
+}
+
+- (const float *)labPoints {
+    return (const float *)[[self labData] bytes];
+}
+
+- (NSUInteger)pointCount {
+    @synchronized(self) {
+        return [labData length] / (3 * sizeof(float));
+    }
+}
+
+- (NSUInteger)revision {
+    @synchronized(self) {
+        return revision;
+    }
+}
+
+- (NSUInteger)colorRevision {
+    @synchronized(self) {
+        return colorRevision;
+    }
+}
+
+// The NSArray views are built on first use; cached models are shared between
+// the load pipeline's worker and the main thread, so building and replacing
+// them is serialized on the model like every other accessor
+- (NSArray *)vertices {
+    @synchronized(self) {
+        if (vertices) return [[vertices retain] autorelease];
+        NSUInteger count = [self pointCount];
+        const float *pts = [self labPoints];
+        NSMutableArray *arr = [[NSMutableArray alloc] initWithCapacity:count];
+        NSUInteger i;
+        for (i = 0; i < count; i++) {
+            [arr addObject:[NSArray arrayWithObjects:
+                           [NSNumber numberWithDouble:pts[i * 3 + 0]],
+                           [NSNumber numberWithDouble:pts[i * 3 + 1]],
+                           [NSNumber numberWithDouble:pts[i * 3 + 2]],
+                           nil]];
+        }
+        vertices = arr;
+        return [[arr retain] autorelease];
+    }
+}
+
+- (void)setVertices:(NSArray *)verts {
+    NSData *packed = [Gamut3DModel labDataFromVertices:verts];
+    @synchronized(self) {
+        [labData release];
+        labData = [packed retain];
+        [verts retain];
+        [vertices release];
+        vertices = verts;
+        [levelsOfDetail release];
+        levelsOfDetail = nil;
+        revision++;
+    }
+}
+
+- (const uint32_t *)triangleIndices {
+    return (const uint32_t *)[[self triangleData] bytes];
+}
+
+- (NSUInteger)triangleCount {
+    @synchronized(self) {
+        return [triangleData length] / (3 * sizeof(uint32_t));
+    }
+}
+
+- (NSData *)triangleData {
+    @synchronized(self) {
+        return [[triangleData retain] autorelease];
+    }
+}
+
+- (void)setTriangleData:(NSData *)data {
+    NSData *copied = [data copy];
+    @synchronized(self) {
+        [triangleData release];
+        triangleData = copied;
+        [faces release];
+        faces = nil;
+        [levelsOfDetail release];
+        levelsOfDetail = nil;
+        revision++;
+    }
+}
+
+- (NSArray *)faces {
+    @synchronized(self) {
+        if (faces || !triangleData) return [[faces retain] autorelease];
+        NSUInteger count = [self triangleCount];
+        const uint32_t *idx = [self triangleIndices];
+        NSMutableArray *arr = [[NSMutableArray alloc] initWithCapacity:count];
+        NSUInteger i;
+        for (i = 0; i < count; i++) {
+            [arr addObject:[NSArray arrayWithObjects:
+                           [NSNumber numberWithUnsignedInt:idx[i * 3 + 0]],
+                           [NSNumber numberWithUnsignedInt:idx[i * 3 + 1]],
+                           [NSNumber numberWithUnsignedInt:idx[i * 3 + 2]],
+                           nil]];
+        }
+        faces = arr;
+        return [[arr retain] autorelease];
+    }
+}
+
+- (void)setFaces:(NSArray *)fs {
+    NSData *packed = fs ? [Gamut3DModel triangleDataFromFaces:fs] : nil;
+    @synchronized(self) {
+        [triangleData release];
+        triangleData = [packed retain];
+        [fs retain];
+        [faces release];
+        faces = fs;
+        [levelsOfDetail release];
+        levelsOfDetail = nil;
+        revision++;
+    }
+}
+
+- (NSArray *)levelsOfDetail {
+    @synchronized(self) {
+        return [[levelsOfDetail retain] autorelease];
+    }
+}
+
+- (void)setLevelsOfDetail:(NSArray *)levels {
+    @synchronized(self) {
+        [levels retain];
+        [levelsOfDetail release];
+        levelsOfDetail = levels;
+        revision++;
+    }
+}
+
 - (float *)color {
     return color;
 }
 
 - (void)setColorRed:(float)r green:(float)g blue:(float)b {
-    color[0] = r;
-    color[1] = g;
-    color[2] = b;
+    @synchronized(self) {
+        color[0] = r;
+        color[1] = g;
+        color[2] = b;
+        colorRevision++;
+    }
 }
 
 - (void)dealloc {
+    [labData release];
     [vertices release];
+    [triangleData release];
     [faces release];
+    [levelsOfDetail release];
     [name release];
     [super dealloc];
 }
@@ -0,0 +1,53 @@
+//
+//  GamutCache.h
+//  SmallICCer
+//
+//  Memory-bounded LRU cache of computed gamut models (packed Lab lattice plus
+//  convex hull triangles and their levels of detail). Profiles are keyed by a hash of their bytes,
+//  color spaces by their primaries and white point; both also by resolution.
+//  Profile gamuts are also kept on disk as mappable gamut files (see
+//  Gamut3DModel), so a warm start never runs LittleCMS.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class Gamut3DModel;
+@class ICCProfile;
+@class ColorSpace;
+
+@interface GamutCache : NSObject {
+    NSMutableDictionary *entries;  // Key → Gamut3DModel
+    NSMutableArray *recentKeys;    // Least recently used first
+    NSUInteger memoryLimit;
+    NSUInteger memoryUsed;
+    NSString *diskDirectory;
+}
+
++ (GamutCache *)sharedCache;
+
+// Upper bound on cached labData + triangleData bytes, levels included (default 64 MB). The
+// most recently used model is always kept, even when it alone is larger.
+@property (nonatomic) NSUInteger memoryLimit;
+@property (nonatomic, readonly) NSUInteger memoryUsed;
+
+// Directory for persisted profile gamuts (nil = memory only, the default).
+// Files are named <content hash>-<resolution>.gamut.
+@property (nonatomic, copy, nullable) NSString *diskDirectory;
+
+// Models are shared between callers and must be treated as immutable: wrap
+// their labData/triangleData (and levelsOfDetail) in a new Gamut3DModel to
+// give it another name or color (the buffers are shared, not copied).
+- (Gamut3DModel *)gamutForProfile:(ICCProfile *)profile resolution:(NSUInteger)resolution;
+- (Gamut3DModel *)gamutForColorSpace:(ColorSpace *)colorSpace resolution:(NSUInteger)resolution;
+
+- (NSUInteger)count;
+- (void)removeAllGamuts;
+
+// 64-bit FNV-1a over the profile bytes (0 without bytes)
++ (uint64_t)contentHashForProfile:(ICCProfile *)profile;
+
+@end
+
+NS_ASSUME_NONNULL_END
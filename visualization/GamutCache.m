@@ -0,0 +1,207 @@
+//
+//  GamutCache.m
+//  SmallICCer
+//
+//  Gamut Cache implementation.
+//  Misses are computed outside the lock, so two threads asking for the same
+//  key may both compute it; the first insert wins and the other result is
+//  dropped.
+//
+
+#import "GamutCache.h"
+#import "Gamut3DModel.h"
+#import "GamutCalculator.h"
+#import "GamutMeshLOD.h"
+#import "ICCProfile.h"
+#import "ColorSpace.h"
+
+static const NSUInteger kDefaultMemoryLimit = 64 * 1024 * 1024;
+
+static GamutCache *sharedInstance = nil;
+
+static NSUInteger modelBytes(Gamut3DModel *model) {
+    NSUInteger bytes = [[model labData] length] + [[model triangleData] length];
+    NSArray *levels = [model levelsOfDetail];
+    NSUInteger i;
+    for (i = 0; i < [levels count]; i++) {
+        Gamut3DModel *level = [levels objectAtIndex:i];
+        bytes += [[level labData] length] + [[level triangleData] length];
+    }
+    return bytes;
+}
+
+@implementation GamutCache
+
+@synthesize memoryLimit;
+@synthesize memoryUsed;
+@synthesize diskDirectory;
+
++ (GamutCache *)sharedCache {
+    @synchronized(self) {
+        if (sharedInstance == nil) {
+            sharedInstance = [[self alloc] init];
+        }
+    }
+    return sharedInstance;
+}
+
++ (uint64_t)contentHashForProfile:(ICCProfile *)profile {
+    NSData *data = [profile profileData];
+    NSUInteger i, length = [data length];
+    if (length == 0) return 0;
+    const uint8_t *bytes = (const uint8_t *)[data bytes];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        entries = [[NSMutableDictionary alloc] init];
+        recentKeys = [[NSMutableArray alloc] init];
+        memoryLimit = kDefaultMemoryLimit;
+        memoryUsed = 0;
+    }
+    return self;
+}
+
+- (void)evictToLimit {
+    // Keep the most recently used entry even when it alone exceeds the limit
+    while (memoryUsed > memoryLimit && [recentKeys count] > 1) {
+        id key = [recentKeys objectAtIndex:0];
+        memoryUsed -= modelBytes([entries objectForKey:key]);
+        [entries removeObjectForKey:key];
+        [recentKeys removeObjectAtIndex:0];
+    }
+}
+
+- (void)setMemoryLimit:(NSUInteger)limit {
+    @synchronized(self) {
+        memoryLimit = limit;
+        [self evictToLimit];
+    }
+}
+
+- (Gamut3DModel *)cachedModelForKey:(NSString *)key {
+    Gamut3DModel *model = nil;
+    @synchronized(self) {
+        model = [entries objectForKey:key];
+        if (model) {
+            [[model retain] autorelease];
+            [key retain];
+            [recentKeys removeObject:key];
+            [recentKeys addObject:key];
+            [key release];
+        }
+    }
+    return model;
+}
+
+- (Gamut3DModel *)storeModel:(Gamut3DModel *)model forKey:(NSString *)key {
+    Gamut3DModel *stored = nil;
+    @synchronized(self) {
+        stored = [entries objectForKey:key];
+        if (!stored) {
+            [entries setObject:model forKey:key];
+            [recentKeys addObject:key];
+            memoryUsed += modelBytes(model);
+            [self evictToLimit];
+            stored = model;
+        }
+        [[stored retain] autorelease];
+    }
+    return stored;
+}
+
+- (Gamut3DModel *)modelWithLabData:(NSData *)points calculator:(GamutCalculator *)calc name:(NSString *)name {
+    NSData *triangles = [calc computeConvexHullTrianglesForPackedLab:points];
+    Gamut3DModel *model = [[[Gamut3DModel alloc] initWithLabData:points triangles:triangles name:name] autorelease];
+    [model setLevelsOfDetail:[GamutMeshLOD levelsOfDetailForModel:model]];
+    return model;
+}
+
+- (NSString *)diskPathForHash:(uint64_t)hash resolution:(NSUInteger)resolution {
+    NSString *directory = [self diskDirectory];
+    if (!directory || hash == 0) return nil;
+    return [directory stringByAppendingPathComponent:
+            [NSString stringWithFormat:@"%016llx-%lu.gamut", (unsigned long long)hash, (unsigned long)resolution]];
+}
+
+- (Gamut3DModel *)gamutForProfile:(ICCProfile *)profile resolution:(NSUInteger)resolution {
+    uint64_t hash = [GamutCache contentHashForProfile:profile];
+    NSString *key = [NSString stringWithFormat:@"profile:%016llx@%lu",
+                     (unsigned long long)hash, (unsigned long)resolution];
+    Gamut3DModel *model = [self cachedModelForKey:key];
+    if (model) return model;
+
+    NSString *path = [self diskPathForHash:hash resolution:resolution];
+    if (path) {
+        model = [[[Gamut3DModel alloc] initWithContentsOfMappedFile:path
+                                                        contentHash:hash
+                                                         resolution:resolution
+                                                               name:@"Profile Gamut"
+                                                              error:NULL] autorelease];
+        if (model) {
+            // Levels of detail are not stored in the file
+            [model setLevelsOfDetail:[GamutMeshLOD levelsOfDetailForModel:model]];
+            return [self storeModel:model forKey:key];
+        }
+    }
+
+    GamutCalculator *calc = [[GamutCalculator alloc] init];
+    [calc setResolution:resolution];
+    model = [self modelWithLabData:[calc computePackedGamutForProfile:profile] calculator:calc name:@"Profile Gamut"];
+    [calc release];
+    if (path) {
+        // ICC header profile ID (bytes 84-99), recorded for identification only
+        NSData *bytes = [profile profileData];
+        NSData *profileID = ([bytes length] >= 128) ? [bytes subdataWithRange:NSMakeRange(84, 16)] : nil;
+        [model writeToFile:path contentHash:hash profileID:profileID resolution:resolution error:NULL];
+    }
+    return [self storeModel:model forKey:key];
+}
+
+- (Gamut3DModel *)gamutForColorSpace:(ColorSpace *)colorSpace resolution:(NSUInteger)resolution {
+    // The lattice depends only on the primaries and white point, not the name
+    NSString *key = [NSString stringWithFormat:@"space:%@ %@@%lu",
+                     [[colorSpace primaries] componentsJoinedByString:@","],
+                     [[colorSpace whitePoint] componentsJoinedByString:@","],
+                     (unsigned long)resolution];
+    Gamut3DModel *model = [self cachedModelForKey:key];
+    if (model) return model;
+
+    GamutCalculator *calc = [[GamutCalculator alloc] init];
+    [calc setResolution:resolution];
+    model = [self modelWithLabData:[calc computePackedGamutForColorSpace:colorSpace] calculator:calc name:[colorSpace name]];
+    [calc release];
+    return [self storeModel:model forKey:key];
+}
+
+- (NSUInteger)count {
+    NSUInteger n;
+    @synchronized(self) {
+        n = [entries count];
+    }
+    return n;
+}
+
+- (void)removeAllGamuts {
+    @synchronized(self) {
+        [entries removeAllObjects];
+        [recentKeys removeAllObjects];
+        memoryUsed = 0;
+    }
+}
+
+- (void)dealloc {
+    [entries release];
+    [recentKeys release];
+    [diskDirectory release];
+    [super dealloc];
+}
+
+@end
@@ -3,41 +3,212 @@
 //  SmallICCer
 //
 //  Gamut Comparator implementation
+//  Volumes are exact over the model's triangles. Intersections cast one ray
+//  along L* per a*/b* grid column through both meshes and integrate the
+//  spans where the running winding of each surface is positive, which works
+//  for concave (segment maxima) meshes as well as convex hulls.
 //
 
 #import "GamutComparator.h"
 #import "Gamut3DModel.h"
+#import "GamutHull.h"
+#import "GamutSpatialIndex.h"
 #import <math.h>
+#import <stdlib.h>
 
-@implementation GamutComparator
+typedef struct {
+    float l;      // L* where the column crosses the surface
+    int winding;  // +1 entering (face points to -L*), -1 leaving
+} ColumnCrossing;
 
-- (double)computeVolume:(Gamut3DModel *)gamut {
-    // Simplified volume calculation - a full implementation would
-    // compute the convex hull and calculate its volume
-    NSArray *vertices = [gamut vertices];
-    if ([vertices count] == 0) return 0.0;
+typedef struct {
+    int columnsA;     // Columns along a*
+    int columnsB;     // Columns along b*
+    double originA;   // a*, b* of the grid corner
+    double originB;
+    double step;      // Column width, same along a* and b*
+} ColumnGrid;
+
+typedef struct {
+    int *offsets;               // Crossings of column c are [offsets[c], offsets[c + 1])
+    ColumnCrossing *crossings;
+} ColumnCrossings;
+
+// Visit every column center covered by each triangle's (a*, b*) projection.
+// Counting pass (out == NULL) bumps counts; fill pass writes at cursor.
+static void rasterizeMesh(const ColumnGrid *grid, const float *pts, const uint32_t *triangles,
+                          NSUInteger triangleCount, int *counts, int *cursor, ColumnCrossing *out) {
+    NSUInteger t;
+    for (t = 0; t < triangleCount; t++) {
+        const uint32_t *tri = triangles + t * 3;
+        const float *p0 = pts + (size_t)tri[0] * 3;
+        const float *p1 = pts + (size_t)tri[1] * 3;
+        const float *p2 = pts + (size_t)tri[2] * 3;
+        double minA = fmin(p0[1], fmin(p1[1], p2[1])), maxA = fmax(p0[1], fmax(p1[1], p2[1]));
+        double minB = fmin(p0[2], fmin(p1[2], p2[2])), maxB = fmax(p0[2], fmax(p1[2], p2[2]));
+        int ia0 = (int)ceil((minA - grid->originA) / grid->step - 0.5);
+        int ia1 = (int)floor((maxA - grid->originA) / grid->step - 0.5);
+        int ib0 = (int)ceil((minB - grid->originB) / grid->step - 0.5);
+        int ib1 = (int)floor((maxB - grid->originB) / grid->step - 0.5);
+        if (ia0 < 0) ia0 = 0;
+        if (ib0 < 0) ib0 = 0;
+        if (ia1 >= grid->columnsA) ia1 = grid->columnsA - 1;
+        if (ib1 >= grid->columnsB) ib1 = grid->columnsB - 1;
+        
+        int ia, ib;
+        for (ib = ib0; ib <= ib1; ib++) {
+            double b = grid->originB + (ib + 0.5) * grid->step;
+            for (ia = ia0; ia <= ia1; ia++) {
+                double a = grid->originA + (ia + 0.5) * grid->step;
+                float l;
+                int winding;
+                if (!GamutHullColumnCrossing(pts, tri, a, b, &l, &winding)) continue;
+                int column = ib * grid->columnsA + ia;
+                if (!out) {
+                    counts[column]++;
+                } else {
+                    ColumnCrossing *c = &out[cursor[column]++];
+                    c->l = l;
+                    c->winding = winding;
+                }
+            }
+        }
+    }
+}
+
+static void freeColumnCrossings(ColumnCrossings *cc) {
+    free(cc->offsets);
+    free(cc->crossings);
+    cc->offsets = NULL;
+    cc->crossings = NULL;
+}
+
+// Bucket a closed mesh's surface crossings by column, each column sorted by L*
+static BOOL buildColumnCrossings(const ColumnGrid *grid, const float *pts, const uint32_t *triangles,
+                                 NSUInteger triangleCount, ColumnCrossings *cc) {
+    int columns = grid->columnsA * grid->columnsB;
+    int c, i, j;
+    cc->offsets = (int *)calloc((size_t)columns + 1, sizeof(int));
+    int *cursor = (int *)malloc((size_t)columns * sizeof(int));
+    cc->crossings = NULL;
+    if (!cc->offsets || !cursor) {
+        free(cursor);
+        freeColumnCrossings(cc);
+        return NO;
+    }
     
-    // Placeholder: return approximate volume based on bounding box
-    double minL = 100.0, maxL = 0.0;
-    double minA = 128.0, maxA = -128.0;
-    double minB = 128.0, maxB = -128.0;
+    rasterizeMesh(grid, pts, triangles, triangleCount, cc->offsets + 1, NULL, NULL);
+    for (c = 0; c < columns; c++) {
+        cc->offsets[c + 1] += cc->offsets[c];
+        cursor[c] = cc->offsets[c];
+    }
+    cc->crossings = (ColumnCrossing *)malloc((size_t)(cc->offsets[columns] + 1) * sizeof(ColumnCrossing));
+    if (!cc->crossings) {
+        free(cursor);
+        freeColumnCrossings(cc);
+        return NO;
+    }
+    rasterizeMesh(grid, pts, triangles, triangleCount, NULL, cursor, cc->crossings);
+    free(cursor);
     
-    for (NSArray *point in vertices) {
-        if ([point count] >= 3) {
-            double l = [[point objectAtIndex:0] doubleValue];
-            double a = [[point objectAtIndex:1] doubleValue];
-            double b = [[point objectAtIndex:2] doubleValue];
-            
-            if (l < minL) minL = l;
-            if (l > maxL) maxL = l;
-            if (a < minA) minA = a;
-            if (a > maxA) maxA = a;
-            if (b < minB) minB = b;
-            if (b > maxB) maxB = b;
+    // Columns hold a handful of crossings: insertion sort
+    for (c = 0; c < columns; c++) {
+        ColumnCrossing *col = cc->crossings + cc->offsets[c];
+        int n = cc->offsets[c + 1] - cc->offsets[c];
+        for (i = 1; i < n; i++) {
+            ColumnCrossing key = col[i];
+            for (j = i - 1; j >= 0 && col[j].l > key.l; j--) col[j + 1] = col[j];
+            col[j + 1] = key;
+        }
+    }
+    return YES;
+}
+
+// Sweep both meshes' crossings up each column: inside where the winding is positive
+static void integrateColumns(const ColumnGrid *grid, const ColumnCrossings *m1, const ColumnCrossings *m2,
+                             double *volume1, double *volume2, double *intersection) {
+    int columns = grid->columnsA * grid->columnsB;
+    double len1 = 0.0, len2 = 0.0, lenBoth = 0.0;
+    int c;
+    for (c = 0; c < columns; c++) {
+        int i = m1->offsets[c], iEnd = m1->offsets[c + 1];
+        int j = m2->offsets[c], jEnd = m2->offsets[c + 1];
+        int w1 = 0, w2 = 0;
+        double last = 0.0;
+        while (i < iEnd || j < jEnd) {
+            const ColumnCrossing *next;
+            int fromFirst = (j >= jEnd) || (i < iEnd && m1->crossings[i].l <= m2->crossings[j].l);
+            next = fromFirst ? &m1->crossings[i++] : &m2->crossings[j++];
+            double span = next->l - last;
+            if (w1 > 0) len1 += span;
+            if (w2 > 0) len2 += span;
+            if (w1 > 0 && w2 > 0) lenBoth += span;
+            if (fromFirst) w1 += next->winding;
+            else w2 += next->winding;
+            last = next->l;
         }
     }
+    double cellArea = grid->step * grid->step;
+    *volume1 = len1 * cellArea;
+    *volume2 = len2 * cellArea;
+    *intersection = lenBoth * cellArea;
+}
+
+// findOverlap: match distance, and the grid cell size that suits it
+static const double kOverlapRadius = 1.0;
+
+// Indexes kept per comparator before the cache is flushed
+static const NSUInteger kMaxCachedIndexes = 8;
+
+// Triangles describing the model's surface: its own mesh, else the hull of its points
+static NSData *surfaceTriangles(Gamut3DModel *gamut) {
+    NSData *triangles = [gamut triangleData];
+    if ([triangles length] > 0) return triangles;
+    return [GamutHull convexHullTrianglesForPoints:[gamut labPoints] count:[gamut pointCount]];
+}
+
+@implementation GamutComparator
+
+@synthesize columnResolution;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        columnResolution = 128;
+        indexCache = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [indexCache release];
+    [super dealloc];
+}
+
+- (double)computeVolume:(Gamut3DModel *)gamut {
+    NSUInteger count = [gamut pointCount];
+    if (count == 0) return 0.0;
+    const float *pts = [gamut labPoints];
+    NSData *triangles = surfaceTriangles(gamut);
+    NSUInteger i, triangleCount = [triangles length] / (3 * sizeof(uint32_t));
+    if (triangleCount == 0) return 0.0;
+    const uint32_t *idx = (const uint32_t *)[triangles bytes];
     
-    return (maxL - minL) * (maxA - minA) * (maxB - minB);
+    // Tetrahedra from a vertex of the mesh keep the terms small (less cancellation)
+    const float *r = pts + (size_t)idx[0] * 3;
+    double volume = 0.0;
+    for (i = 0; i < triangleCount; i++) {
+        const float *pa = pts + (size_t)idx[i * 3] * 3;
+        const float *pb = pts + (size_t)idx[i * 3 + 1] * 3;
+        const float *pc = pts + (size_t)idx[i * 3 + 2] * 3;
+        double a[3] = {pa[0] - r[0], pa[1] - r[1], pa[2] - r[2]};
+        double b[3] = {pb[0] - r[0], pb[1] - r[1], pb[2] - r[2]};
+        double c[3] = {pc[0] - r[0], pc[1] - r[1], pc[2] - r[2]};
+        volume += a[0] * (b[1] * c[2] - b[2] * c[1])
+                - a[1] * (b[0] * c[2] - b[2] * c[0])
+                + a[2] * (b[0] * c[1] - b[1] * c[0]);
+    }
+    return fabs(volume) / 6.0;
 }
 
 - (double)computeVolumeDifference:(Gamut3DModel *)gamut1 and:(Gamut3DModel *)gamut2 {
@@ -46,31 +217,130 @@
     return fabs(vol1 - vol2);
 }
 
+// Sample both surfaces on a shared a*/b* column grid. Returns NO when either
+// model has no closed surface or memory runs out.
+- (BOOL)sampleColumns:(Gamut3DModel *)gamut1 and:(Gamut3DModel *)gamut2
+              volume1:(double *)volume1 volume2:(double *)volume2 intersection:(double *)intersection {
+    *volume1 = *volume2 = *intersection = 0.0;
+    NSData *tris1 = surfaceTriangles(gamut1);
+    NSData *tris2 = surfaceTriangles(gamut2);
+    if ([tris1 length] == 0 || [tris2 length] == 0 || columnResolution == 0) return NO;
+    
+    Gamut3DModel *models[2] = {gamut1, gamut2};
+    double minA = HUGE_VAL, maxA = -HUGE_VAL, minB = HUGE_VAL, maxB = -HUGE_VAL;
+    NSUInteger m, i;
+    for (m = 0; m < 2; m++) {
+        const float *pts = [models[m] labPoints];
+        NSUInteger count = [models[m] pointCount];
+        for (i = 0; i < count; i++) {
+            if (pts[i * 3 + 1] < minA) minA = pts[i * 3 + 1];
+            if (pts[i * 3 + 1] > maxA) maxA = pts[i * 3 + 1];
+            if (pts[i * 3 + 2] < minB) minB = pts[i * 3 + 2];
+            if (pts[i * 3 + 2] > maxB) maxB = pts[i * 3 + 2];
+        }
+    }
+    double extent = fmax(maxA - minA, maxB - minB);
+    if (!(extent > 0.0)) return NO;
+    
+    ColumnGrid grid;
+    grid.step = extent / (double)columnResolution;
+    grid.originA = minA;
+    grid.originB = minB;
+    grid.columnsA = (int)ceil((maxA - minA) / grid.step);
+    grid.columnsB = (int)ceil((maxB - minB) / grid.step);
+    if (grid.columnsA < 1) grid.columnsA = 1;
+    if (grid.columnsB < 1) grid.columnsB = 1;
+    
+    ColumnCrossings crossings1, crossings2;
+    if (!buildColumnCrossings(&grid, [gamut1 labPoints], (const uint32_t *)[tris1 bytes],
+                              [tris1 length] / (3 * sizeof(uint32_t)), &crossings1)) {
+        return NO;
+    }
+    if (!buildColumnCrossings(&grid, [gamut2 labPoints], (const uint32_t *)[tris2 bytes],
+                              [tris2 length] / (3 * sizeof(uint32_t)), &crossings2)) {
+        freeColumnCrossings(&crossings1);
+        return NO;
+    }
+    integrateColumns(&grid, &crossings1, &crossings2, volume1, volume2, intersection);
+    freeColumnCrossings(&crossings1);
+    freeColumnCrossings(&crossings2);
+    return YES;
+}
+
+- (double)computeIntersectionVolume:(Gamut3DModel *)gamut1 and:(Gamut3DModel *)gamut2 {
+    double volume1, volume2, intersection;
+    if (![self sampleColumns:gamut1 and:gamut2 volume1:&volume1 volume2:&volume2 intersection:&intersection]) {
+        return 0.0;
+    }
+    return intersection;
+}
+
+- (double)computeUnionVolume:(Gamut3DModel *)gamut1 and:(Gamut3DModel *)gamut2 {
+    double volume1, volume2, intersection;
+    if (![self sampleColumns:gamut1 and:gamut2 volume1:&volume1 volume2:&volume2 intersection:&intersection]) {
+        return [self computeVolume:gamut1] + [self computeVolume:gamut2];
+    }
+    return volume1 + volume2 - intersection;
+}
+
+- (double)computeCoverage:(Gamut3DModel *)gamut by:(Gamut3DModel *)other {
+    double volume1, volume2, intersection;
+    if (![self sampleColumns:gamut and:other volume1:&volume1 volume2:&volume2 intersection:&intersection] ||
+        volume1 <= 0.0) {
+        return 0.0;
+    }
+    // Both terms come from the same sampling, so their errors largely cancel
+    return intersection / volume1;
+}
+
+- (GamutSpatialIndex *)spatialIndexForGamut:(Gamut3DModel *)gamut {
+    // The index retains the model's labData, so its address stays a valid key
+    NSValue *key = [NSValue valueWithPointer:[gamut labData]];
+    GamutSpatialIndex *index = [indexCache objectForKey:key];
+    if (index && [gamut triangleData] && [gamut triangleData] != [index triangleData]) {
+        index = nil;
+    }
+    if (!index) {
+        if ([indexCache count] >= kMaxCachedIndexes) {
+            [indexCache removeAllObjects];
+        }
+        index = [GamutSpatialIndex indexForGamut:gamut cellSize:kOverlapRadius];
+        if (index) [indexCache setObject:index forKey:key];
+    }
+    return index;
+}
+
 - (NSArray *)findOverlap:(Gamut3DModel *)gamut1 and:(Gamut3DModel *)gamut2 {
-    // Simplified overlap detection - would need proper intersection calculation
     NSMutableArray *overlap = [NSMutableArray array];
+    NSUInteger count1 = [gamut1 pointCount];
+    if (count1 == 0 || [gamut2 pointCount] == 0) return overlap;
     
+    GamutSpatialIndex *index = [self spatialIndexForGamut:gamut2];
+    const float *pts1 = [gamut1 labPoints];
     NSArray *vertices1 = [gamut1 vertices];
-    NSArray *vertices2 = [gamut2 vertices];
-    
-    // Find points that are in both gamuts (simplified)
-    for (NSArray *point1 in vertices1) {
-        for (NSArray *point2 in vertices2) {
-            if ([point1 count] >= 3 && [point2 count] >= 3) {
-                double dist = sqrt(
-                    pow([[point1 objectAtIndex:0] doubleValue] - [[point2 objectAtIndex:0] doubleValue], 2) +
-                    pow([[point1 objectAtIndex:1] doubleValue] - [[point2 objectAtIndex:1] doubleValue], 2) +
-                    pow([[point1 objectAtIndex:2] doubleValue] - [[point2 objectAtIndex:2] doubleValue], 2)
-                );
-                if (dist < 1.0) { // Threshold
-                    [overlap addObject:point1];
-                    break;
-                }
-            }
+    NSUInteger i;
+    for (i = 0; i < count1; i++) {
+        if ([index hasPointWithinRadius:kOverlapRadius ofPoint:pts1 + i * 3]) {
+            [overlap addObject:[vertices1 objectAtIndex:i]];
         }
     }
-    
     return overlap;
 }
 
+- (NSIndexSet *)indicesOfPoints:(Gamut3DModel *)gamut insideGamut:(Gamut3DModel *)other {
+    NSMutableIndexSet *inside = [NSMutableIndexSet indexSet];
+    NSUInteger count = [gamut pointCount];
+    if (count == 0 || [other pointCount] == 0) return inside;
+    
+    GamutSpatialIndex *index = [self spatialIndexForGamut:other];
+    const float *pts = [gamut labPoints];
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        if ([index containsPoint:pts + i * 3]) {
+            [inside addIndex:i];
+        }
+    }
+    return inside;
+}
+
 @end
@@ -0,0 +1,39 @@
+//
+//  GamutMeshLOD.h
+//  SmallICCer
+//
+//  Levels of detail for gamut surface meshes. Coarser meshes are built by
+//  vertex clustering: the vertices are snapped to a grid of cubic Lab
+//  cells, and each cell is merged into one vertex at the mean of its
+//  vertices. The levels are built with the gamut, off the render path. The
+//  backends pick one per frame from the zoom and the rendering quality.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class Gamut3DModel;
+
+@interface GamutMeshLOD : NSObject
+
+// Mesh of model clustered into cellSize ΔE cells. Only vertices used by a
+// triangle are kept; collapsed and duplicate triangles are dropped. nil
+// if memory runs out.
++ (nullable Gamut3DModel *)decimatedModel:(Gamut3DModel *)model cellSize:(double)cellSize;
+
+// Successively coarser meshes, finest first, each with at most half the
+// triangles of the one before. Empty for models with small or no meshes.
++ (NSArray *)levelsOfDetailForModel:(Gamut3DModel *)model;
+
+// Triangles one model may draw at a camera zoom (1 = default distance) and
+// SettingsManager rendering quality (0=low, 1=medium, 2=high)
++ (NSUInteger)triangleBudgetForZoom:(float)zoom quality:(NSInteger)quality;
+
+// model itself when its mesh fits the budget, else the finest of its
+// levelsOfDetail that does (the coarsest when none do)
++ (Gamut3DModel *)meshForModel:(Gamut3DModel *)model zoom:(float)zoom quality:(NSInteger)quality;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,194 @@
+//
+//  GamutMeshLOD.m
+//  SmallICCer
+//
+//  Gamut Mesh LOD implementation.
+//  Clustering sorts the used vertices by cell key and the remapped
+//  triangles by their index triple, so one pass costs O(n log n) and needs
+//  no hash table. Each level is clustered from the one before with twice
+//  the cell size. The cell size keeps doubling until the triangle count at
+//  least halves, so lattice hulls with sparse vertices skip the sizes that
+//  would change nothing.
+//
+
+#import "GamutMeshLOD.h"
+#import "Gamut3DModel.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
+
+// Meshes smaller than this are drawn as they are
+static const NSUInteger kMinLODTriangles = 512;
+static const NSUInteger kMaxLODLevels = 5;
+static const double kFirstCellSize = 1.0;
+static const double kMaxCellSize = 64.0;
+
+// Triangles per model at zoom 1, by rendering quality
+static const NSUInteger kTriangleBudgets[3] = {25000, 100000, 400000};
+
+typedef struct {
+    uint64_t key;
+    uint32_t index;
+} ClusterVertex;
+
+typedef struct {
+    uint32_t v[3];
+} ClusterTriangle;
+
+static int compareClusterVertices(const void *a, const void *b) {
+    uint64_t ka = ((const ClusterVertex *)a)->key, kb = ((const ClusterVertex *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static int compareClusterTriangles(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(ClusterTriangle));
+}
+
+// 21 bits per axis; Lab values are offset so every coordinate is positive
+static uint64_t cellKey(const float *p, double cellSize) {
+    uint64_t key = 0;
+    int k;
+    for (k = 0; k < 3; k++) {
+        double cell = floor(((double)p[k] + 1024.0) / cellSize);
+        if (cell < 0.0) cell = 0.0;
+        if (cell > 2097151.0) cell = 2097151.0;
+        key = (key << 21) | (uint64_t)cell;
+    }
+    return key;
+}
+
+@implementation GamutMeshLOD
+
++ (Gamut3DModel *)decimatedModel:(Gamut3DModel *)model cellSize:(double)cellSize {
+    NSUInteger pointCount = [model pointCount];
+    NSUInteger triangleCount = [model triangleCount];
+    const float *points = [model labPoints];
+    const uint32_t *tris = [model triangleIndices];
+    NSUInteger i, k, used = 0, clusters = 0, kept = 0;
+
+    uint32_t *remap = (uint32_t *)malloc((pointCount ? pointCount : 1) * sizeof(uint32_t));
+    ClusterVertex *vertices = (ClusterVertex *)malloc((pointCount ? pointCount : 1) * sizeof(ClusterVertex));
+    ClusterTriangle *out = (ClusterTriangle *)malloc((triangleCount ? triangleCount : 1) * sizeof(ClusterTriangle));
+    float *means = (float *)malloc((pointCount ? pointCount : 1) * 3 * sizeof(float));
+    if (!remap || !vertices || !out || !means) {
+        free(remap);
+        free(vertices);
+        free(out);
+        free(means);
+        return nil;
+    }
+
+    // Only vertices on the surface take part
+    memset(remap, 0xFF, pointCount * sizeof(uint32_t));
+    for (i = 0; i < triangleCount * 3; i++) {
+        uint32_t v = tris[i];
+        if (v < pointCount && remap[v] == UINT32_MAX) {
+            remap[v] = 0;
+            vertices[used].key = cellKey(points + (size_t)v * 3, cellSize);
+            vertices[used].index = v;
+            used++;
+        }
+    }
+    qsort(vertices, used, sizeof(ClusterVertex), compareClusterVertices);
+
+    // One output vertex per occupied cell, at the mean of its vertices
+    i = 0;
+    while (i < used) {
+        double sum[3] = {0.0, 0.0, 0.0};
+        NSUInteger end = i;
+        while (end < used && vertices[end].key == vertices[i].key) {
+            const float *p = points + (size_t)vertices[end].index * 3;
+            sum[0] += p[0];
+            sum[1] += p[1];
+            sum[2] += p[2];
+            remap[vertices[end].index] = (uint32_t)clusters;
+            end++;
+        }
+        for (k = 0; k < 3; k++) {
+            means[clusters * 3 + k] = (float)(sum[k] / (double)(end - i));
+        }
+        clusters++;
+        i = end;
+    }
+
+    // Remap, drop collapsed triangles, and rotate the lowest index first
+    // (keeping the winding) so duplicates sort next to each other
+    for (i = 0; i < triangleCount; i++) {
+        const uint32_t *t = tris + i * 3;
+        if (t[0] >= pointCount || t[1] >= pointCount || t[2] >= pointCount) continue;
+        uint32_t a = remap[t[0]], b = remap[t[1]], c = remap[t[2]];
+        if (a == b || b == c || a == c) continue;
+        ClusterTriangle *o = &out[kept++];
+        if (a < b && a < c) {
+            o->v[0] = a; o->v[1] = b; o->v[2] = c;
+        } else if (b < c) {
+            o->v[0] = b; o->v[1] = c; o->v[2] = a;
+        } else {
+            o->v[0] = c; o->v[1] = a; o->v[2] = b;
+        }
+    }
+    qsort(out, kept, sizeof(ClusterTriangle), compareClusterTriangles);
+    NSUInteger unique = 0;
+    for (i = 0; i < kept; i++) {
+        if (unique > 0 && memcmp(&out[unique - 1], &out[i], sizeof(ClusterTriangle)) == 0) continue;
+        out[unique++] = out[i];
+    }
+
+    NSData *labData = [NSData dataWithBytes:means length:clusters * 3 * sizeof(float)];
+    NSData *triangleData = [NSData dataWithBytes:out length:unique * sizeof(ClusterTriangle)];
+    free(remap);
+    free(vertices);
+    free(out);
+    free(means);
+
+    Gamut3DModel *decimated = [[Gamut3DModel alloc] initWithLabData:labData triangles:triangleData name:[model name]];
+    float *color = [model color];
+    [decimated setColorRed:color[0] green:color[1] blue:color[2]];
+    return [decimated autorelease];
+}
+
++ (NSArray *)levelsOfDetailForModel:(Gamut3DModel *)model {
+    NSMutableArray *levels = [NSMutableArray array];
+    Gamut3DModel *previous = model;
+    NSUInteger previousTriangles = [model triangleCount];
+    double cellSize = kFirstCellSize;
+
+    while (previousTriangles > kMinLODTriangles && [levels count] < kMaxLODLevels && cellSize <= kMaxCellSize) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        Gamut3DModel *level = [GamutMeshLOD decimatedModel:previous cellSize:cellSize];
+        NSUInteger triangles = [level triangleCount];
+        if (level && triangles >= 4 && triangles * 2 <= previousTriangles) {
+            [levels addObject:level];
+            previous = level;
+            previousTriangles = triangles;
+        }
+        [pool release];
+        if (!level || triangles < 4) break;
+        cellSize *= 2.0;
+    }
+    return levels;
+}
+
++ (NSUInteger)triangleBudgetForZoom:(float)zoom quality:(NSInteger)quality {
+    if (quality < 0) quality = 0;
+    if (quality > 2) quality = 2;
+    // Detail visible on screen grows with the projected area
+    double scale = (zoom > 0.1f) ? (double)zoom * (double)zoom : 0.01;
+    double budget = (double)kTriangleBudgets[quality] * scale;
+    if (budget < (double)kMinLODTriangles) budget = (double)kMinLODTriangles;
+    return (NSUInteger)budget;
+}
+
++ (Gamut3DModel *)meshForModel:(Gamut3DModel *)model zoom:(float)zoom quality:(NSInteger)quality {
+    NSUInteger budget = [GamutMeshLOD triangleBudgetForZoom:zoom quality:quality];
+    NSArray *levels = [model levelsOfDetail];
+    if ([model triangleCount] <= budget || [levels count] == 0) return model;
+    NSUInteger i;
+    for (i = 0; i < [levels count]; i++) {
+        Gamut3DModel *level = [levels objectAtIndex:i];
+        if ([level triangleCount] <= budget) return level;
+    }
+    return [levels lastObject];
+}
+
+@end
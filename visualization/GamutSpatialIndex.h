@@ -0,0 +1,55 @@
+//
+//  GamutSpatialIndex.h
+//  SmallICCer
+//
+//  Uniform-grid index over a gamut's packed Lab points for radius queries,
+//  plus an a*/b* binning of its surface triangles for point-in-gamut tests.
+//  Build once per gamut and reuse it across comparisons.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class Gamut3DModel;
+
+@interface GamutSpatialIndex : NSObject {
+    NSData *labData;          // Indexed points (3 floats each)
+    NSData *triangleData;     // Surface used by -containsPoint: (may be empty)
+
+    double origin[3];         // Lab corner of the point grid
+    double cellSize;
+    NSUInteger dims[3];
+    uint32_t *cellStart;      // Points of cell c: cellPoints[cellStart[c] .. cellStart[c + 1])
+    uint32_t *cellPoints;
+
+    double binOrigin[2];      // a*, b* corner of the triangle bins
+    double binSize;
+    NSUInteger binDims[2];
+    uint32_t *binStart;       // Triangles overlapping bin c: binTriangles[binStart[c] .. binStart[c + 1])
+    uint32_t *binTriangles;
+}
+
+// Cell size is a hint: it grows when the grid would have many more cells
+// than points. Triangles default to the convex hull of the points.
+- (id)initWithLabData:(NSData *)data triangles:(nullable NSData *)triangles cellSize:(double)size;
+
+// Index a model's points and surface (its triangles, else its convex hull)
++ (GamutSpatialIndex *)indexForGamut:(Gamut3DModel *)gamut cellSize:(double)size;
+
+@property (nonatomic, readonly) NSData *labData;
+@property (nonatomic, readonly) NSData *triangleData;
+@property (nonatomic, readonly) double cellSize;
+
+- (NSUInteger)pointCount;
+
+// Radius queries (Euclidean distance in Lab, i.e. ΔE*ab)
+- (BOOL)hasPointWithinRadius:(double)radius ofPoint:(const float *)lab;
+- (NSIndexSet *)indicesOfPointsWithinRadius:(double)radius ofPoint:(const float *)lab;
+
+// Point-in-gamut: YES when lab lies inside the indexed surface
+- (BOOL)containsPoint:(const float *)lab;
+
+@end
+
+NS_ASSUME_NONNULL_END
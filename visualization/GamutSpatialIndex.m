@@ -0,0 +1,265 @@
+//
+//  GamutSpatialIndex.m
+//  SmallICCer
+//
+//  Gamut Spatial Index implementation.
+//  Both grids are counting-sorted into flat offset/index arrays, so a build
+//  is O(n) and a radius query touches only the cells the sphere overlaps.
+//  Containment casts the L* line through the query's a*/b* against the
+//  triangles in its bin and sums the windings of the crossings below it.
+//
+
+#import "GamutSpatialIndex.h"
+#import "Gamut3DModel.h"
+#import "GamutHull.h"
+#import <math.h>
+#import <stdlib.h>
+
+// Grow the cell size until the grid has at most this many cells per point
+static const NSUInteger kMaxCellsPerPoint = 4;
+static const NSUInteger kMinCells = 4096;
+
+// Triangle bins per axis: about sqrt(triangles), so a bin holds a handful
+static const NSUInteger kMaxBinsPerAxis = 256;
+
+static NSUInteger clampCell(double v, NSUInteger dim) {
+    if (v < 0.0) return 0;
+    if (v >= (double)dim) return dim - 1;
+    return (NSUInteger)v;
+}
+
+@implementation GamutSpatialIndex
+
+@synthesize labData;
+@synthesize triangleData;
+@synthesize cellSize;
+
++ (GamutSpatialIndex *)indexForGamut:(Gamut3DModel *)gamut cellSize:(double)size {
+    return [[[self alloc] initWithLabData:[gamut labData] triangles:[gamut triangleData] cellSize:size] autorelease];
+}
+
+- (id)initWithLabData:(NSData *)data triangles:(NSData *)triangles cellSize:(double)size {
+    self = [super init];
+    if (self) {
+        labData = data ? [data copy] : [[NSData alloc] init];
+        if ([triangles length] == 0) {
+            triangles = [GamutHull convexHullTrianglesForPoints:(const float *)[labData bytes]
+                                                          count:[self pointCount]];
+        }
+        triangleData = triangles ? [triangles copy] : [[NSData alloc] init];
+        if (![self buildPointGrid:(size > 0.0 ? size : 1.0)] || ![self buildTriangleBins]) {
+            [self release];
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (NSUInteger)pointCount {
+    return [labData length] / (3 * sizeof(float));
+}
+
+- (BOOL)buildPointGrid:(double)size {
+    NSUInteger count = [self pointCount];
+    const float *pts = (const float *)[labData bytes];
+    double minP[3] = {0.0, 0.0, 0.0}, maxP[3] = {0.0, 0.0, 0.0};
+    NSUInteger i, k;
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < 3; k++) {
+            double v = pts[i * 3 + k];
+            if (i == 0 || v < minP[k]) minP[k] = v;
+            if (i == 0 || v > maxP[k]) maxP[k] = v;
+        }
+    }
+
+    NSUInteger maxCells = MAX(count * kMaxCellsPerPoint, kMinCells);
+    NSUInteger cells;
+    for (;;) {
+        cells = 1;
+        for (k = 0; k < 3; k++) {
+            dims[k] = (NSUInteger)floor((maxP[k] - minP[k]) / size) + 1;
+            cells *= dims[k];
+        }
+        if (cells <= maxCells) break;
+        size *= 1.5;
+    }
+    cellSize = size;
+    for (k = 0; k < 3; k++) origin[k] = minP[k];
+
+    cellStart = (uint32_t *)calloc(cells + 1, sizeof(uint32_t));
+    cellPoints = (uint32_t *)malloc(MAX(count, 1) * sizeof(uint32_t));
+    uint32_t *cellOfPoint = (uint32_t *)malloc(MAX(count, 1) * sizeof(uint32_t));
+    if (!cellStart || !cellPoints || !cellOfPoint) {
+        free(cellOfPoint);
+        return NO;
+    }
+
+    for (i = 0; i < count; i++) {
+        NSUInteger cx = clampCell((pts[i * 3] - origin[0]) / cellSize, dims[0]);
+        NSUInteger cy = clampCell((pts[i * 3 + 1] - origin[1]) / cellSize, dims[1]);
+        NSUInteger cz = clampCell((pts[i * 3 + 2] - origin[2]) / cellSize, dims[2]);
+        cellOfPoint[i] = (uint32_t)((cz * dims[1] + cy) * dims[0] + cx);
+        cellStart[cellOfPoint[i] + 1]++;
+    }
+    for (i = 0; i < cells; i++) {
+        cellStart[i + 1] += cellStart[i];
+    }
+    // Scatter, then restore the start offsets the scatter advanced
+    for (i = 0; i < count; i++) {
+        cellPoints[cellStart[cellOfPoint[i]]++] = (uint32_t)i;
+    }
+    for (i = cells; i > 0; i--) {
+        cellStart[i] = cellStart[i - 1];
+    }
+    cellStart[0] = 0;
+    free(cellOfPoint);
+    return YES;
+}
+
+- (BOOL)buildTriangleBins {
+    NSUInteger triangleCount = [triangleData length] / (3 * sizeof(uint32_t));
+    const uint32_t *tris = (const uint32_t *)[triangleData bytes];
+    const float *pts = (const float *)[labData bytes];
+    NSUInteger t, k, i, pass;
+
+    double minA = HUGE_VAL, maxA = -HUGE_VAL, minB = HUGE_VAL, maxB = -HUGE_VAL;
+    for (t = 0; t < triangleCount * 3; t++) {
+        const float *p = pts + (size_t)tris[t] * 3;
+        if (p[1] < minA) minA = p[1];
+        if (p[1] > maxA) maxA = p[1];
+        if (p[2] < minB) minB = p[2];
+        if (p[2] > maxB) maxB = p[2];
+    }
+    if (triangleCount == 0) {
+        minA = maxA = minB = maxB = 0.0;
+    }
+
+    NSUInteger perAxis = (NSUInteger)sqrt((double)triangleCount);
+    if (perAxis < 1) perAxis = 1;
+    if (perAxis > kMaxBinsPerAxis) perAxis = kMaxBinsPerAxis;
+    double extent = fmax(maxA - minA, maxB - minB);
+    binSize = (extent > 0.0) ? extent / (double)perAxis : 1.0;
+    binOrigin[0] = minA;
+    binOrigin[1] = minB;
+    binDims[0] = (NSUInteger)floor((maxA - minA) / binSize) + 1;
+    binDims[1] = (NSUInteger)floor((maxB - minB) / binSize) + 1;
+    NSUInteger bins = binDims[0] * binDims[1];
+
+    binStart = (uint32_t *)calloc(bins + 1, sizeof(uint32_t));
+    if (!binStart) return NO;
+
+    // Pass 0 counts bin entries from each triangle's a*/b* footprint, pass 1 fills
+    for (pass = 0; pass < 2; pass++) {
+        for (t = 0; t < triangleCount; t++) {
+            double lo[2] = {HUGE_VAL, HUGE_VAL}, hi[2] = {-HUGE_VAL, -HUGE_VAL};
+            for (k = 0; k < 3; k++) {
+                const float *p = pts + (size_t)tris[t * 3 + k] * 3;
+                if (p[1] < lo[0]) lo[0] = p[1];
+                if (p[1] > hi[0]) hi[0] = p[1];
+                if (p[2] < lo[1]) lo[1] = p[2];
+                if (p[2] > hi[1]) hi[1] = p[2];
+            }
+            NSUInteger a0 = clampCell((lo[0] - binOrigin[0]) / binSize, binDims[0]);
+            NSUInteger a1 = clampCell((hi[0] - binOrigin[0]) / binSize, binDims[0]);
+            NSUInteger b0 = clampCell((lo[1] - binOrigin[1]) / binSize, binDims[1]);
+            NSUInteger b1 = clampCell((hi[1] - binOrigin[1]) / binSize, binDims[1]);
+            NSUInteger ba, bb;
+            for (bb = b0; bb <= b1; bb++) {
+                for (ba = a0; ba <= a1; ba++) {
+                    NSUInteger bin = bb * binDims[0] + ba;
+                    if (pass == 0) binStart[bin + 1]++;
+                    else binTriangles[binStart[bin]++] = (uint32_t)t;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (i = 0; i < bins; i++) {
+                binStart[i + 1] += binStart[i];
+            }
+            binTriangles = (uint32_t *)malloc(MAX(binStart[bins], 1) * sizeof(uint32_t));
+            if (!binTriangles) return NO;
+        }
+    }
+    for (i = bins; i > 0; i--) {
+        binStart[i] = binStart[i - 1];
+    }
+    binStart[0] = 0;
+    return YES;
+}
+
+// Visit the points within radius of lab. Stops at the first hit when result is nil.
+- (BOOL)scanRadius:(double)radius ofPoint:(const float *)lab into:(NSMutableIndexSet *)result {
+    if ([self pointCount] == 0 || radius < 0.0) return NO;
+    const float *pts = (const float *)[labData bytes];
+    NSUInteger lo[3], hi[3], k;
+    for (k = 0; k < 3; k++) {
+        double low = (lab[k] - radius - origin[k]) / cellSize;
+        double high = (lab[k] + radius - origin[k]) / cellSize;
+        if (high < 0.0 || low >= (double)dims[k]) return NO;
+        lo[k] = clampCell(low, dims[k]);
+        hi[k] = clampCell(high, dims[k]);
+    }
+    double r2 = radius * radius;
+    BOOL found = NO;
+    NSUInteger cx, cy, cz, j;
+    for (cz = lo[2]; cz <= hi[2]; cz++) {
+        for (cy = lo[1]; cy <= hi[1]; cy++) {
+            for (cx = lo[0]; cx <= hi[0]; cx++) {
+                NSUInteger cell = (cz * dims[1] + cy) * dims[0] + cx;
+                for (j = cellStart[cell]; j < cellStart[cell + 1]; j++) {
+                    const float *p = pts + (size_t)cellPoints[j] * 3;
+                    double dl = p[0] - lab[0], da = p[1] - lab[1], db = p[2] - lab[2];
+                    if (dl * dl + da * da + db * db <= r2) {
+                        if (!result) return YES;
+                        [result addIndex:cellPoints[j]];
+                        found = YES;
+                    }
+                }
+            }
+        }
+    }
+    return found;
+}
+
+- (BOOL)hasPointWithinRadius:(double)radius ofPoint:(const float *)lab {
+    return [self scanRadius:radius ofPoint:lab into:nil];
+}
+
+- (NSIndexSet *)indicesOfPointsWithinRadius:(double)radius ofPoint:(const float *)lab {
+    NSMutableIndexSet *result = [NSMutableIndexSet indexSet];
+    [self scanRadius:radius ofPoint:lab into:result];
+    return result;
+}
+
+- (BOOL)containsPoint:(const float *)lab {
+    double ba = (lab[1] - binOrigin[0]) / binSize;
+    double bb = (lab[2] - binOrigin[1]) / binSize;
+    if (ba < 0.0 || bb < 0.0 || ba >= (double)binDims[0] || bb >= (double)binDims[1]) return NO;
+    NSUInteger bin = (NSUInteger)bb * binDims[0] + (NSUInteger)ba;
+
+    const float *pts = (const float *)[labData bytes];
+    const uint32_t *tris = (const uint32_t *)[triangleData bytes];
+    int inside = 0;
+    NSUInteger j;
+    for (j = binStart[bin]; j < binStart[bin + 1]; j++) {
+        float l;
+        int winding;
+        if (GamutHullColumnCrossing(pts, tris + (size_t)binTriangles[j] * 3, lab[1], lab[2], &l, &winding) &&
+            l <= lab[0]) {
+            inside += winding;
+        }
+    }
+    return inside > 0;
+}
+
+- (void)dealloc {
+    free(cellStart);
+    free(cellPoints);
+    free(binStart);
+    free(binTriangles);
+    [labData release];
+    [triangleData release];
+    [super dealloc];
+}
+
+@end
@@ -0,0 +1,87 @@
+//
+//  ImageGamutAnalyzer.h
+//  SmallICCer
+//
+//  Bins an image's pixels into a Lab voxel histogram and counts the pixels
+//  that fall outside a gamut. Pixels are fed in bands of rows. Each band is
+//  converted to Lab and binned in parallel, then dropped, so memory stays
+//  the same however large the image is.
+//
+
+#import <Foundation/Foundation.h>
+#import "ImageTransformEngine.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ICCProfile;
+@class Gamut3DModel;
+@class GamutSpatialIndex;
+
+// Heat levels of the out-of-gamut overlay
+extern const NSUInteger kImageGamutHeatLevels;
+
+@interface ImageGamutAnalyzer : NSObject {
+    ImageTransformEngine *engine;   // Image pixels → D50 Lab
+    GamutSpatialIndex *gamutIndex;  // Point-in-gamut tests
+    double binSize;
+    NSUInteger dims[3];             // Histogram voxels along L*, a*, b*
+    uint64_t *histogram;            // Pixels per voxel
+    uint64_t *outsideHistogram;     // Out-of-gamut pixels per voxel
+    uint8_t *classification;        // Per 1 ΔE cell: 0 unknown, 1 inside, 2 outside
+    float *labBand;                 // Lab scratch for one band
+    uint32_t *voxelKeys;            // Voxel of each band pixel, high bit when outside
+    NSUInteger labCapacity;         // Pixels labBand and voxelKeys hold
+    NSUInteger workerCount;
+    uint64_t totalPixels;
+    uint64_t outsidePixels;
+}
+
+// sRGB, for images that carry no profile (nil without LittleCMS)
++ (nullable ICCProfile *)defaultImageProfile;
+
+// Pixels in pixelFormat (RGB or CMYK) described by imageProfile, tested
+// against gamut's surface (its triangles, else its convex hull). binSize is
+// the histogram voxel edge in ΔE (0 = default 4), clamped to 1-64.
+- (nullable id)initWithImageProfile:(ICCProfile *)imageProfile
+                        pixelFormat:(ImagePixelFormat)pixelFormat
+                              gamut:(Gamut3DModel *)gamut
+                            binSize:(double)size
+                              error:(NSError **)error;
+
+// Concurrent workers per band (0 = one per active core, the default)
+@property (nonatomic) NSUInteger workerCount;
+
+@property (nonatomic, readonly) double binSize;
+@property (nonatomic, readonly) uint64_t totalPixels;
+@property (nonatomic, readonly) uint64_t outsidePixels;
+
+// Add the next rows of the image; call repeatedly to stream an image through
+- (BOOL)addPixels:(const void *)pixels
+         rowBytes:(NSUInteger)rowBytes
+            width:(NSUInteger)width
+           height:(NSUInteger)height
+            error:(NSError **)error;
+
+// Forget everything added so far
+- (void)reset;
+
+// outsidePixels / totalPixels (0 before any pixels)
+- (double)outsideFraction;
+
+// Voxel counts, L* slowest then a* then b*: voxel (l, a, b) covers
+// L* from l * binSize, a* and b* from -128 + index * binSize
+- (void)getHistogramDimensions:(NSUInteger *)dimensions; // 3 values
+- (const uint64_t *)histogram;
+- (const uint64_t *)outsideHistogram;
+
+// Pixels per L* bin summed over a* and b* (dims[0] values)
+- (NSData *)lightnessHistogram;
+
+// Centers of voxels holding out-of-gamut pixels, split by pixel count into
+// kImageGamutHeatLevels models (coolest first, log scale) colored for drawing
+// over the gamut. Empty levels are left out.
+- (NSArray *)heatOverlayModels;
+
+@end
+
+NS_ASSUME_NONNULL_END
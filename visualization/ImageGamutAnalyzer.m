@@ -0,0 +1,380 @@
+//
+//  ImageGamutAnalyzer.m
+//  SmallICCer
+//
+//  Image Gamut Analyzer implementation.
+//  Each band goes through the ImageTransformEngine into a reused Lab
+//  buffer. The band is then split into slices, and one operation per slice
+//  writes each pixel's voxel (flagged when out of gamut) into a reused key
+//  buffer; the keys are added to the 64-bit totals afterwards. Workers need
+//  no histograms of their own, so their memory does not grow with the voxel
+//  count. Point-in-gamut results are cached per 1 ΔE cell: a
+//  cell is tested once, at its center, and every later pixel that lands in
+//  it is a table lookup. Results are then exact to within the cell size.
+//
+
+#import "ImageGamutAnalyzer.h"
+#import "ICCProfile.h"
+#import "ICCParser.h"
+#import "Gamut3DModel.h"
+#import "GamutSpatialIndex.h"
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
+
+#ifdef HAVE_LCMS
+#include <lcms2.h>
+#endif
+
+const NSUInteger kImageGamutHeatLevels = 4;
+
+// Lab scratch per band: 12 MB
+static const NSUInteger kAnalyzerBandPixels = 1 << 20;
+
+// Below this many pixels a band is binned on the calling thread
+static const NSUInteger kAnalyzerParallelMinPixels = 65536;
+
+static const double kDefaultBinSize = 4.0;
+
+// Set in a pixel's voxel key when it is out of gamut (1 ΔE bins need 23 bits)
+static const uint32_t kVoxelOutside = 0x80000000u;
+
+// Two histograms of 8-byte voxels: 1 ΔE bins already take 106 MB. The upper
+// bound keeps at least a few bins along a* and b*.
+static const double kMinBinSize = 1.0;
+static const double kMaxBinSize = 64.0;
+
+// Classification cells: L* [0, 100] in 100 cells (100 folds into the top
+// one, so white tests just below the white point), a*/b* [-128, 128) in 256
+static const NSUInteger kCellsL = 100;
+static const NSUInteger kCellsAB = 256;
+
+// Overlay colors, coolest (fewest pixels) first
+static const float kHeatColors[4][3] = {
+    {0.2f, 0.4f, 1.0f},
+    {0.0f, 0.9f, 0.9f},
+    {1.0f, 0.9f, 0.0f},
+    {1.0f, 1.0f, 1.0f}
+};
+
+static NSUInteger clampBin(double v, NSUInteger dim) {
+    // !(v >= 0) also catches NaN
+    if (!(v >= 0.0)) return 0;
+    if (v >= (double)dim) return dim - 1;
+    return (NSUInteger)v;
+}
+
+// Out-of-range Lab (including NaN) is outside every gamut. Workers that
+// miss on the same cell store the same state, so the race is harmless.
+static BOOL labIsOutside(GamutSpatialIndex *index, uint8_t *cells, const float *lab) {
+    if (!(lab[0] >= 0.0f && lab[0] <= 100.0f && lab[1] >= -128.0f && lab[1] < 128.0f &&
+          lab[2] >= -128.0f && lab[2] < 128.0f)) {
+        return YES;
+    }
+    NSUInteger l = MIN((NSUInteger)lab[0], kCellsL - 1);
+    NSUInteger a = (NSUInteger)(lab[1] + 128.0f);
+    NSUInteger b = (NSUInteger)(lab[2] + 128.0f);
+    NSUInteger cell = (l * kCellsAB + a) * kCellsAB + b;
+    uint8_t state = cells[cell];
+    if (state == 0) {
+        float center[3] = {(float)l + 0.5f, (float)a - 127.5f, (float)b - 127.5f};
+        state = [index containsPoint:center] ? 1 : 2;
+        cells[cell] = state;
+    }
+    return state == 2;
+}
+
+// Keys one slice of a Lab band by voxel
+@interface ImageBinOperation : NSOperation {
+@public
+    GamutSpatialIndex *index;
+    uint8_t *cells;
+    const float *lab;
+    uint32_t *keys;
+    NSUInteger count;
+    double binSize;
+    NSUInteger dims[3];
+    uint64_t outsideTotal;
+}
+@end
+
+@implementation ImageBinOperation
+
+- (void)main {
+    double scale = 1.0 / binSize;
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        const float *p = lab + i * 3;
+        uint32_t key = (uint32_t)((clampBin(p[0] * scale, dims[0]) * dims[1] +
+                                   clampBin((p[1] + 128.0) * scale, dims[1])) * dims[2] +
+                                  clampBin((p[2] + 128.0) * scale, dims[2]));
+        if (labIsOutside(index, cells, p)) {
+            key |= kVoxelOutside;
+            outsideTotal++;
+        }
+        keys[i] = key;
+    }
+}
+
+@end
+
+@implementation ImageGamutAnalyzer
+
+@synthesize workerCount;
+@synthesize binSize;
+@synthesize totalPixels;
+@synthesize outsidePixels;
+
++ (ICCProfile *)defaultImageProfile {
+#ifdef HAVE_LCMS
+    cmsHPROFILE hProfile = cmsCreate_sRGBProfile();
+    cmsUInt32Number size = 0;
+    NSMutableData *data = nil;
+    if (hProfile && cmsSaveProfileToMem(hProfile, NULL, &size)) {
+        data = [NSMutableData dataWithLength:size];
+        if (!cmsSaveProfileToMem(hProfile, [data mutableBytes], &size)) data = nil;
+    }
+    if (hProfile) cmsCloseProfile(hProfile);
+    if (!data) return nil;
+    ICCParser *parser = [[ICCParser alloc] init];
+    [parser setLazyTagDecoding:YES];
+    ICCProfile *profile = [parser parseProfileFromData:data error:NULL];
+    [parser release];
+    return profile;
+#else
+    return nil;
+#endif
+}
+
+- (id)initWithImageProfile:(ICCProfile *)imageProfile
+               pixelFormat:(ImagePixelFormat)pixelFormat
+                     gamut:(Gamut3DModel *)gamut
+                   binSize:(double)size
+                     error:(NSError **)error {
+    self = [super init];
+    if (!self) return nil;
+    binSize = (size > 0.0) ? MIN(MAX(size, kMinBinSize), kMaxBinSize) : kDefaultBinSize;
+    dims[0] = (NSUInteger)floor(100.0 / binSize) + 1;
+    dims[1] = (NSUInteger)ceil(256.0 / binSize);
+    dims[2] = dims[1];
+
+    // Relative colorimetric, like the lattices GamutCalculator builds gamuts from
+    engine = [[ImageTransformEngine alloc] initWithSourceProfile:imageProfile
+                                              destinationProfile:nil
+                                                    proofProfile:nil
+                                                     inputFormat:pixelFormat
+                                                    outputFormat:ImagePixelFormatLabFloat
+                                                          intent:1
+                                                           error:error];
+    gamutIndex = [[GamutSpatialIndex indexForGamut:gamut cellSize:binSize] retain];
+    NSUInteger voxels = dims[0] * dims[1] * dims[2];
+    histogram = (uint64_t *)calloc(voxels, sizeof(uint64_t));
+    outsideHistogram = (uint64_t *)calloc(voxels, sizeof(uint64_t));
+    classification = (uint8_t *)calloc(kCellsL * kCellsAB * kCellsAB, 1);
+
+    NSString *failure = nil;
+    if (!engine) {
+        [self release];
+        return nil;
+    } else if (!gamutIndex || [gamutIndex pointCount] < 4) {
+        failure = @"The gamut has no surface to test against";
+    } else if (!histogram || !outsideHistogram || !classification) {
+        failure = @"Failed to allocate memory";
+    }
+    if (failure) {
+        if (error) {
+            *error = [NSError errorWithDomain:@"SmallICCer"
+                                         code:1
+                                     userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                               failure, NSLocalizedDescriptionKey, nil]];
+        }
+        [self release];
+        return nil;
+    }
+    return self;
+}
+
+- (void)setWorkerCount:(NSUInteger)count {
+    workerCount = count;
+    [engine setWorkerCount:count];
+}
+
+- (void)reset {
+    NSUInteger voxels = dims[0] * dims[1] * dims[2];
+    memset(histogram, 0, voxels * sizeof(uint64_t));
+    memset(outsideHistogram, 0, voxels * sizeof(uint64_t));
+    totalPixels = 0;
+    outsidePixels = 0;
+}
+
+- (void)binLab:(const float *)lab count:(NSUInteger)count {
+    NSUInteger workers = workerCount ? workerCount : [[NSProcessInfo processInfo] activeProcessorCount];
+    NSUInteger slices = (count < kAnalyzerParallelMinPixels || workers < 2) ? 1 : workers;
+    NSMutableArray *operations = [NSMutableArray arrayWithCapacity:slices];
+    NSUInteger slice, first = 0;
+    for (slice = 0; slice < slices; slice++) {
+        NSUInteger n = count / slices + ((slice < count % slices) ? 1 : 0);
+        ImageBinOperation *op = [[ImageBinOperation alloc] init];
+        op->index = gamutIndex;
+        op->cells = classification;
+        op->lab = lab + first * 3;
+        op->keys = voxelKeys + first;
+        op->count = n;
+        op->binSize = binSize;
+        op->dims[0] = dims[0];
+        op->dims[1] = dims[1];
+        op->dims[2] = dims[2];
+        [operations addObject:op];
+        [op release];
+        first += n;
+    }
+
+    if (slices == 1) {
+        [[operations objectAtIndex:0] start];
+    } else {
+        NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+        [queue setMaxConcurrentOperationCount:(NSInteger)workers];
+        [queue addOperations:operations waitUntilFinished:YES];
+        [queue release];
+    }
+
+    NSUInteger i;
+    for (i = 0; i < count; i++) {
+        uint32_t key = voxelKeys[i];
+        uint32_t voxel = key & ~kVoxelOutside;
+        histogram[voxel]++;
+        if (key & kVoxelOutside) outsideHistogram[voxel]++;
+    }
+    for (i = 0; i < slices; i++) {
+        outsidePixels += ((ImageBinOperation *)[operations objectAtIndex:i])->outsideTotal;
+    }
+    totalPixels += count;
+}
+
+- (BOOL)addPixels:(const void *)pixels
+         rowBytes:(NSUInteger)rowBytes
+            width:(NSUInteger)width
+           height:(NSUInteger)height
+            error:(NSError **)error {
+    if (width == 0 || height == 0) return YES;
+    NSUInteger rows = MAX(kAnalyzerBandPixels / width, (NSUInteger)1);
+    NSUInteger bandPixels = MIN(rows, height) * width;
+    if (bandPixels > labCapacity) {
+        float *grown = (float *)realloc(labBand, bandPixels * 3 * sizeof(float));
+        if (grown) labBand = grown;
+        uint32_t *grownKeys = (uint32_t *)realloc(voxelKeys, bandPixels * sizeof(uint32_t));
+        if (grownKeys) voxelKeys = grownKeys;
+        if (!grown || !grownKeys) {
+            if (error) {
+                *error = [NSError errorWithDomain:@"SmallICCer"
+                                             code:1
+                                         userInfo:[NSDictionary dictionaryWithObjectsAndKeys:
+                                                   @"Failed to allocate memory", NSLocalizedDescriptionKey, nil]];
+            }
+            return NO;
+        }
+        labCapacity = bandPixels;
+    }
+
+    NSUInteger row;
+    for (row = 0; row < height; row += rows) {
+        NSUInteger n = MIN(rows, height - row);
+        if (![engine transformPixels:(const uint8_t *)pixels + row * rowBytes
+                       inputRowBytes:rowBytes
+                            toPixels:labBand
+                      outputRowBytes:width * 3 * sizeof(float)
+                               width:width
+                              height:n
+                               error:error]) {
+            return NO;
+        }
+        [self binLab:labBand count:width * n];
+    }
+    return YES;
+}
+
+- (double)outsideFraction {
+    return totalPixels ? (double)outsidePixels / (double)totalPixels : 0.0;
+}
+
+- (void)getHistogramDimensions:(NSUInteger *)dimensions {
+    dimensions[0] = dims[0];
+    dimensions[1] = dims[1];
+    dimensions[2] = dims[2];
+}
+
+- (const uint64_t *)histogram {
+    return histogram;
+}
+
+- (const uint64_t *)outsideHistogram {
+    return outsideHistogram;
+}
+
+- (NSData *)lightnessHistogram {
+    NSMutableData *data = [NSMutableData dataWithLength:dims[0] * sizeof(uint64_t)];
+    uint64_t *sums = (uint64_t *)[data mutableBytes];
+    NSUInteger plane = dims[1] * dims[2];
+    NSUInteger l, v;
+    for (l = 0; l < dims[0]; l++) {
+        for (v = 0; v < plane; v++) {
+            sums[l] += histogram[l * plane + v];
+        }
+    }
+    return data;
+}
+
+- (NSArray *)heatOverlayModels {
+    NSUInteger voxels = dims[0] * dims[1] * dims[2];
+    uint64_t maxCount = 0;
+    NSUInteger v, level;
+    for (v = 0; v < voxels; v++) {
+        if (outsideHistogram[v] > maxCount) maxCount = outsideHistogram[v];
+    }
+    NSMutableArray *models = [NSMutableArray array];
+    if (maxCount == 0) return models;
+
+    NSMutableData *levels[kImageGamutHeatLevels];
+    for (level = 0; level < kImageGamutHeatLevels; level++) {
+        levels[level] = [NSMutableData data];
+    }
+    double logMax = log1p((double)maxCount);
+    for (v = 0; v < voxels; v++) {
+        uint64_t c = outsideHistogram[v];
+        if (c == 0) continue;
+        level = (NSUInteger)((double)kImageGamutHeatLevels * log1p((double)c) / logMax);
+        if (level >= kImageGamutHeatLevels) level = kImageGamutHeatLevels - 1;
+        NSUInteger l = v / (dims[1] * dims[2]);
+        NSUInteger a = (v / dims[2]) % dims[1];
+        NSUInteger b = v % dims[2];
+        float center[3] = {
+            (float)(((double)l + 0.5) * binSize),
+            (float)(-128.0 + ((double)a + 0.5) * binSize),
+            (float)(-128.0 + ((double)b + 0.5) * binSize)
+        };
+        [levels[level] appendBytes:center length:sizeof(center)];
+    }
+    for (level = 0; level < kImageGamutHeatLevels; level++) {
+        if ([levels[level] length] == 0) continue;
+        NSString *name = [NSString stringWithFormat:@"Out of gamut (%lu/%lu)",
+                          (unsigned long)(level + 1), (unsigned long)kImageGamutHeatLevels];
+        Gamut3DModel *model = [[Gamut3DModel alloc] initWithLabData:levels[level] triangles:nil name:name];
+        [model setColorRed:kHeatColors[level][0] green:kHeatColors[level][1] blue:kHeatColors[level][2]];
+        [models addObject:model];
+        [model release];
+    }
+    return models;
+}
+
+- (void)dealloc {
+    [engine release];
+    [gamutIndex release];
+    free(histogram);
+    free(outsideHistogram);
+    free(classification);
+    free(labBand);
+    free(voxelKeys);
+    [super dealloc];
+}
+
+@end
@@ -4,6 +4,15 @@
 //
 //  OpenGL rendering backend
 //
+//  With GL 3.3 and the shaders/simple.vert and simple.frag sources, each
+//  model is uploaded once into its own VAO/VBO and redrawn from there until
+//  it is removed or its revision changes. Without them, drawing falls back
+//  to the fixed-function pipeline. Models with triangles are drawn as
+//  shaded, translucent surfaces with wireframes, at a level of detail picked
+//  from the zoom and rendering quality (see GamutMeshLOD).
+//  Headless, it renders into an EGL pbuffer (builds with HAVE_EGL), so it
+//  also runs on software rasterizers such as llvmpipe.
+//
 
 #import "RenderBackend.h"
 #import <AppKit/AppKit.h>
@@ -19,6 +28,27 @@ NS_ASSUME_NONNULL_BEGIN
     float viewportWidth, viewportHeight;
     float backgroundRed, backgroundGreen, backgroundBlue;
     NSInteger renderingQuality;
+    BOOL programAttempted;         // Shader build tried (needs the context current)
+    unsigned int program;          // GLuint, 0 = fixed-function fallback
+    int mvpLocation;               // GLint uniform locations
+    int instanceStepLocation;
+    int alphaLocation;
+    int shadingLocation;
+    NSMutableArray *modelSlots;    // OpenGLModelSlot per uploaded model
+    BOOL labSpaceDirty;            // Axes/grid buffers need rebuilding
+    unsigned int axesVAO, axesVBO;
+    unsigned int gridVAO, gridVBO;
+    int axesCount;
+    int gridCount;                 // Points per instance
+    int gridInstances;             // Equal L* planes drawn from one plane
+    float gridStep[3];             // Offset between grid instances
+    void *eglDisplay;              // EGLDisplay, EGLSurface and EGLContext of
+    void *eglSurface;              // the offscreen pbuffer (instead of
+    void *eglContext;              // glContext when headless)
+    unsigned int timerQueries[2];  // GL_TIME_ELAPSED, alternating frames
+    BOOL timerPending[2];          // Query ended, result not read yet
+    NSUInteger frameIndex;
+    double lastGPUTime;            // Seconds, negative until measured
 }
 
 @end
@@ -4,28 +4,226 @@
 //
 //  OpenGL backend implementation
 //
+//  The retained path uploads the packed Lab buffer of each model straight
+//  into a VBO (the model color is a constant vertex attribute, so nothing is
+//  interleaved or converted). Slots are matched to models by identity and
+//  geometry revision on every render, so the clear-and-re-add that
+//  GamutViewPanel does on each change re-uploads only new or reshaped
+//  models. Colors are read at draw time, so recoloring uploads nothing. The
+//  Lab grid is a stack of equal a*b* planes; it is drawn as one plane
+//  instanced per L* level.
+//  Meshed models upload every level of detail with the model and draw as a
+//  wireframe plus a translucent surface. The level is picked per frame from
+//  the zoom and rendering quality, so switching levels uploads nothing.
+//
 
 #import "OpenGLBackend.h"
 #import "Gamut3DModel.h"
 #import "CIELABSpaceModel.h"
+#import "GamutMeshLOD.h"
 #import <math.h>
+#import <string.h>
 
 #if defined(__APPLE__) && !defined(__GNUSTEP__)
+#define GL_DO_NOT_WARN_IF_MULTI_GL_VERSION_HEADERS_INCLUDED
 #import <OpenGL/gl.h>
+#import <OpenGL/gl3.h>
 #import <OpenGL/glu.h>
 #define HAVE_OPENGL 1
 #elif defined(__GNUSTEP__) || defined(__linux__)
+#define GL_GLEXT_PROTOTYPES 1
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/glu.h>
 #define HAVE_OPENGL 1
 #endif
 
+#if HAVE_OPENGL && defined(HAVE_EGL)
+#include <EGL/egl.h>
+#endif
+
+// Vertex attribute locations fixed by the shader layout qualifiers
+enum { kAttribPosition = 0, kAttribColor = 1 };
+
+// Opacity of gamut surfaces and of their wireframes
+static const float kSurfaceAlpha = 0.35f;
+static const float kWireframeAlpha = 0.6f;
+
+#if HAVE_OPENGL
+// The model's own mesh plus its levels of detail
+enum { kMaxSlotMeshes = 6 };
+
+typedef struct {
+    GLuint vao;
+    GLuint vbo;
+    GLuint ibo;
+    GLsizei pointCount;
+    GLsizei indexCount;
+} OpenGLMesh;
+
+// One model's GPU copy: packed Lab points and triangle indices of each level
+@interface OpenGLModelSlot : NSObject {
+@public
+    Gamut3DModel *model;
+    NSUInteger revision;
+    NSArray *meshes;              // model, then its levelsOfDetail
+    OpenGLMesh buffers[kMaxSlotMeshes];
+}
+- (id)initWithModel:(Gamut3DModel *)m;
+- (OpenGLMesh *)bufferForMesh:(Gamut3DModel *)mesh;
+- (void)deleteBuffers;
+@end
+
+@implementation OpenGLModelSlot
+
+- (id)initWithModel:(Gamut3DModel *)m {
+    self = [super init];
+    if (self) {
+        model = [m retain];
+        revision = [m revision];
+        NSMutableArray *all = [NSMutableArray arrayWithObject:m];
+        NSArray *levels = [m levelsOfDetail];
+        NSUInteger i;
+        for (i = 0; i < [levels count] && [all count] < kMaxSlotMeshes; i++) {
+            [all addObject:[levels objectAtIndex:i]];
+        }
+        meshes = [all copy];
+
+        for (i = 0; i < [meshes count]; i++) {
+            Gamut3DModel *mesh = [meshes objectAtIndex:i];
+            OpenGLMesh *b = &buffers[i];
+            b->pointCount = (GLsizei)[mesh pointCount];
+            b->indexCount = (GLsizei)([mesh triangleCount] * 3);
+
+            glGenVertexArrays(1, &b->vao);
+            glBindVertexArray(b->vao);
+            glGenBuffers(1, &b->vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+            glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(b->pointCount * 3 * sizeof(float)), [mesh labPoints], GL_STATIC_DRAW);
+            glEnableVertexAttribArray(kAttribPosition);
+            glVertexAttribPointer(kAttribPosition, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+            if (b->indexCount > 0) {
+                // Element buffer binding is VAO state
+                glGenBuffers(1, &b->ibo);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, b->ibo);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(b->indexCount * sizeof(uint32_t)),
+                             [mesh triangleIndices], GL_STATIC_DRAW);
+            }
+        }
+        glBindVertexArray(0);
+    }
+    return self;
+}
+
+- (OpenGLMesh *)bufferForMesh:(Gamut3DModel *)mesh {
+    NSUInteger i = [meshes indexOfObjectIdenticalTo:mesh];
+    return (i == NSNotFound) ? &buffers[0] : &buffers[i];
+}
+
+// Needs the owning context current
+- (void)deleteBuffers {
+    NSUInteger i;
+    for (i = 0; i < kMaxSlotMeshes; i++) {
+        OpenGLMesh *b = &buffers[i];
+        if (b->ibo) glDeleteBuffers(1, &b->ibo);
+        if (b->vbo) glDeleteBuffers(1, &b->vbo);
+        if (b->vao) glDeleteVertexArrays(1, &b->vao);
+        b->ibo = b->vbo = b->vao = 0;
+    }
+}
+
+- (void)dealloc {
+    [model release];
+    [meshes release];
+    [super dealloc];
+}
+
+@end
+
+// Shader source from the app resources (or the source tree when run from
+// it), retargeted from Vulkan GLSL 4.50 to GLSL 3.30 core
+static NSString *shaderSourceNamed(NSString *name) {
+    NSString *path = [[NSBundle mainBundle] pathForResource:name ofType:nil];
+    if (!path) path = [@"shaders" stringByAppendingPathComponent:name];
+    NSString *source = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+    if (!source || ![source hasPrefix:@"#version"]) return nil;
+    NSRange versionLine = [source lineRangeForRange:NSMakeRange(0, 0)];
+    return [source stringByReplacingCharactersInRange:versionLine
+                                           withString:@"#version 330 core\n#define SMALLICCER_GL 1\n"];
+}
+
+static GLuint compileShader(GLenum type, NSString *name) {
+    NSString *source = shaderSourceNamed(name);
+    if (!source) {
+        NSLog(@"OpenGL: shader %@ not found", name);
+        return 0;
+    }
+    const GLchar *text = [source UTF8String];
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLchar log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        NSLog(@"OpenGL: failed to compile %@: %s", name, log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Pack NSNumber triples into a VAO/VBO; returns the point count
+static GLsizei uploadPoints(NSArray *points, GLuint *vao, GLuint *vbo, float **packedOut) {
+    NSData *packed = [Gamut3DModel labDataFromVertices:points];
+    GLsizei count = (GLsizei)([packed length] / (3 * sizeof(float)));
+    if (!*vao) glGenVertexArrays(1, vao);
+    if (!*vbo) glGenBuffers(1, vbo);
+    glBindVertexArray(*vao);
+    glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)[packed length], [packed bytes], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(kAttribPosition);
+    glVertexAttribPointer(kAttribPosition, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)0);
+    glBindVertexArray(0);
+    if (packedOut) {
+        *packedOut = (float *)malloc([packed length] ? [packed length] : 1);
+        memcpy(*packedOut, [packed bytes], [packed length]);
+    }
+    return count;
+}
+
+// Points made of equal planes stacked at a constant offset: the number of
+// planes (1 when the points are not laid out that way) and the offset
+static int stackedPlanes(const float *p, GLsizei count, float *step) {
+    GLsizei plane = 0, i;
+    while (plane < count && p[plane * 3] == p[0]) plane++;
+    if (plane == 0 || plane == count || count % plane) return 1;
+    step[0] = p[plane * 3] - p[0];
+    step[1] = p[plane * 3 + 1] - p[1];
+    step[2] = p[plane * 3 + 2] - p[2];
+    for (i = plane; i < count; i++) {
+        const float *a = p + i * 3, *b = p + (i - plane) * 3;
+        if (fabsf(a[0] - b[0] - step[0]) > 1e-4f || fabsf(a[1] - b[1] - step[1]) > 1e-4f ||
+            fabsf(a[2] - b[2] - step[2]) > 1e-4f) {
+            return 1;
+        }
+    }
+    return (int)(count / plane);
+}
+
+@interface OpenGLBackend (Retained)
+- (void)deleteRetainedObjects;
+@end
+#endif
+
 @implementation OpenGLBackend
 
 - (id)init {
     self = [super init];
     if (self) {
         gamutModels = [[NSMutableArray alloc] init];
+        modelSlots = [[NSMutableArray alloc] init];
         rotationX = 0.0;
         rotationY = 0.0;
         zoom = 1.0;
@@ -35,6 +233,8 @@
         backgroundGreen = 0.1f;
         backgroundBlue = 0.1f;
         renderingQuality = 1; // medium
+        labSpaceDirty = YES;
+        lastGPUTime = -1.0;
     }
     return self;
 }
@@ -50,45 +250,349 @@
     return NO;
 }
 
+- (BOOL)initializeOffscreenWithWidth:(NSUInteger)width height:(NSUInteger)height {
+#if HAVE_OPENGL && defined(HAVE_EGL)
+    if (width == 0 || height == 0 || glContext || eglContext) return NO;
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        NSLog(@"OpenGL: no EGL display for offscreen rendering");
+        return NO;
+    }
+    eglDisplay = display;
+
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0 ||
+        !eglBindAPI(EGL_OPENGL_API)) {
+        NSLog(@"OpenGL: no EGL pbuffer config for desktop GL");
+        return NO;
+    }
+    const EGLint surfaceAttributes[] = {EGL_WIDTH, (EGLint)width, EGL_HEIGHT, (EGLint)height, EGL_NONE};
+    eglSurface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+    if (eglSurface == EGL_NO_SURFACE) {
+        eglSurface = NULL;
+        NSLog(@"OpenGL: failed to create EGL pbuffer: 0x%x", eglGetError());
+        return NO;
+    }
+
+    // A 3.3 compatibility context runs both the shader and the fixed-function
+    // path; any context the driver offers will do otherwise
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    }
+    if (context == EGL_NO_CONTEXT) {
+        NSLog(@"OpenGL: failed to create EGL context: 0x%x", eglGetError());
+        return NO;
+    }
+    eglContext = context;
+    if (!eglMakeCurrent(display, eglSurface, eglSurface, context)) {
+        NSLog(@"OpenGL: failed to make EGL context current: 0x%x", eglGetError());
+        return NO;
+    }
+    viewportWidth = (float)width;
+    viewportHeight = (float)height;
+    glViewport(0, 0, (GLsizei)width, (GLsizei)height);
+    return YES;
+#else
+    return NO;
+#endif
+}
+
+- (BOOL)makeContextCurrent {
+#if HAVE_OPENGL
+    if (glContext) {
+        [glContext makeCurrentContext];
+        return YES;
+    }
+#if defined(HAVE_EGL)
+    if (eglContext) {
+        return eglMakeCurrent((EGLDisplay)eglDisplay, (EGLSurface)eglSurface, (EGLSurface)eglSurface,
+                              (EGLContext)eglContext) == EGL_TRUE;
+    }
+#endif
+#endif
+    return NO;
+}
+
+- (void)presentFrame {
+#if HAVE_OPENGL
+    if (glContext) {
+        [glContext flushBuffer];
+    } else {
+        // Nothing to show a pbuffer on; just get the commands going
+        glFlush();
+    }
+#endif
+}
+
 - (void)shutdown {
+#if HAVE_OPENGL
+    if ([self makeContextCurrent]) {
+        [self deleteRetainedObjects];
+    }
+#if defined(HAVE_EGL)
+    if (eglDisplay) {
+        eglMakeCurrent((EGLDisplay)eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglContext) eglDestroyContext((EGLDisplay)eglDisplay, (EGLContext)eglContext);
+        if (eglSurface) eglDestroySurface((EGLDisplay)eglDisplay, (EGLSurface)eglSurface);
+        eglTerminate((EGLDisplay)eglDisplay);
+    }
+#endif
+#endif
+    eglContext = NULL;
+    eglSurface = NULL;
+    eglDisplay = NULL;
     [gamutModels removeAllObjects];
     [glContext release];
     glContext = nil;
 }
 
+#if HAVE_OPENGL
+- (void)deleteRetainedObjects {
+    NSUInteger i;
+    for (i = 0; i < [modelSlots count]; i++) {
+        [[modelSlots objectAtIndex:i] deleteBuffers];
+    }
+    [modelSlots removeAllObjects];
+    if (axesVBO) glDeleteBuffers(1, &axesVBO);
+    if (axesVAO) glDeleteVertexArrays(1, &axesVAO);
+    if (gridVBO) glDeleteBuffers(1, &gridVBO);
+    if (gridVAO) glDeleteVertexArrays(1, &gridVAO);
+    axesVBO = axesVAO = gridVBO = gridVAO = 0;
+    if (timerQueries[0]) glDeleteQueries(2, timerQueries);
+    timerQueries[0] = timerQueries[1] = 0;
+    timerPending[0] = timerPending[1] = NO;
+    if (program) glDeleteProgram(program);
+    program = 0;
+    programAttempted = NO;
+    labSpaceDirty = YES;
+}
+
+// GL 3.3 program from the shared shader sources; NO keeps the fixed-function path
+- (BOOL)loadProgram {
+    programAttempted = YES;
+    const char *version = (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION);
+    if (!version || strtod(version, NULL) < 3.3) {
+        return NO;
+    }
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, @"simple.vert");
+    GLuint fragment = compileShader(GL_FRAGMENT_SHADER, @"simple.frag");
+    if (vertex && fragment) {
+        program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glLinkProgram(program);
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            GLchar log[1024];
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            NSLog(@"OpenGL: failed to link shaders: %s", log);
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    if (vertex) glDeleteShader(vertex);
+    if (fragment) glDeleteShader(fragment);
+    if (!program) return NO;
+    mvpLocation = glGetUniformLocation(program, "mvp");
+    instanceStepLocation = glGetUniformLocation(program, "instanceStep");
+    alphaLocation = glGetUniformLocation(program, "alpha");
+    shadingLocation = glGetUniformLocation(program, "shading");
+    return YES;
+}
+
+- (OpenGLModelSlot *)slotForModel:(Gamut3DModel *)model {
+    NSUInteger i;
+    for (i = 0; i < [modelSlots count]; i++) {
+        OpenGLModelSlot *slot = [modelSlots objectAtIndex:i];
+        if (slot->model == model) return slot;
+    }
+    return nil;
+}
+
+// Drop slots of removed or edited models and upload the rest once
+- (void)syncModelSlots {
+    NSUInteger i;
+    for (i = [modelSlots count]; i > 0; i--) {
+        OpenGLModelSlot *slot = [modelSlots objectAtIndex:i - 1];
+        if ([gamutModels indexOfObjectIdenticalTo:slot->model] == NSNotFound || slot->revision != [slot->model revision]) {
+            [slot deleteBuffers];
+            [modelSlots removeObjectAtIndex:i - 1];
+        }
+    }
+    for (i = 0; i < [gamutModels count]; i++) {
+        Gamut3DModel *model = [gamutModels objectAtIndex:i];
+        if ([model pointCount] == 0 || [self slotForModel:model]) continue;
+        OpenGLModelSlot *slot = [[OpenGLModelSlot alloc] initWithModel:model];
+        [modelSlots addObject:slot];
+        [slot release];
+    }
+}
+
+- (void)uploadLabSpace {
+    labSpaceDirty = NO;
+    axesCount = uploadPoints([labSpaceModel axisVertices] ? [labSpaceModel axisVertices] : [NSArray array],
+                             &axesVAO, &axesVBO, NULL);
+
+    float *grid = NULL;
+    NSArray *gridPoints = [labSpaceModel gridVertices] ? [labSpaceModel gridVertices] : [NSArray array];
+    GLsizei count = uploadPoints(gridPoints, &gridVAO, &gridVBO, &grid);
+    gridInstances = stackedPlanes(grid, count, gridStep);
+    gridCount = count / gridInstances;
+    free(grid);
+}
+
+// GPU time of a frame whose timer query has ended (blocks until it is done)
+- (void)collectTimerQuery:(NSUInteger)index {
+    if (!timerPending[index]) return;
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(timerQueries[index], GL_QUERY_RESULT, &elapsed);
+    lastGPUTime = (double)elapsed * 1e-9;
+    timerPending[index] = NO;
+}
+
+- (void)renderRetained:(const float *)mvp {
+    if (labSpaceDirty) [self uploadLabSpace];
+    [self syncModelSlots];
+
+    glUseProgram(program);
+    glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, mvp);
+    glUniform3f(instanceStepLocation, 0.0f, 0.0f, 0.0f);
+    glUniform1f(alphaLocation, 1.0f);
+    glUniform1i(shadingLocation, 0);
+
+    // Render Lab space axes and grid
+    if (labSpaceModel && [labSpaceModel showAxes] && axesCount > 0) {
+        glBindVertexArray(axesVAO);
+        glVertexAttrib3f(kAttribColor, 1.0f, 1.0f, 1.0f);
+        glDrawArrays(GL_LINES, 0, axesCount);
+    }
+    if (labSpaceModel && [labSpaceModel showGrid] && gridCount > 0) {
+        glBindVertexArray(gridVAO);
+        glVertexAttrib3f(kAttribColor, 0.5f, 0.5f, 0.5f);
+        if (gridInstances > 1) {
+            glUniform3f(instanceStepLocation, gridStep[0], gridStep[1], gridStep[2]);
+            glDrawArraysInstanced(GL_POINTS, 0, gridCount, gridInstances);
+            glUniform3f(instanceStepLocation, 0.0f, 0.0f, 0.0f);
+        } else {
+            glDrawArrays(GL_POINTS, 0, gridCount);
+        }
+    }
+
+    // Point clouds and wireframes first, writing depth; then the shaded
+    // surfaces blended over them without writing it, so every surface
+    // stays visible through the ones in front
+    NSUInteger i, pass;
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            glDepthMask(GL_FALSE);
+            glUniform1f(alphaLocation, kSurfaceAlpha);
+            glUniform1i(shadingLocation, 1);
+        }
+        for (i = 0; i < [gamutModels count]; i++) {
+            Gamut3DModel *model = [gamutModels objectAtIndex:i];
+            OpenGLModelSlot *slot = [self slotForModel:model];
+            if (!slot) continue;
+            float *color = [model color];
+            OpenGLMesh *mesh = [slot bufferForMesh:[GamutMeshLOD meshForModel:model zoom:zoom quality:renderingQuality]];
+            glBindVertexArray(mesh->vao);
+            if (mesh->indexCount == 0) {
+                if (pass == 0) {
+                    glVertexAttrib3f(kAttribColor, color[0], color[1], color[2]);
+                    glDrawArrays(GL_POINTS, 0, mesh->pointCount);
+                }
+            } else if (pass == 0) {
+                glUniform1f(alphaLocation, kWireframeAlpha);
+                glVertexAttrib3f(kAttribColor, color[0] * 0.6f, color[1] * 0.6f, color[2] * 0.6f);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+                glDrawElements(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, (const GLvoid *)0);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                glUniform1f(alphaLocation, 1.0f);
+            } else {
+                glVertexAttrib3f(kAttribColor, color[0], color[1], color[2]);
+                glDrawElements(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, (const GLvoid *)0);
+            }
+        }
+    }
+    glDepthMask(GL_TRUE);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+#endif
+
 - (void)render {
 #if HAVE_OPENGL
-    if (!glContext) return;
-    
-    [glContext makeCurrentContext];
-    
+    if (![self makeContextCurrent]) return;
+    if (!programAttempted) {
+        [self loadProgram];
+    }
+
+    // Time the frame on the GPU; reading the query used two frames ago
+    // waits for that frame at most
+    NSUInteger timer = frameIndex % 2;
+    if (program) {
+        if (!timerQueries[0]) glGenQueries(2, timerQueries);
+        [self collectTimerQuery:timer];
+        glBeginQuery(GL_TIME_ELAPSED, timerQueries[timer]);
+    }
+
     float aspect = viewportWidth / viewportHeight;
-    
+
     glClearColor(backgroundRed, backgroundGreen, backgroundBlue, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    
+
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, aspect, 0.1, 1000.0);
-    
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    
+
+    if (program) {
+        float mvp[16];
+        RenderBackendCameraMatrix(mvp, rotationX, rotationY, zoom, aspect, NO);
+        [self renderRetained:mvp];
+        glEndQuery(GL_TIME_ELAPSED);
+        timerPending[timer] = YES;
+        frameIndex++;
+        [self presentFrame];
+        return;
+    }
+
     // Calculate camera position
     float camDist = 200.0 / zoom;
     float radX = rotationX * M_PI / 180.0;
     float radY = rotationY * M_PI / 180.0;
-    
+
     float camX = camDist * sin(radY) * cos(radX);
     float camY = camDist * sin(radX);
     float camZ = camDist * cos(radY) * cos(radX);
-    
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, aspect, 0.1, 1000.0);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
     gluLookAt(camX, camY, camZ, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
-    
+
     // Render Lab space axes and grid
     if (labSpaceModel) {
         if ([labSpaceModel showAxes]) {
@@ -98,16 +602,35 @@
             [self renderGrid:[labSpaceModel gridVertices]];
         }
     }
-    
+
     // Render gamut models
     for (Gamut3DModel *model in gamutModels) {
         [self renderGamutModel:model];
     }
-    
-    [glContext flushBuffer];
+
+    frameIndex++;
+    [self presentFrame];
 #endif
 }
 
+- (void)finishFrames {
+#if HAVE_OPENGL
+    if (![self makeContextCurrent]) return;
+    glFinish();
+    // Older frame first, so the newest frame's time is the one left
+    if (program) {
+        [self collectTimerQuery:frameIndex % 2];
+        [self collectTimerQuery:(frameIndex + 1) % 2];
+    }
+#endif
+}
+
+- (double)lastFrameGPUTime {
+    return lastGPUTime;
+}
+
+#pragma mark - Fixed-function fallback
+
 - (void)renderAxes:(NSArray *)axes {
 #if HAVE_OPENGL
     glBegin(GL_LINES);
@@ -141,24 +664,36 @@
 - (void)renderGamutModel:(Gamut3DModel *)model {
 #if HAVE_OPENGL
     float *color = [model color];
-    glColor3f(color[0], color[1], color[2]);
-    
-    NSArray *vertices = [model vertices];
-    if ([vertices count] > 0) {
-        glBegin(GL_POINTS);
-        for (NSArray *point in vertices) {
-            if ([point count] >= 3) {
-                glVertex3f([[point objectAtIndex:0] floatValue],
-                           [[point objectAtIndex:1] floatValue],
-                           [[point objectAtIndex:2] floatValue]);
-            }
+    Gamut3DModel *mesh = [GamutMeshLOD meshForModel:model zoom:zoom quality:renderingQuality];
+
+    // Draw straight from the packed Lab buffer (no per-point unboxing)
+    NSUInteger count = [mesh pointCount];
+    if (count > 0) {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, [mesh labPoints]);
+        if ([mesh triangleCount] == 0) {
+            glColor3f(color[0], color[1], color[2]);
+            glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+        } else {
+            // Unlit: the fixed-function path has no normals to light with
+            GLsizei indexCount = (GLsizei)([mesh triangleCount] * 3);
+            glColor4f(color[0] * 0.6f, color[1] * 0.6f, color[2] * 0.6f, kWireframeAlpha);
+            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, [mesh triangleIndices]);
+            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            glDepthMask(GL_FALSE);
+            glColor4f(color[0], color[1], color[2], kSurfaceAlpha);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, [mesh triangleIndices]);
+            glDepthMask(GL_TRUE);
         }
-        glEnd();
+        glDisableClientState(GL_VERTEX_ARRAY);
     }
 #endif
 }
 
 - (void)setViewportWidth:(float)width height:(float)height {
+    // The pbuffer keeps the size it was created with
+    if (eglContext) return;
     viewportWidth = width;
     viewportHeight = height;
 }
@@ -171,6 +706,7 @@
     if (zoom > 10.0) zoom = 10.0;
 }
 
+// Uploaded on the next render, unless a slot already holds this revision
 - (void)addGamutModel:(Gamut3DModel *)model {
     [gamutModels addObject:model];
 }
@@ -178,8 +714,11 @@
 - (void)setLabSpaceModel:(CIELABSpaceModel *)model {
     [labSpaceModel release];
     labSpaceModel = [model retain];
+    labSpaceDirty = YES;
 }
 
+// Slots stay until the next render, so models added straight back keep
+// their buffers
 - (void)clearGamutModels {
     [gamutModels removeAllObjects];
 }
@@ -197,6 +736,7 @@
 - (void)dealloc {
     [self shutdown];
     [gamutModels release];
+    [modelSlots release];
     [labSpaceModel release];
     [super dealloc];
 }
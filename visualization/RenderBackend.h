@@ -34,13 +34,33 @@ typedef enum {
 - (void)setBackgroundRed:(CGFloat)r green:(CGFloat)g blue:(CGFloat)b;
 - (void)setRenderingQuality:(NSInteger)quality; // 0=low, 1=medium, 2=high
 
+// Headless rendering into a width x height target owned by the backend (no
+// view, window or display server); used instead of -initializeWithView:
+- (BOOL)initializeOffscreenWithWidth:(NSUInteger)width height:(NSUInteger)height;
+// Block until every frame rendered so far has finished on the GPU
+- (void)finishFrames;
+// GPU time of the latest finished frame in seconds, negative when unknown
+- (double)lastFrameGPUTime;
+
 @end
 
+// Column-major projection * view matrix of the orbit camera every backend
+// uses: 45 degree field of view, looking at the origin from 200 / zoom
+// units. vulkanClip flips Y and maps depth to 0-1 for Vulkan clip space.
+void RenderBackendCameraMatrix(float *matrix, float rotationX, float rotationY, float zoom,
+                               float aspect, BOOL vulkanClip);
+
 @interface RenderBackendFactory : NSObject
 
 + (id<RenderBackend>)createBackend:(RenderBackendType)type;
 + (RenderBackendType)defaultBackendType;
 
+// Backend already initialized offscreen, or nil when this type cannot
+// render headless here (no driver, or not built in)
++ (nullable id<RenderBackend>)createOffscreenBackend:(RenderBackendType)type
+                                               width:(NSUInteger)width
+                                              height:(NSUInteger)height;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -8,11 +8,75 @@
 #import "RenderBackend.h"
 #import "OpenGLBackend.h"
 #import "SSPlatform.h"
+#import <math.h>
 
 // Conditionally import backends (only if available)
 // Note: For tests, we only need OpenGLBackend
 // VulkanBackend and MetalBackend require platform-specific headers
 
+// Column-major gluPerspective(fovY, aspect, zNear, zFar) * gluLookAt(eye,
+// origin, +Y up)
+static void perspectiveLookAt(float *m, float fovY, float aspect, float zNear, float zFar,
+                              float eyeX, float eyeY, float eyeZ) {
+    float f = 1.0f / tanf(fovY * (float)M_PI / 360.0f);
+    float p[16] = {0};
+    p[0] = f / aspect;
+    p[5] = f;
+    p[10] = (zFar + zNear) / (zNear - zFar);
+    p[11] = -1.0f;
+    p[14] = 2.0f * zFar * zNear / (zNear - zFar);
+
+    // Forward, side and up vectors of the camera looking at the origin
+    float fw[3] = {-eyeX, -eyeY, -eyeZ};
+    float len = sqrtf(fw[0] * fw[0] + fw[1] * fw[1] + fw[2] * fw[2]);
+    fw[0] /= len; fw[1] /= len; fw[2] /= len;
+    float s[3] = {-fw[2], 0.0f, fw[0]}; // fw x (0, 1, 0)
+    len = sqrtf(s[0] * s[0] + s[2] * s[2]);
+    if (len > 0.0f) {
+        s[0] /= len; s[2] /= len;
+    }
+    float u[3] = {s[1] * fw[2] - s[2] * fw[1], s[2] * fw[0] - s[0] * fw[2], s[0] * fw[1] - s[1] * fw[0]};
+    float v[16] = {
+        s[0], u[0], -fw[0], 0.0f,
+        s[1], u[1], -fw[1], 0.0f,
+        s[2], u[2], -fw[2], 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+    v[12] = -(s[0] * eyeX + s[1] * eyeY + s[2] * eyeZ);
+    v[13] = -(u[0] * eyeX + u[1] * eyeY + u[2] * eyeZ);
+    v[14] = fw[0] * eyeX + fw[1] * eyeY + fw[2] * eyeZ;
+
+    int row, col, k;
+    for (col = 0; col < 4; col++) {
+        for (row = 0; row < 4; row++) {
+            float sum = 0.0f;
+            for (k = 0; k < 4; k++) {
+                sum += p[k * 4 + row] * v[col * 4 + k];
+            }
+            m[col * 4 + row] = sum;
+        }
+    }
+}
+
+void RenderBackendCameraMatrix(float *matrix, float rotationX, float rotationY, float zoom,
+                               float aspect, BOOL vulkanClip) {
+    float camDist = 200.0f / zoom;
+    float radX = rotationX * (float)M_PI / 180.0f;
+    float radY = rotationY * (float)M_PI / 180.0f;
+    perspectiveLookAt(matrix, 45.0f, aspect, 0.1f, 1000.0f,
+                      camDist * sinf(radY) * cosf(radX),
+                      camDist * sinf(radX),
+                      camDist * cosf(radY) * cosf(radX));
+    if (vulkanClip) {
+        // Y points down in Vulkan clip space and depth runs 0 to w, not -w to w
+        int col;
+        for (col = 0; col < 4; col++) {
+            matrix[col * 4 + 1] = -matrix[col * 4 + 1];
+            matrix[col * 4 + 2] = 0.5f * (matrix[col * 4 + 2] + matrix[col * 4 + 3]);
+        }
+    }
+}
+
 @implementation RenderBackendFactory
 
 + (id<RenderBackend>)createBackend:(RenderBackendType)type {
@@ -32,6 +96,24 @@
     }
 }
 
++ (id<RenderBackend>)createOffscreenBackend:(RenderBackendType)type
+                                      width:(NSUInteger)width
+                                     height:(NSUInteger)height {
+    // Vulkan is looked up by name; builds without it (tests) do not link it
+    id<RenderBackend> backend = nil;
+    if (type == RenderBackendTypeOpenGL) {
+        backend = [[[OpenGLBackend alloc] init] autorelease];
+    } else if (type == RenderBackendTypeVulkan) {
+        backend = [[[NSClassFromString(@"VulkanBackend") alloc] init] autorelease];
+    }
+    if (![backend respondsToSelector:@selector(initializeOffscreenWithWidth:height:)] ||
+        ![backend initializeOffscreenWithWidth:width height:height]) {
+        [backend shutdown];
+        return nil;
+    }
+    return backend;
+}
+
 + (RenderBackendType)defaultBackendType {
     if ([SSPlatform isMacOS]) {
         // macOS: Prefer Metal, fallback to OpenGL
@@ -23,6 +23,11 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (id)initWithView:(NSView *)view backendType:(RenderBackendType)type;
 - (id)initWithView:(NSView *)view; // Uses default backend
+// Headless width x height target, falling back to OpenGL like
+// -initWithView:backendType:; nil when neither can render offscreen
+- (nullable id)initOffscreenWithWidth:(NSUInteger)width
+                               height:(NSUInteger)height
+                          backendType:(RenderBackendType)type;
 - (void)render;
 - (void)addGamutModel:(Gamut3DModel *)model;
 - (void)clearGamutModels;
@@ -31,6 +36,10 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)handleZoom:(float)delta;
 - (void)setViewportWidth:(float)width height:(float)height;
 - (void)applySettings; // Apply SettingsManager (background color, rendering quality)
+- (void)setRenderingQuality:(NSInteger)quality; // 0=low, 1=medium, 2=high
+- (void)setRotationX:(float)x rotationY:(float)y zoom:(float)z; // Degrees; zoom clamped like -handleZoom:
+- (void)finishFrames; // Wait for the GPU (no-op on backends that cannot)
+- (double)lastFrameGPUTime; // Seconds, negative when the backend cannot tell
 - (RenderBackendType)backendType;
 
 @end
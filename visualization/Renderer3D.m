@@ -51,6 +51,30 @@
     return [self initWithView:view backendType:defaultType];
 }
 
+- (id)initOffscreenWithWidth:(NSUInteger)width
+                      height:(NSUInteger)height
+                 backendType:(RenderBackendType)type {
+    self = [super init];
+    if (self) {
+        backendType = type;
+        backend = [RenderBackendFactory createOffscreenBackend:type width:width height:height];
+        if (!backend && type != RenderBackendTypeOpenGL) {
+            backendType = RenderBackendTypeOpenGL;
+            backend = [RenderBackendFactory createOffscreenBackend:RenderBackendTypeOpenGL width:width height:height];
+        }
+        if (!backend) {
+            [self release];
+            return nil;
+        }
+        [backend retain];
+
+        rotationX = 0.0;
+        rotationY = 0.0;
+        zoom = 1.0;
+    }
+    return self;
+}
+
 - (void)render {
     if (backend) {
         [backend setCameraRotationX:rotationX rotationY:rotationY zoom:zoom];
@@ -107,6 +131,33 @@
     }
 }
 
+- (void)setRenderingQuality:(NSInteger)quality {
+    if ([backend respondsToSelector:@selector(setRenderingQuality:)]) {
+        [backend setRenderingQuality:quality];
+    }
+}
+
+- (void)setRotationX:(float)x rotationY:(float)y zoom:(float)z {
+    rotationX = x;
+    rotationY = y;
+    zoom = z;
+    if (zoom < 0.1) zoom = 0.1;
+    if (zoom > 10.0) zoom = 10.0;
+}
+
+- (void)finishFrames {
+    if ([backend respondsToSelector:@selector(finishFrames)]) {
+        [backend finishFrames];
+    }
+}
+
+- (double)lastFrameGPUTime {
+    if ([backend respondsToSelector:@selector(lastFrameGPUTime)]) {
+        return [backend lastFrameGPUTime];
+    }
+    return -1.0;
+}
+
 - (RenderBackendType)backendType {
     return backendType;
 }
@@ -4,11 +4,21 @@
 //
 //  Vulkan rendering backend for Linux
 //
+//  Model geometry lives in one device-local pool buffer that each model's
+//  vertices and indices are suballocated from. Uploads go through a
+//  persistently mapped staging ring and are recorded into the frame's own
+//  command buffer. Up to kVulkanFramesInFlight frames run ahead of the GPU,
+//  paced by per-frame fences instead of waiting for the queue to go idle.
+//  -initializeOffscreenWithWidth:height: renders into a color image with no
+//  surface or swapchain, for headless benchmarks.
+//
 
 #import "RenderBackend.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
+enum { kVulkanFramesInFlight = 2 };
+
 @interface VulkanBackend : NSObject <RenderBackend> {
     void *vulkanInstance; // VkInstance
     void *physicalDevice; // VkPhysicalDevice
@@ -24,9 +34,20 @@ NS_ASSUME_NONNULL_BEGIN
     void *graphicsQueue; // VkQueue
     void *presentQueue; // VkQueue
     NSMutableArray *gamutModels;
-    NSMutableArray *vertexBuffers; // Array of NSValue wrapping VkBuffer*
-    NSMutableArray *vertexBufferMemories; // Array of NSValue wrapping VkDeviceMemory*
-    NSMutableArray *vertexCounts; // Array of NSNumber for vertex counts per model
+    NSMutableArray *modelSlots; // VulkanModelSlot per uploaded model (live or waiting to be freed)
+    void *vertexPool; // VkBuffer, device local, vertex and index data of every model
+    void *vertexPoolMemory; // VkDeviceMemory
+    uint64_t vertexPoolSize;
+    NSMutableArray *poolFreeRanges; // NSValue ranges of the pool, sorted by location
+    void *stagingBuffer; // VkBuffer, host visible, one segment per frame in flight
+    void *stagingMemory; // VkDeviceMemory
+    uint8_t *stagingMapped; // Persistent mapping of stagingMemory
+    void *frameCommandBuffers[kVulkanFramesInFlight]; // VkCommandBuffer
+    void *frameFences[kVulkanFramesInFlight]; // VkFence, signaled when the frame's work is done
+    uint64_t frameSerials[kVulkanFramesInFlight]; // Submission serial each frame slot last carried
+    NSUInteger currentFrame;
+    uint64_t submittedSerial;
+    uint64_t completedSerial;
     CIELABSpaceModel *labSpaceModel;
     float rotationX, rotationY;
     float zoom;
@@ -36,6 +57,16 @@ NS_ASSUME_NONNULL_BEGIN
     void **swapchainImageViews; // VkImageView array
     void **framebuffers; // VkFramebuffer array
     void **commandBuffers; // VkCommandBuffer array
+    BOOL offscreen; // Drawing into offscreenImage instead of a surface
+    void *offscreenImage; // VkImage
+    void *offscreenMemory; // VkDeviceMemory
+    void *offscreenView; // VkImageView
+    void *offscreenFramebuffer; // VkFramebuffer
+    void *timestampPool; // VkQueryPool, start and end timestamp per frame in flight
+    BOOL frameTimed[kVulkanFramesInFlight]; // Timestamps written, not yet read
+    double timestampPeriod; // Nanoseconds per timestamp tick
+    uint64_t timestampMask; // Valid timestamp bits
+    double lastGPUTime; // Seconds, negative until measured
     BOOL initialized;
 }
 
@@ -4,12 +4,24 @@
 //
 //  Vulkan backend implementation for Linux
 //
+//  Every render first waits on the fence of the frame slot it is about to
+//  reuse, which also tells it which earlier submissions have finished.
+//  Models are matched to their pool slots by identity and geometry
+//  revision, so clearing and re-adding the same models uploads nothing. The
+//  model color is a push constant, so recoloring uploads nothing either. A
+//  new or reshaped model is copied through the frame's staging segment. Its old range goes
+//  back to the free list once the frames that may still read it are done.
+//  Growing the pool is the one remaining full stall (vkDeviceWaitIdle).
+//  Headless backends draw into their own color image. Each submission is
+//  bracketed by timestamps that are read back when its fence is waited on.
+//
 
 #import "VulkanBackend.h"
 #import "Gamut3DModel.h"
 #import "CIELABSpaceModel.h"
 #import "VulkanShaderLoader.h"
 #import <math.h>
+#import <string.h>
 
 #if (defined(__GNUSTEP__) || defined(__linux__)) && defined(HAVE_VULKAN)
 #define VK_USE_PLATFORM_XLIB_KHR
@@ -20,21 +32,98 @@
 #define HAVE_VULKAN 0
 #endif
 
+#if HAVE_VULKAN
+// Color format of the render pass and of the offscreen target
+static const VkFormat kColorFormat = VK_FORMAT_B8G8R8A8_UNORM;
+#endif
+
 // Vertex structure for Lab space coordinates
 typedef struct {
     float position[3]; // L*, a*, b*
-    float color[3];    // RGB color
 } Vertex;
 
+// Vertex push constants: the camera matrix, then the model color
+typedef struct {
+    float mvp[16];
+    float color[4];
+} PushConstants;
+
+// Staging bytes each frame in flight may upload; larger uploads spill into
+// extra upload-only submissions
+static const uint64_t kStagingFrameBytes = 8 * 1024 * 1024;
+
+static const uint64_t kMinVertexPoolBytes = 16 * 1024 * 1024;
+
+// Suballocation granularity (covers every vertex and index alignment)
+static const uint64_t kPoolAlignment = 256;
+
+static uint64_t alignSize(uint64_t size, uint64_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// One model's range in the vertex pool: the packed Lab points, then the
+// triangle indices
+@interface VulkanModelSlot : NSObject {
+@public
+    Gamut3DModel *model;
+    NSUInteger revision;      // Model geometry revision the range holds
+    NSData *contents;         // Bytes still to upload; dropped once uploaded
+    uint64_t offset;
+    uint64_t size;
+    uint64_t indexOffset;     // From the start of the pool
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint64_t uploaded;        // Bytes copied so far; drawable at size
+    uint64_t retireSerial;    // Free once this submission has completed
+    BOOL allocated;
+    BOOL retired;
+}
+- (id)initWithModel:(Gamut3DModel *)m;
+- (void)buildContents;
+@end
+
+@implementation VulkanModelSlot
+
+- (id)initWithModel:(Gamut3DModel *)m {
+    self = [super init];
+    if (self) {
+        model = [m retain];
+        revision = [m revision];
+        vertexCount = (uint32_t)[m pointCount];
+        indexCount = (uint32_t)([m triangleCount] * 3);
+        size = alignSize(vertexCount * sizeof(Vertex), 4) + indexCount * sizeof(uint32_t);
+    }
+    return self;
+}
+
+// The packed Lab points as they are, indices after
+- (void)buildContents {
+    NSMutableData *bytes = [NSMutableData dataWithLength:(NSUInteger)size];
+    memcpy([bytes mutableBytes], [model labPoints], vertexCount * sizeof(Vertex));
+    if (indexCount) {
+        memcpy((uint8_t *)[bytes mutableBytes] + size - indexCount * sizeof(uint32_t),
+               [model triangleIndices], indexCount * sizeof(uint32_t));
+    }
+    [contents release];
+    contents = [bytes retain];
+}
+
+- (void)dealloc {
+    [model release];
+    [contents release];
+    [super dealloc];
+}
+
+@end
+
 @implementation VulkanBackend
 
 - (id)init {
     self = [super init];
     if (self) {
         gamutModels = [[NSMutableArray alloc] init];
-        vertexBuffers = [[NSMutableArray alloc] init];
-        vertexBufferMemories = [[NSMutableArray alloc] init];
-        vertexCounts = [[NSMutableArray alloc] init];
+        modelSlots = [[NSMutableArray alloc] init];
+        poolFreeRanges = [[NSMutableArray alloc] init];
         rotationX = 0.0;
         rotationY = 0.0;
         zoom = 1.0;
@@ -59,12 +148,60 @@ typedef struct {
         swapchainImageViews = NULL;
         framebuffers = NULL;
         commandBuffers = NULL;
+        vertexPool = NULL;
+        vertexPoolMemory = NULL;
+        vertexPoolSize = 0;
+        stagingBuffer = NULL;
+        stagingMemory = NULL;
+        stagingMapped = NULL;
+        currentFrame = 0;
+        submittedSerial = 0;
+        completedSerial = 0;
+        offscreen = NO;
+        offscreenImage = NULL;
+        offscreenMemory = NULL;
+        offscreenView = NULL;
+        offscreenFramebuffer = NULL;
+        timestampPool = NULL;
+        timestampPeriod = 0.0;
+        timestampMask = 0;
+        lastGPUTime = -1.0;
     }
     return self;
 }
 
 - (BOOL)initializeWithView:(NSView *)view {
 #if HAVE_VULKAN
+    return [self initializeDeviceForSurface:YES];
+#else
+    (void)view; // Suppress unused parameter warning
+    return NO;
+#endif
+}
+
+- (BOOL)initializeOffscreenWithWidth:(NSUInteger)width height:(NSUInteger)height {
+#if HAVE_VULKAN
+    if (width == 0 || height == 0) return NO;
+    offscreen = YES;
+    viewportWidth = (float)width;
+    viewportHeight = (float)height;
+    // Without the SPIR-V shaders nothing would be drawn, so a headless
+    // backend without a pipeline is no backend
+    if (![self initializeDeviceForSurface:NO]) return NO;
+    if (!pipeline) {
+        NSLog(@"Vulkan offscreen rendering needs simple.vert.spv and simple.frag.spv");
+        return NO;
+    }
+    return [self createOffscreenTarget];
+#else
+    return NO;
+#endif
+}
+
+#if HAVE_VULKAN
+// Headless devices ask for no surface or swapchain extensions, so they also
+// run on drivers without a display (lavapipe, compute-only hosts)
+- (BOOL)initializeDeviceForSurface:(BOOL)presenting {
     VkResult result;
     
     // 1. Create Vulkan instance
@@ -84,8 +221,8 @@ typedef struct {
     VkInstanceCreateInfo createInfo = {0};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     createInfo.pApplicationInfo = &appInfo;
-    createInfo.enabledExtensionCount = 2;
-    createInfo.ppEnabledExtensionNames = extensions;
+    createInfo.enabledExtensionCount = presenting ? 2 : 0;
+    createInfo.ppEnabledExtensionNames = presenting ? extensions : NULL;
     
     result = vkCreateInstance(&createInfo, NULL, (VkInstance *)&vulkanInstance);
     if (result != VK_SUCCESS) {
@@ -114,10 +251,12 @@ typedef struct {
     
     uint32_t graphicsQueueFamily = UINT32_MAX;
     uint32_t presentQueueFamily = UINT32_MAX;
+    uint32_t timestampBits = 0;
     uint32_t i;
     for (i = 0; i < queueFamilyCount; i++) {
         if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
             graphicsQueueFamily = i;
+            timestampBits = queueFamilies[i].timestampValidBits;
         }
         // Check presentation support (simplified - would check with vkGetPhysicalDeviceXlibPresentationSupportKHR)
         if (presentQueueFamily == UINT32_MAX) {
@@ -147,8 +286,8 @@ typedef struct {
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-    deviceCreateInfo.enabledExtensionCount = 1;
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions;
+    deviceCreateInfo.enabledExtensionCount = presenting ? 1 : 0;
+    deviceCreateInfo.ppEnabledExtensionNames = presenting ? deviceExtensions : NULL;
     
     result = vkCreateDevice((VkPhysicalDevice)physicalDevice, &deviceCreateInfo, NULL, (VkDevice *)&device);
     if (result != VK_SUCCESS) {
@@ -173,14 +312,15 @@ typedef struct {
     
     // 7. Create render pass
     VkAttachmentDescription colorAttachment = {0};
-    colorAttachment.format = VK_FORMAT_B8G8R8A8_UNORM; // Placeholder
+    colorAttachment.format = kColorFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Offscreen frames are left ready to be copied out
+    colorAttachment.finalLayout = presenting ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
     
     VkAttachmentReference colorAttachmentRef = {0};
     colorAttachmentRef.attachment = 0;
@@ -191,12 +331,25 @@ typedef struct {
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
     
+    // Frames in flight share one color image: each frame's clear and draws
+    // wait for the previous frame's color writes (and, when presenting, for
+    // the acquire semaphore, which also waits at this stage)
+    VkSubpassDependency dependency = {0};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    
     VkRenderPassCreateInfo renderPassInfo = {0};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = 1;
     renderPassInfo.pAttachments = &colorAttachment;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
     
     result = vkCreateRenderPass((VkDevice)device, &renderPassInfo, NULL, (VkRenderPass *)&renderPass);
     if (result != VK_SUCCESS) {
@@ -219,14 +372,116 @@ typedef struct {
         return NO;
     }
     
+    // 10. Per-frame command buffers, fences and staging segments
+    if (![self createFrameResources]) {
+        return NO;
+    }
+    
+    // 11. GPU timestamps around each submission, where the queue has them
+    if (timestampBits > 0) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties((VkPhysicalDevice)physicalDevice, &properties);
+        VkQueryPoolCreateInfo queryInfo = {0};
+        queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryInfo.queryCount = 2 * kVulkanFramesInFlight;
+        if (vkCreateQueryPool((VkDevice)device, &queryInfo, NULL, (VkQueryPool *)&timestampPool) == VK_SUCCESS) {
+            timestampPeriod = properties.limits.timestampPeriod;
+            timestampMask = (timestampBits >= 64) ? UINT64_MAX : ((1ULL << timestampBits) - 1);
+        }
+    }
+    
     initialized = YES;
     return YES;
-#else
-    (void)view; // Suppress unused parameter warning
-    return NO;
-#endif
 }
 
+// Color image, view and framebuffer the render pass draws into when headless
+- (BOOL)createOffscreenTarget {
+    VkImageCreateInfo imageInfo = {0};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = kColorFormat;
+    imageInfo.extent.width = (uint32_t)viewportWidth;
+    imageInfo.extent.height = (uint32_t)viewportHeight;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkResult result = vkCreateImage((VkDevice)device, &imageInfo, NULL, (VkImage *)&offscreenImage);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to create offscreen image: %d", result);
+        return NO;
+    }
+    
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements((VkDevice)device, (VkImage)offscreenImage, &requirements);
+    VkMemoryAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = [self findMemoryType:requirements.memoryTypeBits
+                                          properties:VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT];
+    result = vkAllocateMemory((VkDevice)device, &allocInfo, NULL, (VkDeviceMemory *)&offscreenMemory);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to allocate offscreen image memory: %d", result);
+        return NO;
+    }
+    vkBindImageMemory((VkDevice)device, (VkImage)offscreenImage, (VkDeviceMemory)offscreenMemory, 0);
+    
+    VkImageViewCreateInfo viewInfo = {0};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = (VkImage)offscreenImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = kColorFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+    result = vkCreateImageView((VkDevice)device, &viewInfo, NULL, (VkImageView *)&offscreenView);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to create offscreen image view: %d", result);
+        return NO;
+    }
+    
+    VkImageView attachment = (VkImageView)offscreenView;
+    VkFramebufferCreateInfo framebufferInfo = {0};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = (VkRenderPass)renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &attachment;
+    framebufferInfo.width = (uint32_t)viewportWidth;
+    framebufferInfo.height = (uint32_t)viewportHeight;
+    framebufferInfo.layers = 1;
+    result = vkCreateFramebuffer((VkDevice)device, &framebufferInfo, NULL, (VkFramebuffer *)&offscreenFramebuffer);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to create offscreen framebuffer: %d", result);
+        return NO;
+    }
+    return YES;
+}
+
+- (void)destroyOffscreenTarget {
+    if (offscreenFramebuffer) {
+        vkDestroyFramebuffer((VkDevice)device, (VkFramebuffer)offscreenFramebuffer, NULL);
+        offscreenFramebuffer = NULL;
+    }
+    if (offscreenView) {
+        vkDestroyImageView((VkDevice)device, (VkImageView)offscreenView, NULL);
+        offscreenView = NULL;
+    }
+    if (offscreenImage) {
+        vkDestroyImage((VkDevice)device, (VkImage)offscreenImage, NULL);
+        offscreenImage = NULL;
+    }
+    if (offscreenMemory) {
+        vkFreeMemory((VkDevice)device, (VkDeviceMemory)offscreenMemory, NULL);
+        offscreenMemory = NULL;
+    }
+}
+#endif
+
 - (void)createGraphicsPipeline {
 #if HAVE_VULKAN
     if (!device || !renderPass) return;
@@ -241,25 +496,19 @@ typedef struct {
     bindingDescription.stride = sizeof(Vertex);
     bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
     
-    // Vertex attributes
-    VkVertexInputAttributeDescription attributeDescriptions[2] = {0};
-    // Position attribute
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, position);
-    // Color attribute
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
+    // Position attribute (the color is a push constant)
+    VkVertexInputAttributeDescription attributeDescription = {0};
+    attributeDescription.binding = 0;
+    attributeDescription.location = 0;
+    attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescription.offset = offsetof(Vertex, position);
     
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {0};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     vertexInputInfo.vertexBindingDescriptionCount = 1;
     vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = 2;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+    vertexInputInfo.vertexAttributeDescriptionCount = 1;
+    vertexInputInfo.pVertexAttributeDescriptions = &attributeDescription;
     
     // Input assembly
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {0};
@@ -318,11 +567,25 @@ typedef struct {
     colorBlending.attachmentCount = 1;
     colorBlending.pAttachments = &colorBlendAttachment;
     
-    // Pipeline layout (simplified - no uniforms for now)
+    // Viewport and scissor follow the view size, set per frame
+    VkDynamicState dynamicStates[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState = {0};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+    
+    // Pipeline layout: the camera matrix and model color are vertex push
+    // constants
+    VkPushConstantRange pushConstantRange = {0};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+    
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {0};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 0;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     
     VkResult result = vkCreatePipelineLayout((VkDevice)device, &pipelineLayoutInfo, NULL, (VkPipelineLayout *)&pipelineLayout);
     if (result != VK_SUCCESS) {
@@ -397,6 +660,7 @@ typedef struct {
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = (VkPipelineLayout)pipelineLayout;
     pipelineInfo.renderPass = (VkRenderPass)renderPass;
     pipelineInfo.subpass = 0;
@@ -416,90 +680,60 @@ typedef struct {
 #endif
 }
 
-- (void)createVertexBuffers {
 #if HAVE_VULKAN
-    if (!device || !commandPool) return;
-    
-    // Clear existing buffers
-    [self destroyVertexBuffers];
-    
-    // Create vertex buffer for each gamut model
-    for (Gamut3DModel *model in gamutModels) {
-        NSArray *vertices = [model vertices];
-        if ([vertices count] == 0) continue;
-        
-        // Convert NSArray vertices to Vertex array
-        NSUInteger vertexCount = [vertices count];
-        Vertex *vertexData = (Vertex *)malloc(vertexCount * sizeof(Vertex));
-        
-        float *modelColor = [model color];
-        NSUInteger i;
-        for (i = 0; i < vertexCount; i++) {
-            NSArray *point = [vertices objectAtIndex:i];
-            if ([point count] >= 3) {
-                vertexData[i].position[0] = [[point objectAtIndex:0] floatValue]; // L*
-                vertexData[i].position[1] = [[point objectAtIndex:1] floatValue]; // a*
-                vertexData[i].position[2] = [[point objectAtIndex:2] floatValue]; // b*
-                vertexData[i].color[0] = modelColor[0];
-                vertexData[i].color[1] = modelColor[1];
-                vertexData[i].color[2] = modelColor[2];
-            }
+- (BOOL)createFrameResources {
+    VkCommandBufferAllocateInfo allocInfo = {0};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = (VkCommandPool)commandPool;
+    allocInfo.commandBufferCount = kVulkanFramesInFlight;
+    
+    VkCommandBuffer buffers[kVulkanFramesInFlight];
+    VkResult result = vkAllocateCommandBuffers((VkDevice)device, &allocInfo, buffers);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to allocate frame command buffers: %d", result);
+        return NO;
+    }
+    
+    // Fences start signaled so the first wait on each slot returns at once
+    VkFenceCreateInfo fenceInfo = {0};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    
+    NSUInteger i;
+    for (i = 0; i < kVulkanFramesInFlight; i++) {
+        frameCommandBuffers[i] = buffers[i];
+        frameSerials[i] = 0;
+        result = vkCreateFence((VkDevice)device, &fenceInfo, NULL, (VkFence *)&frameFences[i]);
+        if (result != VK_SUCCESS) {
+            NSLog(@"Failed to create frame fence: %d", result);
+            return NO;
         }
-        
-        VkDeviceSize bufferSize = vertexCount * sizeof(Vertex);
-        
-        // Create staging buffer
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        [self createBuffer:bufferSize 
-                     usage:VK_BUFFER_USAGE_TRANSFER_SRC_BIT 
-            memoryProperties:VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-                      buffer:&stagingBuffer 
-                     memory:&stagingBufferMemory];
-        
-        // Copy data to staging buffer
-        void *data;
-        vkMapMemory((VkDevice)device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, vertexData, bufferSize);
-        vkUnmapMemory((VkDevice)device, stagingBufferMemory);
-        
-        free(vertexData);
-        
-        // Create vertex buffer
-        VkBuffer vertexBuffer;
-        VkDeviceMemory vertexBufferMemory;
-        [self createBuffer:bufferSize 
-                     usage:VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT 
-            memoryProperties:VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-                      buffer:&vertexBuffer 
-                     memory:&vertexBufferMemory];
-        
-        // Copy from staging to vertex buffer
-        [self copyBuffer:stagingBuffer to:vertexBuffer size:bufferSize];
-        
-        // Clean up staging buffer
-        vkDestroyBuffer((VkDevice)device, stagingBuffer, NULL);
-        vkFreeMemory((VkDevice)device, stagingBufferMemory, NULL);
-        
-        // Store buffers (allocate on heap to persist)
-        VkBuffer *bufferPtr = (VkBuffer *)malloc(sizeof(VkBuffer));
-        *bufferPtr = vertexBuffer;
-        VkDeviceMemory *memoryPtr = (VkDeviceMemory *)malloc(sizeof(VkDeviceMemory));
-        *memoryPtr = vertexBufferMemory;
-        
-        [vertexBuffers addObject:[NSValue valueWithPointer:bufferPtr]];
-        [vertexBufferMemories addObject:[NSValue valueWithPointer:memoryPtr]];
-        [vertexCounts addObject:[NSNumber numberWithUnsignedInteger:vertexCount]];
     }
-#endif
+    
+    if (![self createBuffer:kStagingFrameBytes * kVulkanFramesInFlight
+                      usage:VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+           memoryProperties:VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                     buffer:(VkBuffer *)&stagingBuffer
+                     memory:(VkDeviceMemory *)&stagingMemory]) {
+        return NO;
+    }
+    result = vkMapMemory((VkDevice)device, (VkDeviceMemory)stagingMemory, 0, VK_WHOLE_SIZE, 0, (void **)&stagingMapped);
+    if (result != VK_SUCCESS) {
+        NSLog(@"Failed to map staging memory: %d", result);
+        return NO;
+    }
+    return YES;
 }
 
-- (void)createBuffer:(VkDeviceSize)size 
+- (BOOL)createBuffer:(VkDeviceSize)size 
                usage:(VkBufferUsageFlags)usage 
-      memoryProperties:(VkMemoryPropertyFlags)properties
-                buffer:(VkBuffer *)buffer 
-               memory:(VkDeviceMemory *)bufferMemory {
-#if HAVE_VULKAN
+    memoryProperties:(VkMemoryPropertyFlags)properties
+              buffer:(VkBuffer *)buffer 
+              memory:(VkDeviceMemory *)bufferMemory {
+    *buffer = VK_NULL_HANDLE;
+    *bufferMemory = VK_NULL_HANDLE;
+    
     VkBufferCreateInfo bufferInfo = {0};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
@@ -509,7 +743,8 @@ typedef struct {
     VkResult result = vkCreateBuffer((VkDevice)device, &bufferInfo, NULL, buffer);
     if (result != VK_SUCCESS) {
         NSLog(@"Failed to create buffer");
-        return;
+        *buffer = VK_NULL_HANDLE;
+        return NO;
     }
     
     VkMemoryRequirements memRequirements;
@@ -523,15 +758,17 @@ typedef struct {
     result = vkAllocateMemory((VkDevice)device, &allocInfo, NULL, bufferMemory);
     if (result != VK_SUCCESS) {
         NSLog(@"Failed to allocate buffer memory");
-        return;
+        vkDestroyBuffer((VkDevice)device, *buffer, NULL);
+        *buffer = VK_NULL_HANDLE;
+        *bufferMemory = VK_NULL_HANDLE;
+        return NO;
     }
     
     vkBindBufferMemory((VkDevice)device, *buffer, *bufferMemory, 0);
-#endif
+    return YES;
 }
 
 - (uint32_t)findMemoryType:(uint32_t)typeFilter properties:(VkMemoryPropertyFlags)properties {
-#if HAVE_VULKAN
     VkPhysicalDeviceMemoryProperties memProperties;
     vkGetPhysicalDeviceMemoryProperties((VkPhysicalDevice)physicalDevice, &memProperties);
     
@@ -542,69 +779,309 @@ typedef struct {
             return i;
         }
     }
-#endif
     return 0;
 }
 
-- (void)copyBuffer:(VkBuffer)src to:(VkBuffer)dst size:(VkDeviceSize)size {
-#if HAVE_VULKAN
-    VkCommandBufferAllocateInfo allocInfo = {0};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = (VkCommandPool)commandPool;
-    allocInfo.commandBufferCount = 1;
+#pragma mark - Vertex pool
+
+// First fit over the sorted free list
+- (BOOL)allocateSlot:(VulkanModelSlot *)slot {
+    uint64_t needed = alignSize(slot->size, kPoolAlignment);
+    NSUInteger i;
+    for (i = 0; i < [poolFreeRanges count]; i++) {
+        NSRange range = [[poolFreeRanges objectAtIndex:i] rangeValue];
+        if (range.length < needed) continue;
+        slot->offset = range.location;
+        slot->indexOffset = slot->offset + slot->size - slot->indexCount * sizeof(uint32_t);
+        slot->uploaded = 0;
+        slot->allocated = YES;
+        if (range.length == needed) {
+            [poolFreeRanges removeObjectAtIndex:i];
+        } else {
+            [poolFreeRanges replaceObjectAtIndex:i
+                                      withObject:[NSValue valueWithRange:NSMakeRange(range.location + (NSUInteger)needed,
+                                                                                     range.length - (NSUInteger)needed)]];
+        }
+        return YES;
+    }
+    return NO;
+}
+
+// Return a slot's range, merging it with free neighbours
+- (void)freeSlotRange:(VulkanModelSlot *)slot {
+    if (!slot->allocated) return;
+    slot->allocated = NO;
+    NSRange freed = NSMakeRange((NSUInteger)slot->offset, (NSUInteger)alignSize(slot->size, kPoolAlignment));
+    NSUInteger i = 0;
+    while (i < [poolFreeRanges count] && [[poolFreeRanges objectAtIndex:i] rangeValue].location < freed.location) {
+        i++;
+    }
+    if (i < [poolFreeRanges count]) {
+        NSRange next = [[poolFreeRanges objectAtIndex:i] rangeValue];
+        if (NSMaxRange(freed) == next.location) {
+            freed.length += next.length;
+            [poolFreeRanges removeObjectAtIndex:i];
+        }
+    }
+    if (i > 0) {
+        NSRange previous = [[poolFreeRanges objectAtIndex:i - 1] rangeValue];
+        if (NSMaxRange(previous) == freed.location) {
+            freed = NSMakeRange(previous.location, previous.length + freed.length);
+            [poolFreeRanges removeObjectAtIndex:--i];
+        }
+    }
+    [poolFreeRanges insertObject:[NSValue valueWithRange:freed] atIndex:i];
+}
+
+- (void)destroyVertexPool {
+    if (vertexPool) {
+        vkDestroyBuffer((VkDevice)device, (VkBuffer)vertexPool, NULL);
+        vertexPool = NULL;
+    }
+    if (vertexPoolMemory) {
+        vkFreeMemory((VkDevice)device, (VkDeviceMemory)vertexPoolMemory, NULL);
+        vertexPoolMemory = NULL;
+    }
+    vertexPoolSize = 0;
+    [poolFreeRanges removeAllObjects];
+}
+
+// Replace the pool with one that fits every live slot plus `needed` bytes
+// with room to spare. Live slots are uploaded again; the GPU must be idle
+// first because in-flight frames still read the old pool.
+- (BOOL)growVertexPool:(uint64_t)needed {
+    vkDeviceWaitIdle((VkDevice)device);
+    completedSerial = submittedSerial;
+    
+    uint64_t live = alignSize(needed, kPoolAlignment);
+    NSUInteger i;
+    for (i = [modelSlots count]; i > 0; i--) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i - 1];
+        if (slot->retired) {
+            [modelSlots removeObjectAtIndex:i - 1];
+            continue;
+        }
+        slot->allocated = NO;
+        slot->uploaded = 0;
+        live += alignSize(slot->size, kPoolAlignment);
+    }
+    uint64_t newSize = MAX(MAX(vertexPoolSize * 2, live * 2), kMinVertexPoolBytes);
+    [self destroyVertexPool];
+    
+    if (![self createBuffer:newSize
+                      usage:VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                            VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+           memoryProperties:VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+                     buffer:(VkBuffer *)&vertexPool
+                     memory:(VkDeviceMemory *)&vertexPoolMemory]) {
+        NSLog(@"Failed to create a %llu byte vertex pool", (unsigned long long)newSize);
+        vertexPool = NULL;
+        vertexPoolMemory = NULL;
+        return NO;
+    }
+    vertexPoolSize = newSize;
+    [poolFreeRanges addObject:[NSValue valueWithRange:NSMakeRange(0, (NSUInteger)newSize)]];
+    return YES;
+}
+
+- (VulkanModelSlot *)liveSlotForModel:(Gamut3DModel *)model {
+    NSUInteger i;
+    for (i = 0; i < [modelSlots count]; i++) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i];
+        if (!slot->retired && slot->model == model) return slot;
+    }
+    return nil;
+}
+
+// Match slots to the current models: retire slots of removed or changed
+// models, free ranges no frame can still read, and give new models ranges
+- (void)syncModelSlots {
+    NSUInteger i;
+    for (i = 0; i < [modelSlots count]; i++) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i];
+        if (!slot->retired &&
+            ([gamutModels indexOfObjectIdenticalTo:slot->model] == NSNotFound || slot->revision != [slot->model revision])) {
+            slot->retired = YES;
+            slot->retireSerial = submittedSerial;
+            [slot->contents release];
+            slot->contents = nil;
+        }
+    }
+    for (i = [modelSlots count]; i > 0; i--) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i - 1];
+        if (slot->retired && slot->retireSerial <= completedSerial) {
+            [self freeSlotRange:slot];
+            [modelSlots removeObjectAtIndex:i - 1];
+        }
+    }
     
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers((VkDevice)device, &allocInfo, &commandBuffer);
+    for (i = 0; i < [gamutModels count]; i++) {
+        Gamut3DModel *model = [gamutModels objectAtIndex:i];
+        if ([model pointCount] == 0 || [self liveSlotForModel:model]) continue;
+        VulkanModelSlot *slot = [[VulkanModelSlot alloc] initWithModel:model];
+        [modelSlots addObject:slot];
+        [slot release];
+    }
+    
+    for (i = 0; i < [modelSlots count]; i++) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i];
+        if (slot->retired || slot->allocated || [self allocateSlot:slot]) continue;
+        // Growing unallocates every live slot, so start over
+        if (![self growVertexPool:slot->size]) return;
+        i = (NSUInteger)-1;
+    }
+}
+
+#pragma mark - Frames
+
+// Wait for a slot's last submission and pick up its GPU time
+- (void)completeFrame:(NSUInteger)frame {
+    VkFence fence = (VkFence)frameFences[frame];
+    vkWaitForFences((VkDevice)device, 1, &fence, VK_TRUE, UINT64_MAX);
+    if (frameSerials[frame] > completedSerial) {
+        completedSerial = frameSerials[frame];
+    }
+    if (frameTimed[frame]) {
+        uint64_t ticks[2];
+        VkResult result = vkGetQueryPoolResults((VkDevice)device, (VkQueryPool)timestampPool, (uint32_t)(frame * 2), 2,
+                                                sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            lastGPUTime = (double)((ticks[1] - ticks[0]) & timestampMask) * timestampPeriod * 1e-9;
+        }
+        frameTimed[frame] = NO;
+    }
+}
+
+// Wait for the slot's previous submission, then start recording into it
+- (VkCommandBuffer)beginFrame {
+    [self completeFrame:currentFrame];
     
+    VkCommandBuffer commandBuffer = (VkCommandBuffer)frameCommandBuffers[currentFrame];
+    vkResetCommandBuffer(commandBuffer, 0);
     VkCommandBufferBeginInfo beginInfo = {0};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
-    
-    VkBufferCopy copyRegion = {0};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, src, dst, 1, &copyRegion);
-    
+    if (timestampPool) {
+        vkCmdResetQueryPool(commandBuffer, (VkQueryPool)timestampPool, (uint32_t)(currentFrame * 2), 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            (VkQueryPool)timestampPool, (uint32_t)(currentFrame * 2));
+    }
+    return commandBuffer;
+}
+
+// Submit without waiting; the fence tells a later frame when it is done
+- (void)submitFrame:(VkCommandBuffer)commandBuffer {
+    if (timestampPool) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            (VkQueryPool)timestampPool, (uint32_t)(currentFrame * 2 + 1));
+        frameTimed[currentFrame] = YES;
+    }
     vkEndCommandBuffer(commandBuffer);
     
+    VkFence fence = (VkFence)frameFences[currentFrame];
+    vkResetFences((VkDevice)device, 1, &fence);
+    
     VkSubmitInfo submitInfo = {0};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
+    vkQueueSubmit((VkQueue)graphicsQueue, 1, &submitInfo, fence);
     
-    vkQueueSubmit((VkQueue)graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle((VkQueue)graphicsQueue);
+    frameSerials[currentFrame] = ++submittedSerial;
+    currentFrame = (currentFrame + 1) % kVulkanFramesInFlight;
+}
+
+// Copy pending slot bytes through this frame's staging segment. NO when the
+// segment filled up before every slot was uploaded.
+- (BOOL)recordUploads:(VkCommandBuffer)commandBuffer {
+    uint64_t segment = currentFrame * kStagingFrameBytes;
+    uint64_t used = 0;
+    BOOL copied = NO, complete = YES;
+    NSUInteger i;
+    for (i = 0; i < [modelSlots count] && complete; i++) {
+        VulkanModelSlot *slot = [modelSlots objectAtIndex:i];
+        if (slot->retired || !slot->allocated || slot->uploaded == slot->size) continue;
+        if (!slot->contents) [slot buildContents];
+        while (slot->uploaded < slot->size) {
+            uint64_t room = (used < kStagingFrameBytes) ? kStagingFrameBytes - used : 0;
+            uint64_t chunk = MIN(slot->size - slot->uploaded, room);
+            if (chunk == 0) {
+                complete = NO;
+                break;
+            }
+            memcpy(stagingMapped + segment + used, (const uint8_t *)[slot->contents bytes] + slot->uploaded, (size_t)chunk);
+            VkBufferCopy region = {0};
+            region.srcOffset = segment + used;
+            region.dstOffset = slot->offset + slot->uploaded;
+            region.size = chunk;
+            vkCmdCopyBuffer(commandBuffer, (VkBuffer)stagingBuffer, (VkBuffer)vertexPool, 1, &region);
+            used += alignSize(chunk, 16);
+            slot->uploaded += chunk;
+            copied = YES;
+        }
+        if (slot->uploaded == slot->size) {
+            [slot->contents release];
+            slot->contents = nil;
+        }
+    }
     
-    vkFreeCommandBuffers((VkDevice)device, (VkCommandPool)commandPool, 1, &commandBuffer);
-#endif
+    if (copied) {
+        VkMemoryBarrier barrier = {0};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+    return complete;
 }
+#endif
 
-- (void)destroyVertexBuffers {
+- (void)destroyFrameResources {
 #if HAVE_VULKAN
     NSUInteger i;
-    for (i = 0; i < [vertexBuffers count]; i++) {
-        VkBuffer *buffer = (VkBuffer *)[[vertexBuffers objectAtIndex:i] pointerValue];
-        VkDeviceMemory *memory = (VkDeviceMemory *)[[vertexBufferMemories objectAtIndex:i] pointerValue];
-        if (buffer && *buffer != VK_NULL_HANDLE) {
-            vkDestroyBuffer((VkDevice)device, *buffer, NULL);
-            free(buffer);
-        }
-        if (memory && *memory != VK_NULL_HANDLE) {
-            vkFreeMemory((VkDevice)device, *memory, NULL);
-            free(memory);
+    [modelSlots removeAllObjects];
+    [self destroyVertexPool];
+    if (stagingMapped) {
+        vkUnmapMemory((VkDevice)device, (VkDeviceMemory)stagingMemory);
+        stagingMapped = NULL;
+    }
+    if (stagingBuffer) {
+        vkDestroyBuffer((VkDevice)device, (VkBuffer)stagingBuffer, NULL);
+        stagingBuffer = NULL;
+    }
+    if (stagingMemory) {
+        vkFreeMemory((VkDevice)device, (VkDeviceMemory)stagingMemory, NULL);
+        stagingMemory = NULL;
+    }
+    for (i = 0; i < kVulkanFramesInFlight; i++) {
+        if (frameFences[i]) {
+            vkDestroyFence((VkDevice)device, (VkFence)frameFences[i], NULL);
+            frameFences[i] = NULL;
         }
+        // Freed with the command pool
+        frameCommandBuffers[i] = NULL;
+        frameSerials[i] = 0;
+        frameTimed[i] = NO;
     }
-    [vertexBuffers removeAllObjects];
-    [vertexBufferMemories removeAllObjects];
-    [vertexCounts removeAllObjects];
+    if (timestampPool) {
+        vkDestroyQueryPool((VkDevice)device, (VkQueryPool)timestampPool, NULL);
+        timestampPool = NULL;
+    }
+    currentFrame = 0;
+    submittedSerial = 0;
+    completedSerial = 0;
 #endif
 }
 
 - (void)shutdown {
 #if HAVE_VULKAN
-    [self destroyVertexBuffers];
+    if (device) {
+        vkDeviceWaitIdle((VkDevice)device);
+    }
+    [self destroyFrameResources];
+    [self destroyOffscreenTarget];
     
     if (commandPool) {
         vkDestroyCommandPool((VkDevice)device, (VkCommandPool)commandPool, NULL);
@@ -652,42 +1129,39 @@ typedef struct {
 #endif
     [gamutModels removeAllObjects];
     initialized = NO;
+    offscreen = NO;
 }
 
 - (void)render {
 #if HAVE_VULKAN
     if (!initialized || !device || !commandPool || !renderPass) return;
     
-    // Allocate command buffer if needed
-    static VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-    if (commandBuffer == VK_NULL_HANDLE) {
-        VkCommandBufferAllocateInfo allocInfo = {0};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = (VkCommandPool)commandPool;
-        allocInfo.commandBufferCount = 1;
-        
-        VkResult result = vkAllocateCommandBuffers((VkDevice)device, &allocInfo, &commandBuffer);
-        if (result != VK_SUCCESS) {
-            return;
-        }
+    VkCommandBuffer commandBuffer = [self beginFrame];
+    [self syncModelSlots];
+    // Uploads too large for one staging segment go out in extra submissions
+    while (![self recordUploads:commandBuffer]) {
+        [self submitFrame:commandBuffer];
+        commandBuffer = [self beginFrame];
     }
     
-    // Begin command buffer
-    VkCommandBufferBeginInfo beginInfo = {0};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;
-    
-    VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
-    if (result != VK_SUCCESS) {
+    // Only the offscreen target has a framebuffer yet; a window surface
+    // would acquire a swapchain image here
+    VkFramebuffer target = (VkFramebuffer)offscreenFramebuffer;
+    if (!target || !pipeline) {
+        [self submitFrame:commandBuffer];
         return;
     }
     
-    // Begin render pass (simplified - would use actual framebuffer from swapchain)
-    // Note: In full implementation with swapchain, would use:
-    // VkClearValue clearColor = {{{0.1f, 0.1f, 0.1f, 1.0f}}};
-    // VkRenderPassBeginInfo renderPassInfo = {...};
-    // vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    VkClearValue clearColor = {{{0.1f, 0.1f, 0.1f, 1.0f}}};
+    VkRenderPassBeginInfo renderPassInfo = {0};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = (VkRenderPass)renderPass;
+    renderPassInfo.framebuffer = target;
+    renderPassInfo.renderArea.extent.width = (uint32_t)viewportWidth;
+    renderPassInfo.renderArea.extent.height = (uint32_t)viewportHeight;
+    renderPassInfo.clearValueCount = 1;
+    renderPassInfo.pClearValues = &clearColor;
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     
     // Set viewport
     VkViewport viewport = {0};
@@ -707,49 +1181,53 @@ typedef struct {
     scissor.extent.height = (uint32_t)viewportHeight;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
     
-    // Bind pipeline (if created)
-    if (pipeline) {
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *(VkPipeline *)pipeline);
-    }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, *(VkPipeline *)pipeline);
+    PushConstants constants;
+    RenderBackendCameraMatrix(constants.mvp, rotationX, rotationY, zoom, viewportWidth / viewportHeight, YES);
+    constants.color[3] = 1.0f;
     
-    // Draw gamut models
+    // Draw gamut models in the order they were added, each from its pool range
+    // with its current color
+    VkBuffer pool = (VkBuffer)vertexPool;
     NSUInteger i;
-    for (i = 0; i < [vertexBuffers count]; i++) {
-        VkBuffer *buffer = (VkBuffer *)[[vertexBuffers objectAtIndex:i] pointerValue];
-        NSNumber *count = [vertexCounts objectAtIndex:i];
-        if (buffer && *buffer != VK_NULL_HANDLE && count) {
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffer, offsets);
-            vkCmdDraw(commandBuffer, [count unsignedIntegerValue], 1, 0, 0);
-        }
+    for (i = 0; i < [gamutModels count]; i++) {
+        Gamut3DModel *model = [gamutModels objectAtIndex:i];
+        VulkanModelSlot *slot = [self liveSlotForModel:model];
+        if (!slot || !slot->allocated || slot->uploaded != slot->size) continue;
+        float *color = [model color];
+        constants.color[0] = color[0];
+        constants.color[1] = color[1];
+        constants.color[2] = color[2];
+        vkCmdPushConstants(commandBuffer, (VkPipelineLayout)pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                           0, sizeof(constants), &constants);
+        VkDeviceSize offset = slot->offset;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &pool, &offset);
+        vkCmdDraw(commandBuffer, slot->vertexCount, 1, 0, 0);
     }
     
-    // End render pass (when render pass is begun)
-    // vkCmdEndRenderPass(commandBuffer);
-    
-    // End command buffer
-    result = vkEndCommandBuffer(commandBuffer);
-    if (result != VK_SUCCESS) {
-        return;
+    vkCmdEndRenderPass(commandBuffer);
+    [self submitFrame:commandBuffer];
+#endif
+}
+
+- (void)finishFrames {
+#if HAVE_VULKAN
+    if (!initialized) return;
+    // Oldest slot first, so the newest frame's time is the one left
+    NSUInteger i;
+    for (i = 0; i < kVulkanFramesInFlight; i++) {
+        [self completeFrame:(currentFrame + i) % kVulkanFramesInFlight];
     }
-    
-    // Submit to queue
-    VkSubmitInfo submitInfo = {0};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
-    
-    vkQueueSubmit((VkQueue)graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle((VkQueue)graphicsQueue);
-    
-    // Note: In full implementation, would:
-    // - Present swapchain image
-    // - Use semaphores for synchronization
-    // - Not wait for queue idle (use fences instead)
 #endif
 }
 
+- (double)lastFrameGPUTime {
+    return lastGPUTime;
+}
+
 - (void)setViewportWidth:(float)width height:(float)height {
+    // The offscreen target keeps the size it was created with
+    if (offscreen) return;
     viewportWidth = width;
     viewportHeight = height;
 }
@@ -763,11 +1241,8 @@ typedef struct {
 }
 
 - (void)addGamutModel:(Gamut3DModel *)model {
+    // Uploaded on the next render, unless a slot already holds this revision
     [gamutModels addObject:model];
-    // Recreate vertex buffers when a new model is added
-    if (initialized) {
-        [self createVertexBuffers];
-    }
 }
 
 - (void)setLabSpaceModel:(CIELABSpaceModel *)model {
@@ -775,17 +1250,17 @@ typedef struct {
     labSpaceModel = [model retain];
 }
 
+// Slots stay until the next render, so models that are added straight back
+// keep their uploaded ranges
 - (void)clearGamutModels {
     [gamutModels removeAllObjects];
-    [self destroyVertexBuffers];
 }
 
 - (void)dealloc {
     [self shutdown];
     [gamutModels release];
-    [vertexBuffers release];
-    [vertexBufferMemories release];
-    [vertexCounts release];
+    [modelSlots release];
+    [poolFreeRanges release];
     [labSpaceModel release];
     [super dealloc];
 }